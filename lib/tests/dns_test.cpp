@@ -20,6 +20,11 @@
 #include "ziti/ziti_dns.h"
 #include "ziti/model_collections.h"
 
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
 static int mock_add_route(netif_handle tun, const char *dest) {
     return 0;
 }
@@ -42,7 +47,15 @@ TEST_CASE("recycle ip", "[dns]") {
             .ziti_host = ziti_sdk_c_host
     };
     tunneler_context tnlr = ziti_tunneler_init(&tnlr_opts, uv_default_loop());
-    ziti_dns_setup(tnlr, "100.64.0.2", "100.64.0.1/24");
+    CHECK(ziti_dns_setup(tnlr, "100.64.0.2", "100.64.0.1") != 0);
+    // too small for network, broadcast, tun and dns addresses, or too large to track
+    CHECK(ziti_dns_setup(tnlr, "100.64.0.2", "100.64.0.1/31") != 0);
+    CHECK(ziti_dns_setup(tnlr, "100.64.0.2", "100.64.0.1/32") != 0);
+    CHECK(ziti_dns_setup(tnlr, "100.64.0.2", "100.64.0.1/0") != 0);
+    CHECK(ziti_dns_setup(tnlr, "100.64.0.2", "100.64.0.1/7") != 0);
+    CHECK(ziti_dns_setup(tnlr, "100.64.0.2", "100.64.0.1/-1") != 0);
+    CHECK(ziti_dns_setup(tnlr, "100.64.0.2", "100.64.256.1/24") != 0);
+    REQUIRE(ziti_dns_setup(tnlr, "100.64.0.2", "100.64.0.1/24") == 0);
 
     auto *mock_services = new model_map;
     auto *ips = new model_map;
@@ -71,8 +84,18 @@ TEST_CASE("recycle ip", "[dns]") {
     ziti_address_from_string(&za, "just.one.more");
     CHECK(ziti_dns_register_hostname(&za, new ziti_service) == nullptr);
 
+    tunnel_ip_mem_pool pool_stats = {};
+    ziti_dns_get_ip_pool_stats(&pool_stats);
+    CHECK(pool_stats.avail == 0);
+    CHECK(pool_stats.max == pool_stats.used);
+    free_tunnel_ip_mem_pool(&pool_stats);
+
     // free up an IP and try again
     ziti_dns_deregister_intercept(model_map_getl(mock_services, 100));
+    ziti_dns_get_ip_pool_stats(&pool_stats);
+    CHECK(pool_stats.avail == 1);
+    free_tunnel_ip_mem_pool(&pool_stats);
+
     ip = ziti_dns_register_hostname(&za, new ziti_service);
     CHECK(ip != nullptr);
     CHECK_THAT(ipaddr_ntoa(ip), Catch::Equals("100.64.0.103"));
@@ -85,4 +108,405 @@ TEST_CASE("recycle ip", "[dns]") {
     // last ip is not broadcast ip
     ip = static_cast<const ip_addr_t *>(model_map_getl(ips, pool_size-1));
     CHECK_THAT(ipaddr_ntoa(ip), Catch::Equals("100.64.0.254"));
-}
\ No newline at end of file
+}
+
+TEST_CASE("restore ip from snapshot", "[dns]") {
+    netif_driver_t mock_netif = {};
+    mock_netif.add_route = mock_add_route;
+    tunneler_sdk_options tnlr_opts = {
+            .netif_driver = &mock_netif,
+            .ziti_dial = ziti_sdk_c_dial,
+            .ziti_close = ziti_sdk_c_close,
+            .ziti_close_write = ziti_sdk_c_close_write,
+            .ziti_write = ziti_sdk_c_write,
+            .ziti_host = ziti_sdk_c_host
+    };
+    tunneler_context tnlr = ziti_tunneler_init(&tnlr_opts, uv_default_loop());
+    ziti_dns_setup(tnlr, "100.65.0.2", "100.65.0.1/24");
+
+    const char *snapshot = "dns_snapshot_test.txt";
+    FILE *f = fopen(snapshot, "w");
+    REQUIRE(f != nullptr);
+    fprintf(f, "100.65.0.77 restored.ziti.\n");
+    fprintf(f, "100.66.0.10 other.range.ziti.\n"); // outside of the current range
+    fprintf(f, "garbage\n");
+    fclose(f);
+
+    CHECK(ziti_dns_load_snapshot(uv_default_loop(), snapshot) == 1);
+    remove(snapshot);
+
+    ziti_address za;
+    ziti_address_from_string(&za, "fresh.ziti.");
+    const ip_addr_t *ip = ziti_dns_register_hostname(&za, new ziti_service);
+    REQUIRE(ip != nullptr);
+    CHECK_THAT(ipaddr_ntoa(ip), !Catch::Equals("100.65.0.77"));
+
+    ziti_address_from_string(&za, "restored.ziti.");
+    ip = ziti_dns_register_hostname(&za, new ziti_service);
+    REQUIRE(ip != nullptr);
+    CHECK_THAT(ipaddr_ntoa(ip), Catch::Equals("100.65.0.77"));
+
+    // later tests don't write the snapshot, and can load one of their own
+    ziti_dns_close_snapshot();
+    CHECK(ziti_dns_load_snapshot(uv_default_loop(), snapshot) == 0);
+    ziti_dns_close_snapshot();
+    remove(snapshot);
+}
+
+static const size_t header_len = 12;
+
+static std::vector<uint8_t> make_query(uint16_t id, const std::vector<std::string> &labels, uint16_t type) {
+    std::vector<uint8_t> q = {
+            (uint8_t) (id >> 8), (uint8_t) id, 0x01, 0x00, // RD
+            0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, // one question, one additional (OPT)
+    };
+    for (auto &l : labels) {
+        q.push_back((uint8_t) l.size());
+        q.insert(q.end(), l.begin(), l.end());
+    }
+    q.push_back(0);
+    q.insert(q.end(), { (uint8_t) (type >> 8), (uint8_t) type, 0x00, 0x01 });
+    q.insert(q.end(), { 0x00, 0x00, 0x29, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 });
+    return q;
+}
+
+// the fast path answers exactly like the regular path
+static std::vector<uint8_t> host_answer(const std::vector<uint8_t> &q) {
+    uint8_t fast[1024], regular[1024];
+    size_t fast_len = ziti_dns_host_answer(q.data(), q.size(), fast, sizeof(fast), true);
+    size_t regular_len = ziti_dns_host_answer(q.data(), q.size(), regular, sizeof(regular), false);
+    REQUIRE(fast_len > 0);
+    REQUIRE(regular_len == fast_len);
+    CHECK(memcmp(fast, regular, fast_len) == 0);
+    return std::vector<uint8_t>(fast, fast + fast_len);
+}
+
+TEST_CASE("answer host queries", "[dns]") {
+    netif_driver_t mock_netif = {};
+    mock_netif.add_route = mock_add_route;
+    tunneler_sdk_options tnlr_opts = {
+            .netif_driver = &mock_netif,
+            .ziti_dial = ziti_sdk_c_dial,
+            .ziti_close = ziti_sdk_c_close,
+            .ziti_close_write = ziti_sdk_c_close_write,
+            .ziti_write = ziti_sdk_c_write,
+            .ziti_host = ziti_sdk_c_host
+    };
+    tunneler_context tnlr = ziti_tunneler_init(&tnlr_opts, uv_default_loop());
+    REQUIRE(ziti_dns_setup(tnlr, "100.68.0.2", "100.68.0.1/24") == 0);
+
+    // registered before the IPv6 range, so it only has an IPv4 address
+    ziti_address za;
+    ziti_address_from_string(&za, "fast4.ziti");
+    const ip_addr_t *ip = ziti_dns_register_hostname(&za, new ziti_service);
+    REQUIRE(ip != nullptr);
+    REQUIRE(ziti_dns_hostname_ip6(&za) == nullptr);
+
+    REQUIRE(ziti_dns_setup_ipv6("fd00:7a68::1/64") == 0);
+    ziti_address_from_string(&za, "fast6.ziti");
+    REQUIRE(ziti_dns_register_hostname(&za, new ziti_service) != nullptr);
+    const ip_addr_t *ip6 = ziti_dns_hostname_ip6(&za);
+    REQUIRE(ip6 != nullptr);
+
+    SECTION("A") {
+        auto q = make_query(0x1234, { "fast4", "ziti" }, 1);
+        auto resp = host_answer(q);
+        CHECK(resp[0] == 0x12);
+        CHECK(resp[1] == 0x34);
+        CHECK((resp[2] & 0x80) != 0); // QR
+        CHECK((resp[3] & 0x0f) == 0); // NOERROR
+        CHECK(resp[7] == 1); // one answer
+        // question is echoed, then the answer record refers to it
+        size_t q_end = q.size() - 11;
+        CHECK(memcmp(resp.data() + header_len, q.data() + header_len, q_end - header_len) == 0);
+        CHECK(memcmp(resp.data() + q_end + 12, &ip_2_ip4(ip)->addr, 4) == 0);
+    }
+
+    SECTION("AAAA with an IPv6 address") {
+        auto resp = host_answer(make_query(0x4321, { "fast6", "ziti" }, 28));
+        CHECK(resp[7] == 1);
+        CHECK(memcmp(resp.data() + resp.size() - 11 - 16, ip_2_ip6(ip6)->addr, 16) == 0);
+    }
+
+    SECTION("AAAA without an IPv6 address") {
+        auto resp = host_answer(make_query(0x5678, { "fast4", "ziti" }, 28));
+        CHECK((resp[3] & 0x0f) == 0);
+        CHECK(resp[7] == 0);
+    }
+
+    SECTION("queries that fall back to the regular path") {
+        uint8_t resp[1024];
+        // compressed name
+        auto q = make_query(1, { "fast4", "ziti" }, 1);
+        q[12] = 0xc0;
+        q[13] = 0x0c;
+        CHECK(ziti_dns_host_answer(q.data(), q.size(), resp, sizeof(resp), true) == 0);
+
+        // name longer than any ziti hostname
+        q = make_query(2, { std::string(63, 'a'), std::string(63, 'b'), std::string(63, 'c'), std::string(63, 'd'),
+                            std::string(63, 'e') }, 1);
+        CHECK(ziti_dns_host_answer(q.data(), q.size(), resp, sizeof(resp), true) == 0);
+
+        // label length with the reserved bits set
+        q = make_query(3, { std::string(64, 'x'), "ziti" }, 1);
+        CHECK(ziti_dns_host_answer(q.data(), q.size(), resp, sizeof(resp), true) == 0);
+
+        // not a ziti hostname
+        q = make_query(4, { "not", "intercepted" }, 1);
+        CHECK(ziti_dns_host_answer(q.data(), q.size(), resp, sizeof(resp), true) == 0);
+        CHECK(ziti_dns_host_answer(q.data(), q.size(), resp, sizeof(resp), false) == 0);
+    }
+}
+
+// resolves `labels` on the regular path and returns the A record
+static ip_addr_t resolve_domain_host(const std::vector<std::string> &labels) {
+    auto q = make_query(0x2222, labels, 1);
+    uint8_t resp[1024];
+    size_t len = ziti_dns_host_answer(q.data(), q.size(), resp, sizeof(resp), false);
+    REQUIRE(len > 0);
+    REQUIRE(resp[7] == 1);
+    const uint8_t *a = resp + len - 11 - 4;
+    ip_addr_t ip;
+    IP_ADDR4(&ip, a[0], a[1], a[2], a[3]);
+    return ip;
+}
+
+TEST_CASE("match nested wildcard domains", "[dns]") {
+    netif_driver_t mock_netif = {};
+    mock_netif.add_route = mock_add_route;
+    tunneler_sdk_options tnlr_opts = {
+            .netif_driver = &mock_netif,
+            .ziti_dial = ziti_sdk_c_dial,
+            .ziti_close = ziti_sdk_c_close,
+            .ziti_close_write = ziti_sdk_c_close_write,
+            .ziti_write = ziti_sdk_c_write,
+            .ziti_host = ziti_sdk_c_host
+    };
+    tunneler_context tnlr = ziti_tunneler_init(&tnlr_opts, uv_default_loop());
+    REQUIRE(ziti_dns_setup(tnlr, "100.69.0.2", "100.69.0.1/24") == 0);
+
+    auto outer = new ziti_service;
+    auto inner = new ziti_service;
+    auto other = new ziti_service;
+
+    // the same address is reused for every registration, the intercepts keep their own copies
+    ziti_address za;
+    ziti_address_from_string(&za, "*.a.ziti");
+    CHECK(ziti_dns_register_hostname(&za, outer) == nullptr);
+    ziti_address_from_string(&za, "*.b.a.ziti");
+    CHECK(ziti_dns_register_hostname(&za, inner) == nullptr);
+    ziti_address_from_string(&za, "unrelated.ziti");
+    REQUIRE(ziti_dns_register_hostname(&za, other) != nullptr);
+
+    ip_addr_t deep = resolve_domain_host({ "x", "b", "a", "ziti" });
+    ip_addr_t shallow = resolve_domain_host({ "y", "a", "ziti" });
+
+    // the most specific wildcard of each intercept
+    const ziti_address *match = ziti_dns_match_domain_intercept(&deep, inner);
+    REQUIRE(match != nullptr);
+    CHECK_THAT(match->addr.hostname, Catch::Equals("*.b.a.ziti"));
+
+    // an intercept that only has the broader domain
+    match = ziti_dns_match_domain_intercept(&deep, outer);
+    REQUIRE(match != nullptr);
+    CHECK_THAT(match->addr.hostname, Catch::Equals("*.a.ziti"));
+
+    match = ziti_dns_match_domain_intercept(&shallow, outer);
+    REQUIRE(match != nullptr);
+    CHECK_THAT(match->addr.hostname, Catch::Equals("*.a.ziti"));
+
+    CHECK(ziti_dns_match_domain_intercept(&shallow, inner) == nullptr);
+    CHECK(ziti_dns_match_domain_intercept(&deep, other) == nullptr);
+
+    // hostnames under the inner domain go away with it, and resolve via the outer domain again
+    ziti_dns_deregister_intercept(inner);
+    CHECK(ziti_dns_reverse_lookup(ipaddr_ntoa(&deep)) == nullptr);
+    CHECK(ziti_dns_match_domain_intercept(&deep, inner) == nullptr);
+    CHECK(ziti_dns_reverse_lookup(ipaddr_ntoa(&shallow)) != nullptr);
+
+    deep = resolve_domain_host({ "x", "b", "a", "ziti" });
+    CHECK(ziti_dns_match_domain_intercept(&deep, inner) == nullptr);
+    match = ziti_dns_match_domain_intercept(&deep, outer);
+    REQUIRE(match != nullptr);
+    CHECK_THAT(match->addr.hostname, Catch::Equals("*.a.ziti"));
+
+    ziti_dns_deregister_intercept(outer);
+    CHECK(ziti_dns_match_domain_intercept(&deep, outer) == nullptr);
+    ziti_dns_deregister_intercept(other);
+    delete outer;
+    delete inner;
+    delete other;
+}
+
+TEST_CASE("assign ipv6 address", "[dns]") {
+    netif_driver_t mock_netif = {};
+    mock_netif.add_route = mock_add_route;
+    tunneler_sdk_options tnlr_opts = {
+            .netif_driver = &mock_netif,
+            .ziti_dial = ziti_sdk_c_dial,
+            .ziti_close = ziti_sdk_c_close,
+            .ziti_close_write = ziti_sdk_c_close_write,
+            .ziti_write = ziti_sdk_c_write,
+            .ziti_host = ziti_sdk_c_host
+    };
+    tunneler_context tnlr = ziti_tunneler_init(&tnlr_opts, uv_default_loop());
+    ziti_dns_setup(tnlr, "100.67.0.2", "100.67.0.1/24");
+    // IPv6 range from earlier tests is dropped by the setup
+    CHECK(ziti_dns_ipv6_cidr() == nullptr);
+    CHECK(ziti_dns_setup_ipv6("100.67.0.1/24") != 0);
+    REQUIRE(ziti_dns_setup_ipv6("fd00:7a69::1/64") == 0);
+
+    ziti_address za;
+    ziti_address_from_string(&za, "dual.ziti.");
+    const ip_addr_t *ip = ziti_dns_register_hostname(&za, new ziti_service);
+    REQUIRE(ip != nullptr);
+    CHECK(IP_IS_V4(ip));
+
+    // first address in the range belongs to the tun
+    const ip_addr_t *ip6 = ziti_dns_hostname_ip6(&za);
+    REQUIRE(ip6 != nullptr);
+    CHECK(IP_IS_V6(ip6));
+    CHECK_THAT(ipaddr_ntoa(ip6), Catch::Equals("fd00:7a69::2"));
+
+    const char *hostname = ziti_dns_reverse_lookup("fd00:7a69::2");
+    REQUIRE(hostname != nullptr);
+    CHECK_THAT(hostname, Catch::Equals("dual.ziti."));
+    CHECK_THAT(ziti_dns_reverse_lookup(ipaddr_ntoa(ip)), Catch::Equals("dual.ziti."));
+}
+
+TEST_CASE("ipv6 range with a tun address other than the first", "[dns]") {
+    netif_driver_t mock_netif = {};
+    mock_netif.add_route = mock_add_route;
+    tunneler_sdk_options tnlr_opts = {
+            .netif_driver = &mock_netif,
+            .ziti_dial = ziti_sdk_c_dial,
+            .ziti_close = ziti_sdk_c_close,
+            .ziti_close_write = ziti_sdk_c_close_write,
+            .ziti_write = ziti_sdk_c_write,
+            .ziti_host = ziti_sdk_c_host
+    };
+    tunneler_context tnlr = ziti_tunneler_init(&tnlr_opts, uv_default_loop());
+    ziti_dns_setup(tnlr, "100.70.0.2", "100.70.0.1/24");
+    CHECK(ziti_dns_setup_ipv6("fd00:7a6a::3/64x") != 0);
+    CHECK(ziti_dns_setup_ipv6("fd00:7a6a::3/ 64") != 0);
+    REQUIRE(ziti_dns_setup_ipv6("fd00:7a6a:0::0003/64") == 0);
+    CHECK_THAT(ziti_dns_ipv6_cidr(), Catch::Equals("fd00:7a6a::3/64"));
+
+    // hostnames get every address in the range, except the tun's
+    std::vector<std::string> assigned;
+    ziti_address za;
+    for (int i = 0; i < 4; i++) {
+        std::string name = "v6host" + std::to_string(i) + ".ziti.";
+        ziti_address_from_string(&za, name.c_str());
+        REQUIRE(ziti_dns_register_hostname(&za, new ziti_service) != nullptr);
+        const ip_addr_t *ip6 = ziti_dns_hostname_ip6(&za);
+        REQUIRE(ip6 != nullptr);
+        assigned.emplace_back(ipaddr_ntoa(ip6));
+    }
+    CHECK(assigned == std::vector<std::string>({ "fd00:7a6a::1", "fd00:7a6a::2", "fd00:7a6a::4", "fd00:7a6a::5" }));
+}
+
+TEST_CASE("restore ipv6 from snapshot", "[dns]") {
+    netif_driver_t mock_netif = {};
+    mock_netif.add_route = mock_add_route;
+    tunneler_sdk_options tnlr_opts = {
+            .netif_driver = &mock_netif,
+            .ziti_dial = ziti_sdk_c_dial,
+            .ziti_close = ziti_sdk_c_close,
+            .ziti_close_write = ziti_sdk_c_close_write,
+            .ziti_write = ziti_sdk_c_write,
+            .ziti_host = ziti_sdk_c_host
+    };
+    tunneler_context tnlr = ziti_tunneler_init(&tnlr_opts, uv_default_loop());
+    REQUIRE(ziti_dns_setup(tnlr, "100.71.0.2", "100.71.0.1/24") == 0);
+    REQUIRE(ziti_dns_setup_ipv6("fd00:7a6b::1/64") == 0);
+
+    const char *snapshot = "dns_snapshot6_test.txt";
+    FILE *f = fopen(snapshot, "w");
+    REQUIRE(f != nullptr);
+    fprintf(f, "100.71.0.77 dual.ziti.\n");
+    fprintf(f, "fd00:7a6b::77 dual.ziti.\n");
+    fprintf(f, "fd00:7a6b::78 only6.ziti.\n");
+    fprintf(f, "fd00:7a6c::5 other.range.ziti.\n"); // outside of the current range
+    fclose(f);
+
+    CHECK(ziti_dns_load_snapshot(uv_default_loop(), snapshot) == 2);
+    remove(snapshot);
+
+    ziti_address za;
+    ziti_address_from_string(&za, "fresh.ziti.");
+    REQUIRE(ziti_dns_register_hostname(&za, new ziti_service) != nullptr);
+    const ip_addr_t *ip6 = ziti_dns_hostname_ip6(&za);
+    REQUIRE(ip6 != nullptr);
+    CHECK_THAT(ipaddr_ntoa(ip6), !Catch::Equals("fd00:7a6b::77"));
+    CHECK_THAT(ipaddr_ntoa(ip6), !Catch::Equals("fd00:7a6b::78"));
+
+    ziti_address_from_string(&za, "dual.ziti.");
+    const ip_addr_t *ip = ziti_dns_register_hostname(&za, new ziti_service);
+    REQUIRE(ip != nullptr);
+    CHECK_THAT(ipaddr_ntoa(ip), Catch::Equals("100.71.0.77"));
+    ip6 = ziti_dns_hostname_ip6(&za);
+    REQUIRE(ip6 != nullptr);
+    CHECK_THAT(ipaddr_ntoa(ip6), Catch::Equals("fd00:7a6b::77"));
+
+    // IPv4 address comes from the pool when the snapshot only had the IPv6 one
+    ziti_address_from_string(&za, "only6.ziti.");
+    REQUIRE(ziti_dns_register_hostname(&za, new ziti_service) != nullptr);
+    ip6 = ziti_dns_hostname_ip6(&za);
+    REQUIRE(ip6 != nullptr);
+    CHECK_THAT(ipaddr_ntoa(ip6), Catch::Equals("fd00:7a6b::78"));
+
+    ziti_dns_close_snapshot();
+}
+
+// not run by default. use `all_tests "[benchmark]"`
+TEST_CASE("deregister intercepts benchmark", "[.][benchmark][dns]") {
+    netif_driver_t mock_netif = {};
+    mock_netif.add_route = mock_add_route;
+    tunneler_sdk_options tnlr_opts = {
+            .netif_driver = &mock_netif,
+            .ziti_dial = ziti_sdk_c_dial,
+            .ziti_close = ziti_sdk_c_close,
+            .ziti_close_write = ziti_sdk_c_close_write,
+            .ziti_write = ziti_sdk_c_write,
+            .ziti_host = ziti_sdk_c_host
+    };
+    tunneler_context tnlr = ziti_tunneler_init(&tnlr_opts, uv_default_loop());
+    ziti_dns_setup(tnlr, "100.70.0.2", "100.70.0.1/16");
+
+    const int num_hostnames = 10000;
+    const int num_intercepts = 1000;
+    std::vector<ziti_service> intercepts(num_intercepts);
+
+    tunnel_ip_mem_pool before = {};
+    ziti_dns_get_ip_pool_stats(&before);
+
+    char name[64];
+    ziti_address za;
+    for (int i = 0; i < num_hostnames; i++) {
+        snprintf(name, sizeof(name), "host%05d.bench.ziti", i);
+        ziti_address_from_string(&za, name);
+        // every hostname is shared by two intercepts
+        REQUIRE(ziti_dns_register_hostname(&za, &intercepts[i % num_intercepts]) != nullptr);
+        REQUIRE(ziti_dns_register_hostname(&za, &intercepts[(i + 1) % num_intercepts]) != nullptr);
+    }
+    for (int i = 0; i < num_intercepts; i++) {
+        snprintf(name, sizeof(name), "*.domain%04d.bench.ziti", i);
+        ziti_address_from_string(&za, name);
+        ziti_dns_register_hostname(&za, &intercepts[i]);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto &intercept : intercepts) {
+        ziti_dns_deregister_intercept(&intercept);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    printf("deregistered %d intercepts (%d hostnames) in %lldus\n",
+           num_intercepts, num_hostnames, (long long)elapsed.count());
+
+    tunnel_ip_mem_pool after = {};
+    ziti_dns_get_ip_pool_stats(&after);
+    CHECK(after.used == before.used);
+    free_tunnel_ip_mem_pool(&before);
+    free_tunnel_ip_mem_pool(&after);
+}
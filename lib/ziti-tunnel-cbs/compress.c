@@ -0,0 +1,226 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "compress.h"
+
+// a sync flush adds an empty stored block to what deflateBound() expects
+#define COMPRESS_FLUSH_OVERHEAD 16
+
+struct compress_encoder_s {
+    z_stream z;
+    uint64_t in;
+    uint64_t out;
+    // current sample
+    size_t sample_in;
+    size_t sample_out;
+    size_t bypass; // input that is sent as is before compression is tried again
+    size_t next_bypass;
+};
+
+struct compress_decoder_s {
+    z_stream z;
+    uint8_t hdr[COMPRESS_FRAME_HDR];
+    size_t hdr_len;
+    uint8_t *payload; // frame that was split across reads, allocated on demand
+    size_t payload_len;
+    // one spare byte, so a frame that inflates to more than a block is caught
+    uint8_t out[COMPRESS_BLOCK + 1];
+};
+
+compress_encoder_t *compress_encoder_new(int level) {
+    compress_encoder_t *enc = calloc(1, sizeof(compress_encoder_t));
+    if (deflateInit2(&enc->z, level, Z_DEFLATED, -COMPRESS_WINDOW_BITS, COMPRESS_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(enc);
+        return NULL;
+    }
+    enc->next_bypass = COMPRESS_BYPASS_MIN;
+    return enc;
+}
+
+static size_t put_frame_hdr(uint8_t *p, compress_frame_type_e type, size_t len) {
+    p[0] = (uint8_t) type;
+    p[1] = (uint8_t) (len >> 8);
+    p[2] = (uint8_t) len;
+    return COMPRESS_FRAME_HDR;
+}
+
+/** compresses `len` bytes into a frame at `out`. returns the frame length, or -1 */
+static ssize_t deflate_frame(compress_encoder_t *enc, const uint8_t *data, size_t len, uint8_t *out, size_t out_len) {
+    enc->z.next_in = (Bytef *) data;
+    enc->z.avail_in = (uInt) len;
+    enc->z.next_out = out + COMPRESS_FRAME_HDR;
+    enc->z.avail_out = (uInt) (out_len - COMPRESS_FRAME_HDR);
+    int rc = deflate(&enc->z, Z_SYNC_FLUSH);
+    // output that didn't fit would end up in the next frame
+    if ((rc != Z_OK && rc != Z_BUF_ERROR) || enc->z.avail_in > 0 || enc->z.avail_out == 0) {
+        return -1;
+    }
+    size_t n = out_len - COMPRESS_FRAME_HDR - enc->z.avail_out;
+    if (n > COMPRESS_FRAME_MAX) {
+        return -1;
+    }
+    put_frame_hdr(out, COMPRESS_DEFLATE, n);
+
+    enc->sample_in += len;
+    enc->sample_out += n;
+    if (enc->sample_in >= COMPRESS_SAMPLE_BYTES) {
+        if (enc->sample_out * 100 >= enc->sample_in * COMPRESS_BYPASS_RATIO) {
+            enc->bypass = enc->next_bypass;
+            enc->next_bypass = enc->next_bypass * 2 > COMPRESS_BYPASS_MAX ? COMPRESS_BYPASS_MAX : enc->next_bypass * 2;
+        } else {
+            enc->next_bypass = COMPRESS_BYPASS_MIN;
+        }
+        enc->sample_in = 0;
+        enc->sample_out = 0;
+    }
+    return (ssize_t) (COMPRESS_FRAME_HDR + n);
+}
+
+ssize_t compress_encode(compress_encoder_t *enc, const uint8_t *data, size_t len, uint8_t **out) {
+    size_t blocks = len == 0 ? 1 : (len + COMPRESS_BLOCK - 1) / COMPRESS_BLOCK;
+    size_t cap = deflateBound(&enc->z, (uLong) len) + blocks * (COMPRESS_FRAME_HDR + COMPRESS_FLUSH_OVERHEAD);
+    uint8_t *buf = malloc(cap);
+    if (buf == NULL) {
+        return UV_ENOMEM;
+    }
+
+    size_t n = 0;
+    size_t off = 0;
+    do {
+        size_t block = len - off > COMPRESS_BLOCK ? COMPRESS_BLOCK : len - off;
+        if (enc->bypass > 0 || len < COMPRESS_MIN_BYTES) {
+            n += put_frame_hdr(buf + n, COMPRESS_RAW, block);
+            memcpy(buf + n, data + off, block);
+            n += block;
+            enc->bypass -= enc->bypass > block ? block : enc->bypass;
+        } else {
+            ssize_t f = deflate_frame(enc, data + off, block, buf + n, cap - n);
+            if (f < 0) {
+                free(buf);
+                return UV_EINVAL;
+            }
+            n += (size_t) f;
+        }
+        off += block;
+    } while (off < len);
+
+    enc->in += len;
+    enc->out += n;
+    *out = buf;
+    return (ssize_t) n;
+}
+
+void compress_encoder_stats(const compress_encoder_t *enc, uint64_t *in, uint64_t *out) {
+    *in = enc->in;
+    *out = enc->out;
+}
+
+void compress_encoder_free(compress_encoder_t *enc) {
+    if (enc == NULL) return;
+    deflateEnd(&enc->z);
+    free(enc);
+}
+
+compress_decoder_t *compress_decoder_new(void) {
+    compress_decoder_t *dec = calloc(1, sizeof(compress_decoder_t));
+    if (inflateInit2(&dec->z, -COMPRESS_WINDOW_BITS) != Z_OK) {
+        free(dec);
+        return NULL;
+    }
+    return dec;
+}
+
+/** returns what `cb` returned, or an error */
+static int deliver_frame(compress_decoder_t *dec, const uint8_t *payload, size_t len, compress_data_cb cb, void *ctx) {
+    if (dec->hdr[0] == COMPRESS_RAW) {
+        return len > 0 ? cb(ctx, payload, len) : 0;
+    }
+
+    dec->z.next_in = (Bytef *) payload;
+    dec->z.avail_in = (uInt) len;
+    dec->z.next_out = dec->out;
+    dec->z.avail_out = sizeof(dec->out);
+    int rc = inflate(&dec->z, Z_SYNC_FLUSH);
+    if ((rc != Z_OK && rc != Z_BUF_ERROR) || dec->z.avail_in > 0 || dec->z.avail_out == 0) {
+        return UV_EINVAL;
+    }
+    size_t n = sizeof(dec->out) - dec->z.avail_out;
+    return n > 0 ? cb(ctx, dec->out, n) : 0;
+}
+
+ssize_t compress_decode(compress_decoder_t *dec, const uint8_t *data, size_t len, compress_data_cb cb, void *ctx) {
+    size_t off = 0;
+    while (off < len) {
+        if (dec->hdr_len < COMPRESS_FRAME_HDR) {
+            size_t n = COMPRESS_FRAME_HDR - dec->hdr_len;
+            n = n > len - off ? len - off : n;
+            memcpy(dec->hdr + dec->hdr_len, data + off, n);
+            dec->hdr_len += n;
+            off += n;
+            if (dec->hdr_len < COMPRESS_FRAME_HDR) {
+                break;
+            }
+            if (dec->hdr[0] != COMPRESS_RAW && dec->hdr[0] != COMPRESS_DEFLATE) {
+                return UV_EINVAL;
+            }
+        }
+
+        size_t frame_len = ((size_t) dec->hdr[1] << 8) | dec->hdr[2];
+        // encoder never sends more than a block in one frame, same as deflate frames inflate to
+        if (dec->hdr[0] == COMPRESS_RAW && frame_len > COMPRESS_BLOCK) {
+            return UV_EINVAL;
+        }
+        const uint8_t *payload;
+        if (dec->payload_len == 0 && len - off >= frame_len) {
+            payload = data + off;
+            off += frame_len;
+        } else {
+            if (dec->payload == NULL) {
+                dec->payload = malloc(COMPRESS_FRAME_MAX);
+            }
+            size_t n = frame_len - dec->payload_len;
+            n = n > len - off ? len - off : n;
+            memcpy(dec->payload + dec->payload_len, data + off, n);
+            dec->payload_len += n;
+            off += n;
+            if (dec->payload_len < frame_len) {
+                break;
+            }
+            payload = dec->payload;
+        }
+
+        dec->hdr_len = 0;
+        dec->payload_len = 0;
+        int rc = deliver_frame(dec, payload, frame_len, cb, ctx);
+        if (rc < 0) {
+            return rc;
+        }
+        if (rc > 0) {
+            break;
+        }
+    }
+    return (ssize_t) off;
+}
+
+void compress_decoder_free(compress_decoder_t *dec) {
+    if (dec == NULL) return;
+    inflateEnd(&dec->z);
+    free(dec->payload);
+    free(dec);
+}
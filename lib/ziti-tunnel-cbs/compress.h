@@ -0,0 +1,100 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_COMPRESS_H
+#define ZITI_TUNNELER_SDK_COMPRESS_H
+
+#include <stdint.h>
+#include <uv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// tcp flows are compressed if `compression` in tunneler_app_data asks for it. a side that compresses sends
+// COMPRESS_HELLO as its first message, and frames everything it sends after that. a side that doesn't see the hello
+// as its peer's first message reads plain data, so each direction is negotiated on its own, and peers that don't
+// know about compression are not affected.
+#define COMPRESSION_DEFLATE "deflate"
+#define COMPRESS_HELLO "\0deflate"
+#define COMPRESS_HELLO_LEN 8
+
+// every frame starts with its type and the payload length (2 bytes, big-endian)
+#define COMPRESS_FRAME_HDR 3
+#define COMPRESS_FRAME_MAX 0xffff
+
+#define COMPRESS_FRAME_TYPES(XX) \
+XX(RAW, 0)      /* payload is the data as is */ \
+XX(DEFLATE, 1)  /* raw deflate, flushed at the end of the frame. the window carries over to the next deflate frame */
+
+#define COMPRESS_FRAME_ENUM(t, v) COMPRESS_##t = v,
+typedef enum {
+    COMPRESS_FRAME_TYPES(COMPRESS_FRAME_ENUM)
+} compress_frame_type_e;
+#undef COMPRESS_FRAME_ENUM
+
+// data is compressed a block at a time, so no frame expands to more than this
+#define COMPRESS_BLOCK (16 * 1024)
+// both sides use the same deflate window (log2), it is part of the format
+#define COMPRESS_WINDOW_BITS 12
+#define COMPRESS_MEM_LEVEL 5
+#define COMPRESS_DEFAULT_LEVEL 1
+#define COMPRESS_MAX_LEVEL 9
+// a side stops reading once this much is waiting to be sent
+#define COMPRESS_MAX_PENDING (256 * 1024)
+// smaller writes are not worth the deflate overhead
+#define COMPRESS_MIN_BYTES 64
+// the compression ratio is checked every time this much was compressed
+#define COMPRESS_SAMPLE_BYTES (64 * 1024)
+// data that doesn't shrink below this (percent), like TLS, is sent as is for a while. the while doubles every time
+// the data still doesn't compress when it is tried again
+#define COMPRESS_BYPASS_RATIO 90
+#define COMPRESS_BYPASS_MIN (1024 * 1024)
+#define COMPRESS_BYPASS_MAX (16 * 1024 * 1024)
+
+typedef struct compress_encoder_s compress_encoder_t;
+typedef struct compress_decoder_s compress_decoder_t;
+
+/** `level` is a zlib compression level */
+compress_encoder_t *compress_encoder_new(int level);
+
+/** frames `data`, compressed or not. `*out` is malloc'ed and owned by the caller. returns its length, or an error */
+ssize_t compress_encode(compress_encoder_t *enc, const uint8_t *data, size_t len, uint8_t **out);
+
+/** bytes passed to compress_encode(), and bytes that came out */
+void compress_encoder_stats(const compress_encoder_t *enc, uint64_t *in, uint64_t *out);
+
+void compress_encoder_free(compress_encoder_t *enc);
+
+/** data from one frame. return non-zero to stop after this frame */
+typedef int (*compress_data_cb)(void *ctx, const uint8_t *data, size_t len);
+
+compress_decoder_t *compress_decoder_new(void);
+
+/**
+ * invokes `cb` for every complete frame in `data`, with at most COMPRESS_BLOCK bytes.
+ * frames that span reads are completed by the next call.
+ * returns the number of bytes that were taken, which is less than `len` if `cb` stopped, or an error for bad input.
+ */
+ssize_t compress_decode(compress_decoder_t *dec, const uint8_t *data, size_t len, compress_data_cb cb, void *ctx);
+
+void compress_decoder_free(compress_decoder_t *dec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_COMPRESS_H
@@ -0,0 +1,273 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <ziti/ziti_log.h>
+#include "ziti/sys/queue.h"
+#include "dial_pool.h"
+
+typedef struct idle_conn_s {
+    void *conn;
+    uint64_t since;
+    TAILQ_ENTRY(idle_conn_s) _next;
+} idle_conn_t;
+
+struct dial_pool_s {
+    uv_loop_t *loop;
+    int max_size;
+    uint64_t ttl;
+    dial_pool_dial_fn dial_fn;
+    dial_pool_close_fn close_fn;
+    void *ctx;
+
+    // owner, timer and outstanding dials
+    int refs;
+    bool closed;
+    uv_timer_t timer;
+    int dialing;
+    uint64_t dial_started; // of the oldest outstanding dial, for latency
+    uint32_t failures;
+    uint64_t retry_at;
+
+    // arrivals per second and dial time in seconds, both smoothed
+    uint32_t arrivals;
+    uint64_t sampled_at;
+    double rate;
+    double dial_secs;
+    int target;
+
+    int idle_count;
+    TAILQ_HEAD(idle_conns, idle_conn_s) idle; // oldest first
+};
+
+static void pool_unref(dial_pool_t *pool) {
+    if (--pool->refs > 0) {
+        return;
+    }
+    free(pool);
+}
+
+static void remove_idle(dial_pool_t *pool, idle_conn_t *c, bool close) {
+    TAILQ_REMOVE(&pool->idle, c, _next);
+    pool->idle_count--;
+    if (close) {
+        pool->close_fn(c->conn);
+    }
+    free(c);
+}
+
+/** enough connections for the flows that arrive during one dial, and one to spare */
+static void update_target(dial_pool_t *pool) {
+    int target = 0;
+    if (pool->rate > 0 || pool->arrivals > 0) {
+        double during_dial = pool->rate * pool->dial_secs;
+        target = (int) during_dial + (during_dial > (int) during_dial ? 1 : 0) + 1;
+    }
+    pool->target = target > pool->max_size ? pool->max_size : target;
+}
+
+static void sample(dial_pool_t *pool, uint64_t now) {
+    uint64_t elapsed = now - pool->sampled_at;
+    if (elapsed < DIAL_POOL_SAMPLE_MILLIS) {
+        return;
+    }
+    double rate = pool->arrivals * 1000.0 / (double) elapsed;
+    pool->rate = 0.7 * pool->rate + 0.3 * rate;
+    if (pool->rate < 0.01) {
+        pool->rate = 0;
+    }
+    pool->arrivals = 0;
+    pool->sampled_at = now;
+}
+
+static void refill(dial_pool_t *pool) {
+    while (!pool->closed && pool->idle_count + pool->dialing < pool->target) {
+        // after a failure, probe with one dial at a time
+        if (pool->failures > 0 && (pool->dialing > 0 || pool->retry_at > uv_now(pool->loop))) {
+            break;
+        }
+
+        if (pool->dialing == 0) {
+            pool->dial_started = uv_now(pool->loop);
+        }
+        pool->dialing++;
+        pool->refs++;
+        int rc = pool->dial_fn(pool, pool->ctx);
+        if (rc != 0) {
+            dial_pool_dialed(pool, NULL, rc);
+            break;
+        }
+    }
+}
+
+static void on_pool_timer(uv_timer_t *t);
+
+/** wake up for sampling while there is anything to sample, the next expiring connection, or a refill retry */
+static void schedule(dial_pool_t *pool) {
+    if (pool->closed) return;
+
+    uint64_t now = uv_now(pool->loop);
+    uint64_t deadline = UINT64_MAX;
+    if (pool->rate > 0 || pool->arrivals > 0) {
+        deadline = pool->sampled_at + DIAL_POOL_SAMPLE_MILLIS;
+    }
+    if (pool->failures > 0 && pool->dialing == 0 && pool->retry_at < deadline) {
+        deadline = pool->retry_at;
+    }
+    idle_conn_t *oldest = TAILQ_FIRST(&pool->idle);
+    if (oldest != NULL && oldest->since + pool->ttl < deadline) {
+        deadline = oldest->since + pool->ttl;
+    }
+
+    if (deadline == UINT64_MAX) {
+        uv_timer_stop(&pool->timer);
+        return;
+    }
+    uv_timer_start(&pool->timer, on_pool_timer, deadline > now ? deadline - now : 0, 0);
+}
+
+static void on_pool_timer(uv_timer_t *t) {
+    dial_pool_t *pool = t->data;
+    uint64_t now = uv_now(pool->loop);
+
+    idle_conn_t *c;
+    while ((c = TAILQ_FIRST(&pool->idle)) != NULL && c->since + pool->ttl <= now) {
+        remove_idle(pool, c, true);
+    }
+    sample(pool, now);
+    update_target(pool);
+    refill(pool);
+    schedule(pool);
+}
+
+dial_pool_t *dial_pool_new(uv_loop_t *loop, int max_size, uint64_t ttl_millis, dial_pool_dial_fn dial_fn,
+                           dial_pool_close_fn close_fn, void *ctx) {
+    if (max_size <= 0 || max_size > DIAL_POOL_MAX_SIZE || ttl_millis == 0) {
+        return NULL;
+    }
+
+    dial_pool_t *pool = calloc(1, sizeof(dial_pool_t));
+    pool->loop = loop;
+    pool->max_size = max_size;
+    pool->ttl = ttl_millis;
+    pool->dial_fn = dial_fn;
+    pool->close_fn = close_fn;
+    pool->ctx = ctx;
+    pool->sampled_at = uv_now(loop);
+    TAILQ_INIT(&pool->idle);
+
+    uv_timer_init(loop, &pool->timer);
+    pool->timer.data = pool;
+    uv_unref((uv_handle_t *) &pool->timer);
+    pool->refs = 2;
+    return pool;
+}
+
+static void on_timer_close(uv_handle_t *h) {
+    pool_unref(h->data);
+}
+
+void dial_pool_close(dial_pool_t *pool) {
+    if (pool == NULL || pool->closed) {
+        return;
+    }
+
+    pool->closed = true;
+    uv_close((uv_handle_t *) &pool->timer, on_timer_close);
+    while (!TAILQ_EMPTY(&pool->idle)) {
+        remove_idle(pool, TAILQ_FIRST(&pool->idle), true);
+    }
+    pool_unref(pool);
+}
+
+void dial_pool_dialed(dial_pool_t *pool, void *conn, int status) {
+    pool->dialing--;
+    if (pool->closed) {
+        if (conn != NULL) {
+            pool->close_fn(conn);
+        }
+        pool_unref(pool);
+        return;
+    }
+
+    uint64_t now = uv_now(pool->loop);
+    if (conn == NULL) {
+        pool->failures++;
+        uint64_t backoff = DIAL_POOL_RETRY_MAX_MILLIS;
+        if (pool->failures < 16) {
+            backoff = (uint64_t) DIAL_POOL_RETRY_MIN_MILLIS << (pool->failures - 1);
+            if (backoff > DIAL_POOL_RETRY_MAX_MILLIS) backoff = DIAL_POOL_RETRY_MAX_MILLIS;
+        }
+        pool->retry_at = now + backoff;
+        ZITI_LOG(DEBUG, "pooled dial failed: %d. retrying in %" PRIu64 "ms", status, backoff);
+    } else {
+        double secs = (double) (now - pool->dial_started) / 1000.0;
+        pool->dial_secs = pool->dial_secs == 0 ? secs : 0.75 * pool->dial_secs + 0.25 * secs;
+        pool->dial_started = now;
+        pool->failures = 0;
+
+        idle_conn_t *c = calloc(1, sizeof(idle_conn_t));
+        c->conn = conn;
+        c->since = now;
+        TAILQ_INSERT_TAIL(&pool->idle, c, _next);
+        pool->idle_count++;
+        refill(pool);
+    }
+    schedule(pool);
+    pool_unref(pool);
+}
+
+void *dial_pool_take(dial_pool_t *pool) {
+    if (pool->closed) {
+        return NULL;
+    }
+
+    pool->arrivals++;
+    void *conn = NULL;
+    // most recently dialed first, it is least likely to have been closed by a router
+    idle_conn_t *c = TAILQ_LAST(&pool->idle, idle_conns);
+    if (c != NULL) {
+        conn = c->conn;
+        remove_idle(pool, c, false);
+    }
+
+    update_target(pool);
+    refill(pool);
+    schedule(pool);
+    return conn;
+}
+
+bool dial_pool_remove(dial_pool_t *pool, void *conn) {
+    idle_conn_t *c;
+    TAILQ_FOREACH(c, &pool->idle, _next) {
+        if (c->conn == conn) {
+            remove_idle(pool, c, false);
+            refill(pool);
+            schedule(pool);
+            return true;
+        }
+    }
+    return false;
+}
+
+int dial_pool_idle_count(const dial_pool_t *pool) {
+    return pool->idle_count;
+}
+
+int dial_pool_target(const dial_pool_t *pool) {
+    return pool->target;
+}
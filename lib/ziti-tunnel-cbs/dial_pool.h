@@ -0,0 +1,79 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_DIAL_POOL_H
+#define ZITI_TUNNELER_SDK_DIAL_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DIAL_POOL_MAX_SIZE 32
+#define DIAL_POOL_DEFAULT_TTL_SECONDS 30
+#define DIAL_POOL_SAMPLE_MILLIS 1000 // arrival rate is sampled this often
+// refill backoff after failed dials. doubles with every consecutive failure
+#define DIAL_POOL_RETRY_MIN_MILLIS 1000
+#define DIAL_POOL_RETRY_MAX_MILLIS (30 * 1000)
+
+// pooled ziti connections are dialed before the flow is known, with `connType` "deferred" in their app_data.
+// the intercepting side sends the flow's app_data as the first message: a 2-byte length followed by the json.
+// the hosting side answers with an empty 2-byte message once it is connected to the server.
+#define DIAL_POOL_PRELUDE_HDR 2
+#define DIAL_POOL_PRELUDE_MAX 4096
+
+/**
+ * connections to a ziti service, dialed ahead of the intercepted flows that will use them.
+ * the pool is sized from the recent arrival rate and the time a dial takes, so there is roughly one
+ * connection ready for every flow that arrives while a dial is in progress. connections that are
+ * not used within the ttl are closed.
+ */
+typedef struct dial_pool_s dial_pool_t;
+
+/** start one dial, and report its result with dial_pool_dialed(). return 0 if the dial was started */
+typedef int (*dial_pool_dial_fn)(dial_pool_t *pool, void *ctx);
+
+/** close a connection the pool doesn't need anymore */
+typedef void (*dial_pool_close_fn)(void *conn);
+
+dial_pool_t *dial_pool_new(uv_loop_t *loop, int max_size, uint64_t ttl_millis, dial_pool_dial_fn dial_fn,
+                           dial_pool_close_fn close_fn, void *ctx);
+
+/** stop dialing and close idle connections. the pool is freed once outstanding dials are reported */
+void dial_pool_close(dial_pool_t *pool);
+
+/** result of a dial started by `dial_fn`. `conn` is NULL if the dial failed */
+void dial_pool_dialed(dial_pool_t *pool, void *conn, int status);
+
+/** an idle connection for a new flow, or NULL. every call counts as an arrival */
+void *dial_pool_take(dial_pool_t *pool);
+
+/** forget an idle connection that was closed by the other side. returns false if `conn` isn't idle in the pool */
+bool dial_pool_remove(dial_pool_t *pool, void *conn);
+
+int dial_pool_idle_count(const dial_pool_t *pool);
+
+/** number of connections the pool is trying to keep ready */
+int dial_pool_target(const dial_pool_t *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_DIAL_POOL_H
@@ -0,0 +1,119 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "dial_template.h"
+
+#define DIAL_VAR_NAME(v, name) name,
+static const char *const var_names[] = {
+    DIAL_TEMPLATE_VARS(DIAL_VAR_NAME)
+};
+#undef DIAL_VAR_NAME
+
+/** the variable at `p`. the longest name wins if one is a prefix of another */
+static int match_var(const char *p, uint32_t vars, size_t *name_len) {
+    int match = -1;
+    *name_len = 0;
+    for (int i = 0; i < DIAL_VAR_COUNT; i++) {
+        size_t len = strlen(var_names[i]);
+        if ((vars & (1U << i)) && len > *name_len && strncmp(p, var_names[i], len) == 0) {
+            match = i;
+            *name_len = len;
+        }
+    }
+    return match;
+}
+
+static void add_seg(dial_template_t *t, int var, size_t off, size_t len) {
+    // adjacent literal text is merged
+    if (var < 0 && t->num_segs > 0 && t->segs[t->num_segs - 1].var < 0) {
+        t->segs[t->num_segs - 1].len += (uint16_t) len;
+        return;
+    }
+    dial_template_seg_t *s = &t->segs[t->num_segs++];
+    s->var = var;
+    s->off = (uint16_t) off;
+    s->len = (uint16_t) len;
+    if (var >= 0) {
+        t->num_vars++;
+    }
+}
+
+int dial_template_compile(dial_template_t *t, const char *text, uint32_t vars) {
+    memset(t, 0, sizeof(*t));
+    size_t text_len = strlen(text);
+    if (text_len > UINT16_MAX) {
+        return UV_EINVAL;
+    }
+
+    t->text = strdup(text);
+    // a segment starts at most at every '$' and right after it
+    size_t max_segs = 1;
+    for (const char *p = text; (p = strchr(p, '$')) != NULL; p++) {
+        max_segs += 2;
+    }
+    t->segs = calloc(max_segs, sizeof(dial_template_seg_t));
+
+    size_t lit_start = 0;
+    for (size_t i = 0; i < text_len;) {
+        size_t name_len;
+        int var = text[i] == '$' ? match_var(text + i, vars, &name_len) : -1;
+        if (var < 0) {
+            i++;
+            continue;
+        }
+        if (i > lit_start) {
+            add_seg(t, -1, lit_start, i - lit_start);
+        }
+        add_seg(t, var, i, name_len);
+        i += name_len;
+        lit_start = i;
+    }
+    if (text_len > lit_start) {
+        add_seg(t, -1, lit_start, text_len - lit_start);
+    }
+    return 0;
+}
+
+ssize_t dial_template_render(const dial_template_t *t, const dial_template_values_t *values, char *out, size_t len) {
+    size_t n = 0;
+    for (int i = 0; i < t->num_segs; i++) {
+        const dial_template_seg_t *s = &t->segs[i];
+        const char *src = t->text + s->off;
+        size_t src_len = s->len;
+        if (s->var >= 0 && values->v[s->var] != NULL) {
+            src = values->v[s->var];
+            src_len = strlen(src);
+        }
+        if (n + src_len >= len) {
+            return -1;
+        }
+        memcpy(out + n, src, src_len);
+        n += src_len;
+    }
+    if (n >= len) {
+        return -1;
+    }
+    out[n] = '\0';
+    return (ssize_t) n;
+}
+
+void dial_template_free(dial_template_t *t) {
+    free(t->text);
+    free(t->segs);
+    memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,85 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_DIAL_TEMPLATE_H
+#define ZITI_TUNNELER_SDK_DIAL_TEMPLATE_H
+
+#include <stdint.h>
+#include <uv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DIAL_TEMPLATE_VARS(XX) \
+XX(TUNNELER_ID, "$tunneler_id.name") \
+XX(DST_PROTOCOL, "$dst_protocol") \
+XX(DST_IP, "$dst_ip") \
+XX(DST_PORT, "$dst_port") \
+XX(DST_HOSTNAME, "$dst_hostname") \
+XX(SRC_IP, "$src_ip") \
+XX(SRC_PORT, "$src_port")
+
+#define DIAL_VAR_ENUM(v, name) DIAL_VAR_##v,
+typedef enum {
+    DIAL_TEMPLATE_VARS(DIAL_VAR_ENUM)
+    DIAL_VAR_COUNT
+} dial_template_var_e;
+#undef DIAL_VAR_ENUM
+
+#define DIAL_VAR_BIT(v) (1U << DIAL_VAR_##v)
+
+// variables that intercept.v1 `sourceIp` and `dialOptions.identity` have always supported
+#define DIAL_SOURCE_ADDR_VARS (DIAL_VAR_BIT(TUNNELER_ID) | DIAL_VAR_BIT(DST_IP) | DIAL_VAR_BIT(DST_PORT) | \
+                               DIAL_VAR_BIT(SRC_IP) | DIAL_VAR_BIT(SRC_PORT))
+#define DIAL_IDENTITY_VARS (DIAL_VAR_BIT(DST_PROTOCOL) | DIAL_VAR_BIT(DST_IP) | DIAL_VAR_BIT(DST_PORT) | \
+                            DIAL_VAR_BIT(DST_HOSTNAME))
+
+typedef struct dial_template_seg_s {
+    int var; // dial_template_var_e, or -1 for literal text
+    uint16_t off;
+    uint16_t len;
+} dial_template_seg_t;
+
+/**
+ * a `$variable` string from a service config, split into literal text and variables once,
+ * so every dial only has to copy the pieces into place.
+ */
+typedef struct dial_template_s {
+    char *text;
+    dial_template_seg_t *segs;
+    int num_segs;
+    int num_vars;
+} dial_template_t;
+
+/** values for one dial, NUL terminated. a NULL value leaves its `$variable` in place */
+typedef struct dial_template_values_s {
+    const char *v[DIAL_VAR_COUNT];
+} dial_template_values_t;
+
+/** only variables in `vars` (DIAL_VAR_BIT mask) are recognized, anything else is literal text */
+int dial_template_compile(dial_template_t *t, const char *text, uint32_t vars);
+
+/** returns the rendered length, or -1 if it doesn't fit in `out` (including the terminating NUL) */
+ssize_t dial_template_render(const dial_template_t *t, const dial_template_values_t *values, char *out, size_t len);
+
+void dial_template_free(dial_template_t *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_DIAL_TEMPLATE_H
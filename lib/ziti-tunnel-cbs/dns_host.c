@@ -13,6 +13,7 @@
  See the License for the specific language governing permissions and
  limitations under the License.
  */
+#include <ctype.h>
 #include <ziti/ziti.h>
 #include <ziti/ziti_log.h>
 #include "ziti_hosting.h"
@@ -27,11 +28,71 @@
 #endif // PACKETSZ
 
 
+#define DNS_HOST_QUERY_TIMEOUT 5000 // millis
+#define DNS_HOST_MAX_PENDING 64 // queries queued or in flight across all resolver connections
+#define DNS_HOST_RESOLVER_THREADS 2 // blocking upstream queries run here, not on the uv worker pool
+#define DNS_HOST_CACHE_MAX 1024
+#define DNS_HOST_CACHE_MAX_TTL 300 // seconds
+#define DNS_HOST_CACHE_NEG_TTL 30 // seconds, NXDOMAIN and empty answers
+
+#if _WIN32
+#define DNS_WIRE_SUPPORTED 0 // no raw message API in windns
+#else
+#define DNS_WIRE_SUPPORTED 1
+#endif
+
 typedef struct dns_host_conn_s {
-    resolver_t resolver;
+    ziti_connection conn;
+    uv_loop_t *loop;
     allowed_hostnames_t allowed_domains;
+    LIST_HEAD(dns_host_reqs, dns_host_req_s) reqs;
+    bool wire; // peer sends length-prefixed wire format messages
+    dns_frame_buf_t rbuf;
 } dns_host_conn_t;
 
+// query that is being resolved on a resolver thread
+typedef struct dns_host_req_s {
+    uv_timer_t timer;
+    dns_host_conn_t *dns; // NULL if resolver connection was closed while query was in flight
+    dns_message msg;
+    char *cache_key;
+    // wire format query and answer. only set on connections that use wire format
+    uint8_t *wire_q;
+    size_t wire_q_len;
+    uint8_t *wire_a;
+    int wire_a_len;
+    bool replied;
+    LIST_ENTRY(dns_host_req_s) _next;
+    STAILQ_ENTRY(dns_host_req_s) _queue; // resolver todo/done queue
+} dns_host_req_t;
+
+// dedicated threads for upstream queries. a slow upstream would otherwise hold
+// the uv worker pool that getaddrinfo and fs requests share.
+// queues are guarded by lock, everything else is only touched on the loop thread
+static struct {
+    bool started;
+    uv_mutex_t lock;
+    uv_cond_t cond;
+    STAILQ_HEAD(, dns_host_req_s) todo;
+    STAILQ_HEAD(, dns_host_req_s) done;
+    uv_async_t done_async;
+    uv_thread_t threads[DNS_HOST_RESOLVER_THREADS];
+} resolver_pool;
+
+// answers shared by all resolver connections: SRV/MX/TXT for JSON queries, whole messages for wire queries.
+// only accessed from the loop thread
+typedef struct dns_cache_entry_s {
+    uint64_t stored;
+    uint64_t expires;
+    int status;
+    dns_answer **answer;
+    uint8_t *wire;
+    size_t wire_len;
+} dns_cache_entry_t;
+
+static model_map answer_cache;
+static unsigned int pending_queries;
+
 
 typedef int (*rr_fmt)(const ns_msg *, const ns_rr*, dns_answer *ans, size_t max);
 static int fmt_srv(const ns_msg *, const ns_rr*, dns_answer *ans, size_t max);
@@ -54,7 +115,12 @@ void dns_host_init() {
 static void on_close(ziti_connection conn) {
     dns_host_conn_t *dns = ziti_conn_data(conn);
     if (dns) {
-        res_nclose(&dns->resolver);
+        // in-flight queries complete on their own, but have nowhere to send the answer
+        while (!LIST_EMPTY(&dns->reqs)) {
+            dns_host_req_t *req = LIST_FIRST(&dns->reqs);
+            LIST_REMOVE(req, _next);
+            req->dns = NULL;
+        }
         while(!LIST_EMPTY(&dns->allowed_domains)) {
             struct allowed_hostname_s *ad = LIST_FIRST(&dns->allowed_domains);
             LIST_REMOVE(ad, _next);
@@ -65,12 +131,6 @@ static void on_close(ziti_connection conn) {
     }
 }
 
-static void on_conn_complete(ziti_connection conn, int status) {
-    if (status != ZITI_OK) {
-        ziti_close(conn, on_close);
-    }
-}
-
 static void on_write(ziti_connection conn, ssize_t status, void *ctx) {
     if (ctx) free(ctx);
     
@@ -79,6 +139,17 @@ static void on_write(ziti_connection conn, ssize_t status, void *ctx) {
     }
 }
 
+static void on_conn_complete(ziti_connection conn, int status) {
+    dns_host_conn_t *dns = ziti_conn_data(conn);
+    if (status != ZITI_OK) {
+        ziti_close(conn, on_close);
+    } else if (dns->wire) {
+        // empty frame tells the peer that we understand wire format
+        static uint8_t wire_ack[2] = { 0, 0 };
+        ziti_write(conn, wire_ack, sizeof(wire_ack), on_write, NULL);
+    }
+}
+
 static bool is_allowed(const char *name, const dns_host_conn_t *dns) {
     struct allowed_hostname_s *ad;
     LIST_FOREACH(ad, &dns->allowed_domains, _next) {
@@ -241,48 +312,497 @@ static int fmt_txt(const ns_msg *msg, const ns_rr* rr, dns_answer *ans, size_t m
 
 #endif
 
-static ssize_t on_dns_req(ziti_connection conn, const uint8_t *data, ssize_t datalen) {
-    if (datalen < 0) {
-        ziti_close(conn, on_close);
+static void free_answers(dns_answer **answers) {
+    if (answers == NULL) return;
+    for (int i = 0; answers[i] != NULL; i++) {
+        free_dns_answer_ptr(answers[i]);
+    }
+    free(answers);
+}
+
+static dns_answer **copy_answers(dns_answer **answers, int ttl) {
+    if (answers == NULL) return NULL;
+
+    int count = 0;
+    while (answers[count] != NULL) count++;
+
+    dns_answer **copy = calloc(count + 1, sizeof(dns_answer *));
+    for (int i = 0; i < count; i++) {
+        dns_answer *a = alloc_dns_answer();
+        *a = *answers[i];
+        a->name = answers[i]->name ? strdup(answers[i]->name) : NULL;
+        a->data = answers[i]->data ? strdup(answers[i]->data) : NULL;
+        if (ttl >= 0) a->ttl = ttl;
+        copy[i] = a;
+    }
+    return copy;
+}
+
+static void free_cache_entry(dns_cache_entry_t *entry) {
+    free_answers(entry->answer);
+    free(entry->wire);
+    free(entry);
+}
+
+static bool cache_lookup(uv_loop_t *loop, const char *key, dns_message *msg) {
+    dns_cache_entry_t *entry = model_map_get(&answer_cache, key);
+    if (entry == NULL) return false;
+
+    uint64_t now = uv_now(loop);
+    if (entry->expires <= now) {
+        model_map_remove(&answer_cache, key);
+        free_cache_entry(entry);
+        return false;
+    }
+
+    msg->status = entry->status;
+    msg->answer = copy_answers(entry->answer, (int)((entry->expires - now) / 1000));
+    return true;
+}
+
+static void cache_put(uv_loop_t *loop, const char *key, dns_cache_entry_t *entry, int ttl);
+
+static void cache_store(uv_loop_t *loop, const char *key, const dns_message *msg) {
+    int ttl;
+    if (msg->status == ns_r_noerror && msg->answer != NULL && msg->answer[0] != NULL) {
+        ttl = DNS_HOST_CACHE_MAX_TTL;
+        for (int i = 0; msg->answer[i] != NULL; i++) {
+            if (msg->answer[i]->ttl < ttl) ttl = msg->answer[i]->ttl;
+        }
+    } else if (msg->status == ns_r_noerror || msg->status == ns_r_nxdomain) {
+        ttl = DNS_HOST_CACHE_NEG_TTL;
+    } else {
+        return; // do not remember server failures
+    }
+
+    if (ttl <= 0) return;
+
+    dns_cache_entry_t *entry = calloc(1, sizeof(dns_cache_entry_t));
+    entry->status = msg->status;
+    entry->answer = copy_answers(msg->answer, -1);
+    cache_put(loop, key, entry, ttl);
+}
+
+static void wire_min_ttl(uint8_t *ttl, void *ctx) {
+    uint32_t t = ((uint32_t) ttl[0] << 24) | (ttl[1] << 16) | (ttl[2] << 8) | ttl[3];
+    int *min = ctx;
+    if ((int64_t) t < *min) *min = (int) t;
+}
+
+static void wire_age_ttl(uint8_t *ttl, void *ctx) {
+    uint32_t t = ((uint32_t) ttl[0] << 24) | (ttl[1] << 16) | (ttl[2] << 8) | ttl[3];
+    uint32_t elapsed = *(uint32_t *) ctx;
+    t = t > elapsed ? t - elapsed : 0;
+    ttl[0] = (uint8_t) (t >> 24);
+    ttl[1] = (uint8_t) (t >> 16);
+    ttl[2] = (uint8_t) (t >> 8);
+    ttl[3] = (uint8_t) t;
+}
+
+// cached wire answers are shared by queries that differ in ID or name case, and by EDNS/non-EDNS queries separately
+static void wire_cache_key(char *key, size_t key_len, const uint8_t *q, const dns_question *question) {
+    bool edns = ((q[10] << 8) | q[11]) > 0;
+    int n = snprintf(key, key_len, "w:%d:%d:", (int) question->type, edns);
+    for (const char *c = question->name; *c && n < (int) key_len - 1; c++) {
+        key[n++] = (char) tolower((unsigned char) *c);
+    }
+    key[n] = 0;
+}
+
+static void wire_cache_store(uv_loop_t *loop, const char *key, const uint8_t *a, size_t a_len) {
+    int rcode = a[3] & 0x0f;
+    int an_count = (a[6] << 8) | a[7];
+    if (a[2] & 0x02) return; // truncated
+
+    int ttl;
+    if (rcode == ns_r_noerror && an_count > 0) {
+        ttl = DNS_HOST_CACHE_MAX_TTL;
+    } else if (rcode == ns_r_noerror || rcode == ns_r_nxdomain) {
+        ttl = DNS_HOST_CACHE_NEG_TTL;
+    } else {
+        return; // do not remember server failures
+    }
+
+    dns_cache_entry_t *entry = calloc(1, sizeof(dns_cache_entry_t));
+    entry->status = rcode;
+    entry->wire = malloc(a_len);
+    memcpy(entry->wire, a, a_len);
+    entry->wire_len = a_len;
+    if (an_count > 0 && dns_wire_foreach_ttl(entry->wire, a_len, wire_min_ttl, &ttl) != 0) {
+        free_cache_entry(entry);
+        return;
+    }
+    if (ttl <= 0) {
+        free_cache_entry(entry);
+        return;
+    }
+    cache_put(loop, key, entry, ttl);
+}
+
+/** copies a cached answer for query `q` into `resp`. returns the answer length, or 0 if there is none */
+static size_t wire_cache_lookup(uv_loop_t *loop, const char *key, const uint8_t *q, size_t q_len, uint8_t *resp) {
+    dns_cache_entry_t *entry = model_map_get(&answer_cache, key);
+    if (entry == NULL || entry->wire == NULL) return 0;
+
+    uint64_t now = uv_now(loop);
+    if (entry->expires <= now) {
+        model_map_remove(&answer_cache, key);
+        free_cache_entry(entry);
         return 0;
     }
-    dns_host_conn_t *dns = ziti_conn_data(conn);
 
+    size_t q_end = dns_wire_question_end(q, q_len);
+    if (q_end == 0 || q_end != dns_wire_question_end(entry->wire, entry->wire_len)) return 0;
+
+    memcpy(resp, entry->wire, entry->wire_len);
+    // answer the query as it was asked: ID, RD flag, and question with its original case
+    memcpy(resp, q, 2);
+    resp[2] = (uint8_t) ((resp[2] & ~0x01) | (q[2] & 0x01));
+    memcpy(resp + DNS_HEADER_LEN, q + DNS_HEADER_LEN, q_end - DNS_HEADER_LEN);
+    uint32_t elapsed = (uint32_t) ((now - entry->stored) / 1000);
+    dns_wire_foreach_ttl(resp, entry->wire_len, wire_age_ttl, &elapsed);
+    return entry->wire_len;
+}
+
+static void cache_put(uv_loop_t *loop, const char *key, dns_cache_entry_t *entry, int ttl) {
+    uint64_t now = uv_now(loop);
+    if (model_map_size(&answer_cache) >= DNS_HOST_CACHE_MAX) {
+        model_map_iter it = model_map_iterator(&answer_cache);
+        while (it != NULL) {
+            dns_cache_entry_t *e = model_map_it_value(it);
+            if (e->expires <= now) {
+                it = model_map_it_remove(it);
+                free_cache_entry(e);
+            } else {
+                it = model_map_it_next(it);
+            }
+        }
+        if (model_map_size(&answer_cache) >= DNS_HOST_CACHE_MAX) {
+            free_cache_entry(entry);
+            return;
+        }
+    }
+
+    entry->stored = now;
+    entry->expires = now + (uint64_t)ttl * 1000;
+    dns_cache_entry_t *old = model_map_set(&answer_cache, key, entry);
+    if (old) {
+        free_cache_entry(old);
+    }
+}
+
+static void send_reply(dns_host_conn_t *dns, const dns_message *msg) {
+    size_t msg_len = 0;
+    char *json = dns_message_to_json(msg, 0, &msg_len);
+    ziti_write(dns->conn, (uint8_t *)json, msg_len, on_write, json);
+}
+
+static void send_wire_reply(dns_host_conn_t *dns, const uint8_t *msg, size_t len) {
+    size_t frame_len;
+    uint8_t *frame = dns_frame_msg(msg, len, &frame_len);
+    ziti_write(dns->conn, frame, frame_len, on_write, frame);
+}
+
+// answer a wire format query with just the header and question section
+static void send_wire_error(dns_host_conn_t *dns, const uint8_t *q, size_t q_len, int rcode) {
+    uint8_t resp[DNS_PROXY_MAX_MSG];
+    size_t len = dns_wire_question_end(q, q_len);
+    if (len == 0) {
+        if (q_len < DNS_HEADER_LEN) return; // can't even tell the query ID
+        len = DNS_HEADER_LEN;
+        memset(resp + 4, 0, 2); // no question
+    }
+    memcpy(resp, q, len);
+    resp[2] |= 0x80; // QR
+    resp[3] = 0x80 | (rcode & 0x0f); // RA + RCODE
+    memset(resp + 6, 0, 6); // no answer, authority, or additional records
+    send_wire_reply(dns, resp, len);
+}
+
+static void send_servfail(dns_host_req_t *req) {
+    req->replied = true;
+    if (req->wire_q) {
+        send_wire_error(req->dns, req->wire_q, req->wire_q_len, ns_r_servfail);
+        return;
+    }
+
+    // resolver thread may still own status/answers of req->msg
+    dns_message resp = {
+            .id = req->msg.id,
+            .recursive = req->msg.recursive,
+            .status = ns_r_servfail,
+            .question = req->msg.question,
+    };
+    send_reply(req->dns, &resp);
+}
+
+static void free_dns_req(uv_handle_t *h) {
+    dns_host_req_t *req = h->data;
+    if (req->dns) {
+        LIST_REMOVE(req, _next);
+    }
+    free(req->cache_key);
+    free(req->wire_q);
+    free(req->wire_a);
+    free_dns_message(&req->msg);
+    free(req);
+}
+
+// runs on a resolver thread. must not touch anything but the request message
+static void resolve_work(dns_host_req_t *req) {
+    resolver_t resolver;
+    memset(&resolver, 0, sizeof(resolver));
+    if (res_ninit(&resolver) != 0) {
+        req->msg.status = ns_r_servfail;
+        return;
+    }
+#if !_WIN32 && __RES >= 19991006
+    // keep blocked resolver threads well under the request timeout
+    resolver.retrans = 2;
+    resolver.retry = 2;
+#endif
+#if DNS_WIRE_SUPPORTED
+    if (req->wire_q) {
+        req->wire_a = malloc(DNS_PROXY_MAX_MSG);
+        req->wire_a_len = res_nsend(&resolver, req->wire_q, (int)req->wire_q_len, req->wire_a, DNS_PROXY_MAX_MSG);
+        if (req->wire_a_len > DNS_PROXY_MAX_MSG) {
+            req->wire_a_len = DNS_PROXY_MAX_MSG;
+            req->wire_a[2] |= 0x02; // TC
+        }
+    } else
+#endif
+    do_query(req->msg.question[0], &req->msg, &resolver);
+    res_nclose(&resolver);
+}
+
+static void resolve_done(dns_host_req_t *req) {
+    pending_queries--;
+    if (pending_queries == 0) {
+        uv_unref((uv_handle_t *) &resolver_pool.done_async);
+    }
+
+    if (req->wire_q) {
+        if (!req->replied && req->dns) {
+            if (req->wire_a_len >= DNS_HEADER_LEN) {
+                req->replied = true;
+                wire_cache_store(req->timer.loop, req->cache_key, req->wire_a, req->wire_a_len);
+                send_wire_reply(req->dns, req->wire_a, req->wire_a_len);
+            } else {
+                send_servfail(req);
+            }
+        }
+        uv_close((uv_handle_t *) &req->timer, free_dns_req);
+        return;
+    }
+
+    cache_store(req->timer.loop, req->cache_key, &req->msg);
+
+    if (!req->replied && req->dns) {
+        req->replied = true;
+        send_reply(req->dns, &req->msg);
+    }
+    uv_close((uv_handle_t *) &req->timer, free_dns_req);
+}
+
+static void on_resolve_timeout(uv_timer_t *t) {
+    dns_host_req_t *req = t->data;
+    if (req->replied || req->dns == NULL) return;
+
+    ZITI_LOG(WARN, "query for %s[%d] timed out after %dms",
+             req->msg.question[0]->name, (int)req->msg.question[0]->type, DNS_HOST_QUERY_TIMEOUT);
+    send_servfail(req);
+}
+
+static void resolver_thread(void *arg) {
+    for (;;) {
+        uv_mutex_lock(&resolver_pool.lock);
+        while (STAILQ_EMPTY(&resolver_pool.todo)) {
+            uv_cond_wait(&resolver_pool.cond, &resolver_pool.lock);
+        }
+        dns_host_req_t *req = STAILQ_FIRST(&resolver_pool.todo);
+        STAILQ_REMOVE_HEAD(&resolver_pool.todo, _queue);
+        uv_mutex_unlock(&resolver_pool.lock);
+
+        resolve_work(req);
+
+        uv_mutex_lock(&resolver_pool.lock);
+        STAILQ_INSERT_TAIL(&resolver_pool.done, req, _queue);
+        uv_mutex_unlock(&resolver_pool.lock);
+        uv_async_send(&resolver_pool.done_async);
+    }
+}
+
+static void on_resolved(uv_async_t *a) {
+    STAILQ_HEAD(, dns_host_req_s) done;
+    uv_mutex_lock(&resolver_pool.lock);
+    STAILQ_INIT(&done);
+    STAILQ_CONCAT(&done, &resolver_pool.done);
+    uv_mutex_unlock(&resolver_pool.lock);
+
+    while (!STAILQ_EMPTY(&done)) {
+        dns_host_req_t *req = STAILQ_FIRST(&done);
+        STAILQ_REMOVE_HEAD(&done, _queue);
+        resolve_done(req);
+    }
+}
+
+// threads live for the rest of the process, they are only blocked in the resolver or idle
+static int resolver_pool_start(uv_loop_t *loop) {
+    if (resolver_pool.started) return 0;
+
+    int rc = uv_async_init(loop, &resolver_pool.done_async, on_resolved);
+    if (rc != 0) return rc;
+    uv_unref((uv_handle_t *) &resolver_pool.done_async);
+    uv_mutex_init(&resolver_pool.lock);
+    uv_cond_init(&resolver_pool.cond);
+    STAILQ_INIT(&resolver_pool.todo);
+    STAILQ_INIT(&resolver_pool.done);
+
+    int started = 0;
+    for (int i = 0; i < DNS_HOST_RESOLVER_THREADS; i++) {
+        rc = uv_thread_create(&resolver_pool.threads[i], resolver_thread, NULL);
+        if (rc != 0) {
+            ZITI_LOG(WARN, "failed to start resolver thread: %d(%s)", rc, uv_strerror(rc));
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        uv_close((uv_handle_t *) &resolver_pool.done_async, NULL);
+        uv_cond_destroy(&resolver_pool.cond);
+        uv_mutex_destroy(&resolver_pool.lock);
+        return rc;
+    }
+    resolver_pool.started = true;
+    return 0;
+}
+
+static void start_query(dns_host_conn_t *dns, dns_host_req_t *req) {
+    req->dns = dns;
+    req->timer.data = req;
+    uv_timer_init(dns->loop, &req->timer);
+    LIST_INSERT_HEAD(&dns->reqs, req, _next);
+
+    int rc = resolver_pool_start(dns->loop);
+    if (rc == 0) {
+        // keep the loop alive until the answer is delivered
+        if (pending_queries++ == 0) {
+            uv_ref((uv_handle_t *) &resolver_pool.done_async);
+        }
+        uv_mutex_lock(&resolver_pool.lock);
+        STAILQ_INSERT_TAIL(&resolver_pool.todo, req, _queue);
+        uv_cond_signal(&resolver_pool.cond);
+        uv_mutex_unlock(&resolver_pool.lock);
+        uv_timer_start(&req->timer, on_resolve_timeout, DNS_HOST_QUERY_TIMEOUT, 0);
+        return;
+    }
+
+    ZITI_LOG(WARN, "failed to queue query for %s: %d(%s)", req->msg.question[0]->name, rc, uv_strerror(rc));
+    send_servfail(req);
+    uv_close((uv_handle_t *) &req->timer, free_dns_req);
+}
+
+static void on_json_req(dns_host_conn_t *dns, const uint8_t *data, size_t datalen) {
     ZITI_LOG(DEBUG, "resolve_req: %.*s", (int)datalen, data);
     dns_message msg = {0};
     parse_dns_message(&msg, (const char*) data, datalen);
-    dns_question *q = msg.question[0];
+    dns_question *q = msg.question ? msg.question[0] : NULL;
 
-    if (is_allowed(q->name, dns)) {
-        do_query(q, &msg, &dns->resolver);
-    } else {
+    if (q == NULL || q->name == NULL) {
+        msg.status = ns_r_formerr;
+    } else if (!is_allowed(q->name, dns)) {
         msg.status = ns_r_refused;
+    } else {
+        char key[300];
+        snprintf(key, sizeof(key), "%d:%s", (int)q->type, q->name);
+        if (!cache_lookup(dns->loop, key, &msg)) {
+            if (pending_queries >= DNS_HOST_MAX_PENDING) {
+                ZITI_LOG(WARN, "too many queries in flight, failing query for %s", q->name);
+                msg.status = ns_r_servfail;
+            } else {
+                dns_host_req_t *req = calloc(1, sizeof(dns_host_req_t));
+                req->msg = msg;
+                req->cache_key = strdup(key);
+                start_query(dns, req);
+                return;
+            }
+        }
     }
 
-    size_t msg_len = 0;
-    char *json = dns_message_to_json(&msg, 0, &msg_len);
-    ziti_write(conn, (uint8_t *)json, msg_len, on_write, json);
+    send_reply(dns, &msg);
+    free_dns_message(&msg);
+}
+
+static void on_wire_req(void *ctx, const uint8_t *q, size_t q_len) {
+    dns_host_conn_t *dns = ctx;
+    dns_message msg = {0};
+
+    if (q_len < DNS_HEADER_LEN || parse_dns_req(&msg, q, q_len) != 0 || msg.question[0]->name == NULL) {
+        send_wire_error(dns, q, q_len, ns_r_formerr);
+    } else if (!is_allowed(msg.question[0]->name, dns)) {
+        send_wire_error(dns, q, q_len, ns_r_refused);
+    } else {
+        char key[300];
+        uint8_t cached[DNS_PROXY_MAX_MSG];
+        wire_cache_key(key, sizeof(key), q, msg.question[0]);
+        size_t cached_len = wire_cache_lookup(dns->loop, key, q, q_len, cached);
+        if (cached_len > 0) {
+            send_wire_reply(dns, cached, cached_len);
+        } else if (pending_queries >= DNS_HOST_MAX_PENDING) {
+            ZITI_LOG(WARN, "too many queries in flight, failing query for %s", msg.question[0]->name);
+            send_wire_error(dns, q, q_len, ns_r_servfail);
+        } else {
+            ZITI_LOG(DEBUG, "resolve_req[%04x]: %s[%d]", (int)msg.id, msg.question[0]->name, (int)msg.question[0]->type);
+            dns_host_req_t *req = calloc(1, sizeof(dns_host_req_t));
+            req->msg = msg;
+            req->wire_q = malloc(q_len);
+            memcpy(req->wire_q, q, q_len);
+            req->wire_q_len = q_len;
+            req->cache_key = strdup(key);
+            start_query(dns, req);
+            return;
+        }
+    }
     free_dns_message(&msg);
+}
+
+static ssize_t on_dns_req(ziti_connection conn, const uint8_t *data, ssize_t datalen) {
+    if (datalen < 0) {
+        ziti_close(conn, on_close);
+        return 0;
+    }
+    dns_host_conn_t *dns = ziti_conn_data(conn);
+
+    // wire format peers send JSON until they see our ack
+    if (!dns->wire || (dns->rbuf.len == 0 && datalen > 0 && data[0] == '{')) {
+        on_json_req(dns, data, datalen);
+        return datalen;
+    }
+
+    if (dns_frame_read(&dns->rbuf, data, datalen, on_wire_req, dns) != 0) {
+        ZITI_LOG(ERROR, "invalid DNS message frame from peer");
+        ziti_close(conn, on_close);
+    }
     return datalen;
 }
 
-void accept_resolver_conn(ziti_connection conn, allowed_hostnames_t *allowed) {
+void accept_resolver_conn(ziti_connection conn, uv_loop_t *loop, allowed_hostnames_t *allowed, const char *dns_format) {
     uv_once(&init, do_init);
     dns_host_conn_t *dns = calloc(1, sizeof(dns_host_conn_t));
-    if (res_ninit(&dns->resolver) == 0) {
-        ziti_conn_set_data(conn, dns);
-        struct allowed_hostname_s *ah;
-        LIST_FOREACH(ah, allowed, _next) {
-            if (ah->domain_name[0] == '*' && ah->domain_name[1] == '.') {
-                struct allowed_hostname_s *allowed_domain = calloc(1, sizeof(struct allowed_hostname_s));
-                allowed_domain->domain_name = strdup(ah->domain_name + 2); // skip *.
-                LIST_INSERT_HEAD(&dns->allowed_domains, allowed_domain, _next);
-            }
+    dns->conn = conn;
+    dns->loop = loop;
+    dns->wire = DNS_WIRE_SUPPORTED && dns_format != NULL && strcmp(dns_format, DNS_PROXY_FORMAT_WIRE) == 0;
+    LIST_INIT(&dns->reqs);
+    ziti_conn_set_data(conn, dns);
+    struct allowed_hostname_s *ah;
+    LIST_FOREACH(ah, allowed, _next) {
+        if (ah->domain_name[0] == '*' && ah->domain_name[1] == '.') {
+            struct allowed_hostname_s *allowed_domain = calloc(1, sizeof(struct allowed_hostname_s));
+            allowed_domain->domain_name = strdup(ah->domain_name + 2); // skip *.
+            LIST_INSERT_HEAD(&dns->allowed_domains, allowed_domain, _next);
         }
-        ziti_accept(conn, on_conn_complete, on_dns_req);
-    } else {
-        ziti_close(conn, on_close);
     }
+    ziti_accept(conn, on_conn_complete, on_dns_req);
 }
 
 
@@ -32,6 +32,10 @@
 #define ns_t_mx  DNS_TYPE_MX
 #define ns_t_txt DNS_TYPE_TEXT
 
+#define ns_r_noerror DNS_RCODE_NOERROR
+#define ns_r_formerr DNS_RCODE_FORMERR
+#define ns_r_servfail DNS_RCODE_SERVFAIL
+#define ns_r_nxdomain DNS_RCODE_NXDOMAIN
 #define ns_r_refused DNS_RCODE_REFUSED
 
 typedef struct {
@@ -46,6 +50,7 @@ typedef struct __res_state resolver_t;
 #     define res_ninit(c) res_init()
 #     define res_nclose(c) do{}while(0)
 #     define res_nquery(res, name, c, t, resp, sz) res_query(name, c, t, resp, sz)
+#     define res_nsend(res, msg, len, resp, sz) res_send(msg, len, resp, sz)
 #endif
 
 #endif
@@ -80,6 +85,21 @@ extern "C" {
 #define DNS_FLAG_QR(f) (((f) & 0x8000U) != 0)
 #define DNS_FLAG_RD(f) (((f) & 0x0100U) != 0)
 
+#define DNS_HEADER_LEN 12
+
+// resolver connections can carry raw DNS messages instead of JSON, if `dns_format` in tunneler_app_data asks for it.
+// messages are framed with a 2-byte length prefix (like DNS over TCP), so queries can be pipelined.
+// hosting side acknowledges wire format by sending an empty frame; legacy peers keep using JSON.
+#define DNS_PROXY_FORMAT_WIRE "wire"
+#define DNS_PROXY_MAX_MSG 4096
+
+typedef struct dns_frame_buf_s {
+    uint8_t buf[2 + DNS_PROXY_MAX_MSG];
+    size_t len;
+} dns_frame_buf_t;
+
+typedef void (*dns_frame_cb)(void *ctx, const uint8_t *msg, size_t len);
+
 DECLARE_MODEL(dns_question, DNS_Q_MODEL)
 
 DECLARE_MODEL(dns_answer, DNS_A_MODEL)
@@ -92,6 +112,25 @@ void do_query(const dns_question *q, dns_message *resp, resolver_t *resolver);
 
 int parse_dns_req(dns_message *msg, const unsigned char* buf, size_t buflen);
 
+/** offset of the end of the question section, or 0 if the message is malformed */
+size_t dns_wire_question_end(const uint8_t *msg, size_t len);
+
+#define DNS_T_OPT 41
+
+typedef void (*dns_wire_ttl_cb)(uint8_t *ttl, void *ctx);
+
+/** calls `cb` with the 4-byte TTL field of each record after the question section. returns -1 if the message is malformed */
+int dns_wire_foreach_ttl(uint8_t *msg, size_t len, dns_wire_ttl_cb cb, void *ctx);
+
+/** returns malloc'ed copy of `msg` with length prefix */
+uint8_t *dns_frame_msg(const uint8_t *msg, size_t len, size_t *frame_len);
+
+/**
+ * accumulates `data` in `fb` and invokes `cb` for every complete message (empty frames included).
+ * returns -1 if peer sent a frame larger than DNS_PROXY_MAX_MSG
+ */
+int dns_frame_read(dns_frame_buf_t *fb, const uint8_t *data, size_t len, dns_frame_cb cb, void *ctx);
+
 #ifdef __cplusplus
 }
 #endif
@@ -66,3 +66,87 @@ int parse_dns_req(dns_message *msg, const unsigned char* buf, size_t buflen) {
 
     return 0;
 }
+
+size_t dns_wire_question_end(const uint8_t *msg, size_t len) {
+    if (len < DNS_HEADER_LEN) return 0;
+
+    int qcount = (msg[4] << 8) | msg[5];
+    size_t off = DNS_HEADER_LEN;
+    for (int i = 0; i < qcount; i++) {
+        while (off < len && msg[off] != 0) {
+            if ((msg[off] & 0xc0) != 0) return 0; // queries don't use compression
+            off += msg[off] + 1;
+        }
+        off += 1 + 4; // root label, type, class
+        if (off > len) return 0;
+    }
+    return off;
+}
+
+static size_t skip_wire_name(const uint8_t *msg, size_t len, size_t off) {
+    while (off < len) {
+        uint8_t l = msg[off];
+        if ((l & 0xc0) == 0xc0) { // compression pointer ends the name
+            return off + 2 <= len ? off + 2 : 0;
+        }
+        if ((l & 0xc0) != 0) return 0;
+        off += l + 1;
+        if (l == 0) return off;
+    }
+    return 0;
+}
+
+int dns_wire_foreach_ttl(uint8_t *msg, size_t len, dns_wire_ttl_cb cb, void *ctx) {
+    size_t off = dns_wire_question_end(msg, len);
+    if (off == 0) return -1;
+
+    int rr_count = ((msg[6] << 8) | msg[7]) + ((msg[8] << 8) | msg[9]) + ((msg[10] << 8) | msg[11]);
+    for (int i = 0; i < rr_count; i++) {
+        off = skip_wire_name(msg, len, off);
+        if (off == 0 || off + 10 > len) return -1;
+        int type = (msg[off] << 8) | msg[off + 1];
+        size_t rdlen = (msg[off + 8] << 8) | msg[off + 9];
+        if (type != DNS_T_OPT) { // OPT keeps EDNS flags where the TTL would be
+            cb(msg + off + 4, ctx);
+        }
+        off += 10 + rdlen;
+        if (off > len) return -1;
+    }
+    return 0;
+}
+
+uint8_t *dns_frame_msg(const uint8_t *msg, size_t len, size_t *frame_len) {
+    uint8_t *frame = malloc(len + 2);
+    frame[0] = (uint8_t)(len >> 8);
+    frame[1] = (uint8_t)(len & 0xff);
+    memcpy(frame + 2, msg, len);
+    *frame_len = len + 2;
+    return frame;
+}
+
+int dns_frame_read(dns_frame_buf_t *fb, const uint8_t *data, size_t len, dns_frame_cb cb, void *ctx) {
+    while (len > 0) {
+        size_t n = sizeof(fb->buf) - fb->len;
+        if (n > len) n = len;
+        memcpy(fb->buf + fb->len, data, n);
+        fb->len += n;
+        data += n;
+        len -= n;
+
+        size_t off = 0;
+        while (fb->len - off >= 2) {
+            size_t msg_len = (fb->buf[off] << 8) | fb->buf[off + 1];
+            if (msg_len > DNS_PROXY_MAX_MSG) {
+                fb->len = 0;
+                return -1;
+            }
+            if (fb->len - off < msg_len + 2) break;
+
+            cb(ctx, fb->buf + off + 2, msg_len);
+            off += msg_len + 2;
+        }
+        memmove(fb->buf, fb->buf + off, fb->len - off);
+        fb->len -= off;
+    }
+    return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "ziti/sys/queue.h"
+#include "hairpin.h"
+
+typedef struct hairpin_msg_s {
+    STAILQ_ENTRY(hairpin_msg_s) _next;
+    int from;
+    uint8_t *msg;
+    size_t len;
+    void *req;
+} hairpin_msg_t;
+
+struct hairpin_s {
+    mux_t *ends[2];
+    hairpin_close_cb close_cbs[2];
+    void *ctxs[2];
+    STAILQ_HEAD(hairpin_msgs, hairpin_msg_s) msgs;
+    int queued;
+    bool closed;
+    uv_timer_t timer;
+};
+
+static void on_timer_closed(uv_handle_t *h) {
+    free(h->data);
+}
+
+static void deliver(uv_timer_t *t) {
+    hairpin_t *hp = t->data;
+    // messages that are written while these are delivered wait for the next run, so a busy flow doesn't hold the loop
+    for (int n = hp->queued; n > 0; n--) {
+        hairpin_msg_t *m = STAILQ_FIRST(&hp->msgs);
+        STAILQ_REMOVE_HEAD(&hp->msgs, _next);
+        hp->queued--;
+        mux_t *to = hp->ends[1 - m->from];
+        if (!hp->closed && to != NULL) {
+            mux_on_data(to, m->msg, m->len);
+        }
+        free(m->msg);
+        mux_written(hp->ends[m->from], m->req, hp->closed ? UV_ECANCELED : 0);
+        free(m);
+    }
+
+    if (hp->queued > 0) {
+        uv_timer_start(&hp->timer, deliver, 0, 0);
+    } else if (hp->closed) {
+        uv_close((uv_handle_t *) &hp->timer, on_timer_closed);
+    }
+}
+
+hairpin_t *hairpin_new(uv_loop_t *loop) {
+    hairpin_t *hp = calloc(1, sizeof(hairpin_t));
+    STAILQ_INIT(&hp->msgs);
+    uv_timer_init(loop, &hp->timer);
+    hp->timer.data = hp;
+    uv_unref((uv_handle_t *) &hp->timer);
+    return hp;
+}
+
+void hairpin_attach(hairpin_t *hp, int end, mux_t *mux, hairpin_close_cb close_cb, void *ctx) {
+    hp->ends[end] = mux;
+    hp->close_cbs[end] = close_cb;
+    hp->ctxs[end] = ctx;
+}
+
+int hairpin_write(hairpin_t *hp, int end, uint8_t *msg, size_t len, void *req) {
+    if (hp->closed) {
+        free(msg);
+        return UV_EPIPE;
+    }
+    hairpin_msg_t *m = malloc(sizeof(hairpin_msg_t));
+    m->from = end;
+    m->msg = msg;
+    m->len = len;
+    m->req = req;
+    STAILQ_INSERT_TAIL(&hp->msgs, m, _next);
+    hp->queued++;
+    if (!uv_is_active((uv_handle_t *) &hp->timer)) {
+        uv_timer_start(&hp->timer, deliver, 0, 0);
+    }
+    return 0;
+}
+
+void hairpin_close(hairpin_t *hp, int err) {
+    if (hp->closed) {
+        return;
+    }
+    hp->closed = true;
+    for (int i = 0; i < 2; i++) {
+        if (hp->ends[i] != NULL) {
+            mux_close(hp->ends[i], err);
+        }
+        if (hp->close_cbs[i] != NULL) {
+            hp->close_cbs[i](hp->ctxs[i]);
+        }
+    }
+    // the messages in flight are cancelled from the timer, then the hairpin is freed
+    uv_timer_start(&hp->timer, deliver, 0, 0);
+}
@@ -0,0 +1,56 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_HAIRPIN_H
+#define ZITI_TUNNELER_SDK_HAIRPIN_H
+
+#include <uv.h>
+#include "mux.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a tunneler that intercepts a service it hosts itself can carry the flows as mux streams to its own hosting side,
+// instead of through the fabric. the two muxes are connected by a hairpin
+#define HAIRPIN_INTERCEPT 0
+#define HAIRPIN_HOST 1
+
+/** two muxes back to back in this process. see mux.h */
+typedef struct hairpin_s hairpin_t;
+
+hairpin_t *hairpin_new(uv_loop_t *loop);
+
+/** called by hairpin_close() after the end's mux is closed */
+typedef void (*hairpin_close_cb)(void *ctx);
+
+/** `mux` gets what the other end writes. `end` is HAIRPIN_INTERCEPT or HAIRPIN_HOST. `close_cb` may be NULL */
+void hairpin_attach(hairpin_t *hp, int end, mux_t *mux, hairpin_close_cb close_cb, void *ctx);
+
+/**
+ * for the mux_write_fn of `end`. `msg` is delivered to the other end from the loop, never from inside the write,
+ * and mux_written() is called once it is.
+ */
+int hairpin_write(hairpin_t *hp, int end, uint8_t *msg, size_t len, void *req);
+
+/** closes both muxes with `err`. messages that weren't delivered yet are cancelled, and the hairpin is freed */
+void hairpin_close(hairpin_t *hp, int err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_HAIRPIN_H
@@ -0,0 +1,790 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#if _WIN32
+#include <ws2tcpip.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ziti/ziti_log.h>
+#include <ziti/model_collections.h>
+#include "ziti/ziti_tunnel.h"
+#include "host_dial.h"
+
+#if _WIN32
+#define sock_errno() WSAGetLastError()
+#define sock_close(s) closesocket(s)
+#define CONNECT_IN_PROGRESS(e) ((e) == WSAEWOULDBLOCK)
+#define INVALID_SOCK INVALID_SOCKET
+#else
+#define sock_errno() errno
+#define sock_close(s) close(s)
+#define CONNECT_IN_PROGRESS(e) ((e) == EINPROGRESS)
+#define INVALID_SOCK (-1)
+#endif
+
+struct host_dial_ctx_s {
+    uv_loop_t *loop;
+    int refs;
+    model_map resolve_cache; // map[host:port:socktype -> resolve_entry_t]
+    model_map dead_addrs;    // map[ip:port -> dead_addr_t]
+    host_lb_policy_e policy;
+    uint32_t rr_next;
+    model_map backends;      // map[ip:port -> backend_stats_t]
+};
+
+typedef struct resolve_waiter_s {
+    host_resolve_cb cb;
+    void *ctx;
+    LIST_ENTRY(resolve_waiter_s) _next;
+} resolve_waiter_t;
+
+typedef struct resolve_entry_s {
+    host_dial_ctx_t *hd;
+    uv_getaddrinfo_t req;
+    bool resolving;
+    uint64_t expires;
+    int status;
+    int count;
+    struct sockaddr_storage addrs[HOST_DIAL_MAX_ADDRS];
+    LIST_HEAD(resolve_waiters, resolve_waiter_s) waiters;
+} resolve_entry_t;
+
+typedef struct dead_addr_s {
+    uint64_t until;
+    uint32_t failures; // consecutive
+    bool probing;      // the breaker is half open, and the one connection it lets through is in progress
+} dead_addr_t;
+
+typedef struct backend_stats_s {
+    int active;
+    uint64_t connect_nanos; // moving average
+} backend_stats_t;
+
+struct host_dial_s;
+
+typedef struct dial_attempt_s {
+    uv_poll_t poll;
+    uv_os_sock_t sock;
+    bool close_sock; // socket is closed after the poll handle, unless it was handed to the caller
+    uint64_t started;
+    struct host_dial_s *dial;
+    int idx;
+} dial_attempt_t;
+
+typedef struct host_dial_s {
+    host_dial_ctx_t *hd;
+    host_dial_cb cb;
+    void *ctx;
+
+    uv_timer_t timer;
+    uv_timer_t timeout;
+    bool has_src;
+    bool sequential; // attempts can't share the source port
+    struct sockaddr_storage src;
+
+    int count;
+    int next;
+    int pending;
+    int open_handles;
+    int last_err;
+    bool completed;
+    struct sockaddr_storage addrs[HOST_DIAL_MAX_ADDRS];
+    dial_attempt_t attempts[HOST_DIAL_MAX_ADDRS];
+} host_dial_t;
+
+static socklen_t addr_len(const struct sockaddr *addr) {
+    return addr->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+void host_dial_addr_str(const struct sockaddr *addr, char *buf, size_t len) {
+    char ip[INET6_ADDRSTRLEN] = "";
+    if (addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *) addr;
+        uv_ip6_name(in6, ip, sizeof(ip));
+        snprintf(buf, len, "[%s]:%d", ip, ntohs(in6->sin6_port));
+    } else {
+        const struct sockaddr_in *in4 = (const struct sockaddr_in *) addr;
+        uv_ip4_name(in4, ip, sizeof(ip));
+        snprintf(buf, len, "%s:%d", ip, ntohs(in4->sin_port));
+    }
+}
+
+host_dial_ctx_t *host_dial_ctx_new(uv_loop_t *loop) {
+    host_dial_ctx_t *hd = calloc(1, sizeof(host_dial_ctx_t));
+    hd->loop = loop;
+    hd->refs = 1;
+    return hd;
+}
+
+static void host_dial_ctx_unref(host_dial_ctx_t *hd) {
+    if (--hd->refs > 0) {
+        return;
+    }
+    // nothing is in flight at this point
+    model_map_clear(&hd->resolve_cache, free);
+    model_map_clear(&hd->dead_addrs, free);
+    model_map_clear(&hd->backends, free);
+    free(hd);
+}
+
+void host_dial_ctx_release(host_dial_ctx_t *hd) {
+    if (hd != NULL) {
+        host_dial_ctx_unref(hd);
+    }
+}
+
+/********** dead addresses **********/
+
+static dead_addr_t *get_dead(host_dial_ctx_t *hd, const struct sockaddr *addr) {
+    if (model_map_size(&hd->dead_addrs) == 0) return NULL;
+
+    char key[INET6_ADDRSTRLEN + 8];
+    host_dial_addr_str(addr, key, sizeof(key));
+    return model_map_get(&hd->dead_addrs, key);
+}
+
+static bool is_backing_off(host_dial_ctx_t *hd, const struct sockaddr *addr) {
+    dead_addr_t *dead = get_dead(hd, addr);
+    return dead != NULL && dead->until > uv_now(hd->loop);
+}
+
+/** true if the address is out of rotation: backing off after too many failures, or being probed */
+static bool circuit_open(host_dial_ctx_t *hd, const struct sockaddr *addr) {
+    dead_addr_t *dead = get_dead(hd, addr);
+    if (dead == NULL || dead->failures < HOST_BREAKER_FAILURES) {
+        return false;
+    }
+    return dead->probing || dead->until > uv_now(hd->loop);
+}
+
+static void release_probe(host_dial_ctx_t *hd, const struct sockaddr *addr) {
+    dead_addr_t *dead = get_dead(hd, addr);
+    if (dead != NULL) {
+        dead->probing = false;
+    }
+}
+
+static void mark_dead(host_dial_ctx_t *hd, const struct sockaddr *addr, int err) {
+    char key[INET6_ADDRSTRLEN + 8];
+    host_dial_addr_str(addr, key, sizeof(key));
+    dead_addr_t *dead = model_map_get(&hd->dead_addrs, key);
+    if (dead == NULL) {
+        dead = calloc(1, sizeof(dead_addr_t));
+        model_map_set(&hd->dead_addrs, key, dead);
+    }
+    dead->failures++;
+    dead->probing = false;
+    uint64_t backoff = HOST_DIAL_BACKOFF_MAX_MILLIS;
+    if (dead->failures < 16) {
+        backoff = (uint64_t) HOST_DIAL_BACKOFF_MIN_MILLIS << (dead->failures - 1);
+        if (backoff > HOST_DIAL_BACKOFF_MAX_MILLIS) backoff = HOST_DIAL_BACKOFF_MAX_MILLIS;
+    }
+    dead->until = uv_now(hd->loop) + backoff;
+    if (dead->failures >= HOST_BREAKER_FAILURES) {
+        ZITI_LOG(WARN, "connect to %s failed: %s. circuit breaker is open for %" PRIu64 "s after %u failures",
+                 key, uv_strerror(err), backoff / 1000, dead->failures);
+    } else {
+        ZITI_LOG(DEBUG, "connect to %s failed: %s. trying other addresses first for %" PRIu64 "s",
+                 key, uv_strerror(err), backoff / 1000);
+    }
+}
+
+static void clear_dead(host_dial_ctx_t *hd, const struct sockaddr *addr) {
+    if (model_map_size(&hd->dead_addrs) == 0) return;
+
+    char key[INET6_ADDRSTRLEN + 8];
+    host_dial_addr_str(addr, key, sizeof(key));
+    dead_addr_t *dead = model_map_remove(&hd->dead_addrs, key);
+    if (dead != NULL && dead->failures >= HOST_BREAKER_FAILURES) {
+        ZITI_LOG(INFO, "circuit breaker for %s is closed", key);
+    }
+    free(dead);
+}
+
+/********** load balancing **********/
+
+void host_dial_set_policy(host_dial_ctx_t *hd, host_lb_policy_e policy) {
+    hd->policy = policy;
+}
+
+static backend_stats_t *get_backend(host_dial_ctx_t *hd, const struct sockaddr *addr, bool create) {
+    char key[INET6_ADDRSTRLEN + 8];
+    host_dial_addr_str(addr, key, sizeof(key));
+    backend_stats_t *b = model_map_get(&hd->backends, key);
+    if (b == NULL && create) {
+        if (model_map_size(&hd->backends) >= HOST_DIAL_MAX_BACKENDS) {
+            // forget idle backends
+            model_map_iter it = model_map_iterator(&hd->backends);
+            while (it != NULL) {
+                backend_stats_t *e = model_map_it_value(it);
+                if (e->active == 0) {
+                    free(e);
+                    it = model_map_it_remove(it);
+                } else {
+                    it = model_map_it_next(it);
+                }
+            }
+        }
+        b = calloc(1, sizeof(backend_stats_t));
+        model_map_set(&hd->backends, key, b);
+    }
+    return b;
+}
+
+void host_dial_conn_opened(host_dial_ctx_t *hd, const struct sockaddr *addr) {
+    get_backend(hd, addr, true)->active++;
+}
+
+void host_dial_conn_closed(host_dial_ctx_t *hd, const struct sockaddr *addr) {
+    backend_stats_t *b = get_backend(hd, addr, false);
+    if (b != NULL && b->active > 0) {
+        b->active--;
+    }
+}
+
+static void record_latency(host_dial_ctx_t *hd, const struct sockaddr *addr, uint64_t nanos) {
+    backend_stats_t *b = get_backend(hd, addr, true);
+    b->connect_nanos = b->connect_nanos == 0 ? nanos : (3 * b->connect_nanos + nanos) / 4;
+}
+
+static uint64_t backend_active(host_dial_ctx_t *hd, const struct sockaddr_storage *addr) {
+    backend_stats_t *b = get_backend(hd, (const struct sockaddr *) addr, false);
+    return b ? b->active : 0;
+}
+
+static uint64_t backend_latency(host_dial_ctx_t *hd, const struct sockaddr_storage *addr) {
+    backend_stats_t *b = get_backend(hd, (const struct sockaddr *) addr, false);
+    return b ? b->connect_nanos : 0;
+}
+
+static void sort_by(host_dial_ctx_t *hd, const struct sockaddr_storage *addrs, int *order, int count,
+                    uint64_t (*score)(host_dial_ctx_t *, const struct sockaddr_storage *)) {
+    uint64_t scores[HOST_DIAL_MAX_ADDRS];
+    for (int i = 0; i < count; i++) {
+        scores[i] = score(hd, &addrs[order[i]]);
+    }
+    // stable, so ties keep their round-robin order
+    for (int i = 1; i < count; i++) {
+        int idx = order[i];
+        uint64_t sc = scores[i];
+        int j = i - 1;
+        for (; j >= 0 && scores[j] > sc; j--) {
+            order[j + 1] = order[j];
+            scores[j + 1] = scores[j];
+        }
+        order[j + 1] = idx;
+        scores[j + 1] = sc;
+    }
+}
+
+/** pick the first address with probability inversely proportional to its connect latency */
+static void pick_by_latency(host_dial_ctx_t *hd, const struct sockaddr_storage *addrs, int *order, int count) {
+    sort_by(hd, addrs, order, count, backend_latency);
+
+    // addresses without samples yet get the same share as the fastest one
+    uint64_t fastest = 0;
+    for (int i = 0; i < count && fastest == 0; i++) {
+        fastest = backend_latency(hd, &addrs[order[i]]);
+    }
+    double weights[HOST_DIAL_MAX_ADDRS];
+    double total = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t lat = backend_latency(hd, &addrs[order[i]]);
+        weights[i] = 1.0 / (double) (lat ? lat : (fastest ? fastest : 1));
+        total += weights[i];
+    }
+
+    double r = total * ((double) rand() / ((double) RAND_MAX + 1));
+    int pick = 0;
+    while (pick < count - 1 && r >= weights[pick]) {
+        r -= weights[pick++];
+    }
+    int idx = order[pick];
+    memmove(&order[1], &order[0], pick * sizeof(order[0]));
+    order[0] = idx;
+}
+
+/** indexes of `addrs` in the order the load balancing policy prefers them */
+static int apply_policy(host_dial_ctx_t *hd, const struct sockaddr_storage *addrs, int count, int *order) {
+    if (count > HOST_DIAL_MAX_ADDRS) count = HOST_DIAL_MAX_ADDRS;
+
+    int start = 0;
+    if (hd->policy != HOST_LB_ORDERED && count > 1) {
+        start = (int) (hd->rr_next++ % (uint32_t) count);
+    }
+    for (int i = 0; i < count; i++) {
+        order[i] = (start + i) % count;
+    }
+
+    switch (hd->policy) {
+        case HOST_LB_LEAST_CONN:
+            sort_by(hd, addrs, order, count, backend_active);
+            break;
+        case HOST_LB_LATENCY:
+            pick_by_latency(hd, addrs, order, count);
+            break;
+        default:
+            break;
+    }
+    return count;
+}
+
+const struct sockaddr_storage *host_dial_pick(host_dial_ctx_t *hd, const struct sockaddr_storage *addrs, int count) {
+    int order[HOST_DIAL_MAX_ADDRS];
+    const struct sockaddr_storage *fallback = NULL;
+    count = apply_policy(hd, addrs, count, order);
+    for (int i = 0; i < count; i++) {
+        const struct sockaddr *addr = (const struct sockaddr *) &addrs[order[i]];
+        if (circuit_open(hd, addr)) {
+            continue;
+        }
+        if (!is_backing_off(hd, addr)) {
+            return &addrs[order[i]];
+        }
+        if (fallback == NULL) {
+            fallback = &addrs[order[i]];
+        }
+    }
+    return fallback;
+}
+
+/********** resolution **********/
+
+static void on_resolved(uv_getaddrinfo_t *req, int status, struct addrinfo *res) {
+    resolve_entry_t *e = req->data;
+    host_dial_ctx_t *hd = e->hd;
+
+    e->resolving = false;
+    e->status = status;
+    e->count = 0;
+    if (status == 0) {
+        for (struct addrinfo *ai = res; ai != NULL && e->count < HOST_DIAL_MAX_ADDRS; ai = ai->ai_next) {
+            if (ai->ai_addrlen <= sizeof(e->addrs[0])) {
+                memcpy(&e->addrs[e->count++], ai->ai_addr, ai->ai_addrlen);
+            }
+        }
+        uv_freeaddrinfo(res);
+    }
+    // don't remember cancellation
+    e->expires = status == UV_ECANCELED ? 0 :
+                 uv_now(hd->loop) + (status == 0 ? HOST_RESOLVE_TTL_MILLIS : HOST_RESOLVE_NEG_TTL_MILLIS);
+
+    while (!LIST_EMPTY(&e->waiters)) {
+        resolve_waiter_t *w = LIST_FIRST(&e->waiters);
+        LIST_REMOVE(w, _next);
+        w->cb(w->ctx, status, e->addrs, e->count);
+        free(w);
+    }
+    host_dial_ctx_unref(hd);
+}
+
+/** make room in the cache. entries that are being resolved are never evicted */
+static void evict_resolved(host_dial_ctx_t *hd) {
+    uint64_t now = uv_now(hd->loop);
+    model_map_iter it = model_map_iterator(&hd->resolve_cache);
+    while (it != NULL) {
+        resolve_entry_t *e = model_map_it_value(it);
+        if (!e->resolving && e->expires <= now) {
+            free(e);
+            it = model_map_it_remove(it);
+        } else {
+            it = model_map_it_next(it);
+        }
+    }
+
+    it = model_map_iterator(&hd->resolve_cache);
+    while (it != NULL && model_map_size(&hd->resolve_cache) >= HOST_RESOLVE_CACHE_MAX) {
+        resolve_entry_t *e = model_map_it_value(it);
+        if (!e->resolving) {
+            free(e);
+            it = model_map_it_remove(it);
+        } else {
+            it = model_map_it_next(it);
+        }
+    }
+}
+
+int host_dial_parse_addr(const char *host, const char *port, struct sockaddr_storage *addr) {
+    long p = 0;
+    if (port != NULL && *port != '\0') {
+        char *end;
+        p = strtol(port, &end, 10);
+        if (*end != '\0' || p < 0 || p > 65535) {
+            return UV_EINVAL;
+        }
+    }
+    if (uv_ip4_addr(host, (int) p, (struct sockaddr_in *) addr) == 0) {
+        return 0;
+    }
+    return uv_ip6_addr(host, (int) p, (struct sockaddr_in6 *) addr);
+}
+
+int host_resolve(host_dial_ctx_t *hd, const char *host, const char *port, int socktype, bool numeric,
+                 host_resolve_cb cb, void *ctx) {
+    if (numeric) {
+        struct sockaddr_storage addr = {0};
+        int rc = host_dial_parse_addr(host, port, &addr);
+        if (rc == 0) {
+            cb(ctx, 0, &addr, 1);
+            return 0;
+        }
+        // let getaddrinfo deal with it
+    }
+
+    char key[512];
+    snprintf(key, sizeof(key), "%s:%s:%d", host, port, socktype);
+
+    resolve_entry_t *e = model_map_get(&hd->resolve_cache, key);
+    if (e != NULL && !e->resolving) {
+        if (e->expires > uv_now(hd->loop)) {
+            cb(ctx, e->status, e->addrs, e->count);
+            return 0;
+        }
+        free(model_map_remove(&hd->resolve_cache, key));
+        e = NULL;
+    }
+
+    if (e == NULL) {
+        e = calloc(1, sizeof(resolve_entry_t));
+        e->hd = hd;
+        e->req.data = e;
+        struct addrinfo hints = {0};
+        hints.ai_socktype = socktype;
+        hints.ai_flags = AI_NUMERICSERV;
+        if (numeric) hints.ai_flags |= AI_NUMERICHOST;
+        int rc = uv_getaddrinfo(hd->loop, &e->req, on_resolved, host, port, &hints);
+        if (rc != 0) {
+            free(e);
+            return rc;
+        }
+        e->resolving = true;
+        hd->refs++;
+
+        if (model_map_size(&hd->resolve_cache) >= HOST_RESOLVE_CACHE_MAX) {
+            evict_resolved(hd);
+        }
+        model_map_set(&hd->resolve_cache, key, e);
+    } else {
+        ZITI_LOG(TRACE, "joining in-flight lookup of %s", key);
+    }
+
+    resolve_waiter_t *w = calloc(1, sizeof(resolve_waiter_t));
+    w->cb = cb;
+    w->ctx = ctx;
+    LIST_INSERT_HEAD(&e->waiters, w, _next);
+    return 0;
+}
+
+/********** connect **********/
+
+static void start_next_attempt(host_dial_t *d);
+
+static void dial_handle_closed(host_dial_t *d) {
+    if (--d->open_handles == 0) {
+        host_dial_ctx_unref(d->hd);
+        free(d);
+    }
+}
+
+static void on_attempt_close(uv_handle_t *h) {
+    dial_attempt_t *att = h->data;
+    if (att->close_sock) {
+        sock_close(att->sock);
+    }
+    dial_handle_closed(att->dial);
+}
+
+static void on_timer_close(uv_handle_t *h) {
+    dial_handle_closed(h->data);
+}
+
+static void close_attempt(dial_attempt_t *att, bool close_sock) {
+    att->close_sock = close_sock;
+    att->dial->pending--;
+    uv_close((uv_handle_t *) &att->poll, on_attempt_close);
+}
+
+static void complete_dial(host_dial_t *d, dial_attempt_t *winner) {
+    d->completed = true;
+    uv_timer_stop(&d->timer);
+    uv_close((uv_handle_t *) &d->timer, on_timer_close);
+    uv_timer_stop(&d->timeout);
+    uv_close((uv_handle_t *) &d->timeout, on_timer_close);
+
+    // cancel the attempts that are still racing
+    for (int i = 0; i < d->next; i++) {
+        dial_attempt_t *att = &d->attempts[i];
+        if (att != winner && att->dial != NULL && !uv_is_closing((uv_handle_t *) &att->poll)) {
+            release_probe(d->hd, (struct sockaddr *) &d->addrs[i]);
+            close_attempt(att, true);
+        }
+    }
+
+    if (winner) {
+        d->cb(winner->sock, 0, (struct sockaddr *) &d->addrs[winner->idx], d->ctx);
+    } else {
+        d->cb(INVALID_SOCK, d->last_err ? d->last_err : UV_ECONNREFUSED, NULL, d->ctx);
+    }
+}
+
+static void on_attempt_writable(uv_poll_t *p, int status, int events) {
+    dial_attempt_t *att = p->data;
+    host_dial_t *d = att->dial;
+    const struct sockaddr *addr = (struct sockaddr *) &d->addrs[att->idx];
+
+    // libuv reports POLLERR as UV_EBADF, the actual connect error is in SO_ERROR
+    int so_err = 0;
+    socklen_t len = sizeof(so_err);
+    if (getsockopt(att->sock, SOL_SOCKET, SO_ERROR, (char *) &so_err, &len) != 0) {
+        so_err = sock_errno();
+    }
+    int err = so_err ? uv_translate_sys_error(so_err) : status;
+
+    if (err == 0) {
+        uint64_t elapsed = uv_hrtime() - att->started;
+        record_latency(d->hd, addr, elapsed);
+        if (elapsed / 1000000 > HOST_BREAKER_SLOW_MILLIS) {
+            char key[INET6_ADDRSTRLEN + 8];
+            host_dial_addr_str(addr, key, sizeof(key));
+            ZITI_LOG(DEBUG, "connect to %s took %" PRIu64 "ms", key, elapsed / 1000000);
+            mark_dead(d->hd, addr, UV_ETIMEDOUT);
+        } else {
+            clear_dead(d->hd, addr);
+        }
+        close_attempt(att, false);
+        complete_dial(d, att);
+        return;
+    }
+
+    mark_dead(d->hd, addr, err);
+    d->last_err = err;
+    close_attempt(att, true);
+    // don't wait for the attempt delay, failure is a signal to move on
+    uv_timer_stop(&d->timer);
+    start_next_attempt(d);
+}
+
+static void on_attempt_delay(uv_timer_t *t) {
+    start_next_attempt(t->data);
+}
+
+static void on_dial_timeout(uv_timer_t *t) {
+    host_dial_t *d = t->data;
+    for (int i = 0; i < d->next; i++) {
+        dial_attempt_t *att = &d->attempts[i];
+        if (att->dial != NULL && !uv_is_closing((uv_handle_t *) &att->poll)) {
+            mark_dead(d->hd, (struct sockaddr *) &d->addrs[i], UV_ETIMEDOUT);
+        }
+    }
+    d->last_err = UV_ETIMEDOUT;
+    complete_dial(d, NULL);
+}
+
+static int set_nonblocking(uv_os_sock_t s) {
+#if _WIN32
+    u_long on = 1;
+    return ioctlsocket(s, FIONBIO, &on);
+#else
+    fcntl(s, F_SETFD, FD_CLOEXEC);
+    int flags = fcntl(s, F_GETFL);
+    return flags < 0 ? -1 : fcntl(s, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
+static int start_attempt(host_dial_t *d, int idx) {
+    const struct sockaddr *addr = (struct sockaddr *) &d->addrs[idx];
+    // another connection may have started probing since the addresses were ordered
+    if (circuit_open(d->hd, addr)) {
+        return HOST_DIAL_ECIRCUIT;
+    }
+
+    uv_os_sock_t s = socket(addr->sa_family, SOCK_STREAM, IPPROTO_TCP);
+    if (s == INVALID_SOCK) {
+        return uv_translate_sys_error(sock_errno());
+    }
+
+    int err = 0;
+    if (set_nonblocking(s) != 0) {
+        err = sock_errno();
+    } else if (d->has_src && bind(s, (struct sockaddr *) &d->src, addr_len((struct sockaddr *) &d->src)) != 0) {
+        err = sock_errno();
+    } else if (connect(s, addr, addr_len(addr)) != 0 && !CONNECT_IN_PROGRESS(sock_errno())) {
+        err = sock_errno();
+        mark_dead(d->hd, addr, uv_translate_sys_error(err));
+    }
+    if (err != 0) {
+        sock_close(s);
+        return uv_translate_sys_error(err);
+    }
+
+    dial_attempt_t *att = &d->attempts[idx];
+    int rc = uv_poll_init_socket(d->hd->loop, &att->poll, s);
+    if (rc != 0) {
+        sock_close(s);
+        return rc;
+    }
+    att->sock = s;
+    att->dial = d;
+    att->idx = idx;
+    att->started = uv_hrtime();
+    dead_addr_t *dead = get_dead(d->hd, addr);
+    if (dead != NULL && dead->failures >= HOST_BREAKER_FAILURES) {
+        dead->probing = true;
+    }
+    att->poll.data = att;
+    d->open_handles++;
+    d->pending++;
+    uv_poll_start(&att->poll, UV_WRITABLE, on_attempt_writable);
+    return 0;
+}
+
+static void start_next_attempt(host_dial_t *d) {
+    while (d->next < d->count) {
+        int idx = d->next++;
+        int rc = start_attempt(d, idx);
+        if (rc == 0) {
+            if (!d->sequential && d->next < d->count) {
+                uv_timer_start(&d->timer, on_attempt_delay, HOST_DIAL_ATTEMPT_DELAY_MILLIS, 0);
+            }
+            return;
+        }
+        d->last_err = rc;
+    }
+
+    if (d->pending == 0) {
+        complete_dial(d, NULL);
+    }
+}
+
+/**
+ * order addresses for connection attempts: interleave address families, starting with the family of the
+ * address the policy prefers (RFC 8305 section 4). addresses that are backing off go last, addresses with an
+ * open circuit breaker are left out.
+ */
+static int order_addrs(host_dial_ctx_t *hd, const struct sockaddr_storage *unordered, int count,
+                       struct sockaddr_storage *out) {
+    int n = 0;
+    bool used[HOST_DIAL_MAX_ADDRS] = {0};
+    int order[HOST_DIAL_MAX_ADDRS];
+    count = apply_policy(hd, unordered, count, order);
+    struct sockaddr_storage addrs[HOST_DIAL_MAX_ADDRS];
+    bool skip[HOST_DIAL_MAX_ADDRS];
+    for (int i = 0; i < count; i++) {
+        addrs[i] = unordered[order[i]];
+        skip[i] = circuit_open(hd, (struct sockaddr *) &addrs[i]);
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        bool dead = pass == 1;
+        int family = -1;
+        for (;;) {
+            int found = -1;
+            // prefer the other family, then whatever is left
+            for (int i = 0; i < count && found < 0; i++) {
+                if (!used[i] && !skip[i] && addrs[i].ss_family != family &&
+                    is_backing_off(hd, (struct sockaddr *) &addrs[i]) == dead) {
+                    found = i;
+                }
+            }
+            for (int i = 0; i < count && found < 0; i++) {
+                if (!used[i] && !skip[i] && is_backing_off(hd, (struct sockaddr *) &addrs[i]) == dead) {
+                    found = i;
+                }
+            }
+            if (found < 0) break;
+
+            used[found] = true;
+            family = addrs[found].ss_family;
+            out[n++] = addrs[found];
+        }
+    }
+    return n;
+}
+
+int host_dial_connect(host_dial_ctx_t *hd, const struct sockaddr_storage *addrs, int count, const struct sockaddr *src,
+                      host_dial_cb cb, void *ctx) {
+    if (count <= 0) {
+        return UV_EINVAL;
+    }
+
+    struct sockaddr_storage ordered[HOST_DIAL_MAX_ADDRS];
+    int n = order_addrs(hd, addrs, count, ordered);
+    if (n == 0) {
+        return HOST_DIAL_ECIRCUIT;
+    }
+
+    host_dial_t *d = calloc(1, sizeof(host_dial_t));
+    d->hd = hd;
+    d->cb = cb;
+    d->ctx = ctx;
+    d->count = n;
+    memcpy(d->addrs, ordered, n * sizeof(ordered[0]));
+    if (src) {
+        d->has_src = true;
+        memcpy(&d->src, src, addr_len(src));
+        d->sequential = ((struct sockaddr_in *) src)->sin_port != 0; // same offset for both families
+    }
+
+    uv_timer_init(hd->loop, &d->timer);
+    d->timer.data = d;
+    uv_timer_init(hd->loop, &d->timeout);
+    d->timeout.data = d;
+    uv_timer_start(&d->timeout, on_dial_timeout, HOST_DIAL_TIMEOUT_MILLIS, 0);
+    d->open_handles = 2;
+    hd->refs++;
+
+    start_next_attempt(d);
+    return 0;
+}
+
+static double moving_avg(double avg, uint64_t count, double v) {
+    return count == 0 ? v : (3 * avg + v) / 4;
+}
+
+void host_setup_latency_add(host_setup_latency_t *latency, double resolve_ms, double connect_ms, double accept_ms,
+                            double total_ms) {
+    latency->resolve_millis = moving_avg(latency->resolve_millis, latency->count, resolve_ms);
+    latency->connect_millis = moving_avg(latency->connect_millis, latency->count, connect_ms);
+    latency->accept_millis = moving_avg(latency->accept_millis, latency->count, accept_ms);
+    latency->total_millis = moving_avg(latency->total_millis, latency->count, total_ms);
+    if (total_ms > latency->max_total_millis) {
+        latency->max_total_millis = total_ms;
+    }
+    latency->count++;
+}
+
+int host_load_cost(const host_load_t *load, int base_cost, int64_t max_cost) {
+    double failure_pct = load->attempts > 0 ? 100.0 * load->failures / load->attempts : 0;
+    double cost = base_cost + load->active * HOST_COST_PER_ACTIVE_CONN +
+                  load->connect_millis * HOST_COST_PER_CONNECT_MILLI + failure_pct * HOST_COST_PER_FAILURE_PCT;
+    int64_t max = max_cost > 0 && max_cost < HOST_COST_MAX ? max_cost : HOST_COST_MAX;
+    return cost > (double) max ? (int) max : (int) cost;
+}
+
+bool host_cost_changed(int advertised, int cost) {
+    int threshold = advertised * HOST_COST_MIN_CHANGE_PCT / 100;
+    if (threshold < HOST_COST_MIN_CHANGE) threshold = HOST_COST_MIN_CHANGE;
+    return abs(cost - advertised) >= threshold;
+}
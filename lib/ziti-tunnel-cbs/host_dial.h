@@ -0,0 +1,158 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_HOST_DIAL_H
+#define ZITI_TUNNELER_SDK_HOST_DIAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HOST_RESOLVE_TTL_MILLIS (30 * 1000)
+#define HOST_RESOLVE_NEG_TTL_MILLIS (5 * 1000)
+#define HOST_RESOLVE_CACHE_MAX 256 // per hosted service
+#define HOST_DIAL_MAX_ADDRS 16
+// RFC 8305 "Connection Attempt Delay"
+#define HOST_DIAL_ATTEMPT_DELAY_MILLIS 250
+// addresses that failed to connect are tried last for this long. doubles with every consecutive failure
+#define HOST_DIAL_BACKOFF_MIN_MILLIS (5 * 1000)
+#define HOST_DIAL_BACKOFF_MAX_MILLIS (5 * 60 * 1000)
+#define HOST_DIAL_MAX_BACKENDS 256 // tracked backend addresses, per hosted service
+// give up on a connect that didn't complete in this time, instead of waiting for the OS
+#define HOST_DIAL_TIMEOUT_MILLIS (10 * 1000)
+
+// circuit breaker: an address is taken out of rotation after this many consecutive failures. once its backoff
+// expires a single connection is let through, and its result decides whether the address is back.
+#define HOST_BREAKER_FAILURES 3
+// a connect this slow counts as a failure for the breaker, even though the connection is used
+#define HOST_BREAKER_SLOW_MILLIS 3000
+// returned when every address has an open circuit breaker
+#define HOST_DIAL_ECIRCUIT UV_EHOSTDOWN
+
+// dynamic terminator cost
+#define HOST_COST_MAX 65535
+#define HOST_COST_PER_ACTIVE_CONN 10
+#define HOST_COST_PER_CONNECT_MILLI 1
+#define HOST_COST_PER_FAILURE_PCT 20
+// hysteresis: the advertised cost only changes if the new one differs by at least this much
+#define HOST_COST_MIN_CHANGE 50
+#define HOST_COST_MIN_CHANGE_PCT 20
+
+// observed load of a hosted service, advertised to the fabric as terminator cost
+typedef struct host_load_s {
+    int active;
+    uint32_t attempts;     // connections that ended since the last cost update
+    uint32_t failures;     // connections that ended without being bridged
+    double connect_millis; // moving average
+} host_load_t;
+
+// how long hosted connections took from the incoming dial to being bridged, by phase
+typedef struct host_setup_latency_s {
+    uint64_t count;
+    double resolve_millis; // moving averages
+    double connect_millis;
+    double accept_millis;
+    double total_millis;
+    double max_total_millis;
+} host_setup_latency_t;
+
+/** how connections are spread over the addresses of a destination */
+typedef enum {
+    HOST_LB_ORDERED,     // resolver order. other addresses are only used when the first one fails
+    HOST_LB_ROUND_ROBIN,
+    HOST_LB_LEAST_CONN,  // fewest open connections, see host_dial_conn_opened()
+    HOST_LB_LATENCY      // weighted by observed connect latency
+} host_lb_policy_e;
+
+/**
+ * destination resolution and connect state of a hosted service.
+ * outstanding resolves and dials hold a reference, so the context outlives the service if it has to.
+ */
+typedef struct host_dial_ctx_s host_dial_ctx_t;
+
+/** `addrs` are only valid for the duration of the callback */
+typedef void (*host_resolve_cb)(void *ctx, int status, const struct sockaddr_storage *addrs, int count);
+
+/** `sock` is a connected, non-blocking socket that is owned by the callee. `addr` is the peer address */
+typedef void (*host_dial_cb)(uv_os_sock_t sock, int status, const struct sockaddr *addr, void *ctx);
+
+host_dial_ctx_t *host_dial_ctx_new(uv_loop_t *loop);
+
+void host_dial_ctx_release(host_dial_ctx_t *hd);
+
+void host_dial_set_policy(host_dial_ctx_t *hd, host_lb_policy_e policy);
+
+/** open connections per backend address, for HOST_LB_LEAST_CONN */
+void host_dial_conn_opened(host_dial_ctx_t *hd, const struct sockaddr *addr);
+
+void host_dial_conn_closed(host_dial_ctx_t *hd, const struct sockaddr *addr);
+
+/**
+ * resolve `host`:`port` for the given socket type.
+ * hostnames are resolved on the worker pool, and the results are cached for HOST_RESOLVE_TTL_MILLIS.
+ * concurrent lookups of the same name share one getaddrinfo call.
+ * numeric addresses are parsed in place. `cb` may be called before this function returns.
+ */
+int host_resolve(host_dial_ctx_t *hd, const char *host, const char *port, int socktype, bool numeric,
+                 host_resolve_cb cb, void *ctx);
+
+/**
+ * connect a TCP socket to one of `addrs`, racing attempts as described in RFC 8305.
+ * the first attempt goes to the address that the load balancing policy prefers.
+ * addresses that recently failed are tried after the others, addresses with an open circuit breaker aren't tried.
+ * if `src` is not NULL every attempt is bound to it.
+ * returns HOST_DIAL_ECIRCUIT, without calling `cb`, if no address can be tried.
+ */
+int host_dial_connect(host_dial_ctx_t *hd, const struct sockaddr_storage *addrs, int count, const struct sockaddr *src,
+                      host_dial_cb cb, void *ctx);
+
+/**
+ * returns the preferred address that is not backing off, or the preferred one if all of them are.
+ * returns NULL if every address has an open circuit breaker.
+ */
+const struct sockaddr_storage *host_dial_pick(host_dial_ctx_t *hd, const struct sockaddr_storage *addrs, int count);
+
+/** parse a numeric host and port without touching the resolver. a NULL or empty `port` means 0 */
+int host_dial_parse_addr(const char *host, const char *port, struct sockaddr_storage *addr);
+
+/** format as ip:port, or [ip6]:port */
+void host_dial_addr_str(const struct sockaddr *addr, char *buf, size_t len);
+
+/** add the phases of one connection setup to `latency` */
+void host_setup_latency_add(host_setup_latency_t *latency, double resolve_ms, double connect_ms, double accept_ms,
+                            double total_ms);
+
+/**
+ * terminator cost of `load`, on top of `base_cost`.
+ * capped at `max_cost`, or at HOST_COST_MAX if `max_cost` is not positive or larger than that.
+ */
+int host_load_cost(const host_load_t *load, int base_cost, int64_t max_cost);
+
+/**
+ * whether `cost` is far enough from the `advertised` cost to replace the terminator:
+ * by HOST_COST_MIN_CHANGE_PCT of the advertised cost, and at least HOST_COST_MIN_CHANGE.
+ */
+bool host_cost_changed(int advertised, int cost);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_HOST_DIAL_H
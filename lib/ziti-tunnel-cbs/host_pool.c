@@ -0,0 +1,321 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#if _WIN32
+#include <ws2tcpip.h>
+#else
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ziti/ziti_log.h>
+#include "ziti/ziti_tunnel.h"
+#include "host_pool.h"
+
+#if _WIN32
+#define sock_errno() WSAGetLastError()
+#define sock_close(s) closesocket(s)
+#define WOULD_BLOCK(e) ((e) == WSAEWOULDBLOCK)
+#else
+#define sock_errno() errno
+#define sock_close(s) close(s)
+#define WOULD_BLOCK(e) ((e) == EAGAIN || (e) == EWOULDBLOCK)
+#endif
+
+typedef struct pooled_conn_s {
+    uv_poll_t poll;
+    uv_os_sock_t sock;
+    bool close_sock; // socket is closed after the poll handle, unless it was taken
+    uint64_t since;
+    struct sockaddr_storage peer;
+    struct host_pool_s *pool;
+    TAILQ_ENTRY(pooled_conn_s) _next;
+} pooled_conn_t;
+
+struct host_pool_s {
+    uv_loop_t *loop;
+    host_dial_ctx_t *hd;
+    char *host;
+    char *port;
+    bool numeric;
+    int size;
+    uint64_t max_idle;
+
+    // owner, timer, outstanding connects and idle connections
+    int refs;
+    bool closed;
+    uv_timer_t timer;
+    int dialing;
+    uint32_t failures;
+    uint64_t retry_at;
+
+    int idle_count;
+    TAILQ_HEAD(pooled_conns, pooled_conn_s) idle; // oldest first
+};
+
+static void refill(host_pool_t *pool);
+
+static void pool_unref(host_pool_t *pool) {
+    if (--pool->refs > 0) {
+        return;
+    }
+    free(pool->host);
+    free(pool->port);
+    free(pool);
+}
+
+/** true if the backend closed or reset the connection */
+static bool peer_closed(uv_os_sock_t sock) {
+    char b;
+    int n = (int) recv(sock, &b, 1, MSG_PEEK);
+    if (n >= 0) {
+        return n == 0;
+    }
+    return !WOULD_BLOCK(sock_errno());
+}
+
+static void on_conn_close(uv_handle_t *h) {
+    pooled_conn_t *c = h->data;
+    host_pool_t *pool = c->pool;
+    if (c->close_sock) {
+        sock_close(c->sock);
+    }
+    free(c);
+    pool_unref(pool);
+}
+
+static void remove_conn(pooled_conn_t *c, bool close_sock) {
+    TAILQ_REMOVE(&c->pool->idle, c, _next);
+    c->pool->idle_count--;
+    c->close_sock = close_sock;
+    uv_close((uv_handle_t *) &c->poll, on_conn_close);
+}
+
+static void on_pool_timer(uv_timer_t *t);
+
+/** wake up for the next expiring connection or refill retry, whichever comes first */
+static void schedule(host_pool_t *pool) {
+    if (pool->closed) return;
+
+    uint64_t deadline = UINT64_MAX;
+    if (pool->failures > 0 && pool->dialing == 0) {
+        deadline = pool->retry_at;
+    }
+    pooled_conn_t *oldest = TAILQ_FIRST(&pool->idle);
+    if (oldest != NULL && oldest->since + pool->max_idle < deadline) {
+        deadline = oldest->since + pool->max_idle;
+    }
+
+    if (deadline == UINT64_MAX) {
+        uv_timer_stop(&pool->timer);
+        return;
+    }
+    uint64_t now = uv_now(pool->loop);
+    uv_timer_start(&pool->timer, on_pool_timer, deadline > now ? deadline - now : 0, 0);
+}
+
+static void on_pool_timer(uv_timer_t *t) {
+    host_pool_t *pool = t->data;
+    uint64_t now = uv_now(pool->loop);
+
+    pooled_conn_t *c;
+    while ((c = TAILQ_FIRST(&pool->idle)) != NULL && c->since + pool->max_idle <= now) {
+        remove_conn(c, true);
+    }
+    refill(pool);
+    schedule(pool);
+}
+
+static void on_idle_event(uv_poll_t *p, int status, int events) {
+    pooled_conn_t *c = p->data;
+    host_pool_t *pool = c->pool;
+
+    if (status == 0 && (events & UV_DISCONNECT) == 0 && !peer_closed(c->sock)) {
+        // backend speaks first. the data waits in the socket for the client, nothing to watch for until then
+        uv_poll_stop(p);
+        return;
+    }
+
+    ZITI_LOG(DEBUG, "pool[%s:%s] idle connection closed by backend", pool->host, pool->port);
+    remove_conn(c, true);
+    refill(pool);
+    schedule(pool);
+}
+
+static void dial_failed(host_pool_t *pool, int err) {
+    pool->dialing--;
+    if (!pool->closed) {
+        pool->failures++;
+        uint64_t backoff = HOST_POOL_RETRY_MAX_MILLIS;
+        if (pool->failures < 16) {
+            backoff = (uint64_t) HOST_POOL_RETRY_MIN_MILLIS << (pool->failures - 1);
+            if (backoff > HOST_POOL_RETRY_MAX_MILLIS) backoff = HOST_POOL_RETRY_MAX_MILLIS;
+        }
+        pool->retry_at = uv_now(pool->loop) + backoff;
+        ZITI_LOG(DEBUG, "pool[%s:%s] connect failed: %s. retrying in %" PRIu64 "ms",
+                 pool->host, pool->port, uv_strerror(err), backoff);
+        schedule(pool);
+    }
+    pool_unref(pool);
+}
+
+static int add_conn(host_pool_t *pool, uv_os_sock_t sock, const struct sockaddr *addr) {
+    pooled_conn_t *c = calloc(1, sizeof(pooled_conn_t));
+    if (uv_poll_init_socket(pool->loop, &c->poll, sock) != 0) {
+        free(c);
+        return -1;
+    }
+    c->sock = sock;
+    c->pool = pool;
+    c->since = uv_now(pool->loop);
+    memcpy(&c->peer, addr, addr->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+    c->poll.data = c;
+    uv_poll_start(&c->poll, UV_READABLE | UV_DISCONNECT, on_idle_event);
+
+    TAILQ_INSERT_TAIL(&pool->idle, c, _next);
+    pool->idle_count++;
+    return 0;
+}
+
+static void on_pool_dialed(uv_os_sock_t sock, int status, const struct sockaddr *addr, void *ctx) {
+    host_pool_t *pool = ctx;
+    if (status != 0) {
+        dial_failed(pool, status);
+        return;
+    }
+
+    pool->dialing--;
+    // the connect reference moves to the idle connection
+    if (pool->closed || add_conn(pool, sock, addr) != 0) {
+        sock_close(sock);
+        pool_unref(pool);
+        return;
+    }
+    pool->failures = 0;
+    refill(pool);
+    schedule(pool);
+}
+
+static void on_pool_resolved(void *ctx, int status, const struct sockaddr_storage *addrs, int count) {
+    host_pool_t *pool = ctx;
+    if (pool->closed) {
+        dial_failed(pool, UV_ECANCELED);
+        return;
+    }
+    if (status != 0) {
+        dial_failed(pool, status);
+        return;
+    }
+
+    int rc = host_dial_connect(pool->hd, addrs, count, NULL, on_pool_dialed, pool);
+    if (rc != 0) {
+        dial_failed(pool, rc);
+    }
+}
+
+static void refill(host_pool_t *pool) {
+    while (!pool->closed && pool->idle_count + pool->dialing < pool->size) {
+        // after a failure, probe with one connection at a time
+        if (pool->failures > 0 && (pool->dialing > 0 || pool->retry_at > uv_now(pool->loop))) {
+            break;
+        }
+
+        pool->dialing++;
+        pool->refs++;
+        int rc = host_resolve(pool->hd, pool->host, pool->port, SOCK_STREAM, pool->numeric, on_pool_resolved, pool);
+        if (rc != 0) {
+            dial_failed(pool, rc);
+            break;
+        }
+    }
+}
+
+host_pool_t *host_pool_new(host_dial_ctx_t *hd, uv_loop_t *loop, const char *host, const char *port, bool numeric,
+                           int size, uint64_t max_idle_millis) {
+    if (size <= 0 || size > HOST_POOL_MAX_SIZE || max_idle_millis == 0) {
+        return NULL;
+    }
+
+    host_pool_t *pool = calloc(1, sizeof(host_pool_t));
+    pool->loop = loop;
+    pool->hd = hd;
+    pool->host = strdup(host);
+    pool->port = strdup(port);
+    pool->numeric = numeric;
+    pool->size = size;
+    pool->max_idle = max_idle_millis;
+    TAILQ_INIT(&pool->idle);
+
+    uv_timer_init(loop, &pool->timer);
+    pool->timer.data = pool;
+    uv_unref((uv_handle_t *) &pool->timer);
+    pool->refs = 2;
+
+    refill(pool);
+    schedule(pool);
+    return pool;
+}
+
+static void on_timer_close(uv_handle_t *h) {
+    pool_unref(h->data);
+}
+
+void host_pool_close(host_pool_t *pool) {
+    if (pool == NULL || pool->closed) {
+        return;
+    }
+
+    pool->closed = true;
+    uv_close((uv_handle_t *) &pool->timer, on_timer_close);
+    while (!TAILQ_EMPTY(&pool->idle)) {
+        remove_conn(TAILQ_FIRST(&pool->idle), true);
+    }
+    pool_unref(pool);
+}
+
+int host_pool_take(host_pool_t *pool, uv_os_sock_t *sock, struct sockaddr_storage *peer) {
+    if (pool->closed) {
+        return UV_EAGAIN;
+    }
+
+    int rc = UV_EAGAIN;
+    pooled_conn_t *c;
+    // most recently connected first, the backend is least likely to have given up on it
+    while ((c = TAILQ_LAST(&pool->idle, pooled_conns)) != NULL) {
+        if (peer_closed(c->sock)) {
+            remove_conn(c, true);
+            continue;
+        }
+        *sock = c->sock;
+        memcpy(peer, &c->peer, sizeof(*peer));
+        remove_conn(c, false);
+        rc = 0;
+        break;
+    }
+
+    refill(pool);
+    schedule(pool);
+    return rc;
+}
+
+int host_pool_idle_count(const host_pool_t *pool) {
+    return pool->idle_count;
+}
@@ -0,0 +1,59 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_HOST_POOL_H
+#define ZITI_TUNNELER_SDK_HOST_POOL_H
+
+#include <stdbool.h>
+#include <uv.h>
+#include "host_dial.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HOST_POOL_MAX_SIZE 64
+#define HOST_POOL_DEFAULT_MAX_IDLE_SECONDS 60
+// refill backoff after failed connects. doubles with every consecutive failure
+#define HOST_POOL_RETRY_MIN_MILLIS 1000
+#define HOST_POOL_RETRY_MAX_MILLIS (30 * 1000)
+
+/**
+ * idle TCP connections to a fixed backend, established ahead of the ziti clients that will use them.
+ * the pool is refilled in the background whenever a connection is taken, closed by the backend, or expires.
+ * only suitable for backends that don't mind connections that sit idle (or are never used).
+ */
+typedef struct host_pool_s host_pool_t;
+
+host_pool_t *host_pool_new(host_dial_ctx_t *hd, uv_loop_t *loop, const char *host, const char *port, bool numeric,
+                           int size, uint64_t max_idle_millis);
+
+/** stop refilling and close idle connections. the pool is freed once outstanding connects complete */
+void host_pool_close(host_pool_t *pool);
+
+/**
+ * take an idle connection. `sock` is connected, non-blocking and owned by the caller.
+ * returns UV_EAGAIN if none is ready.
+ */
+int host_pool_take(host_pool_t *pool, uv_os_sock_t *sock, struct sockaddr_storage *peer);
+
+int host_pool_idle_count(const host_pool_t *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_HOST_POOL_H
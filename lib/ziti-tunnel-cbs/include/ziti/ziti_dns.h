@@ -37,14 +37,55 @@ int ziti_dns_setup(tunneler_context tnlr, const char *dns_addr, const char *dns_
 
 int ziti_dns_set_upstream(uv_loop_t *l, tunnel_upstream_dns_array upstreams);
 
+/**
+ * assign IPv6 addresses (in addition to IPv4) to intercepted hostnames from `dns_cidr6`, and answer AAAA queries for them.
+ * the address in `dns_cidr6` belongs to the tun interface, and is not assigned to hostnames.
+ * must be called after ziti_dns_setup(), before any hostnames are registered.
+ */
+int ziti_dns_setup_ipv6(const char *dns_cidr6);
+
+/** the tun address of the IPv6 range in x:x::x/m form, as ziti_dns_setup_ipv6() parsed it. NULL if it is not configured */
+const char *ziti_dns_ipv6_cidr(void);
+
 const ip_addr_t *ziti_dns_register_hostname(const ziti_address *addr, void *intercept);
 
 const char *ziti_dns_reverse_lookup_domain(const ip_addr_t *addr);
 
+/** returns IPv6 address that was assigned to a registered hostname, or NULL if IPv6 range is not configured */
+const ip_addr_t *ziti_dns_hostname_ip6(const ziti_address *addr);
+
 const char *ziti_dns_reverse_lookup(const char *ip_addr);
 
+/**
+ * if `addr` was assigned to a hostname that is covered by a wildcard domain that `intercept` registered,
+ * return the address that the wildcard was registered with.
+ */
+const ziti_address *ziti_dns_match_domain_intercept(const ip_addr_t *addr, const void *intercept);
+
 void ziti_dns_deregister_intercept(void *intercept);
 
+/**
+ * keep hostname to IP assignments in a snapshot file at `path`.
+ * assignments found in the snapshot are held for their hostnames for a grace period,
+ * so that clients with cached answers keep working after a restart.
+ * should be called after ziti_dns_setup() (and ziti_dns_setup_ipv6(), if used) and before any services are registered.
+ * returns number of hostnames that had addresses restored.
+ */
+int ziti_dns_load_snapshot(uv_loop_t *loop, const char *path);
+
+/** stop saving the snapshot and give the IPs that are still held for it back to the pool. the file is left as it is */
+void ziti_dns_close_snapshot();
+
+/**
+ * writes the answer to an A or AAAA query for a ziti hostname into `resp` without sending it.
+ * `fast` selects the allocation free path that is tried first for each query; the regular path handles the rest.
+ * returns the response length, or 0 if the query is not answered locally on that path.
+ */
+size_t ziti_dns_host_answer(const uint8_t *q, size_t q_len, uint8_t *resp, size_t resp_len, bool fast);
+
+/** fills `pool` with usage of the virtual IP range that hostnames are mapped into */
+void ziti_dns_get_ip_pool_stats(tunnel_ip_mem_pool *pool);
+
 #ifdef __cplusplus
 };
 #endif
@@ -33,7 +33,9 @@ extern "C" {
 
 #define TUNNELER_CONN_TYPE_ENUM(XX,...) \
 XX(data, __VA_ARGS__)                    \
-XX(resolver, __VA_ARGS__)
+XX(resolver, __VA_ARGS__)                \
+XX(deferred, __VA_ARGS__)                \
+XX(multiplexed, __VA_ARGS__)
 
 #define TUNNELER_APP_DATA_MODEL(XX, ...) \
 XX(conn_type, TunnelConnectionType, none, connType, __VA_ARGS__) \
@@ -44,7 +46,10 @@ XX(dst_port, model_string, none, dst_port, __VA_ARGS__)\
 XX(src_protocol, model_string, none, src_protocol, __VA_ARGS__)\
 XX(src_ip, model_string, none, src_ip, __VA_ARGS__)\
 XX(src_port, model_string, none, src_port, __VA_ARGS__)\
-XX(source_addr, model_string, none, source_addr, __VA_ARGS__)
+XX(source_addr, model_string, none, source_addr, __VA_ARGS__)\
+XX(dns_format, model_string, none, dns_format, __VA_ARGS__)\
+XX(udp_framing, model_string, none, udp_framing, __VA_ARGS__)\
+XX(compression, model_string, none, compression, __VA_ARGS__)
 
 DECLARE_ENUM(TunnelConnectionType, TUNNELER_CONN_TYPE_ENUM)
 
@@ -312,6 +317,18 @@ typedef struct ziti_io_ctx_s {
     bool ziti_eof;
     bool tnlr_eof;
     uint64_t pending_wbytes;
+    // udp: framing was requested, and the hosting side hasn't answered yet
+    bool udp_framing_pending;
+    // udp: hosting side sent the framing hello, datagrams from ziti are length-prefixed
+    struct udp_frame_reader_s *udp_frames;
+    // tcp: small client writes are combined before they are written to ziti, if the service asks for it
+    struct write_coalescer_s *coalescer;
+    // pooled connection: the hosting side hasn't connected to the server yet
+    bool deferred_pending;
+    // tcp: the flow is a stream on a multiplexed connection, and ziti_conn is NULL
+    struct mux_stream_s *mux_stream;
+    // tcp: the hosting side was asked to compress
+    struct compress_flow_s *compress;
 } ziti_io_context;
 
 
@@ -375,6 +392,7 @@ struct ziti_instance_s {
     ziti_context ztx;
     struct mfa_request_s *mfa_req;
     model_map intercepts;
+    model_map hosts; // host_ctx_t by service name
     LIST_ENTRY(ziti_instance_s) _next;
 };
 
@@ -0,0 +1,588 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ziti/ziti_log.h>
+#include "ziti/sys/queue.h"
+#include "mux.h"
+
+#define MUX_BUCKETS 64
+// credit is returned in chunks, not for every write the application completes
+#define MUX_CREDIT_MIN (MUX_WINDOW / 4)
+
+typedef struct mux_write_s {
+    TAILQ_ENTRY(mux_write_s) _next;
+    mux_stream_t *stream;
+    uint8_t *data;
+    size_t len;
+    size_t off;
+    mux_write_cb cb;
+    void *ctx;
+} mux_write_t;
+
+struct mux_stream_s {
+    LIST_ENTRY(mux_stream_s) _bucket;
+    TAILQ_ENTRY(mux_stream_s) _blocked;
+    TAILQ_ENTRY(mux_stream_s) _closing;
+    mux_t *mux;
+    uint32_t id;
+    void *data;
+    mux_connect_cb conn_cb;
+    mux_data_cb data_cb;
+
+    bool hashed;
+    bool connecting;
+    bool fin_pending; // half-close once the queued writes are sent
+    bool fin_sent;
+    bool fin_rcvd;
+    bool eof_delivered;
+    bool reset;
+    bool failed;
+    bool closing;
+    mux_close_cb close_cb;
+
+    size_t send_credit;
+    size_t recv_credit;
+    size_t unacked;
+    TAILQ_HEAD(mux_writes, mux_write_s) writes;
+    int inflight; // writes handed to the underlay
+
+    // received data that the application didn't take yet
+    uint8_t *rx;
+    size_t rx_len;
+    bool blocked;
+    uint32_t retried; // timer run that offered it last
+};
+
+struct mux_s {
+    uv_loop_t *loop;
+    mux_write_fn write_fn;
+    mux_open_cb open_cb;
+    void *ctx;
+
+    LIST_HEAD(mux_bucket, mux_stream_s) buckets[MUX_BUCKETS];
+    TAILQ_HEAD(mux_blocked, mux_stream_s) blocked;
+    TAILQ_HEAD(mux_closing, mux_stream_s) closing;
+    uint32_t next_id;
+    int num_open;
+    int num_streams; // including closed streams that aren't freed yet
+    int inflight;
+    int err;
+    bool closed;
+    uv_timer_t timer;
+    uint32_t timer_runs;
+
+    // a frame that is split across reads
+    uint8_t *buf;
+    size_t buf_len;
+};
+
+static void on_timer(uv_timer_t *t);
+
+static void schedule(mux_t *mux, uint64_t delay) {
+    if (!uv_is_active((uv_handle_t *) &mux->timer) || delay == 0) {
+        uv_timer_start(&mux->timer, on_timer, delay, 0);
+    }
+}
+
+static size_t frame_len(const uint8_t *hdr) {
+    return ((size_t) hdr[5] << 8) | hdr[6];
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t) (v >> 24);
+    p[1] = (uint8_t) (v >> 16);
+    p[2] = (uint8_t) (v >> 8);
+    p[3] = (uint8_t) v;
+}
+
+static int send_frame(mux_t *mux, mux_frame_type_e type, uint32_t id, const uint8_t *payload, size_t len, void *req) {
+    if (mux->err != 0) {
+        return mux->err;
+    }
+    uint8_t *msg = malloc(MUX_FRAME_HDR + len);
+    msg[0] = (uint8_t) type;
+    put_u32(msg + 1, id);
+    msg[5] = (uint8_t) (len >> 8);
+    msg[6] = (uint8_t) len;
+    if (len > 0) {
+        memcpy(msg + MUX_FRAME_HDR, payload, len);
+    }
+    mux->inflight++;
+    int rc = mux->write_fn(mux->ctx, msg, MUX_FRAME_HDR + len, req);
+    if (rc != 0) {
+        mux->inflight--;
+    }
+    return rc;
+}
+
+static mux_stream_t *find_stream(mux_t *mux, uint32_t id) {
+    mux_stream_t *s;
+    LIST_FOREACH(s, &mux->buckets[id % MUX_BUCKETS], _bucket) {
+        if (s->id == id) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static mux_stream_t *new_stream(mux_t *mux, uint32_t id) {
+    mux_stream_t *s = calloc(1, sizeof(mux_stream_t));
+    s->mux = mux;
+    s->id = id;
+    s->send_credit = MUX_WINDOW;
+    s->recv_credit = MUX_WINDOW;
+    TAILQ_INIT(&s->writes);
+    LIST_INSERT_HEAD(&mux->buckets[id % MUX_BUCKETS], s, _bucket);
+    s->hashed = true;
+    mux->num_open++;
+    mux->num_streams++;
+    return s;
+}
+
+static void unhash(mux_stream_t *s) {
+    if (s->hashed) {
+        LIST_REMOVE(s, _bucket);
+        s->hashed = false;
+    }
+}
+
+static void unblock(mux_stream_t *s) {
+    if (s->blocked) {
+        TAILQ_REMOVE(&s->mux->blocked, s, _blocked);
+        s->blocked = false;
+    }
+}
+
+static void free_stream(mux_stream_t *s) {
+    s->mux->num_streams--;
+    free(s->rx);
+    free(s);
+}
+
+static void complete_write(mux_write_t *w, ssize_t status) {
+    mux_stream_t *s = w->stream;
+    if (w->cb) {
+        w->cb(s->closing ? NULL : s->data, status, w->ctx);
+    }
+    free(w->data);
+    free(w);
+}
+
+static void try_send(mux_stream_t *s) {
+    mux_write_t *w;
+    while ((w = TAILQ_FIRST(&s->writes)) != NULL && s->send_credit > 0) {
+        size_t n = w->len - w->off;
+        n = n < s->send_credit ? n : s->send_credit;
+        n = n < MUX_FRAME_MAX ? n : MUX_FRAME_MAX;
+        bool last = w->off + n == w->len;
+        // only the last frame of a write completes it
+        if (last) {
+            TAILQ_REMOVE(&s->writes, w, _next);
+            s->inflight++;
+        }
+        int rc = send_frame(s->mux, MUX_DATA, s->id, w->data + w->off, n, last ? w : NULL);
+        if (rc != 0) {
+            // the underlay is failing. the streams find out when it is closed
+            if (last) {
+                s->inflight--;
+                complete_write(w, rc);
+            }
+            return;
+        }
+        w->off += n;
+        s->send_credit -= n;
+    }
+
+    if (TAILQ_EMPTY(&s->writes) && s->fin_pending && !s->fin_sent) {
+        s->fin_sent = true;
+        send_frame(s->mux, MUX_FIN, s->id, NULL, 0, NULL);
+    }
+}
+
+static void deliver_eof(mux_stream_t *s) {
+    if (!s->eof_delivered && !s->closing && s->data_cb) {
+        s->eof_delivered = true;
+        s->data_cb(s, NULL, UV_EOF);
+    }
+}
+
+/** offers data to the application, and keeps what it doesn't take */
+static void deliver(mux_stream_t *s, const uint8_t *data, size_t len) {
+    if (s->rx_len > 0) {
+        s->rx = realloc(s->rx, s->rx_len + len);
+        memcpy(s->rx + s->rx_len, data, len);
+        s->rx_len += len;
+        return;
+    }
+
+    ssize_t taken = s->data_cb ? s->data_cb(s, data, (ssize_t) len) : 0;
+    if (s->closing || s->failed || taken < 0 || (size_t) taken >= len) {
+        return;
+    }
+    s->rx_len = len - (size_t) taken;
+    s->rx = malloc(s->rx_len);
+    memcpy(s->rx, data + taken, s->rx_len);
+    if (!s->blocked) {
+        s->blocked = true;
+        TAILQ_INSERT_TAIL(&s->mux->blocked, s, _blocked);
+    }
+    schedule(s->mux, MUX_RETRY_MILLIS);
+}
+
+static void redeliver(mux_stream_t *s) {
+    ssize_t taken = s->data_cb ? s->data_cb(s, s->rx, (ssize_t) s->rx_len) : 0;
+    if (s->closing || s->failed) {
+        return;
+    }
+    if (taken < 0 || (size_t) taken >= s->rx_len) {
+        s->rx_len = 0;
+    } else if (taken > 0) {
+        memmove(s->rx, s->rx + taken, s->rx_len - (size_t) taken);
+        s->rx_len -= (size_t) taken;
+    }
+    if (s->rx_len == 0) {
+        unblock(s);
+        free(s->rx);
+        s->rx = NULL;
+        if (s->fin_rcvd) {
+            deliver_eof(s);
+        }
+    }
+}
+
+static void stream_error(mux_stream_t *s, int err) {
+    if (s->closing || s->failed) {
+        return;
+    }
+    s->failed = true;
+    unblock(s);
+    if (s->connecting) {
+        s->connecting = false;
+        s->conn_cb(s, err);
+    } else if (s->data_cb) {
+        s->data_cb(s, NULL, err);
+    }
+}
+
+static void process_frame(mux_t *mux, uint8_t type, uint32_t id, const uint8_t *payload, size_t len) {
+    if (type == MUX_OPEN) {
+        if (mux->open_cb == NULL || find_stream(mux, id) != NULL) {
+            ZITI_LOG(WARN, "mux[%p] unexpected open for stream[%u]", mux, id);
+            send_frame(mux, MUX_RESET, id, NULL, 0, NULL);
+            return;
+        }
+        mux->open_cb(mux, new_stream(mux, id), payload, len, mux->ctx);
+        return;
+    }
+
+    mux_stream_t *s = find_stream(mux, id);
+    if (s == NULL) {
+        // closed on this side already
+        return;
+    }
+    switch (type) {
+        case MUX_OPENED:
+            if (s->connecting) {
+                s->connecting = false;
+                s->conn_cb(s, 0);
+            }
+            break;
+        case MUX_DATA:
+            if (len > s->recv_credit || s->fin_rcvd) {
+                ZITI_LOG(WARN, "mux[%p] stream[%u] sent data without credit", mux, id);
+                stream_error(s, UV_EPROTO);
+                break;
+            }
+            s->recv_credit -= len;
+            if (len > 0) {
+                deliver(s, payload, len);
+            }
+            break;
+        case MUX_CREDIT:
+            if (len == 4) {
+                s->send_credit += get_u32(payload);
+                try_send(s);
+            }
+            break;
+        case MUX_FIN:
+            s->fin_rcvd = true;
+            if (s->rx_len == 0) {
+                deliver_eof(s);
+            }
+            break;
+        case MUX_RESET:
+            s->reset = true;
+            stream_error(s, s->connecting ? UV_ECONNREFUSED : UV_ECONNRESET);
+            break;
+        default:
+            ZITI_LOG(WARN, "mux[%p] stream[%u] unknown frame type %d", mux, id, type);
+            break;
+    }
+}
+
+static void on_timer_closed(uv_handle_t *h) {
+    mux_t *mux = h->data;
+    free(mux->buf);
+    free(mux);
+}
+
+static void on_timer(uv_timer_t *t) {
+    mux_t *mux = t->data;
+
+    // callbacks can close other streams, so the list is searched again after every one
+    uint32_t run = ++mux->timer_runs;
+    mux_stream_t *s, *next;
+    for (;;) {
+        TAILQ_FOREACH(s, &mux->blocked, _blocked) {
+            if (s->retried != run) break;
+        }
+        if (s == NULL) break;
+        s->retried = run;
+        redeliver(s);
+    }
+
+    for (s = TAILQ_FIRST(&mux->closing); s != NULL; s = next) {
+        next = TAILQ_NEXT(s, _closing);
+        mux_write_t *w;
+        while ((w = TAILQ_FIRST(&s->writes)) != NULL) {
+            TAILQ_REMOVE(&s->writes, w, _next);
+            complete_write(w, UV_ECANCELED);
+        }
+        if (s->inflight > 0) {
+            continue;
+        }
+        TAILQ_REMOVE(&mux->closing, s, _closing);
+        if (s->close_cb) {
+            s->close_cb(s);
+        }
+        free_stream(s);
+    }
+
+    if (mux->closed && mux->num_streams == 0 && mux->inflight == 0) {
+        uv_close((uv_handle_t *) &mux->timer, on_timer_closed);
+        return;
+    }
+    if (!TAILQ_EMPTY(&mux->blocked)) {
+        schedule(mux, MUX_RETRY_MILLIS);
+    }
+}
+
+mux_t *mux_new(uv_loop_t *loop, mux_write_fn write_fn, mux_open_cb open_cb, void *ctx) {
+    mux_t *mux = calloc(1, sizeof(mux_t));
+    mux->loop = loop;
+    mux->write_fn = write_fn;
+    mux->open_cb = open_cb;
+    mux->ctx = ctx;
+    mux->next_id = 1;
+    for (int i = 0; i < MUX_BUCKETS; i++) {
+        LIST_INIT(&mux->buckets[i]);
+    }
+    TAILQ_INIT(&mux->blocked);
+    TAILQ_INIT(&mux->closing);
+
+    uv_timer_init(loop, &mux->timer);
+    mux->timer.data = mux;
+    uv_unref((uv_handle_t *) &mux->timer);
+    return mux;
+}
+
+void mux_on_data(mux_t *mux, const uint8_t *data, size_t len) {
+    while (len > 0 && mux->err == 0) {
+        // whole frames are processed without copying
+        if (mux->buf_len == 0 && len >= MUX_FRAME_HDR && len >= MUX_FRAME_HDR + frame_len(data)) {
+            size_t plen = frame_len(data);
+            process_frame(mux, data[0], get_u32(data + 1), data + MUX_FRAME_HDR, plen);
+            data += MUX_FRAME_HDR + plen;
+            len -= MUX_FRAME_HDR + plen;
+            continue;
+        }
+
+        if (mux->buf == NULL) {
+            mux->buf = malloc(MUX_FRAME_HDR + MUX_FRAME_MAX);
+        }
+        size_t want = mux->buf_len < MUX_FRAME_HDR ? MUX_FRAME_HDR - mux->buf_len :
+                      MUX_FRAME_HDR + frame_len(mux->buf) - mux->buf_len;
+        size_t n = want < len ? want : len;
+        memcpy(mux->buf + mux->buf_len, data, n);
+        mux->buf_len += n;
+        data += n;
+        len -= n;
+        if (mux->buf_len >= MUX_FRAME_HDR && mux->buf_len == MUX_FRAME_HDR + frame_len(mux->buf)) {
+            mux->buf_len = 0;
+            process_frame(mux, mux->buf[0], get_u32(mux->buf + 1), mux->buf + MUX_FRAME_HDR, frame_len(mux->buf));
+        }
+    }
+}
+
+void mux_written(mux_t *mux, void *req, int status) {
+    mux->inflight--;
+    mux_write_t *w = req;
+    if (w != NULL) {
+        mux_stream_t *s = w->stream;
+        s->inflight--;
+        complete_write(w, status < 0 ? status : (ssize_t) w->len);
+        if (s->closing && s->inflight == 0) {
+            schedule(mux, 0);
+        }
+    }
+    if (mux->closed && mux->inflight == 0) {
+        schedule(mux, 0);
+    }
+}
+
+void mux_close(mux_t *mux, int err) {
+    if (mux->closed) {
+        return;
+    }
+    mux->closed = true;
+    mux->err = err < 0 ? err : UV_ECONNRESET;
+
+    // callbacks may close any of the streams
+    TAILQ_HEAD(mux_failed, mux_stream_s) failed = TAILQ_HEAD_INITIALIZER(failed);
+    for (int i = 0; i < MUX_BUCKETS; i++) {
+        mux_stream_t *s;
+        while ((s = LIST_FIRST(&mux->buckets[i])) != NULL) {
+            unhash(s);
+            unblock(s);
+            TAILQ_INSERT_TAIL(&failed, s, _blocked);
+        }
+    }
+    mux_stream_t *s;
+    while ((s = TAILQ_FIRST(&failed)) != NULL) {
+        TAILQ_REMOVE(&failed, s, _blocked);
+        stream_error(s, mux->err);
+    }
+    schedule(mux, 0);
+}
+
+int mux_stream_count(const mux_t *mux) {
+    return mux->num_open;
+}
+
+void *mux_ctx(const mux_t *mux) {
+    return mux->ctx;
+}
+
+mux_stream_t *mux_stream_open(mux_t *mux, const uint8_t *app_data, size_t len, mux_connect_cb conn_cb,
+                              mux_data_cb data_cb, void *data) {
+    if (mux->err != 0 || len > MUX_FRAME_MAX) {
+        return NULL;
+    }
+    uint32_t id = mux->next_id++;
+    if (mux->next_id == 0) {
+        mux->next_id = 1;
+    }
+    mux_stream_t *s = new_stream(mux, id);
+    s->conn_cb = conn_cb;
+    s->data_cb = data_cb;
+    s->data = data;
+    s->connecting = true;
+    if (send_frame(mux, MUX_OPEN, id, app_data, len, NULL) != 0) {
+        unhash(s);
+        mux->num_open--;
+        free_stream(s);
+        return NULL;
+    }
+    return s;
+}
+
+void mux_stream_set_data(mux_stream_t *s, mux_data_cb data_cb, void *data) {
+    s->data_cb = data_cb;
+    s->data = data;
+}
+
+void *mux_stream_data(const mux_stream_t *s) {
+    return s->data;
+}
+
+mux_t *mux_stream_mux(const mux_stream_t *s) {
+    return s->mux;
+}
+
+int mux_stream_accept(mux_stream_t *s) {
+    if (s->closing || s->failed) {
+        return UV_ECONNRESET;
+    }
+    return send_frame(s->mux, MUX_OPENED, s->id, NULL, 0, NULL);
+}
+
+int mux_stream_write(mux_stream_t *s, const uint8_t *data, size_t len, mux_write_cb cb, void *ctx) {
+    if (s->closing || s->failed || s->fin_pending) {
+        return UV_EPIPE;
+    }
+    if (s->mux->err != 0) {
+        return s->mux->err;
+    }
+    mux_write_t *w = calloc(1, sizeof(mux_write_t));
+    w->stream = s;
+    w->data = malloc(len > 0 ? len : 1);
+    memcpy(w->data, data, len);
+    w->len = len;
+    w->cb = cb;
+    w->ctx = ctx;
+    TAILQ_INSERT_TAIL(&s->writes, w, _next);
+    try_send(s);
+    return 0;
+}
+
+void mux_stream_consumed(mux_stream_t *s, size_t len) {
+    if (s->closing || s->failed || s->fin_rcvd) {
+        return;
+    }
+    s->unacked += len;
+    if (s->unacked < MUX_CREDIT_MIN) {
+        return;
+    }
+    uint8_t credit[4];
+    put_u32(credit, (uint32_t) s->unacked);
+    if (send_frame(s->mux, MUX_CREDIT, s->id, credit, sizeof(credit), NULL) == 0) {
+        s->recv_credit += s->unacked;
+        s->unacked = 0;
+    }
+}
+
+int mux_stream_close_write(mux_stream_t *s) {
+    if (s->closing || s->failed) {
+        return UV_EPIPE;
+    }
+    s->fin_pending = true;
+    try_send(s);
+    return 0;
+}
+
+void mux_stream_close(mux_stream_t *s, mux_close_cb close_cb) {
+    if (s->closing) {
+        return;
+    }
+    mux_t *mux = s->mux;
+    if (!s->reset && !(s->fin_sent && s->fin_rcvd)) {
+        send_frame(mux, MUX_RESET, s->id, NULL, 0, NULL);
+    }
+    s->closing = true;
+    s->close_cb = close_cb;
+    unhash(s);
+    unblock(s);
+    mux->num_open--;
+    // queued writes are cancelled from the timer, not from inside the caller
+    TAILQ_INSERT_TAIL(&mux->closing, s, _closing);
+    schedule(mux, 0);
+}
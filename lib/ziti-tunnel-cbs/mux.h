@@ -0,0 +1,121 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_MUX_H
+#define ZITI_TUNNELER_SDK_MUX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// every frame starts with its type, the stream id (4 bytes) and the payload length (2 bytes), big-endian
+#define MUX_FRAME_HDR 7
+#define MUX_FRAME_MAX 0xffff
+// bytes a stream may send before the receiving side grants more
+#define MUX_WINDOW (256 * 1024)
+// data that the receiving application didn't take is offered again after this long
+#define MUX_RETRY_MILLIS 10
+
+#define MUX_FRAME_TYPES(XX) \
+XX(OPEN, 1)     /* payload is the stream's app_data */ \
+XX(OPENED, 2)   /* the accepting side connected the stream */ \
+XX(DATA, 3)     \
+XX(CREDIT, 4)   /* payload is the number of bytes (4 bytes) the sender may send in addition */ \
+XX(FIN, 5)      /* the sender won't send more data */ \
+XX(RESET, 6)    /* the stream is gone */
+
+#define MUX_FRAME_ENUM(t, v) MUX_##t = v,
+typedef enum {
+    MUX_FRAME_TYPES(MUX_FRAME_ENUM)
+} mux_frame_type_e;
+#undef MUX_FRAME_ENUM
+
+/**
+ * many streams over one byte stream (a ziti connection), each with its own flow control and half-close.
+ * streams are opened by one side of the mux and accepted by the other.
+ */
+typedef struct mux_s mux_t;
+typedef struct mux_stream_s mux_stream_t;
+
+/** send `msg` on the underlay, and take ownership of it. `req` is passed to mux_written() once it is sent */
+typedef int (*mux_write_fn)(void *ctx, uint8_t *msg, size_t len, void *req);
+
+/** the other side opened a stream. accept it with mux_stream_set_data() and mux_stream_accept(), or close it */
+typedef void (*mux_open_cb)(mux_t *mux, mux_stream_t *s, const uint8_t *app_data, size_t len, void *ctx);
+
+/** result of mux_stream_open(). the stream must be closed if status is not 0 */
+typedef void (*mux_connect_cb)(mux_stream_t *s, int status);
+
+/**
+ * data from the other side. returns the number of bytes taken, the rest is offered again later.
+ * len is UV_EOF once the other side is done sending, and another error if the stream was reset or the mux failed.
+ * the stream must be closed after an error.
+ */
+typedef ssize_t (*mux_data_cb)(mux_stream_t *s, const uint8_t *data, ssize_t len);
+
+/** `stream_data` is NULL if the stream was closed before the write completed */
+typedef void (*mux_write_cb)(void *stream_data, ssize_t status, void *ctx);
+
+/** called once the stream and its outstanding writes are done */
+typedef void (*mux_close_cb)(mux_stream_t *s);
+
+/** open_cb is NULL for the side that opens streams */
+mux_t *mux_new(uv_loop_t *loop, mux_write_fn write_fn, mux_open_cb open_cb, void *ctx);
+
+/** bytes from the underlay */
+void mux_on_data(mux_t *mux, const uint8_t *data, size_t len);
+
+/** a message from write_fn was sent, or failed */
+void mux_written(mux_t *mux, void *req, int status);
+
+/** the underlay is gone. open streams see `err`, and the mux is freed once all of them are closed */
+void mux_close(mux_t *mux, int err);
+
+/** streams that are open and not closed yet */
+int mux_stream_count(const mux_t *mux);
+
+void *mux_ctx(const mux_t *mux);
+
+mux_stream_t *mux_stream_open(mux_t *mux, const uint8_t *app_data, size_t len, mux_connect_cb conn_cb,
+                              mux_data_cb data_cb, void *data);
+
+void mux_stream_set_data(mux_stream_t *s, mux_data_cb data_cb, void *data);
+void *mux_stream_data(const mux_stream_t *s);
+mux_t *mux_stream_mux(const mux_stream_t *s);
+
+int mux_stream_accept(mux_stream_t *s);
+
+/** `data` is copied. writes go out in order as the other side grants credit */
+int mux_stream_write(mux_stream_t *s, const uint8_t *data, size_t len, mux_write_cb cb, void *ctx);
+
+/** the application is done with `len` received bytes, the other side can send that much more */
+void mux_stream_consumed(mux_stream_t *s, size_t len);
+
+/** half-close, after the writes that are queued */
+int mux_stream_close_write(mux_stream_t *s);
+
+/** resets the stream unless both sides have finished. there are no more callbacks except `close_cb`, which may be NULL */
+void mux_stream_close(mux_stream_t *s, mux_close_cb close_cb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_MUX_H
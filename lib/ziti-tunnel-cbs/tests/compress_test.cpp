@@ -0,0 +1,157 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "catch2/catch.hpp"
+#include "../compress.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+struct decoded {
+    std::string data;
+    int frames = 0;
+    int stop_after = 0;
+};
+
+static int on_decoded(void *ctx, const uint8_t *data, size_t len) {
+    auto d = static_cast<decoded *>(ctx);
+    d->data.append((const char *) data, len);
+    d->frames++;
+    return d->stop_after > 0 && d->frames >= d->stop_after;
+}
+
+static std::string encode(compress_encoder_t *enc, const std::string &data) {
+    uint8_t *out = nullptr;
+    ssize_t n = compress_encode(enc, (const uint8_t *) data.data(), data.size(), &out);
+    REQUIRE(n > 0);
+    std::string s((const char *) out, (size_t) n);
+    free(out);
+    return s;
+}
+
+/** decodes `wire` in pieces of `split` bytes, if it is set */
+static void decode(compress_decoder_t *dec, const std::string &wire, decoded &d, size_t split = 0) {
+    size_t step = split > 0 ? split : wire.size();
+    for (size_t off = 0; off < wire.size(); off += step) {
+        size_t n = std::min(step, wire.size() - off);
+        REQUIRE(compress_decode(dec, (const uint8_t *) wire.data() + off, n, on_decoded, &d) == (ssize_t) n);
+    }
+}
+
+static std::string random_bytes(size_t len) {
+    std::mt19937 gen(42);
+    std::string s(len, '\0');
+    for (auto &c : s) {
+        c = (char) (gen() & 0xff);
+    }
+    return s;
+}
+
+TEST_CASE("compressed frames", "[compress]") {
+    compress_encoder_t *enc = compress_encoder_new(1);
+    compress_decoder_t *dec = compress_decoder_new();
+    REQUIRE(enc != nullptr);
+    REQUIRE(dec != nullptr);
+    decoded d;
+
+    SECTION("text shrinks, and the window carries over between writes") {
+        size_t split = GENERATE(0, 1, 1000);
+        std::string req = "GET /api/v1/items?page=1 HTTP/1.1\r\nHost: example.com\r\nAccept: application/json\r\n"
+                          "User-Agent: test\r\n\r\n";
+        std::string all, wire;
+        for (int i = 0; i < 100; i++) {
+            all += req;
+            wire += encode(enc, req);
+        }
+        CHECK(wire.size() * 5 < all.size());
+        decode(dec, wire, d, split);
+        CHECK(d.data == all);
+    }
+
+    SECTION("large writes are split into blocks") {
+        std::string text;
+        while (text.size() < 5 * COMPRESS_BLOCK) {
+            text += "{\"id\": " + std::to_string(text.size()) + ", \"name\": \"item\", \"tags\": [\"a\", \"b\"]},\n";
+        }
+        decode(dec, encode(enc, text), d, 4096);
+        CHECK(d.data == text);
+        CHECK(d.frames >= 5);
+    }
+
+    SECTION("small writes are sent as is") {
+        std::string wire = encode(enc, "ls -l\n");
+        CHECK(wire.size() == COMPRESS_FRAME_HDR + 6);
+        CHECK(wire[0] == COMPRESS_RAW);
+        decode(dec, wire, d);
+        CHECK(d.data == "ls -l\n");
+    }
+
+    SECTION("incompressible data is sent as is after a sample") {
+        std::string noise = random_bytes(2 * 1024 * 1024);
+        std::string wire;
+        for (size_t off = 0; off < noise.size(); off += 16384) {
+            wire += encode(enc, noise.substr(off, 16384));
+        }
+        // nothing is gained, and not much is lost
+        CHECK(wire.size() < noise.size() + noise.size() / 100);
+        uint64_t in, out;
+        compress_encoder_stats(enc, &in, &out);
+        CHECK(in == noise.size());
+        CHECK(out == wire.size());
+
+        decode(dec, wire, d, 3000);
+        CHECK(d.data == noise);
+
+        // text compresses again once the bypass is over
+        std::string text(COMPRESS_BYPASS_MAX, 'a');
+        std::string more = encode(enc, text);
+        CHECK(more.size() < text.size() / 2);
+    }
+
+    SECTION("decoding stops when the callback asks for it") {
+        std::string wire = encode(enc, "first") + encode(enc, "second");
+        d.stop_after = 1;
+        ssize_t n = compress_decode(dec, (const uint8_t *) wire.data(), wire.size(), on_decoded, &d);
+        CHECK(n == (ssize_t) (COMPRESS_FRAME_HDR + 5));
+        CHECK(d.data == "first");
+        d.stop_after = 0;
+        CHECK(compress_decode(dec, (const uint8_t *) wire.data() + n, wire.size() - n, on_decoded, &d) ==
+              (ssize_t) (wire.size() - n));
+        CHECK(d.data == "firstsecond");
+    }
+
+    SECTION("bad frames") {
+        const uint8_t bad_type[] = { 7, 0, 1, 'x' };
+        CHECK(compress_decode(dec, bad_type, sizeof(bad_type), on_decoded, &d) == UV_EINVAL);
+        compress_decoder_free(dec);
+        dec = compress_decoder_new();
+        const uint8_t bad_deflate[] = { COMPRESS_DEFLATE, 0, 4, 0xff, 0xff, 0xff, 0xff };
+        CHECK(compress_decode(dec, bad_deflate, sizeof(bad_deflate), on_decoded, &d) == UV_EINVAL);
+        compress_decoder_free(dec);
+        dec = compress_decoder_new();
+        // raw frames are limited to a block, like the output of deflate frames
+        std::vector<uint8_t> big_raw(COMPRESS_FRAME_HDR + COMPRESS_BLOCK + 1, 'r');
+        big_raw[0] = COMPRESS_RAW;
+        big_raw[1] = (COMPRESS_BLOCK + 1) >> 8;
+        big_raw[2] = (COMPRESS_BLOCK + 1) & 0xff;
+        CHECK(compress_decode(dec, big_raw.data(), big_raw.size(), on_decoded, &d) == UV_EINVAL);
+        CHECK(d.data.empty());
+    }
+
+    compress_encoder_free(enc);
+    compress_decoder_free(dec);
+}
@@ -0,0 +1,142 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "catch2/catch.hpp"
+#include "../dial_pool.h"
+
+#include <vector>
+
+struct pool_test {
+    int dials = 0;
+    bool fail = false;
+    std::vector<dial_pool_t *> pending;
+};
+
+static std::vector<void *> closed;
+
+static int fake_dial(dial_pool_t *pool, void *ctx) {
+    auto t = static_cast<pool_test *>(ctx);
+    t->dials++;
+    t->pending.push_back(pool);
+    return 0;
+}
+
+static void fake_close(void *conn) {
+    closed.push_back(conn);
+}
+
+static void complete_dials(pool_test &t) {
+    auto pending = t.pending;
+    t.pending.clear();
+    for (auto pool : pending) {
+        if (t.fail) {
+            dial_pool_dialed(pool, nullptr, UV_ECONNREFUSED);
+        } else {
+            dial_pool_dialed(pool, (void *) (intptr_t) t.dials, 0);
+        }
+    }
+}
+
+TEST_CASE("dial pool", "[pool]") {
+    uv_loop_t *loop = uv_default_loop();
+    closed.clear();
+    pool_test t;
+
+    REQUIRE(dial_pool_new(loop, 0, 1000, fake_dial, fake_close, &t) == nullptr);
+    REQUIRE(dial_pool_new(loop, DIAL_POOL_MAX_SIZE + 1, 1000, fake_dial, fake_close, &t) == nullptr);
+
+    SECTION("nothing is dialed before flows arrive") {
+        dial_pool_t *pool = dial_pool_new(loop, 4, 1000, fake_dial, fake_close, &t);
+        uv_run(loop, UV_RUN_NOWAIT);
+        CHECK(t.dials == 0);
+        CHECK(dial_pool_target(pool) == 0);
+        dial_pool_close(pool);
+    }
+
+    SECTION("an arrival starts filling the pool") {
+        dial_pool_t *pool = dial_pool_new(loop, 4, 1000, fake_dial, fake_close, &t);
+        CHECK(dial_pool_take(pool) == nullptr);
+        CHECK(dial_pool_target(pool) >= 1);
+        CHECK(t.dials == 1);
+
+        complete_dials(t);
+        CHECK(dial_pool_idle_count(pool) == 1);
+
+        void *conn = dial_pool_take(pool);
+        CHECK(conn == (void *) 1);
+        CHECK(dial_pool_idle_count(pool) == 0);
+        CHECK(t.dials == 2); // replaced right away
+        complete_dials(t);
+        dial_pool_close(pool);
+        CHECK(closed.size() == 1);
+    }
+
+    SECTION("connections closed by the other side are forgotten") {
+        dial_pool_t *pool = dial_pool_new(loop, 4, 1000, fake_dial, fake_close, &t);
+        dial_pool_take(pool);
+        complete_dials(t);
+        CHECK(dial_pool_remove(pool, (void *) 1));
+        CHECK_FALSE(dial_pool_remove(pool, (void *) 1));
+        CHECK(dial_pool_idle_count(pool) == 0);
+        CHECK(t.dials == 2);
+        complete_dials(t);
+        dial_pool_close(pool);
+        CHECK(closed.size() == 1);
+        CHECK(closed[0] == (void *) 2);
+    }
+
+    SECTION("unused connections expire") {
+        dial_pool_t *pool = dial_pool_new(loop, 4, 20, fake_dial, fake_close, &t);
+        dial_pool_take(pool);
+        complete_dials(t);
+        CHECK(dial_pool_idle_count(pool) == 1);
+
+        // the pool timer doesn't keep the loop alive
+        uv_timer_t keepalive;
+        uv_timer_init(loop, &keepalive);
+        uv_timer_start(&keepalive, [](uv_timer_t *) {}, 5, 5);
+        uint64_t start = uv_now(loop);
+        while (closed.empty() && uv_now(loop) - start < 1000) {
+            uv_run(loop, UV_RUN_ONCE);
+        }
+        uv_close((uv_handle_t *) &keepalive, nullptr);
+        CHECK(closed.size() == 1);
+        complete_dials(t);
+        dial_pool_close(pool);
+    }
+
+    SECTION("failed dials back off") {
+        dial_pool_t *pool = dial_pool_new(loop, 4, 1000, fake_dial, fake_close, &t);
+        t.fail = true;
+        dial_pool_take(pool);
+        complete_dials(t);
+        CHECK(dial_pool_idle_count(pool) == 0);
+
+        dial_pool_take(pool);
+        CHECK(t.dials == 1); // waiting for the retry
+        dial_pool_close(pool);
+    }
+
+    SECTION("dials that complete after close are closed") {
+        dial_pool_t *pool = dial_pool_new(loop, 4, 1000, fake_dial, fake_close, &t);
+        dial_pool_take(pool);
+        dial_pool_close(pool);
+        complete_dials(t);
+        CHECK(closed.size() == 1);
+    }
+
+    uv_run(loop, UV_RUN_DEFAULT);
+}
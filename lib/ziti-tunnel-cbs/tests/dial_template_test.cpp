@@ -0,0 +1,80 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "catch2/catch.hpp"
+#include "../dial_template.h"
+
+#include <string>
+
+static std::string render(const dial_template_t *t, const dial_template_values_t *values, size_t len = 128) {
+    char out[128];
+    REQUIRE(len <= sizeof(out));
+    ssize_t n = dial_template_render(t, values, out, len);
+    return n < 0 ? "<too long>" : std::string(out, n);
+}
+
+TEST_CASE("dial template substitution", "[template]") {
+    dial_template_values_t values = {};
+    values.v[DIAL_VAR_TUNNELER_ID] = "edge-router-1";
+    values.v[DIAL_VAR_DST_PROTOCOL] = "tcp";
+    values.v[DIAL_VAR_DST_IP] = "100.64.0.7";
+    values.v[DIAL_VAR_DST_PORT] = "443";
+    values.v[DIAL_VAR_SRC_IP] = "10.0.0.2";
+    values.v[DIAL_VAR_SRC_PORT] = "51234";
+
+    dial_template_t t;
+
+    SECTION("source address") {
+        REQUIRE(dial_template_compile(&t, "$src_ip:$src_port", DIAL_SOURCE_ADDR_VARS) == 0);
+        CHECK(t.num_vars == 2);
+        CHECK(render(&t, &values) == "10.0.0.2:51234");
+    }
+
+    SECTION("every occurrence is replaced") {
+        REQUIRE(dial_template_compile(&t, "$dst_ip-$dst_ip", DIAL_IDENTITY_VARS) == 0);
+        CHECK(render(&t, &values) == "100.64.0.7-100.64.0.7");
+    }
+
+    SECTION("literal text") {
+        REQUIRE(dial_template_compile(&t, "host-$tunneler_id.name.$dst_port$", DIAL_SOURCE_ADDR_VARS) == 0);
+        CHECK(render(&t, &values) == "host-edge-router-1.443$");
+        CHECK(t.num_segs == 5);
+    }
+
+    SECTION("variables that the setting doesn't support are left alone") {
+        REQUIRE(dial_template_compile(&t, "$tunneler_id.name-$dst_protocol", DIAL_IDENTITY_VARS) == 0);
+        CHECK(render(&t, &values) == "$tunneler_id.name-tcp");
+    }
+
+    SECTION("missing values are left alone") {
+        REQUIRE(dial_template_compile(&t, "$dst_hostname:$dst_port", DIAL_IDENTITY_VARS) == 0);
+        CHECK(render(&t, &values) == "$dst_hostname:443");
+    }
+
+    SECTION("no variables") {
+        REQUIRE(dial_template_compile(&t, "static-identity", DIAL_IDENTITY_VARS) == 0);
+        CHECK(t.num_vars == 0);
+        CHECK(render(&t, &values) == "static-identity");
+    }
+
+    SECTION("output too small") {
+        REQUIRE(dial_template_compile(&t, "$src_ip:$src_port", DIAL_SOURCE_ADDR_VARS) == 0);
+        CHECK(render(&t, &values, 14) == "<too long>");
+        CHECK(render(&t, &values, 15) == "10.0.0.2:51234");
+    }
+
+    dial_template_free(&t);
+}
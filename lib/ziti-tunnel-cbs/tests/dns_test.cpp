@@ -17,6 +17,9 @@
 #include "catch2/catch.hpp"
 #include "../dns_host.h"
 
+#include <string>
+#include <vector>
+
 TEST_CASE("resolve", "[dns]") {
     dns_host_init();
 
@@ -120,3 +123,89 @@ TEST_CASE("dns parse MX", "[dns]") {
     free_dns_message(&req);
 
 }
+
+TEST_CASE("dns question end", "[dns]") {
+    uint8_t b[] = {
+  0xbd, 0x2d, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x01, 0x05, 0x79, 0x61, 0x68,
+  0x6f, 0x6f, 0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00,
+  0x0f, 0x00, 0x01, 0x00, 0x00, 0x29, 0x02, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+    CHECK(dns_wire_question_end(b, sizeof(b)) == 27);
+    CHECK(dns_wire_question_end(b, 20) == 0);
+    CHECK(dns_wire_question_end(b, 8) == 0);
+}
+
+static void collect_frame(void *ctx, const uint8_t *msg, size_t len) {
+    auto frames = static_cast<std::vector<std::string> *>(ctx);
+    frames->emplace_back((const char *) msg, len);
+}
+
+TEST_CASE("dns message framing", "[dns]") {
+    std::vector<std::string> frames;
+    dns_frame_buf_t fb = {};
+
+    size_t f1_len, f2_len;
+    uint8_t *f1 = dns_frame_msg((const uint8_t *) "first", 5, &f1_len);
+    uint8_t *f2 = dns_frame_msg((const uint8_t *) "second message", 14, &f2_len);
+    CHECK(f1_len == 7);
+    CHECK(f1[0] == 0);
+    CHECK(f1[1] == 5);
+
+    std::string stream((char *) f1, f1_len);
+    stream.append(2, '\0'); // empty frame
+    stream.append((char *) f2, f2_len);
+    free(f1);
+    free(f2);
+
+    SECTION("single read") {
+        CHECK(dns_frame_read(&fb, (const uint8_t *) stream.data(), stream.size(), collect_frame, &frames) == 0);
+    }
+
+    SECTION("byte at a time") {
+        for (char c: stream) {
+            CHECK(dns_frame_read(&fb, (const uint8_t *) &c, 1, collect_frame, &frames) == 0);
+        }
+    }
+
+    REQUIRE(frames.size() == 3);
+    CHECK(frames[0] == "first");
+    CHECK(frames[1].empty());
+    CHECK(frames[2] == "second message");
+    CHECK(fb.len == 0);
+
+    uint8_t oversized[] = { 0xff, 0xff, 0x00 };
+    CHECK(dns_frame_read(&fb, oversized, sizeof(oversized), collect_frame, &frames) == -1);
+}
+
+static void collect_ttl(uint8_t *ttl, void *ctx) {
+    auto ttls = static_cast<std::vector<uint32_t> *>(ctx);
+    ttls->push_back(((uint32_t) ttl[0] << 24) | (ttl[1] << 16) | (ttl[2] << 8) | ttl[3]);
+}
+
+TEST_CASE("dns wire ttls", "[dns]") {
+    uint8_t resp[] = {
+            0x12, 0x34, 0x81, 0x80, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x01,
+            // a.ziti A IN
+            0x01, 'a', 0x04, 'z', 'i', 't', 'i', 0x00, 0x00, 0x01, 0x00, 0x01,
+            // compressed name, A IN, ttl 300, 100.64.0.3
+            0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x2c, 0x00, 0x04, 0x64, 0x40, 0x00, 0x03,
+            // full name, A IN, ttl 60, 100.64.0.4
+            0x01, 'a', 0x04, 'z', 'i', 't', 'i', 0x00,
+            0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x04, 0x64, 0x40, 0x00, 0x04,
+            // OPT with the DO bit where the ttl would be
+            0x00, 0x00, 0x29, 0x10, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00,
+    };
+
+    std::vector<uint32_t> ttls;
+    CHECK(dns_wire_foreach_ttl(resp, sizeof(resp), collect_ttl, &ttls) == 0);
+    REQUIRE(ttls.size() == 2);
+    CHECK(ttls[0] == 300);
+    CHECK(ttls[1] == 60);
+
+    ttls.clear();
+    CHECK(dns_wire_foreach_ttl(resp, sizeof(resp) - 1, collect_ttl, &ttls) == -1);
+    CHECK(dns_wire_foreach_ttl(resp, 30, collect_ttl, &ttls) == -1);
+}
@@ -0,0 +1,160 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "catch2/catch.hpp"
+#include "../hairpin.h"
+
+#include <string>
+
+struct hairpin_end {
+    hairpin_t *hp = nullptr;
+    int end = 0;
+    mux_t *mux = nullptr;
+    int closed = 0;
+};
+
+struct flow {
+    mux_stream_t *s = nullptr;
+    std::string received;
+    bool eof = false;
+    int err = 0;
+    int connect_status = 1;
+    int written = 0;
+    ssize_t write_status = 0;
+};
+
+static flow hosted;
+
+static int end_write(void *ctx, uint8_t *msg, size_t len, void *req) {
+    auto e = static_cast<hairpin_end *>(ctx);
+    return hairpin_write(e->hp, e->end, msg, len, req);
+}
+
+static void on_end_closed(void *ctx) {
+    static_cast<hairpin_end *>(ctx)->closed++;
+}
+
+static ssize_t on_flow_data(mux_stream_t *s, const uint8_t *data, ssize_t len) {
+    auto f = static_cast<flow *>(mux_stream_data(s));
+    if (len > 0) {
+        f->received.append((const char *) data, len);
+        mux_stream_consumed(s, len);
+    } else if (len == UV_EOF) {
+        f->eof = true;
+    } else {
+        f->err = (int) len;
+    }
+    return len;
+}
+
+static void on_flow_connect(mux_stream_t *s, int status) {
+    static_cast<flow *>(mux_stream_data(s))->connect_status = status;
+}
+
+static void on_flow_written(void *stream_data, ssize_t status, void *ctx) {
+    auto f = static_cast<flow *>(ctx);
+    f->written++;
+    f->write_status = status;
+}
+
+static void on_flow_open(mux_t *mux, mux_stream_t *s, const uint8_t *app_data, size_t len, void *ctx) {
+    hosted = flow();
+    hosted.s = s;
+    hosted.received.assign((const char *) app_data, len);
+    mux_stream_set_data(s, on_flow_data, &hosted);
+    mux_stream_accept(s);
+}
+
+// hairpin and mux timers don't keep the loop alive
+static void run_for(uv_loop_t *loop, uint64_t millis) {
+    uv_timer_t keepalive;
+    uv_timer_init(loop, &keepalive);
+    uv_timer_start(&keepalive, [](uv_timer_t *) {}, millis, 0);
+    uv_run(loop, UV_RUN_DEFAULT);
+    uv_close((uv_handle_t *) &keepalive, nullptr);
+    uv_run(loop, UV_RUN_DEFAULT);
+}
+
+TEST_CASE("hairpin", "[hairpin]") {
+    uv_loop_t *loop = uv_default_loop();
+    hairpin_t *hp = hairpin_new(loop);
+
+    hairpin_end icpt, host;
+    icpt.hp = host.hp = hp;
+    icpt.end = HAIRPIN_INTERCEPT;
+    host.end = HAIRPIN_HOST;
+    icpt.mux = mux_new(loop, end_write, nullptr, &icpt);
+    host.mux = mux_new(loop, end_write, on_flow_open, &host);
+    hairpin_attach(hp, HAIRPIN_INTERCEPT, icpt.mux, nullptr, nullptr);
+    hairpin_attach(hp, HAIRPIN_HOST, host.mux, on_end_closed, &host);
+
+    flow client;
+    const std::string app_data = R"({"dst_protocol":"tcp"})";
+    client.s = mux_stream_open(icpt.mux, (const uint8_t *) app_data.data(), app_data.size(), on_flow_connect,
+                               on_flow_data, &client);
+    REQUIRE(client.s != nullptr);
+    // nothing is delivered from inside the write
+    CHECK(hosted.s == nullptr);
+    run_for(loop, 1);
+    CHECK(client.connect_status == 0);
+    CHECK(hosted.received == app_data);
+    hosted.received.clear();
+
+    SECTION("data in both directions") {
+        const std::string req = "GET / HTTP/1.1\r\n\r\n";
+        REQUIRE(mux_stream_write(client.s, (const uint8_t *) req.data(), req.size(), on_flow_written, &client) == 0);
+        mux_stream_close_write(client.s);
+        const std::string resp(MUX_WINDOW * 3, 'r');
+        REQUIRE(mux_stream_write(hosted.s, (const uint8_t *) resp.data(), resp.size(), on_flow_written, &hosted) == 0);
+        for (int i = 0; i < 100 && (client.received.size() < resp.size() || !hosted.eof); i++) {
+            run_for(loop, 0);
+        }
+        CHECK(hosted.received == req);
+        CHECK(hosted.eof);
+        CHECK(client.received == resp);
+        CHECK(client.written == 1);
+        CHECK(client.write_status == (ssize_t) req.size());
+        CHECK(hosted.written == 1);
+        CHECK(hosted.write_status == (ssize_t) resp.size());
+
+        mux_stream_close(client.s, nullptr);
+        mux_stream_close(hosted.s, nullptr);
+        run_for(loop, 1);
+        hairpin_close(hp, UV_ECANCELED);
+        CHECK(host.closed == 1);
+    }
+
+    SECTION("close with messages in flight") {
+        const std::string req(1000, 'q');
+        REQUIRE(mux_stream_write(client.s, (const uint8_t *) req.data(), req.size(), on_flow_written, &client) == 0);
+        hairpin_close(hp, UV_ECONNABORTED);
+        CHECK(host.closed == 1);
+        CHECK(client.err == UV_ECONNABORTED);
+        CHECK(hosted.err == UV_ECONNABORTED);
+        CHECK(mux_stream_write(client.s, (const uint8_t *) "x", 1, nullptr, nullptr) != 0);
+
+        mux_stream_close(client.s, nullptr);
+        mux_stream_close(hosted.s, nullptr);
+        run_for(loop, 1);
+        CHECK(hosted.received.empty());
+        CHECK(client.written == 1);
+        CHECK(client.write_status == UV_ECANCELED);
+    }
+
+    // the hairpin and both muxes are freed
+    run_for(loop, 1);
+    hosted = flow();
+}
@@ -0,0 +1,294 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "catch2/catch.hpp"
+#include "../host_dial.h"
+
+#include <string>
+
+struct resolve_result {
+    int calls = 0;
+    int status = -1;
+    int count = 0;
+    std::string first;
+};
+
+static void on_resolve(void *ctx, int status, const struct sockaddr_storage *addrs, int count) {
+    auto r = static_cast<resolve_result *>(ctx);
+    r->calls++;
+    r->status = status;
+    r->count = count;
+    if (count > 0) {
+        char buf[64];
+        host_dial_addr_str((const struct sockaddr *) &addrs[0], buf, sizeof(buf));
+        r->first = buf;
+    }
+}
+
+struct dial_result {
+    bool done = false;
+    int status = -1;
+    uv_os_sock_t sock;
+    std::string addr;
+};
+
+static void on_dial(uv_os_sock_t sock, int status, const struct sockaddr *addr, void *ctx) {
+    auto r = static_cast<dial_result *>(ctx);
+    r->done = true;
+    r->status = status;
+    r->sock = sock;
+    if (status == 0) {
+        char buf[64];
+        host_dial_addr_str(addr, buf, sizeof(buf));
+        r->addr = buf;
+    }
+}
+
+static int local_port(uv_tcp_t *tcp) {
+    struct sockaddr_in addr = {};
+    int len = sizeof(addr);
+    uv_tcp_getsockname(tcp, (struct sockaddr *) &addr, &len);
+    return ntohs(addr.sin_port);
+}
+
+TEST_CASE("resolve numeric and cached addresses", "[host]") {
+    uv_loop_t *loop = uv_default_loop();
+    host_dial_ctx_t *hd = host_dial_ctx_new(loop);
+
+    resolve_result numeric;
+    REQUIRE(host_resolve(hd, "127.0.0.1", "8080", SOCK_STREAM, true, on_resolve, &numeric) == 0);
+    CHECK(numeric.calls == 1); // no worker pool round trip
+    CHECK(numeric.status == 0);
+    CHECK(numeric.first == "127.0.0.1:8080");
+
+    resolve_result first, second;
+    REQUIRE(host_resolve(hd, "localhost", "8080", SOCK_STREAM, false, on_resolve, &first) == 0);
+    REQUIRE(host_resolve(hd, "localhost", "8080", SOCK_STREAM, false, on_resolve, &second) == 0);
+    uv_run(loop, UV_RUN_DEFAULT);
+    CHECK(first.calls == 1);
+    CHECK(second.calls == 1);
+    REQUIRE(first.status == 0);
+    CHECK(first.count > 0);
+
+    resolve_result cached;
+    REQUIRE(host_resolve(hd, "localhost", "8080", SOCK_STREAM, false, on_resolve, &cached) == 0);
+    CHECK(cached.calls == 1);
+    CHECK(cached.first == first.first);
+
+    host_dial_ctx_release(hd);
+}
+
+TEST_CASE("dial moves on from dead address", "[host]") {
+    uv_loop_t *loop = uv_default_loop();
+    host_dial_ctx_t *hd = host_dial_ctx_new(loop);
+
+    struct sockaddr_in any = {};
+    uv_ip4_addr("127.0.0.1", 0, &any);
+
+    uv_tcp_t server;
+    uv_tcp_init(loop, &server);
+    REQUIRE(uv_tcp_bind(&server, (struct sockaddr *) &any, 0) == 0);
+    REQUIRE(uv_listen((uv_stream_t *) &server, 5, [](uv_stream_t *, int) {}) == 0);
+
+    // bound, but not listening
+    uv_tcp_t closed;
+    uv_tcp_init(loop, &closed);
+    REQUIRE(uv_tcp_bind(&closed, (struct sockaddr *) &any, 0) == 0);
+    int closed_port = local_port(&closed);
+    uv_close((uv_handle_t *) &closed, nullptr);
+    uv_run(loop, UV_RUN_NOWAIT);
+
+    struct sockaddr_storage addrs[2] = {};
+    uv_ip4_addr("127.0.0.1", closed_port, (struct sockaddr_in *) &addrs[0]);
+    uv_ip4_addr("127.0.0.1", local_port(&server), (struct sockaddr_in *) &addrs[1]);
+
+    dial_result r;
+    REQUIRE(host_dial_connect(hd, addrs, 2, nullptr, on_dial, &r) == 0);
+    while (!r.done) {
+        uv_run(loop, UV_RUN_ONCE);
+    }
+    REQUIRE(r.status == 0);
+    CHECK(r.addr == "127.0.0.1:" + std::to_string(local_port(&server)));
+
+    // refused address is backing off now
+    CHECK(host_dial_pick(hd, addrs, 2) == &addrs[1]);
+
+    uv_tcp_t client;
+    uv_tcp_init(loop, &client);
+    REQUIRE(uv_tcp_open(&client, r.sock) == 0);
+    uv_close((uv_handle_t *) &client, nullptr);
+    uv_close((uv_handle_t *) &server, nullptr);
+    host_dial_ctx_release(hd);
+    uv_run(loop, UV_RUN_DEFAULT);
+}
+
+TEST_CASE("parse numeric address", "[host]") {
+    struct sockaddr_storage addr = {};
+    char str[64];
+
+    REQUIRE(host_dial_parse_addr("10.1.2.3", "80", &addr) == 0);
+    host_dial_addr_str((struct sockaddr *) &addr, str, sizeof(str));
+    CHECK(std::string(str) == "10.1.2.3:80");
+
+    REQUIRE(host_dial_parse_addr("fd00::1", nullptr, &addr) == 0);
+    host_dial_addr_str((struct sockaddr *) &addr, str, sizeof(str));
+    CHECK(std::string(str) == "[fd00::1]:0");
+
+    CHECK(host_dial_parse_addr("10.1.2.3", "http", &addr) != 0);
+    CHECK(host_dial_parse_addr("10.1.2.3", "65536", &addr) != 0);
+    CHECK(host_dial_parse_addr("localhost", "80", &addr) != 0);
+}
+
+TEST_CASE("load balancing policies", "[host]") {
+    uv_loop_t *loop = uv_default_loop();
+    host_dial_ctx_t *hd = host_dial_ctx_new(loop);
+
+    struct sockaddr_storage addrs[3] = {};
+    uv_ip4_addr("10.0.0.1", 80, (struct sockaddr_in *) &addrs[0]);
+    uv_ip4_addr("10.0.0.2", 80, (struct sockaddr_in *) &addrs[1]);
+    uv_ip4_addr("10.0.0.3", 80, (struct sockaddr_in *) &addrs[2]);
+
+    SECTION("ordered") {
+        CHECK(host_dial_pick(hd, addrs, 3) == &addrs[0]);
+        CHECK(host_dial_pick(hd, addrs, 3) == &addrs[0]);
+    }
+
+    SECTION("round-robin") {
+        host_dial_set_policy(hd, HOST_LB_ROUND_ROBIN);
+        CHECK(host_dial_pick(hd, addrs, 3) == &addrs[0]);
+        CHECK(host_dial_pick(hd, addrs, 3) == &addrs[1]);
+        CHECK(host_dial_pick(hd, addrs, 3) == &addrs[2]);
+        CHECK(host_dial_pick(hd, addrs, 3) == &addrs[0]);
+    }
+
+    SECTION("least connections") {
+        host_dial_set_policy(hd, HOST_LB_LEAST_CONN);
+        host_dial_conn_opened(hd, (struct sockaddr *) &addrs[0]);
+        host_dial_conn_opened(hd, (struct sockaddr *) &addrs[2]);
+        for (int i = 0; i < 3; i++) {
+            CHECK(host_dial_pick(hd, addrs, 3) == &addrs[1]);
+        }
+
+        host_dial_conn_opened(hd, (struct sockaddr *) &addrs[1]);
+        host_dial_conn_opened(hd, (struct sockaddr *) &addrs[1]);
+        host_dial_conn_closed(hd, (struct sockaddr *) &addrs[2]);
+        CHECK(host_dial_pick(hd, addrs, 3) == &addrs[2]);
+    }
+
+    host_dial_ctx_release(hd);
+}
+
+TEST_CASE("circuit breaker opens after consecutive failures", "[host]") {
+    uv_loop_t *loop = uv_default_loop();
+    host_dial_ctx_t *hd = host_dial_ctx_new(loop);
+
+    // bound, but not listening
+    struct sockaddr_in any = {};
+    uv_ip4_addr("127.0.0.1", 0, &any);
+    uv_tcp_t closed;
+    uv_tcp_init(loop, &closed);
+    REQUIRE(uv_tcp_bind(&closed, (struct sockaddr *) &any, 0) == 0);
+    int closed_port = local_port(&closed);
+    uv_close((uv_handle_t *) &closed, nullptr);
+    uv_run(loop, UV_RUN_NOWAIT);
+
+    struct sockaddr_storage addr = {};
+    uv_ip4_addr("127.0.0.1", closed_port, (struct sockaddr_in *) &addr);
+
+    for (int i = 0; i < HOST_BREAKER_FAILURES; i++) {
+        CHECK(host_dial_pick(hd, &addr, 1) == &addr);
+        dial_result r;
+        REQUIRE(host_dial_connect(hd, &addr, 1, nullptr, on_dial, &r) == 0);
+        while (!r.done) {
+            uv_run(loop, UV_RUN_ONCE);
+        }
+        CHECK(r.status == UV_ECONNREFUSED);
+    }
+
+    // open: connections are rejected without trying
+    dial_result r;
+    CHECK(host_dial_connect(hd, &addr, 1, nullptr, on_dial, &r) == HOST_DIAL_ECIRCUIT);
+    CHECK_FALSE(r.done);
+    CHECK(host_dial_pick(hd, &addr, 1) == nullptr);
+
+    host_dial_ctx_release(hd);
+    uv_run(loop, UV_RUN_DEFAULT);
+}
+
+TEST_CASE("terminator cost from observed load", "[host]") {
+    host_load_t load = {};
+    CHECK(host_load_cost(&load, 100, 0) == 100);
+
+    load.active = 3;
+    load.connect_millis = 12.5;
+    load.attempts = 10;
+    load.failures = 1;
+    // 3 connections, 12.5ms to connect, 10% failed
+    CHECK(host_load_cost(&load, 100, 0) == 100 + 3 * HOST_COST_PER_ACTIVE_CONN + 12 + 10 * HOST_COST_PER_FAILURE_PCT);
+
+    SECTION("capped at the configured max") {
+        CHECK(host_load_cost(&load, 100, 200) == 200);
+        CHECK(host_load_cost(&load, 100, 1000) < 1000);
+    }
+
+    SECTION("never more than the fabric allows") {
+        load.active = 100000;
+        CHECK(host_load_cost(&load, 0, 0) == HOST_COST_MAX);
+        CHECK(host_load_cost(&load, 0, -1) == HOST_COST_MAX);
+        CHECK(host_load_cost(&load, 0, 2 * (int64_t) HOST_COST_MAX) == HOST_COST_MAX);
+    }
+}
+
+TEST_CASE("terminator cost hysteresis", "[host]") {
+    SECTION("small costs change by the minimum") {
+        CHECK_FALSE(host_cost_changed(100, 100));
+        CHECK_FALSE(host_cost_changed(100, 100 + HOST_COST_MIN_CHANGE - 1));
+        CHECK(host_cost_changed(100, 100 + HOST_COST_MIN_CHANGE));
+        CHECK_FALSE(host_cost_changed(100, 100 - HOST_COST_MIN_CHANGE + 1));
+        CHECK(host_cost_changed(100, 100 - HOST_COST_MIN_CHANGE));
+        CHECK(host_cost_changed(0, HOST_COST_MIN_CHANGE));
+    }
+
+    SECTION("large costs change by a percentage") {
+        // 20% of 1000 is more than the minimum
+        CHECK_FALSE(host_cost_changed(1000, 1199));
+        CHECK(host_cost_changed(1000, 1200));
+        CHECK_FALSE(host_cost_changed(1000, 801));
+        CHECK(host_cost_changed(1000, 800));
+    }
+}
+
+TEST_CASE("connection setup latency", "[host]") {
+    host_setup_latency_t latency = {};
+    host_setup_latency_add(&latency, 1, 2, 3, 6);
+    CHECK(latency.count == 1);
+    CHECK(latency.resolve_millis == Approx(1));
+    CHECK(latency.connect_millis == Approx(2));
+    CHECK(latency.accept_millis == Approx(3));
+    CHECK(latency.total_millis == Approx(6));
+    CHECK(latency.max_total_millis == Approx(6));
+
+    // one slow connect moves the averages a quarter of the way, and stays as the max
+    host_setup_latency_add(&latency, 1, 42, 3, 46);
+    CHECK(latency.count == 2);
+    CHECK(latency.resolve_millis == Approx(1));
+    CHECK(latency.connect_millis == Approx(12));
+    CHECK(latency.total_millis == Approx(16));
+    CHECK(latency.max_total_millis == Approx(46));
+
+    host_setup_latency_add(&latency, 1, 2, 3, 6);
+    CHECK(latency.max_total_millis == Approx(46));
+}
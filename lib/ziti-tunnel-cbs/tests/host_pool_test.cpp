@@ -0,0 +1,78 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "catch2/catch.hpp"
+#include "../host_pool.h"
+
+#include <string>
+
+TEST_CASE("pool keeps idle connections", "[host]") {
+    uv_loop_t *loop = uv_default_loop();
+    host_dial_ctx_t *hd = host_dial_ctx_new(loop);
+
+    struct sockaddr_in any = {};
+    uv_ip4_addr("127.0.0.1", 0, &any);
+
+    // handshakes complete in the backlog, connections are never accepted
+    uv_tcp_t server;
+    uv_tcp_init(loop, &server);
+    REQUIRE(uv_tcp_bind(&server, (struct sockaddr *) &any, 0) == 0);
+    REQUIRE(uv_listen((uv_stream_t *) &server, 5, [](uv_stream_t *, int) {}) == 0);
+    struct sockaddr_in bound = {};
+    int len = sizeof(bound);
+    uv_tcp_getsockname(&server, (struct sockaddr *) &bound, &len);
+    std::string port = std::to_string(ntohs(bound.sin_port));
+
+    host_pool_t *pool = host_pool_new(hd, loop, "127.0.0.1", port.c_str(), true, 2, 60 * 1000);
+    REQUIRE(pool != nullptr);
+    while (host_pool_idle_count(pool) < 2) {
+        uv_run(loop, UV_RUN_ONCE);
+    }
+
+    uv_os_sock_t sock;
+    struct sockaddr_storage peer = {};
+    REQUIRE(host_pool_take(pool, &sock, &peer) == 0);
+    char peer_str[64];
+    host_dial_addr_str((struct sockaddr *) &peer, peer_str, sizeof(peer_str));
+    CHECK(std::string(peer_str) == "127.0.0.1:" + port);
+    CHECK(host_pool_idle_count(pool) == 1);
+
+    uv_tcp_t client;
+    uv_tcp_init(loop, &client);
+    REQUIRE(uv_tcp_open(&client, sock) == 0);
+
+    // refilled in the background
+    while (host_pool_idle_count(pool) < 2) {
+        uv_run(loop, UV_RUN_ONCE);
+    }
+
+    host_pool_close(pool);
+    uv_close((uv_handle_t *) &client, nullptr);
+    uv_close((uv_handle_t *) &server, nullptr);
+    host_dial_ctx_release(hd);
+    uv_run(loop, UV_RUN_DEFAULT);
+}
+
+TEST_CASE("pool rejects bad settings", "[host]") {
+    uv_loop_t *loop = uv_default_loop();
+    host_dial_ctx_t *hd = host_dial_ctx_new(loop);
+
+    CHECK(host_pool_new(hd, loop, "127.0.0.1", "80", true, 0, 1000) == nullptr);
+    CHECK(host_pool_new(hd, loop, "127.0.0.1", "80", true, HOST_POOL_MAX_SIZE + 1, 1000) == nullptr);
+    CHECK(host_pool_new(hd, loop, "127.0.0.1", "80", true, 1, 0) == nullptr);
+
+    host_dial_ctx_release(hd);
+}
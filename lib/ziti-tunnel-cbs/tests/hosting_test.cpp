@@ -0,0 +1,168 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "catch2/catch.hpp"
+#include "../ziti_hosting.h"
+#include "../hairpin.h"
+
+#include <cstring>
+#include <string>
+
+TEST_CASE("replace listener with a new terminator cost", "[host]") {
+    // listeners are only compared and handed back, never used
+    int conns[2];
+    auto current = reinterpret_cast<ziti_connection>(&conns[0]);
+    auto pending = reinterpret_cast<ziti_connection>(&conns[1]);
+
+    host_ctx_t host_ctx;
+    memset(&host_ctx, 0, sizeof(host_ctx));
+    host_ctx.service_name = (char *) "cost-test";
+    host_ctx.listener = current;
+    host_ctx.pending_listener = pending;
+    host_ctx.advertised_cost = 100;
+    host_ctx.listen_opts.terminator_cost = 300;
+
+    SECTION("bound") {
+        CHECK(hosted_service_replace_listener(&host_ctx, pending, ZITI_OK) == current);
+        CHECK(host_ctx.listener == pending);
+        CHECK(host_ctx.pending_listener == nullptr);
+        CHECK(host_ctx.advertised_cost == 300);
+        CHECK(host_ctx.listen_opts.terminator_cost == 300);
+    }
+
+    SECTION("failed") {
+        CHECK(hosted_service_replace_listener(&host_ctx, pending, ZITI_SERVICE_UNAVAILABLE) == pending);
+        CHECK(host_ctx.listener == current);
+        CHECK(host_ctx.pending_listener == nullptr);
+        CHECK(host_ctx.advertised_cost == 100);
+        CHECK(host_ctx.listen_opts.terminator_cost == 100);
+    }
+}
+
+struct reset_server {
+    uv_tcp_t tcp;
+    int accepted = 0;
+    int closed = 0;
+};
+
+static void on_reset_server_conn(uv_stream_t *srv, int status) {
+    auto rs = static_cast<reset_server *>(srv->data);
+    auto c = new uv_tcp_t;
+    uv_tcp_init(srv->loop, c);
+    uv_unref((uv_handle_t *) c);
+    c->data = rs;
+    REQUIRE(uv_accept(srv, (uv_stream_t *) c) == 0);
+    rs->accepted++;
+    uv_read_start((uv_stream_t *) c,
+                  [](uv_handle_t *, size_t, uv_buf_t *b) {
+                      static char buf[1024];
+                      *b = uv_buf_init(buf, sizeof(buf));
+                  },
+                  [](uv_stream_t *c, ssize_t nread, const uv_buf_t *) {
+                      if (nread < 0) {
+                          static_cast<reset_server *>(c->data)->closed++;
+                          uv_close((uv_handle_t *) c, [](uv_handle_t *h) { delete (uv_tcp_t *) h; });
+                      }
+                  });
+}
+
+static int intercept_write(void *ctx, uint8_t *msg, size_t len, void *req) {
+    return hairpin_write(static_cast<hairpin_t *>(ctx), HAIRPIN_INTERCEPT, msg, len, req);
+}
+
+// hairpin, mux and dial timers don't keep the loop alive, and neither does the server
+static void run_for(uv_loop_t *loop, uint64_t millis) {
+    uv_timer_t keepalive;
+    uv_timer_init(loop, &keepalive);
+    uv_timer_start(&keepalive, [](uv_timer_t *) {}, millis, 0);
+    uv_run(loop, UV_RUN_DEFAULT);
+    uv_close((uv_handle_t *) &keepalive, nullptr);
+    uv_run(loop, UV_RUN_DEFAULT);
+}
+
+TEST_CASE("hosted stream closed while its server is being dialed", "[host]") {
+    uv_loop_t *loop = uv_default_loop();
+
+    reset_server server;
+    uv_tcp_init(loop, &server.tcp);
+    server.tcp.data = &server;
+    struct sockaddr_in addr = {};
+    uv_ip4_addr("127.0.0.1", 0, &addr);
+    REQUIRE(uv_tcp_bind(&server.tcp, (struct sockaddr *) &addr, 0) == 0);
+    REQUIRE(uv_listen((uv_stream_t *) &server.tcp, 4, on_reset_server_conn) == 0);
+    uv_unref((uv_handle_t *) &server.tcp);
+    int len = sizeof(addr);
+    uv_tcp_getsockname(&server.tcp, (struct sockaddr *) &addr, &len);
+
+    host_ctx_t host_ctx;
+    memset(&host_ctx, 0, sizeof(host_ctx));
+    host_ctx.service_name = (char *) "reset-test";
+    host_ctx.loop = loop;
+    host_ctx.proto_u.protocol = "tcp";
+    host_ctx.port_u.port = ntohs(addr.sin_port);
+    host_ctx.dial = host_dial_ctx_new(loop);
+
+    SECTION("resolving") {
+        // hostnames are resolved on the worker pool, so the reset comes first
+        host_ctx.addr_u.address = "localhost";
+    }
+    SECTION("connecting") {
+        host_ctx.addr_u.address = "127.0.0.1";
+    }
+
+    hairpin_t *hp = hairpin_new(loop);
+    mux_t *icpt = mux_new(loop, intercept_write, nullptr, hp);
+    hairpin_attach(hp, HAIRPIN_INTERCEPT, icpt, nullptr, nullptr);
+    hosted_service_hairpin(&host_ctx, hp, "reset-client");
+
+    // the hosting side starts the dial when the open is delivered. the client goes away before it completes:
+    // the reset is delivered with the open, or the timer closes the whole mux conn right after the delivery
+    bool close_conn = GENERATE(false, true);
+    const std::string app_data = R"({"dst_protocol":"tcp"})";
+    mux_stream_t *s = mux_stream_open(icpt, (const uint8_t *) app_data.data(), app_data.size(),
+                                      [](mux_stream_t *, int) {},
+                                      [](mux_stream_t *, const uint8_t *, ssize_t len) { return len; }, nullptr);
+    REQUIRE(s != nullptr);
+    uv_timer_t closer;
+    uv_timer_init(loop, &closer);
+    closer.data = hp;
+    if (close_conn) {
+        uv_timer_start(&closer, [](uv_timer_t *t) { hairpin_close(static_cast<hairpin_t *>(t->data), UV_ECONNRESET); },
+                       0, 0);
+    } else {
+        mux_stream_close(s, nullptr);
+    }
+    for (int i = 0; i < 100 && host_ctx.load.attempts == 0; i++) {
+        run_for(loop, 10);
+    }
+    run_for(loop, 10);
+
+    // the connection was counted as failed when it was freed, and a server connection that completed was closed
+    CHECK(host_ctx.load.attempts == 1);
+    CHECK(host_ctx.load.failures == 1);
+    CHECK(server.closed == server.accepted);
+
+    if (close_conn) {
+        // the stream failed with the conn, and is closed like any failed stream
+        mux_stream_close(s, nullptr);
+    } else {
+        hairpin_close(hp, UV_ECANCELED);
+    }
+    uv_close((uv_handle_t *) &closer, nullptr);
+    uv_close((uv_handle_t *) &server.tcp, nullptr);
+    host_dial_ctx_release(host_ctx.dial);
+    run_for(loop, 1);
+}
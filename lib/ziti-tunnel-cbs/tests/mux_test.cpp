@@ -0,0 +1,251 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "catch2/catch.hpp"
+#include "../mux.h"
+
+#include <deque>
+#include <string>
+
+// two muxes connected back to back. messages are delivered by pump(), never from inside a write
+struct wire_msg {
+    mux_t *to;
+    mux_t *from;
+    uint8_t *msg;
+    size_t len;
+    void *req;
+};
+
+struct mux_end {
+    mux_t *mux = nullptr;
+    mux_end *peer = nullptr;
+};
+
+struct stream_end {
+    mux_stream_t *s = nullptr;
+    std::string received;
+    bool eof = false;
+    int err = 0;
+    int connect_status = 1;
+    bool take = true;
+    int written = 0;
+    ssize_t write_status = 0;
+    bool write_saw_stream = false;
+};
+
+static std::deque<wire_msg> wire;
+static stream_end accepted;
+
+static int wire_write(void *ctx, uint8_t *msg, size_t len, void *req) {
+    auto e = static_cast<mux_end *>(ctx);
+    wire.push_back({e->peer->mux, e->mux, msg, len, req});
+    return 0;
+}
+
+// mux timers don't keep the loop alive
+static void run_for(uv_loop_t *loop, uint64_t millis) {
+    uv_timer_t keepalive;
+    uv_timer_init(loop, &keepalive);
+    uv_timer_start(&keepalive, [](uv_timer_t *) {}, millis, 0);
+    uv_run(loop, UV_RUN_DEFAULT);
+    uv_close((uv_handle_t *) &keepalive, nullptr);
+    uv_run(loop, UV_RUN_DEFAULT);
+}
+
+/** delivers messages in pieces of `split` bytes, if it is set */
+static void pump(uv_loop_t *loop, size_t split = 0) {
+    for (int i = 0; i < 100 && !wire.empty(); i++) {
+        while (!wire.empty()) {
+            wire_msg m = wire.front();
+            wire.pop_front();
+            size_t step = split > 0 ? split : m.len;
+            for (size_t off = 0; off < m.len; off += step) {
+                mux_on_data(m.to, m.msg + off, std::min(step, m.len - off));
+            }
+            free(m.msg);
+            mux_written(m.from, m.req, 0);
+        }
+        run_for(loop, 0);
+    }
+}
+
+static ssize_t on_stream_data(mux_stream_t *s, const uint8_t *data, ssize_t len) {
+    auto e = static_cast<stream_end *>(mux_stream_data(s));
+    if (len == UV_EOF) {
+        e->eof = true;
+    } else if (len < 0) {
+        e->err = (int) len;
+    } else if (e->take) {
+        e->received.append((const char *) data, len);
+        mux_stream_consumed(s, len);
+        return len;
+    } else {
+        return 0;
+    }
+    return len;
+}
+
+static void on_stream_connect(mux_stream_t *s, int status) {
+    static_cast<stream_end *>(mux_stream_data(s))->connect_status = status;
+}
+
+static void on_stream_written(void *stream_data, ssize_t status, void *ctx) {
+    auto e = static_cast<stream_end *>(ctx);
+    e->written++;
+    e->write_status = status;
+    e->write_saw_stream = stream_data != nullptr;
+}
+
+static void on_open(mux_t *mux, mux_stream_t *s, const uint8_t *app_data, size_t len, void *ctx) {
+    accepted = stream_end();
+    accepted.s = s;
+    accepted.received.assign((const char *) app_data, len);
+    mux_stream_set_data(s, on_stream_data, &accepted);
+    mux_stream_accept(s);
+}
+
+TEST_CASE("mux streams", "[mux]") {
+    uv_loop_t *loop = uv_default_loop();
+    wire.clear();
+
+    mux_end a, b;
+    a.peer = &b;
+    b.peer = &a;
+    a.mux = mux_new(loop, wire_write, nullptr, &a);
+    b.mux = mux_new(loop, wire_write, on_open, &b);
+
+    stream_end client;
+    const std::string app_data = R"({"dst_protocol":"tcp"})";
+    client.s = mux_stream_open(a.mux, (const uint8_t *) app_data.data(), app_data.size(), on_stream_connect,
+                               on_stream_data, &client);
+    REQUIRE(client.s != nullptr);
+    pump(loop);
+    CHECK(client.connect_status == 0);
+    CHECK(accepted.received == app_data);
+    accepted.received.clear();
+    CHECK(mux_stream_count(a.mux) == 1);
+    CHECK(mux_stream_count(b.mux) == 1);
+    bool underlay_closed = false;
+
+    SECTION("data and half-close in both directions") {
+        size_t split = GENERATE(0, 1, 5);
+        const std::string req = "GET / HTTP/1.1\r\n\r\n";
+        REQUIRE(mux_stream_write(client.s, (const uint8_t *) req.data(), req.size(), on_stream_written, &client) == 0);
+        REQUIRE(mux_stream_close_write(client.s) == 0);
+        pump(loop, split);
+        CHECK(accepted.received == req);
+        CHECK(accepted.eof);
+        CHECK(client.written == 1);
+        CHECK(client.write_status == (ssize_t) req.size());
+        CHECK(client.write_saw_stream);
+
+        const std::string resp(100000, 'r');
+        REQUIRE(mux_stream_write(accepted.s, (const uint8_t *) resp.data(), resp.size(), nullptr, nullptr) == 0);
+        mux_stream_close_write(accepted.s);
+        pump(loop, split);
+        CHECK(client.received == resp);
+        CHECK(client.eof);
+        CHECK(client.err == 0);
+
+        mux_stream_close(client.s, nullptr);
+        mux_stream_close(accepted.s, nullptr);
+        CHECK(mux_stream_count(a.mux) == 0);
+        CHECK(mux_stream_count(b.mux) == 0);
+    }
+
+    SECTION("flow control") {
+        accepted.take = false;
+        const std::string big(MUX_WINDOW * 2, 'x');
+        REQUIRE(mux_stream_write(client.s, (const uint8_t *) big.data(), big.size(), on_stream_written, &client) == 0);
+        pump(loop);
+        // nothing more than the window is in flight, and the write isn't complete
+        CHECK(client.written == 0);
+
+        accepted.take = true;
+        for (int i = 0; i < 100 && accepted.received.size() < big.size(); i++) {
+            run_for(loop, MUX_RETRY_MILLIS);
+            pump(loop);
+        }
+        CHECK(accepted.received == big);
+        CHECK(client.written == 1);
+
+        mux_stream_close(client.s, nullptr);
+        pump(loop);
+        CHECK(accepted.err == UV_ECONNRESET);
+        mux_stream_close(accepted.s, nullptr);
+    }
+
+    SECTION("reset") {
+        mux_stream_close(accepted.s, nullptr);
+        pump(loop);
+        CHECK(client.err == UV_ECONNRESET);
+        CHECK(mux_stream_write(client.s, (const uint8_t *) "x", 1, nullptr, nullptr) == UV_EPIPE);
+        mux_stream_close(client.s, nullptr);
+    }
+
+    SECTION("underlay failure") {
+        // queued behind a window that never opens
+        accepted.take = false;
+        const std::string big(MUX_WINDOW + 1, 'x');
+        REQUIRE(mux_stream_write(client.s, (const uint8_t *) big.data(), big.size(), on_stream_written, &client) == 0);
+        pump(loop);
+
+        mux_close(a.mux, UV_ECONNABORTED);
+        mux_close(b.mux, UV_ECONNABORTED);
+        underlay_closed = true;
+        CHECK(client.err == UV_ECONNABORTED);
+        CHECK(accepted.err == UV_ECONNABORTED);
+        CHECK(mux_stream_open(a.mux, nullptr, 0, on_stream_connect, on_stream_data, &client) == nullptr);
+
+        mux_stream_close(client.s, nullptr);
+        CHECK(client.written == 0);
+        run_for(loop, 0);
+        CHECK(client.written == 1);
+        CHECK(client.write_status == UV_ECANCELED);
+        CHECK_FALSE(client.write_saw_stream);
+        mux_stream_close(accepted.s, nullptr);
+    }
+
+    pump(loop);
+    if (!underlay_closed) {
+        mux_close(a.mux, 0);
+        mux_close(b.mux, 0);
+    }
+    run_for(loop, 1);
+}
+
+TEST_CASE("mux rejects unexpected streams", "[mux]") {
+    uv_loop_t *loop = uv_default_loop();
+    wire.clear();
+
+    mux_end a, b;
+    a.peer = &b;
+    b.peer = &a;
+    a.mux = mux_new(loop, wire_write, nullptr, &a);
+    b.mux = mux_new(loop, wire_write, nullptr, &b);
+
+    // b doesn't accept streams
+    stream_end client;
+    client.s = mux_stream_open(a.mux, nullptr, 0, on_stream_connect, on_stream_data, &client);
+    pump(loop);
+    CHECK(client.connect_status == UV_ECONNREFUSED);
+    mux_stream_close(client.s, nullptr);
+
+    pump(loop);
+    mux_close(a.mux, 0);
+    mux_close(b.mux, 0);
+    run_for(loop, 1);
+}
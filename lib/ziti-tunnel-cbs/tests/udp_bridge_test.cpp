@@ -0,0 +1,150 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "catch2/catch.hpp"
+#include "../udp_bridge.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+static void collect_frame(void *ctx, const uint8_t *dgram, size_t len) {
+    auto frames = static_cast<std::vector<std::string> *>(ctx);
+    frames->emplace_back((const char *) dgram, len);
+}
+
+TEST_CASE("udp frames split across reads", "[udp]") {
+    std::string in;
+    uint8_t frame[UDP_FRAME_HDR + 16];
+    for (const char *d : {"", "one", "datagram two"}) {
+        size_t n = udp_frame_put(frame, (const uint8_t *) d, strlen(d));
+        in.append((const char *) frame, n);
+    }
+
+    for (size_t step : {in.size(), (size_t) 1, (size_t) 3}) {
+        udp_frame_reader_t r = {};
+        std::vector<std::string> frames;
+        for (size_t off = 0; off < in.size(); off += step) {
+            size_t len = std::min(step, in.size() - off);
+            udp_frame_read(&r, (const uint8_t *) in.data() + off, len, collect_frame, &frames);
+        }
+        CHECK(r.len == 0);
+        REQUIRE(frames.size() == 3);
+        CHECK(frames[0].empty());
+        CHECK(frames[1] == "one");
+        CHECK(frames[2] == "datagram two");
+        udp_frame_reader_free(&r);
+    }
+}
+
+struct bridge_test {
+    std::vector<std::string> msgs;
+    size_t bytes = 0;
+    udp_bridge_t *bridge = nullptr;
+};
+
+static int collect_msg(void *ctx, uint8_t *msg, size_t len) {
+    auto t = static_cast<bridge_test *>(ctx);
+    t->msgs.emplace_back((const char *) msg, len);
+    t->bytes += len;
+    free(msg);
+    if (t->bridge) udp_bridge_write_done(t->bridge, len); // the hello is written during start
+    return 0;
+}
+
+TEST_CASE("udp bridge batches datagrams", "[udp]") {
+    uv_loop_t *loop = uv_default_loop();
+
+    struct sockaddr_in any = {};
+    uv_ip4_addr("127.0.0.1", 0, &any);
+
+    uv_udp_t server;
+    uv_udp_init(loop, &server);
+    REQUIRE(uv_udp_bind(&server, (struct sockaddr *) &any, 0) == 0);
+    struct sockaddr_in server_addr = {};
+    int len = sizeof(server_addr);
+    uv_udp_getsockname(&server, (struct sockaddr *) &server_addr, &len);
+
+    uv_udp_t udp;
+    REQUIRE(uv_udp_init_ex(loop, &udp, AF_UNSPEC | UV_UDP_RECVMMSG) == 0);
+    REQUIRE(uv_udp_connect(&udp, (struct sockaddr *) &server_addr) == 0);
+    struct sockaddr_in bridge_addr = {};
+    len = sizeof(bridge_addr);
+    uv_udp_getsockname(&udp, (struct sockaddr *) &bridge_addr, &len);
+
+    bridge_test t;
+    udp.data = &t;
+    t.bridge = udp_bridge_start(&udp, true, collect_msg, [](void *, int) {}, &t);
+    REQUIRE(t.bridge != nullptr);
+
+    SECTION("server to ziti") {
+        // empty datagrams are datagrams too
+        std::vector<std::string> sent = {"a", "", "bb", "ccc", std::string(1200, 'd')};
+        size_t expected = UDP_FRAMING_HELLO_LEN;
+        for (auto &d : sent) {
+            uv_buf_t b = uv_buf_init((char *) d.data(), (unsigned int) d.size());
+            REQUIRE(uv_udp_try_send(&server, &b, 1, (struct sockaddr *) &bridge_addr) == (int) d.size());
+            expected += UDP_FRAME_HDR + d.size();
+        }
+        while (t.bytes < expected) {
+            uv_run(loop, UV_RUN_ONCE);
+        }
+
+        // hello goes out before the datagrams, as its own message
+        REQUIRE(t.msgs.size() >= 2);
+        CHECK(t.msgs[0] == std::string(UDP_FRAMING_HELLO, UDP_FRAMING_HELLO_LEN));
+
+        udp_frame_reader_t r = {};
+        std::vector<std::string> frames;
+        for (size_t i = 1; i < t.msgs.size(); i++) {
+            udp_frame_read(&r, (const uint8_t *) t.msgs[i].data(), t.msgs[i].size(), collect_frame, &frames);
+        }
+        udp_frame_reader_free(&r);
+        REQUIRE(frames.size() == sent.size());
+        for (size_t i = 0; i < sent.size(); i++) {
+            CHECK(frames[i] == sent[i]);
+        }
+    }
+
+    SECTION("ziti to server") {
+        static std::vector<std::string> received;
+        received.clear();
+        uv_udp_recv_start(&server,
+                          [](uv_handle_t *, size_t, uv_buf_t *b) { *b = uv_buf_init((char *) malloc(2048), 2048); },
+                          [](uv_udp_t *, ssize_t nread, const uv_buf_t *b, const struct sockaddr *, unsigned) {
+                              if (nread > 0) received.emplace_back(b->base, nread);
+                              free(b->base);
+                          });
+
+        // more than one batch
+        for (int i = 0; i < UDP_BRIDGE_BATCH + 2; i++) {
+            std::string d = "datagram " + std::to_string(i);
+            REQUIRE(udp_bridge_send(t.bridge, (const uint8_t *) d.data(), d.size()) == 0);
+        }
+        while (received.size() < UDP_BRIDGE_BATCH + 2) {
+            uv_run(loop, UV_RUN_ONCE);
+        }
+        for (int i = 0; i < UDP_BRIDGE_BATCH + 2; i++) {
+            CHECK(received[i] == "datagram " + std::to_string(i));
+        }
+    }
+
+    udp_bridge_close(t.bridge);
+    CHECK(udp.data == &t);
+    uv_close((uv_handle_t *) &udp, nullptr);
+    uv_close((uv_handle_t *) &server, nullptr);
+    uv_run(loop, UV_RUN_DEFAULT);
+}
@@ -0,0 +1,112 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "catch2/catch.hpp"
+#include "../write_coalescer.h"
+
+#include <string>
+#include <vector>
+
+struct coalesce_test {
+    std::vector<std::string> batches;
+    std::vector<std::vector<void *>> ctxs;
+};
+
+static void collect_batch(void *ctx, write_batch_t *batch) {
+    auto t = static_cast<coalesce_test *>(ctx);
+    t->batches.emplace_back((const char *) batch->data, batch->len);
+    t->ctxs.emplace_back(batch->ctx, batch->ctx + batch->num_ctx);
+    write_batch_free(batch);
+}
+
+static int released;
+static void count_release(void *) { released++; }
+
+static void *wctx(intptr_t i) { return (void *) i; }
+
+TEST_CASE("write coalescing", "[coalesce]") {
+    uv_loop_t *loop = uv_default_loop();
+    coalesce_test t;
+
+    SECTION("small writes are combined until the end of the loop iteration") {
+        write_coalescer_t *wc = write_coalescer_new(loop, 16, 0, collect_batch, &t);
+        CHECK(write_coalescer_write(wc, "ab", 2, wctx(1)) == 0);
+        CHECK(write_coalescer_write(wc, "cd", 2, wctx(2)) == 0);
+        CHECK(write_coalescer_pending(wc) == 4);
+        CHECK(t.batches.empty());
+
+        uv_run(loop, UV_RUN_NOWAIT);
+        REQUIRE(t.batches.size() == 1);
+        CHECK(t.batches[0] == "abcd");
+        CHECK(t.ctxs[0] == std::vector<void *>{wctx(1), wctx(2)});
+        CHECK(write_coalescer_pending(wc) == 0);
+        write_coalescer_close(wc, count_release);
+    }
+
+    SECTION("a full batch is written right away") {
+        write_coalescer_t *wc = write_coalescer_new(loop, 8, 0, collect_batch, &t);
+        CHECK(write_coalescer_write(wc, "12345", 5, wctx(1)) == 0);
+        CHECK(write_coalescer_write(wc, "678", 3, wctx(2)) == 0);
+        REQUIRE(t.batches.size() == 1);
+        CHECK(t.batches[0] == "12345678");
+
+        // doesn't fit with what is batched, so that goes first
+        CHECK(write_coalescer_write(wc, "abcde", 5, wctx(3)) == 0);
+        CHECK(write_coalescer_write(wc, "fghij", 5, wctx(4)) == 0);
+        REQUIRE(t.batches.size() == 2);
+        CHECK(t.batches[1] == "abcde");
+        CHECK(write_coalescer_pending(wc) == 5);
+        write_coalescer_close(wc, count_release);
+    }
+
+    SECTION("large writes bypass the batch") {
+        write_coalescer_t *wc = write_coalescer_new(loop, 8, 0, collect_batch, &t);
+        CHECK(write_coalescer_write(wc, "ab", 2, wctx(1)) == 0);
+        CHECK(write_coalescer_write(wc, "0123456789", 10, wctx(2)) == WRITE_COALESCE_BYPASS);
+        // what was batched before is written first
+        REQUIRE(t.batches.size() == 1);
+        CHECK(t.batches[0] == "ab");
+        CHECK(write_coalescer_pending(wc) == 0);
+        write_coalescer_close(wc, count_release);
+    }
+
+    SECTION("batches wait for the deadline") {
+        write_coalescer_t *wc = write_coalescer_new(loop, 1024, 2000, collect_batch, &t);
+        uint64_t start = uv_now(loop);
+        CHECK(write_coalescer_write(wc, "x", 1, wctx(1)) == 0);
+        uv_run(loop, UV_RUN_NOWAIT);
+        CHECK(t.batches.empty());
+
+        while (t.batches.empty()) {
+            uv_run(loop, UV_RUN_ONCE);
+        }
+        CHECK(uv_now(loop) - start >= 2);
+        CHECK(t.batches[0] == "x");
+        write_coalescer_close(wc, count_release);
+    }
+
+    SECTION("closing releases the batched writes") {
+        released = 0;
+        write_coalescer_t *wc = write_coalescer_new(loop, 1024, 0, collect_batch, &t);
+        CHECK(write_coalescer_write(wc, "ab", 2, wctx(1)) == 0);
+        CHECK(write_coalescer_write(wc, "cd", 2, wctx(2)) == 0);
+        write_coalescer_close(wc, count_release);
+        CHECK(released == 2);
+        CHECK(t.batches.empty());
+    }
+
+    uv_run(loop, UV_RUN_DEFAULT);
+}
@@ -0,0 +1,334 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#if defined(__linux__)
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // sendmmsg
+#endif
+#include <errno.h>
+#include <sys/socket.h>
+#endif
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ziti/ziti_log.h>
+#include "udp_bridge.h"
+
+#define RECV_BUF_SIZE (UDP_BRIDGE_BATCH * UDP_BRIDGE_SLOT)
+
+struct udp_bridge_s {
+    uv_udp_t *udp;
+    void *udp_data;
+    udp_bridge_write_cb write_cb;
+    udp_bridge_error_cb err_cb;
+    void *ctx;
+    bool framed;
+
+    // framed datagrams waiting to go out as one ziti message
+    uint8_t *out;
+    size_t out_len;
+    size_t pending; // bytes written to ziti and not yet acknowledged
+    uint64_t dropped;
+
+    // datagrams from ziti, sent by the check handle at the end of the loop iteration
+    uv_check_t flush;
+    uv_buf_t sendq[UDP_BRIDGE_BATCH];
+    int sendq_len;
+};
+
+typedef struct udp_send_req_s {
+    uv_udp_send_t req;
+    char *data;
+} udp_send_req_t;
+
+// receive buffers are only held for the duration of a read callback, so a few of them cover every bridge on the loop
+static char *recv_pool[UDP_BRIDGE_POOL_MAX];
+static int recv_pool_len;
+
+static void recv_alloc(uv_handle_t *h, size_t suggested, uv_buf_t *buf) {
+    char *base = recv_pool_len > 0 ? recv_pool[--recv_pool_len] : malloc(RECV_BUF_SIZE);
+    *buf = uv_buf_init(base, base ? RECV_BUF_SIZE : 0);
+}
+
+static void recv_release(char *base) {
+    if (base == NULL) return;
+    if (recv_pool_len < UDP_BRIDGE_POOL_MAX) {
+        recv_pool[recv_pool_len++] = base;
+    } else {
+        free(base);
+    }
+}
+
+static void send_msg(udp_bridge_t *b, uint8_t *msg, size_t len) {
+    if (b->pending + len > UDP_BRIDGE_MAX_PENDING) {
+        // ziti isn't keeping up. this is where the kernel would have dropped the datagram too
+        b->dropped++;
+        free(msg);
+        return;
+    }
+    b->pending += len;
+    if (b->write_cb(b->ctx, msg, len) != 0) {
+        b->pending -= len;
+        b->dropped++;
+    }
+}
+
+static void flush_out(udp_bridge_t *b) {
+    if (b->out_len == 0) return;
+    uint8_t *msg = b->out;
+    size_t len = b->out_len;
+    b->out = NULL;
+    b->out_len = 0;
+    send_msg(b, msg, len);
+}
+
+static void on_dgram(udp_bridge_t *b, const char *data, size_t len) {
+    if (!b->framed) {
+        uint8_t *msg = malloc(len);
+        memcpy(msg, data, len);
+        send_msg(b, msg, len);
+        return;
+    }
+
+    size_t frame_len = UDP_FRAME_HDR + len;
+    if (b->out_len + frame_len > UDP_BRIDGE_COALESCE_MAX) {
+        flush_out(b);
+    }
+    if (frame_len > UDP_BRIDGE_COALESCE_MAX) {
+        uint8_t *msg = malloc(frame_len);
+        udp_frame_put(msg, (const uint8_t *) data, len);
+        send_msg(b, msg, frame_len);
+        return;
+    }
+    if (b->out == NULL) {
+        b->out = malloc(UDP_BRIDGE_COALESCE_MAX);
+    }
+    b->out_len += udp_frame_put(b->out + b->out_len, (const uint8_t *) data, len);
+}
+
+static void on_server_data(uv_udp_t *h, ssize_t nread, const uv_buf_t *buf, const struct sockaddr *addr,
+                           unsigned int flags) {
+    udp_bridge_t *b = h->data;
+    // an empty datagram comes with the address of its sender, nothing to read comes without one
+    if (nread > 0 || (nread == 0 && addr != NULL)) {
+        on_dgram(b, buf->base, (size_t) nread);
+    }
+
+    // with recvmmsg, each datagram is a chunk of the buffer. it is released by the final UV_UDP_MMSG_FREE callback
+    if (flags & UV_UDP_MMSG_CHUNK) {
+        return;
+    }
+    flush_out(b);
+    recv_release(buf->base);
+
+    if (nread < 0) {
+        b->err_cb(b->ctx, (int) nread);
+    }
+}
+
+static void on_send_done(uv_udp_send_t *req, int status) {
+    udp_send_req_t *sr = (udp_send_req_t *) req;
+    free(sr->data);
+    free(sr);
+}
+
+static void queue_send(udp_bridge_t *b, uv_buf_t *buf) {
+    udp_send_req_t *sr = calloc(1, sizeof(udp_send_req_t));
+    sr->data = buf->base;
+    if (uv_udp_send(&sr->req, b->udp, buf, 1, NULL, on_send_done) != 0) {
+        b->dropped++;
+        on_send_done(&sr->req, 0);
+    }
+}
+
+/** returns how many of the queued datagrams were sent without blocking */
+static int send_now(udp_bridge_t *b) {
+    // datagrams that libuv already holds have to go first
+    if (uv_udp_get_send_queue_count(b->udp) > 0) {
+        return 0;
+    }
+
+#if defined(__linux__)
+    uv_os_fd_t fd;
+    if (uv_fileno((uv_handle_t *) b->udp, &fd) != 0) {
+        return 0;
+    }
+    struct mmsghdr msgs[UDP_BRIDGE_BATCH];
+    struct iovec iov[UDP_BRIDGE_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < b->sendq_len; i++) {
+        iov[i].iov_base = b->sendq[i].base;
+        iov[i].iov_len = b->sendq[i].len;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int sent;
+    do {
+        sent = sendmmsg(fd, msgs, b->sendq_len, 0);
+    } while (sent < 0 && errno == EINTR);
+    if (sent >= 0) {
+        return sent;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0;
+    }
+    // e.g. ECONNREFUSED after an icmp unreachable. same as losing the datagram on the wire
+    ZITI_LOG(DEBUG, "sendmmsg failed: %s", strerror(errno));
+    b->dropped++;
+    return 1;
+#else
+    int sent = 0;
+    for (; sent < b->sendq_len; sent++) {
+        int rc = uv_udp_try_send(b->udp, &b->sendq[sent], 1, NULL);
+        if (rc == UV_EAGAIN) {
+            break;
+        }
+        if (rc < 0) {
+            ZITI_LOG(DEBUG, "udp send failed: %s", uv_strerror(rc));
+            b->dropped++;
+        }
+    }
+    return sent;
+#endif
+}
+
+static void flush_sends(udp_bridge_t *b) {
+    int sent = send_now(b);
+    for (int i = 0; i < b->sendq_len; i++) {
+        if (i < sent) {
+            free(b->sendq[i].base);
+        } else {
+            // libuv waits for the socket to become writable, and batches these itself
+            queue_send(b, &b->sendq[i]);
+        }
+    }
+    b->sendq_len = 0;
+}
+
+static void on_flush(uv_check_t *c) {
+    udp_bridge_t *b = c->data;
+    uv_check_stop(c);
+    flush_sends(b);
+}
+
+udp_bridge_t *udp_bridge_start(uv_udp_t *udp, bool framed, udp_bridge_write_cb write_cb, udp_bridge_error_cb err_cb,
+                               void *ctx) {
+    udp_bridge_t *b = calloc(1, sizeof(udp_bridge_t));
+    b->udp = udp;
+    b->udp_data = udp->data;
+    b->write_cb = write_cb;
+    b->err_cb = err_cb;
+    b->ctx = ctx;
+    b->framed = framed;
+    uv_check_init(udp->loop, &b->flush);
+    b->flush.data = b;
+
+    udp->data = b;
+    int rc = uv_udp_recv_start(udp, recv_alloc, on_server_data);
+    if (rc != 0) {
+        ZITI_LOG(ERROR, "failed to start reading from udp server: %s", uv_strerror(rc));
+        udp_bridge_close(b);
+        return NULL;
+    }
+
+    if (framed) {
+        uint8_t *hello = malloc(UDP_FRAMING_HELLO_LEN);
+        memcpy(hello, UDP_FRAMING_HELLO, UDP_FRAMING_HELLO_LEN);
+        send_msg(b, hello, UDP_FRAMING_HELLO_LEN);
+    }
+    return b;
+}
+
+int udp_bridge_send(udp_bridge_t *b, const uint8_t *dgram, size_t len) {
+    if (b->sendq_len == UDP_BRIDGE_BATCH) {
+        flush_sends(b);
+    }
+    char *data = malloc(len > 0 ? len : 1);
+    memcpy(data, dgram, len);
+    b->sendq[b->sendq_len++] = uv_buf_init(data, (unsigned int) len);
+    if (!uv_is_active((uv_handle_t *) &b->flush)) {
+        uv_check_start(&b->flush, on_flush);
+    }
+    return 0;
+}
+
+void udp_bridge_write_done(udp_bridge_t *b, size_t len) {
+    b->pending = len > b->pending ? 0 : b->pending - len;
+}
+
+static void on_bridge_closed(uv_handle_t *h) {
+    free(h->data);
+}
+
+void udp_bridge_close(udp_bridge_t *b) {
+    if (b == NULL) return;
+
+    uv_udp_recv_stop(b->udp);
+    b->udp->data = b->udp_data;
+    flush_out(b);
+    flush_sends(b);
+    if (b->dropped > 0) {
+        ZITI_LOG(DEBUG, "udp bridge dropped %" PRIu64 " datagrams", b->dropped);
+    }
+    uv_close((uv_handle_t *) &b->flush, on_bridge_closed);
+}
+
+size_t udp_frame_put(uint8_t *out, const uint8_t *dgram, size_t len) {
+    out[0] = (uint8_t) (len >> 8);
+    out[1] = (uint8_t) len;
+    if (len > 0) {
+        memcpy(out + UDP_FRAME_HDR, dgram, len);
+    }
+    return UDP_FRAME_HDR + len;
+}
+
+static size_t frame_len(const uint8_t *hdr) {
+    return ((size_t) hdr[0] << 8) | hdr[1];
+}
+
+void udp_frame_read(udp_frame_reader_t *r, const uint8_t *data, size_t len, udp_frame_cb cb, void *ctx) {
+    while (len > 0) {
+        // whole frames are passed on without copying
+        if (r->len == 0 && len >= UDP_FRAME_HDR && len >= UDP_FRAME_HDR + frame_len(data)) {
+            size_t dlen = frame_len(data);
+            cb(ctx, data + UDP_FRAME_HDR, dlen);
+            data += UDP_FRAME_HDR + dlen;
+            len -= UDP_FRAME_HDR + dlen;
+            continue;
+        }
+
+        if (r->buf == NULL) {
+            r->buf = malloc(UDP_FRAME_HDR + UDP_FRAME_MAX);
+        }
+        size_t want = r->len < UDP_FRAME_HDR ? UDP_FRAME_HDR - r->len : UDP_FRAME_HDR + frame_len(r->buf) - r->len;
+        size_t n = want < len ? want : len;
+        memcpy(r->buf + r->len, data, n);
+        r->len += n;
+        data += n;
+        len -= n;
+        if (r->len >= UDP_FRAME_HDR && r->len == UDP_FRAME_HDR + frame_len(r->buf)) {
+            r->len = 0;
+            cb(ctx, r->buf + UDP_FRAME_HDR, frame_len(r->buf));
+        }
+    }
+}
+
+void udp_frame_reader_free(udp_frame_reader_t *r) {
+    free(r->buf);
+    r->buf = NULL;
+    r->len = 0;
+}
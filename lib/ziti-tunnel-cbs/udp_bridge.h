@@ -0,0 +1,98 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_UDP_BRIDGE_H
+#define ZITI_TUNNELER_SDK_UDP_BRIDGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// hosted udp connections can carry several datagrams per ziti message, if `udp_framing` in tunneler_app_data asks
+// for it. every datagram is prefixed with its 2-byte length. the hosting side sends UDP_FRAMING_HELLO as its first
+// message, and frames everything it sends after that. the intercepting side keeps sending one datagram per message,
+// since lwip hands it one datagram at a time anyway.
+// like COMPRESS_HELLO, the hello is a message of its own and not a frame, and it names the framing, so the first
+// datagram of a hosting side that doesn't know about framing is not mistaken for it.
+#define UDP_FRAMING_LEN16 "len16"
+#define UDP_FRAMING_HELLO "\0ziti-udp-framing:" UDP_FRAMING_LEN16
+#define UDP_FRAMING_HELLO_LEN (sizeof(UDP_FRAMING_HELLO) - 1)
+#define UDP_FRAME_HDR 2
+#define UDP_FRAME_MAX 0xFFFF
+
+#define UDP_BRIDGE_BATCH 8 // datagrams per recvmmsg/sendmmsg
+#define UDP_BRIDGE_SLOT (64 * 1024) // receive space per datagram, as libuv expects with UV_UDP_RECVMMSG
+#define UDP_BRIDGE_POOL_MAX 4 // idle receive buffers that are kept for reuse
+#define UDP_BRIDGE_COALESCE_MAX (16 * 1024) // framed datagrams are combined into ziti messages up to this size
+// datagrams from the server are dropped while this much is waiting to be written to ziti
+#define UDP_BRIDGE_MAX_PENDING (1024 * 1024)
+
+/**
+ * moves datagrams between a connected uv_udp_t and a ziti connection, a batch at a time.
+ * the udp handle should be initialized with UV_UDP_RECVMMSG. receive buffers come from a pool
+ * that is shared by all bridges, so the bridges must run on the same loop.
+ */
+typedef struct udp_bridge_s udp_bridge_t;
+
+/**
+ * sends one message to ziti. `msg` is malloc'ed and owned by the callee.
+ * return 0 if the message was queued, and call udp_bridge_write_done() once it is written.
+ */
+typedef int (*udp_bridge_write_cb)(void *ctx, uint8_t *msg, size_t len);
+
+/** reading from the server failed. the bridge stays usable until it is closed */
+typedef void (*udp_bridge_error_cb)(void *ctx, int err);
+
+/**
+ * start reading datagrams from `udp`. the bridge borrows `udp->data` until udp_bridge_close().
+ * if `framed` is set, UDP_FRAMING_HELLO is written before anything else.
+ */
+udp_bridge_t *udp_bridge_start(uv_udp_t *udp, bool framed, udp_bridge_write_cb write_cb, udp_bridge_error_cb err_cb,
+                               void *ctx);
+
+/** queue a datagram from ziti. queued datagrams are sent together once the loop is done with i/o callbacks */
+int udp_bridge_send(udp_bridge_t *b, const uint8_t *dgram, size_t len);
+
+void udp_bridge_write_done(udp_bridge_t *b, size_t len);
+
+/** stop reading and restore `udp->data`. queued datagrams are sent first. the caller still closes `udp` */
+void udp_bridge_close(udp_bridge_t *b);
+
+typedef struct udp_frame_reader_s {
+    uint8_t *buf; // frame that was split across reads, allocated on demand
+    size_t len;
+} udp_frame_reader_t;
+
+/** `dgram` is only valid for the duration of the callback */
+typedef void (*udp_frame_cb)(void *ctx, const uint8_t *dgram, size_t len);
+
+/** write `dgram` with its length prefix to `out`. returns the number of bytes written */
+size_t udp_frame_put(uint8_t *out, const uint8_t *dgram, size_t len);
+
+/** invokes `cb` for every complete frame in `data`. frames that span reads are completed by the next call */
+void udp_frame_read(udp_frame_reader_t *r, const uint8_t *data, size_t len, udp_frame_cb cb, void *ctx);
+
+void udp_frame_reader_free(udp_frame_reader_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_UDP_BRIDGE_H
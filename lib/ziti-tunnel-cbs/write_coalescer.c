@@ -0,0 +1,129 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "write_coalescer.h"
+
+struct write_coalescer_s {
+    size_t max_bytes;
+    uint64_t delay_ms; // 0: end of the loop iteration
+    write_coalescer_flush_cb flush_cb;
+    void *ctx;
+
+    write_batch_t *batch;
+    uv_timer_t timer;
+    uv_check_t check;
+    int closing;
+};
+
+static void on_deadline_timer(uv_timer_t *t) {
+    write_coalescer_flush(t->data);
+}
+
+static void on_deadline_check(uv_check_t *c) {
+    write_coalescer_flush(c->data);
+}
+
+write_coalescer_t *write_coalescer_new(uv_loop_t *loop, size_t max_bytes, uint32_t max_delay_us,
+                                       write_coalescer_flush_cb flush_cb, void *ctx) {
+    write_coalescer_t *wc = calloc(1, sizeof(write_coalescer_t));
+    wc->max_bytes = max_bytes;
+    wc->delay_ms = max_delay_us < 1000 ? 0 : (max_delay_us + 999) / 1000;
+    wc->flush_cb = flush_cb;
+    wc->ctx = ctx;
+    uv_timer_init(loop, &wc->timer);
+    wc->timer.data = wc;
+    uv_check_init(loop, &wc->check);
+    wc->check.data = wc;
+    return wc;
+}
+
+static void start_deadline(write_coalescer_t *wc) {
+    if (wc->delay_ms > 0) {
+        uv_timer_start(&wc->timer, on_deadline_timer, wc->delay_ms, 0);
+    } else {
+        uv_check_start(&wc->check, on_deadline_check);
+    }
+}
+
+int write_coalescer_write(write_coalescer_t *wc, const void *data, size_t len, void *write_ctx) {
+    if (len >= wc->max_bytes) {
+        write_coalescer_flush(wc);
+        return WRITE_COALESCE_BYPASS;
+    }
+
+    if (wc->batch && (wc->batch->len + len > wc->max_bytes || wc->batch->num_ctx == WRITE_COALESCE_MAX_CTX)) {
+        write_coalescer_flush(wc);
+    }
+    if (wc->batch == NULL) {
+        wc->batch = calloc(1, sizeof(write_batch_t));
+        wc->batch->data = malloc(wc->max_bytes);
+        start_deadline(wc);
+    }
+
+    write_batch_t *b = wc->batch;
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    b->ctx[b->num_ctx++] = write_ctx;
+    if (b->len == wc->max_bytes) {
+        write_coalescer_flush(wc);
+    }
+    return 0;
+}
+
+void write_coalescer_flush(write_coalescer_t *wc) {
+    uv_timer_stop(&wc->timer);
+    uv_check_stop(&wc->check);
+    write_batch_t *b = wc->batch;
+    if (b == NULL) return;
+
+    wc->batch = NULL;
+    wc->flush_cb(wc->ctx, b);
+}
+
+size_t write_coalescer_pending(const write_coalescer_t *wc) {
+    return wc->batch ? wc->batch->len : 0;
+}
+
+static void on_close(uv_handle_t *h) {
+    write_coalescer_t *wc = h->data;
+    if (--wc->closing == 0) {
+        free(wc);
+    }
+}
+
+void write_coalescer_close(write_coalescer_t *wc, void (*release)(void *write_ctx)) {
+    if (wc == NULL) return;
+
+    write_batch_t *b = wc->batch;
+    if (b) {
+        for (int i = 0; release && i < b->num_ctx; i++) {
+            release(b->ctx[i]);
+        }
+        write_batch_free(b);
+        wc->batch = NULL;
+    }
+    wc->closing = 2;
+    uv_close((uv_handle_t *) &wc->timer, on_close);
+    uv_close((uv_handle_t *) &wc->check, on_close);
+}
+
+void write_batch_free(write_batch_t *batch) {
+    if (batch == NULL) return;
+    free(batch->data);
+    free(batch);
+}
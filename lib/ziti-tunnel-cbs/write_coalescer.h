@@ -0,0 +1,72 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_WRITE_COALESCER_H
+#define ZITI_TUNNELER_SDK_WRITE_COALESCER_H
+
+#include <stdint.h>
+#include <uv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WRITE_COALESCE_MAX_CTX 64 // writes per batch
+// write_coalescer_write() didn't take the data, because it is as large as a batch. write it directly
+#define WRITE_COALESCE_BYPASS 1
+
+/**
+ * small writes from an intercepted client, combined into one ziti message.
+ * the write contexts are kept with the batch, so the client isn't acknowledged before the batch is written.
+ */
+typedef struct write_batch_s {
+    uint8_t *data;
+    size_t len;
+    int num_ctx;
+    void *ctx[WRITE_COALESCE_MAX_CTX];
+} write_batch_t;
+
+typedef struct write_coalescer_s write_coalescer_t;
+
+/** write `batch` to ziti. the callee owns `batch` and frees it with write_batch_free() */
+typedef void (*write_coalescer_flush_cb)(void *ctx, write_batch_t *batch);
+
+/**
+ * batches are written when they reach `max_bytes`, or `max_delay_us` after their first write.
+ * libuv timers count milliseconds, so delays below 1ms write the batch at the end of the
+ * current loop iteration, and longer delays are rounded up to whole milliseconds.
+ */
+write_coalescer_t *write_coalescer_new(uv_loop_t *loop, size_t max_bytes, uint32_t max_delay_us,
+                                       write_coalescer_flush_cb flush_cb, void *ctx);
+
+/** returns 0 if `data` was added to the batch, or WRITE_COALESCE_BYPASS after writing out what was batched before it */
+int write_coalescer_write(write_coalescer_t *wc, const void *data, size_t len, void *write_ctx);
+
+/** write the current batch now, e.g. before the connection is half-closed */
+void write_coalescer_flush(write_coalescer_t *wc);
+
+size_t write_coalescer_pending(const write_coalescer_t *wc);
+
+/** the current batch is not written. its write contexts are passed to `release`, if it is set */
+void write_coalescer_close(write_coalescer_t *wc, void (*release)(void *write_ctx));
+
+void write_batch_free(write_batch_t *batch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_WRITE_COALESCER_H
@@ -17,12 +17,23 @@
 #include <ziti/ziti_tunnel.h>
 #include <ziti/ziti_log.h>
 #include <ziti/ziti_dns.h>
+#include <ziti/ziti_buffer.h>
 #include "ziti_instance.h"
 #include "dns_host.h"
 
+#include <ctype.h>
+#include <errno.h>
+
 #define MAX_UPSTREAMS 5
 #define MAX_DNS_NAME 256
 #define MAX_IP_LENGTH 16
+#define DNS_HOST_TTL 60
+#define DNS_A_RR_LEN 16 // name ref(2), type(2), class(2), ttl(4), rdlength(2), address(4)
+#define DNS_AAAA_RR_LEN 28 // same as A, with 16 byte address
+// upper bound for the IPv6 pool, ULA prefixes are much bigger than any set of intercepted hostnames
+#define DNS_IP6_POOL_MAX (1 << 20)
+#define DNS_IP4_MIN_BITS 8
+#define DNS_IP4_MAX_BITS 30
 
 #ifndef IN6ADDR_V4MAPPED
 #define IN6ADDR_V4MAPPED(v4) \
@@ -54,6 +65,7 @@ struct dns_req {
     dns_message msg;
 
     struct in_addr addr;
+    struct in6_addr addr6;
 
     uint8_t *rp;
 
@@ -69,12 +81,30 @@ static void on_upstream_packet(uv_udp_t *h, ssize_t rc, const uv_buf_t *buf, con
 static void complete_dns_req(struct dns_req *req);
 static void free_dns_req(struct dns_req *req);
 
+// reversed-label trie of active wildcard domains. `*.example.com` lives at root -> com -> example
+typedef struct domain_trie_s {
+    struct domain_trie_s *parent;
+    char *label;
+    model_map children; // map[label -> domain_trie_t]
+    struct dns_domain_s *domain;
+} domain_trie_t;
+
+// intercept registered for a wildcard domain, and a copy of the configured address that put it there
+typedef struct dns_domain_intercept_s {
+    void *intercept;
+    ziti_address addr;
+} dns_domain_intercept_t;
+
 typedef struct dns_domain_s {
     char name[MAX_DNS_NAME];
 
-    model_map intercepts; // set[intercept]
+    model_map intercepts; // map[intercept -> dns_domain_intercept_t]
+    domain_trie_t *node;
+    LIST_HEAD(domain_entries, dns_entry_s) entries; // hostnames resolved via this domain
 
     ziti_connection resolv_proxy;
+    bool proxy_wire; // hosting side acknowledged wire format
+    dns_frame_buf_t *proxy_rbuf;
 
 } dns_domain_t;
 
@@ -83,20 +113,90 @@ typedef struct dns_entry_s {
     char name[MAX_DNS_NAME];
     char ip[MAX_IP_LENGTH];
     ip_addr_t addr;
+    // assigned from the IPv6 pool, if configured
+    bool has_ip6;
+    char ip6[IP6ADDR_STRLEN_MAX];
+    ip_addr_t addr6;
     dns_domain_t *domain;
+    LIST_ENTRY(dns_entry_s) _domain_link;
 
     model_map intercepts;
 
+    // pre-encoded answer records, appended to the question echo when answering A/AAAA queries
+    uint8_t a_rr[DNS_A_RR_LEN];
+    uint8_t aaaa_rr[DNS_AAAA_RR_LEN];
+
+    // wildcard-derived entries are kept in LRU order so they can be reclaimed when the ip pool runs dry
+    bool in_lru;
+    uint64_t last_used;
+    TAILQ_ENTRY(dns_entry_s) _lru;
 } dns_entry_t;
 
+/**
+ * virtual ip allocator. addresses are tracked by their offset from the network address of the pool.
+ * offsets that have never been used are handed out first, then released offsets are recycled
+ * oldest-release-first, which keeps clients from getting an ip that they may still have cached for another name.
+ */
+typedef struct ip_pool_s {
+    uint32_t capacity; // usable offsets are [1, capacity]
+    uint32_t used;
+    uint32_t max_used;
+    uint32_t next_fresh;
+    uint64_t *in_use;  // bitmap indexed by offset
+    struct {
+        uint32_t *offsets;
+        uint32_t head;
+        uint32_t count;
+        uint32_t size;
+    } released;        // ring of released offsets
+} ip_pool_t;
+
+// addresses that a hostname had before restart
+typedef struct dns_reservation_s {
+    bool has_ip4;
+    uint32_t ip4;
+    bool has_ip6;
+    ip6_addr_t ip6;
+} dns_reservation_t;
+
+// entries and domains that an intercept was registered with
+typedef struct dns_intercept_refs_s {
+    model_map entries; // set[dns_entry_t]
+    model_map domains; // set[dns_domain_t]
+} dns_intercept_refs_t;
+
 struct ziti_dns_s {
 
     struct {
         uint32_t base;
-        uint32_t counter;
         uint32_t counter_mask;
-        uint32_t capacity;
-    } ip_pool;
+        ip_pool_t pool;
+    } ip4;
+
+    // optional IPv6 (ULA) range. offsets are added to the last 32 bits of the prefix
+    struct {
+        bool enabled;
+        ip6_addr_t prefix;
+        int bits;
+        char cidr[IP6ADDR_STRLEN_MAX + 4]; // tun address, as it was parsed
+        ip_pool_t pool;
+    } ip6;
+
+    // wildcard-derived dns_entry_t, least recently used first
+    TAILQ_HEAD(dns_lru_s, dns_entry_s) wildcard_lru;
+    uint64_t reclaimed;
+
+    // hostname -> ip assignments are saved so that they survive restarts
+    struct {
+        char *path;
+        uv_timer_t save_timer;
+        uv_timer_t grace_timer;
+        bool timers_init;
+        bool saving;
+        bool dirty;
+        // map[hostname -> dns_reservation_t], assigned before restart and held for the grace period
+        model_map reserved;
+    } snapshot;
 
     // map[hostname -> dns_entry_t]
     model_map hostnames;
@@ -104,8 +204,15 @@ struct ziti_dns_s {
     // map[ip4_addr_t -> dns_entry_t]
     model_map ip_addresses;
 
+    // map[ip6_addr_t.addr -> dns_entry_t]
+    model_map ip6_addresses;
+
     // map[domain -> dns_domain_t]
     model_map domains;
+    domain_trie_t domain_trie;
+
+    // map[intercept -> dns_intercept_refs_t]
+    model_map intercept_refs;
 
     uv_loop_t *loop;
     tunneler_context tnlr;
@@ -117,70 +224,430 @@ struct ziti_dns_s {
     struct sockaddr_in6 upstream_addr[MAX_UPSTREAMS];
 } ziti_dns;
 
+#define IP_POOL_WORD(off) ((off) / 64)
+#define IP_POOL_BIT(off) ((uint64_t)1 << ((off) % 64))
+
+// wildcard-derived entries that were not used for this long can be reclaimed when the pool is exhausted
+#define WILDCARD_ENTRY_IDLE_MILLIS (10 * 60 * 1000)
+
+// how long ips from the snapshot are held for their hostnames after startup
+#define SNAPSHOT_GRACE_MILLIS (15 * 60 * 1000)
+// batch up mapping changes before writing the snapshot
+#define SNAPSHOT_SAVE_DELAY_MILLIS 2000
+
+static void snapshot_changed();
+
+static void ip_pool_free(ip_pool_t *pool) {
+    free(pool->in_use);
+    free(pool->released.offsets);
+    memset(pool, 0, sizeof(*pool));
+}
+
+static int ip_pool_init(ip_pool_t *pool, uint32_t capacity) {
+    ip_pool_free(pool);
+
+    pool->capacity = capacity;
+    pool->next_fresh = 1;
+    pool->in_use = calloc(IP_POOL_WORD(capacity) + 1, sizeof(uint64_t));
+    return pool->in_use != NULL ? 0 : -1;
+}
+
+static bool ip_pool_is_used(const ip_pool_t *pool, uint32_t off) {
+    return (pool->in_use[IP_POOL_WORD(off)] & IP_POOL_BIT(off)) != 0;
+}
+
+static void ip_pool_mark(ip_pool_t *pool, uint32_t off) {
+    pool->in_use[IP_POOL_WORD(off)] |= IP_POOL_BIT(off);
+    pool->used++;
+    if (pool->used > pool->max_used) {
+        pool->max_used = pool->used;
+    }
+}
+
+/** mark a specific offset as used. returns false if the offset is outside the pool or already taken */
+static bool ip_pool_claim(ip_pool_t *pool, uint32_t off) {
+    if (pool->in_use == NULL || off == 0 || off > pool->capacity || ip_pool_is_used(pool, off)) {
+        return false;
+    }
+    ip_pool_mark(pool, off);
+    return true;
+}
+
+/** returns an unused offset, or 0 if the pool is exhausted */
+static uint32_t ip_pool_alloc(ip_pool_t *pool) {
+    if (pool->in_use == NULL) {
+        return 0;
+    }
+
+    while (pool->next_fresh <= pool->capacity) {
+        uint32_t off = pool->next_fresh++;
+        if (!ip_pool_is_used(pool, off)) {
+            ip_pool_mark(pool, off);
+            return off;
+        }
+    }
+
+    while (pool->released.count > 0) {
+        uint32_t off = pool->released.offsets[pool->released.head];
+        pool->released.head = (pool->released.head + 1) % pool->released.size;
+        pool->released.count--;
+        // skip offsets that were claimed explicitly after they were released
+        if (!ip_pool_is_used(pool, off)) {
+            ip_pool_mark(pool, off);
+            return off;
+        }
+    }
+
+    return 0;
+}
+
+static void ip_pool_release(ip_pool_t *pool, uint32_t off) {
+    if (pool->in_use == NULL || off == 0 || off > pool->capacity || !ip_pool_is_used(pool, off)) {
+        return;
+    }
+    pool->in_use[IP_POOL_WORD(off)] &= ~IP_POOL_BIT(off);
+    pool->used--;
+
+    if (off >= pool->next_fresh) {
+        return; // fresh cursor will get to it
+    }
+
+    if (pool->released.count == pool->released.size) {
+        uint32_t new_size = pool->released.size ? pool->released.size * 2 : 64;
+        uint32_t *offsets = calloc(new_size, sizeof(uint32_t));
+        if (offsets == NULL) {
+            // can't remember the release order. let the fresh cursor find the offset again
+            pool->next_fresh = off;
+            return;
+        }
+        for (uint32_t i = 0; i < pool->released.count; i++) {
+            offsets[i] = pool->released.offsets[(pool->released.head + i) % pool->released.size];
+        }
+        free(pool->released.offsets);
+        pool->released.offsets = offsets;
+        pool->released.head = 0;
+        pool->released.size = new_size;
+    }
+    pool->released.offsets[(pool->released.head + pool->released.count) % pool->released.size] = off;
+    pool->released.count++;
+}
+
+static bool ipv4_offset(uint32_t addr, uint32_t *off) {
+    uint32_t host_addr = ntohl(addr);
+    if ((host_addr & ~ziti_dns.ip4.counter_mask) != ziti_dns.ip4.base) {
+        return false;
+    }
+    *off = host_addr & ziti_dns.ip4.counter_mask;
+    return true;
+}
+
+static void release_ipv4(uint32_t addr) {
+    uint32_t off;
+    if (ipv4_offset(addr, &off)) {
+        ip_pool_release(&ziti_dns.ip4.pool, off);
+    }
+}
+
+static bool ipv6_offset(const ip6_addr_t *addr, uint32_t *off) {
+    if (!ziti_dns.ip6.enabled ||
+        memcmp(addr->addr, ziti_dns.ip6.prefix.addr, 3 * sizeof(addr->addr[0])) != 0) {
+        return false;
+    }
+    uint32_t host = ntohl(addr->addr[3]);
+    uint32_t base = ntohl(ziti_dns.ip6.prefix.addr[3]);
+    if (host < base) {
+        return false;
+    }
+    *off = host - base;
+    return true;
+}
+
+static void release_ipv6(const ip6_addr_t *addr) {
+    uint32_t off;
+    if (ipv6_offset(addr, &off)) {
+        ip_pool_release(&ziti_dns.ip6.pool, off);
+    }
+}
+
+static dns_entry_t *entry_by_addr(const ip_addr_t *addr) {
+    if (IP_IS_V6(addr)) {
+        return model_map_get_key(&ziti_dns.ip6_addresses, ip_2_ip6(addr)->addr, sizeof(ip_2_ip6(addr)->addr));
+    }
+    return model_map_getl(&ziti_dns.ip_addresses, ip_2_ip4(addr)->addr);
+}
+
+static uint64_t now_millis() {
+    return uv_hrtime() / 1000000;
+}
+
+static void touch_entry(dns_entry_t *entry) {
+    if (entry->in_lru) {
+        entry->last_used = now_millis();
+        TAILQ_REMOVE(&ziti_dns.wildcard_lru, entry, _lru);
+        TAILQ_INSERT_TAIL(&ziti_dns.wildcard_lru, entry, _lru);
+    }
+}
+
+/** drop an entry that has already been removed from `ziti_dns.hostnames` and give its ip back to the pool */
+static void free_dns_entry(dns_entry_t *entry) {
+    if (entry->in_lru) {
+        TAILQ_REMOVE(&ziti_dns.wildcard_lru, entry, _lru);
+    }
+    if (entry->domain) {
+        LIST_REMOVE(entry, _domain_link);
+    }
+    model_map_removel(&ziti_dns.ip_addresses, ip_2_ip4(&entry->addr)->addr);
+    release_ipv4(ip_2_ip4(&entry->addr)->addr);
+    if (entry->has_ip6) {
+        const ip6_addr_t *ip6 = ip_2_ip6(&entry->addr6);
+        model_map_remove_key(&ziti_dns.ip6_addresses, ip6->addr, sizeof(ip6->addr));
+        release_ipv6(ip6);
+    }
+    model_map_clear(&entry->intercepts, NULL);
+    free(entry);
+    snapshot_changed();
+}
+
+static void release_reserved_ips(dns_reservation_t *r) {
+    if (r->has_ip4) {
+        release_ipv4(r->ip4);
+    }
+    if (r->has_ip6) {
+        release_ipv6(&r->ip6);
+    }
+    free(r);
+}
+
+/** give the ips held for one snapshot hostname back to the pools */
+static bool release_reservation() {
+    model_map_iter it = model_map_iterator(&ziti_dns.snapshot.reserved);
+    if (it == NULL) return false;
+
+    dns_reservation_t *r = model_map_it_value(it);
+    ZITI_LOG(DEBUG, "releasing reserved ip for %s", model_map_it_key(it));
+    release_reserved_ips(r);
+    model_map_it_remove(it);
+    return true;
+}
+
+/** reclaim the least recently used wildcard-derived entry if it has been idle long enough */
+static bool reclaim_wildcard_entry() {
+    uint64_t now = now_millis();
+    dns_entry_t *entry;
+    while ((entry = TAILQ_FIRST(&ziti_dns.wildcard_lru)) != NULL) {
+        if (model_map_size(&entry->intercepts) > 0) {
+            // hostname is now intercepted explicitly. it is not reclaimable anymore
+            TAILQ_REMOVE(&ziti_dns.wildcard_lru, entry, _lru);
+            entry->in_lru = false;
+            continue;
+        }
+
+        if (now - entry->last_used < WILDCARD_ENTRY_IDLE_MILLIS) {
+            return false;
+        }
+
+        ZITI_LOG(INFO, "reclaiming DNS mapping %s -> %s (idle for %" PRIu64 "s)",
+                 entry->name, entry->ip, (now - entry->last_used) / 1000);
+        model_map_remove(&ziti_dns.hostnames, entry->name);
+        free_dns_entry(entry);
+        ziti_dns.reclaimed++;
+        return true;
+    }
+    return false;
+}
+
 static uint32_t next_ipv4() {
-    uint32_t candidate;
-    uint32_t i = 0; // track how many candidates have been considered. should never exceed pool capacity.
+    uint32_t off = ip_pool_alloc(&ziti_dns.ip4.pool);
+    if (off == 0 && reclaim_wildcard_entry()) {
+        off = ip_pool_alloc(&ziti_dns.ip4.pool);
+    }
+
+    if (off == 0 && release_reservation()) {
+        off = ip_pool_alloc(&ziti_dns.ip4.pool);
+    }
 
-    if (model_map_size(&ziti_dns.ip_addresses) == ziti_dns.ip_pool.capacity) {
+    if (off == 0) {
         ZITI_LOG(ERROR, "DNS ip pool exhausted (%u IPs). Try rerunning with larger DNS range.",
-                 ziti_dns.ip_pool.capacity);
+                 ziti_dns.ip4.pool.capacity);
         return INADDR_NONE;
     }
 
-    do {
-        candidate = htonl(ziti_dns.ip_pool.base | (ziti_dns.ip_pool.counter++ & ziti_dns.ip_pool.counter_mask));
-        i += 1;
-        if (ziti_dns.ip_pool.counter == ziti_dns.ip_pool.counter_mask) {
-            ziti_dns.ip_pool.counter = 1;
-        }
-    } while ((model_map_getl(&ziti_dns.ip_addresses, candidate) != NULL) && i < ziti_dns.ip_pool.capacity);
+    return htonl(ziti_dns.ip4.base | off);
+}
 
-    if (i == ziti_dns.ip_pool.capacity) {
-        ZITI_LOG(ERROR, "no IPs available after scanning entire pool");
-        return INADDR_NONE;
+/** assigns the next IPv6 address to `addr`. returns false if IPv6 is not configured, or the pool is exhausted */
+static bool next_ipv6(ip_addr_t *addr) {
+    if (!ziti_dns.ip6.enabled) {
+        return false;
+    }
+
+    uint32_t off = ip_pool_alloc(&ziti_dns.ip6.pool);
+    if (off == 0 && reclaim_wildcard_entry()) {
+        off = ip_pool_alloc(&ziti_dns.ip6.pool);
+    }
+    if (off == 0 && release_reservation()) {
+        off = ip_pool_alloc(&ziti_dns.ip6.pool);
     }
+    if (off == 0) {
+        ZITI_LOG(WARN, "DNS IPv6 pool exhausted (%u IPs)", ziti_dns.ip6.pool.capacity);
+        return false;
+    }
+
+    const ip6_addr_t *prefix = &ziti_dns.ip6.prefix;
+    IP_ADDR6(addr, prefix->addr[0], prefix->addr[1], prefix->addr[2], htonl(ntohl(prefix->addr[3]) + off));
+    return true;
+}
 
-    return candidate;
+void ziti_dns_get_ip_pool_stats(tunnel_ip_mem_pool *pool) {
+    if (!pool) return;
+    pool->name = strdup("DNS_IP_POOL");
+    pool->used = ziti_dns.ip4.pool.used;
+    pool->max = ziti_dns.ip4.pool.max_used;
+    pool->avail = ziti_dns.ip4.pool.capacity - ziti_dns.ip4.pool.used;
+    ZITI_LOG(DEBUG, "DNS ip pool: %u/%u used, %u released, %" PRIu64 " reclaimed", ziti_dns.ip4.pool.used,
+             ziti_dns.ip4.pool.capacity, ziti_dns.ip4.pool.released.count, ziti_dns.reclaimed);
 }
 
 static int seed_dns(const char *dns_cidr) {
-    uint32_t ip[4];
-    uint32_t bits;
+    int ip[4];
+    int bits;
     int rc = sscanf(dns_cidr, "%d.%d.%d.%d/%d", &ip[0], &ip[1], &ip[2], &ip[3], &bits);
-    if (rc != 5 || ip[0] > 255 || ip[1] > 255 || ip[2] > 255 || ip[3] > 255 || bits > 32) {
+    if (rc != 5) {
         ZITI_LOG(ERROR, "Invalid IP range specification: n.n.n.n/m format is expected");
         return -1;
     }
+    for (int i = 0; i < 4; i++) {
+        if (ip[i] < 0 || ip[i] > 255) {
+            ZITI_LOG(ERROR, "Invalid IP range specification[%s]: n.n.n.n/m format is expected", dns_cidr);
+            return -1;
+        }
+    }
+    // the range needs room for the network, broadcast, tun and dns addresses
+    if (bits < DNS_IP4_MIN_BITS || bits > DNS_IP4_MAX_BITS) {
+        ZITI_LOG(ERROR, "Invalid IP range specification[%s]: prefix length must be between %d and %d", dns_cidr,
+                 DNS_IP4_MIN_BITS, DNS_IP4_MAX_BITS);
+        return -1;
+    }
     uint32_t mask = 0;
     for (int i = 0; i < 4; i++) {
         mask <<= 8U;
         mask |= (ip[i] & 0xFFU);
     }
 
-    ziti_dns.ip_pool.counter_mask = ~( (uint32_t)-1 << (32 - (uint32_t)bits));
-    ziti_dns.ip_pool.base = mask & ~ziti_dns.ip_pool.counter_mask;
+    ziti_dns.ip4.counter_mask = ~((uint32_t) -1 << (32 - bits));
+    ziti_dns.ip4.base = mask & ~ziti_dns.ip4.counter_mask;
 
-    ziti_dns.ip_pool.counter = 1;
-    ziti_dns.ip_pool.capacity = (1 << (32 - bits)) - 2; // subtract 2 for network and broadcast IPs
+    // subtract 2 for network and broadcast IPs
+    if (ip_pool_init(&ziti_dns.ip4.pool, (1U << (32 - bits)) - 2) != 0) {
+        ZITI_LOG(ERROR, "failed to allocate DNS ip pool");
+        return -1;
+    }
 
     union ip_bits {
         uint8_t b[4];
         uint32_t ip;
     } min_ip, max_ip;
 
-    min_ip.ip = htonl(ziti_dns.ip_pool.base);
-    max_ip.ip = htonl(ziti_dns.ip_pool.base | ziti_dns.ip_pool.counter_mask);
+    min_ip.ip = htonl(ziti_dns.ip4.base);
+    max_ip.ip = htonl(ziti_dns.ip4.base | ziti_dns.ip4.counter_mask);
     ZITI_LOG(INFO, "DNS configured with range %d.%d.%d.%d - %d.%d.%d.%d (%u ips)",
              min_ip.b[0],min_ip.b[1],min_ip.b[2],min_ip.b[3],
-             max_ip.b[0],max_ip.b[1],max_ip.b[2],max_ip.b[3], ziti_dns.ip_pool.capacity
+             max_ip.b[0],max_ip.b[1],max_ip.b[2],max_ip.b[3], ziti_dns.ip4.pool.capacity
              );
 
     return 0;
 }
 
+int ziti_dns_setup_ipv6(const char *dns_cidr6) {
+    char addr_str[IP6ADDR_STRLEN_MAX];
+    int bits;
+    ip_addr_t addr;
+    int bits_len = 0;
+    const char *slash = strchr(dns_cidr6, '/');
+    if (slash == NULL || slash - dns_cidr6 >= sizeof(addr_str) || !isdigit((unsigned char) slash[1]) ||
+        sscanf(slash + 1, "%d%n", &bits, &bits_len) != 1 || slash[1 + bits_len] != '\0' ||
+        bits < 8 || bits > 126) {
+        ZITI_LOG(ERROR, "Invalid IPv6 range specification[%s]: x:x::x/m format is expected", dns_cidr6);
+        return -1;
+    }
+    snprintf(addr_str, sizeof(addr_str), "%.*s", (int)(slash - dns_cidr6), dns_cidr6);
+    if (!ipaddr_aton(addr_str, &addr) || !IP_IS_V6(&addr)) {
+        ZITI_LOG(ERROR, "Invalid IPv6 range specification[%s]: x:x::x/m format is expected", dns_cidr6);
+        return -1;
+    }
+
+    // clear host bits
+    ip6_addr_t *prefix = &ziti_dns.ip6.prefix;
+    *prefix = *ip_2_ip6(&addr);
+    for (int i = 0; i < 4; i++) {
+        int word_bits = bits - i * 32;
+        uint32_t mask = word_bits >= 32 ? 0xFFFFFFFFU : word_bits <= 0 ? 0 : ~(0xFFFFFFFFU >> word_bits);
+        prefix->addr[i] = htonl(ntohl(prefix->addr[i]) & mask);
+    }
+
+    // subtract 2 for the network and last address, same as the IPv4 range
+    uint32_t capacity = 128 - bits >= 21 ? DNS_IP6_POOL_MAX : (1U << (128 - bits)) - 2;
+    if (ip_pool_init(&ziti_dns.ip6.pool, capacity) != 0) {
+        ZITI_LOG(ERROR, "failed to allocate DNS IPv6 pool");
+        return -1;
+    }
+    ziti_dns.ip6.bits = bits;
+    ziti_dns.ip6.enabled = true;
+
+    // the configured address is used by the tun interface
+    uint32_t tun_off;
+    if (ipv6_offset(ip_2_ip6(&addr), &tun_off)) {
+        ip_pool_claim(&ziti_dns.ip6.pool, tun_off);
+    }
+    snprintf(ziti_dns.ip6.cidr, sizeof(ziti_dns.ip6.cidr), "%s/%d", ipaddr_ntoa(&addr), bits);
+
+    ip_addr_t net = addr;
+    *ip_2_ip6(&net) = *prefix;
+    ZITI_LOG(INFO, "DNS configured with IPv6 range %s/%d (%u ips)", ipaddr_ntoa(&net), bits, capacity);
+    return 0;
+}
+
+const char *ziti_dns_ipv6_cidr(void) {
+    return ziti_dns.ip6.enabled ? ziti_dns.ip6.cidr : NULL;
+}
+
+/** drop the hostnames and address ranges of an earlier ziti_dns_setup() */
+static void reset_dns() {
+    model_map_iter it;
+    // every hostname and domain is held by at least one intercept
+    while ((it = model_map_iterator(&ziti_dns.intercept_refs)) != NULL) {
+        size_t len;
+        void *intercept;
+        memcpy(&intercept, model_map_it_key_s(it, &len), sizeof(intercept));
+        ziti_dns_deregister_intercept(intercept);
+    }
+    it = model_map_iterator(&ziti_dns.hostnames);
+    while (it != NULL) {
+        dns_entry_t *e = model_map_it_value(it);
+        it = model_map_it_remove(it);
+        free_dns_entry(e);
+    }
+    // the tun and dns addresses
+    model_map_clear(&ziti_dns.ip_addresses, free);
+    model_map_clear(&ziti_dns.ip6_addresses, NULL);
+    model_map_clear(&ziti_dns.snapshot.reserved, free);
+
+    ip_pool_free(&ziti_dns.ip4.pool);
+    ip_pool_free(&ziti_dns.ip6.pool);
+    memset(&ziti_dns.ip6, 0, sizeof(ziti_dns.ip6));
+    ziti_dns.reclaimed = 0;
+}
+
 int ziti_dns_setup(tunneler_context tnlr, const char *dns_addr, const char *dns_cidr) {
+    if (ziti_dns.tnlr != NULL) {
+        ZITI_LOG(INFO, "DNS was set up before, dropping the existing hostnames");
+        reset_dns();
+    }
     ziti_dns.tnlr = tnlr;
-    seed_dns(dns_cidr);
+    TAILQ_INIT(&ziti_dns.wildcard_lru);
+    if (seed_dns(dns_cidr) != 0) {
+        return -1;
+    }
 
     intercept_ctx_t *dns_intercept = intercept_ctx_new(tnlr, "ziti:dns-resolver", &ziti_dns);
     ziti_address dns_zaddr, tun_zaddr;
@@ -198,10 +665,221 @@ int ziti_dns_setup(tunneler_context tnlr, const char *dns_addr, const char *dns_
     for (int i = 0; i < n; i++) {
         struct in_addr *in4_p = (struct in_addr *) &reserved[i]->addr.cidr.ip;
         model_map_setl(&ziti_dns.ip_addresses, in4_p->s_addr, calloc(1, sizeof(dns_entry_t)));
+        uint32_t off;
+        if (ipv4_offset(in4_p->s_addr, &off)) {
+            ip_pool_claim(&ziti_dns.ip4.pool, off);
+        }
     }
     return 0;
 }
 
+struct snapshot_write_s {
+    uv_work_t wr;
+    char *path;
+    char *data;
+    size_t len;
+    int err;
+};
+
+static void on_snapshot_timer(uv_timer_t *t);
+
+// runs on the worker pool
+static void write_snapshot(uv_work_t *wr) {
+    struct snapshot_write_s *req = wr->data;
+    size_t tmp_path_len = strlen(req->path) + sizeof(".tmp");
+    char *tmp_path = malloc(tmp_path_len);
+    snprintf(tmp_path, tmp_path_len, "%s.tmp", req->path);
+
+    FILE *f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        req->err = errno;
+    } else {
+        size_t written = fwrite(req->data, 1, req->len, f);
+        if (fclose(f) != 0 || written != req->len) {
+            req->err = errno ? errno : EIO;
+            remove(tmp_path);
+        } else {
+#if _WIN32
+            remove(req->path); // rename does not replace existing files
+#endif
+            if (rename(tmp_path, req->path) != 0) {
+                req->err = errno;
+            }
+        }
+    }
+    free(tmp_path);
+}
+
+static void write_snapshot_done(uv_work_t *wr, int status) {
+    struct snapshot_write_s *req = wr->data;
+    if (req->err != 0) {
+        ZITI_LOG(WARN, "failed to save DNS snapshot[%s]: %d(%s)", req->path, req->err, strerror(req->err));
+    } else {
+        ZITI_LOG(DEBUG, "saved DNS snapshot[%s]", req->path);
+    }
+    free(req->path);
+    free(req->data);
+    free(req);
+
+    ziti_dns.snapshot.saving = false;
+    if (ziti_dns.snapshot.dirty) {
+        snapshot_changed();
+    }
+}
+
+static void on_snapshot_timer(uv_timer_t *t) {
+    if (ziti_dns.snapshot.saving) {
+        ziti_dns.snapshot.dirty = true; // try again when current write is done
+        return;
+    }
+    ziti_dns.snapshot.dirty = false;
+
+    string_buf_t *buf = new_string_buf();
+    const char *name;
+    dns_entry_t *entry;
+    MODEL_MAP_FOREACH(name, entry, &ziti_dns.hostnames) {
+        string_buf_fmt(buf, "%s %s\n", entry->ip, name);
+        if (entry->has_ip6) {
+            string_buf_fmt(buf, "%s %s\n", entry->ip6, name);
+        }
+    }
+    dns_reservation_t *r;
+    MODEL_MAP_FOREACH(name, r, &ziti_dns.snapshot.reserved) {
+        char ip[IP6ADDR_STRLEN_MAX];
+        if (r->has_ip4) {
+            uv_inet_ntop(AF_INET, &r->ip4, ip, sizeof(ip));
+            string_buf_fmt(buf, "%s %s\n", ip, name);
+        }
+        if (r->has_ip6) {
+            uv_inet_ntop(AF_INET6, r->ip6.addr, ip, sizeof(ip));
+            string_buf_fmt(buf, "%s %s\n", ip, name);
+        }
+    }
+
+    struct snapshot_write_s *req = calloc(1, sizeof(struct snapshot_write_s));
+    req->wr.data = req;
+    req->path = strdup(ziti_dns.snapshot.path);
+    req->data = string_buf_to_string(buf, &req->len);
+    delete_string_buf(buf);
+
+    int rc = uv_queue_work(t->loop, &req->wr, write_snapshot, write_snapshot_done);
+    if (rc != 0) {
+        ZITI_LOG(WARN, "failed to save DNS snapshot[%s]: %d(%s)", req->path, rc, uv_strerror(rc));
+        free(req->path);
+        free(req->data);
+        free(req);
+        return;
+    }
+    ziti_dns.snapshot.saving = true;
+}
+
+static void snapshot_changed() {
+    if (ziti_dns.snapshot.path == NULL) return;
+
+    if (!uv_is_active((const uv_handle_t *) &ziti_dns.snapshot.save_timer)) {
+        uv_timer_start(&ziti_dns.snapshot.save_timer, on_snapshot_timer, SNAPSHOT_SAVE_DELAY_MILLIS, 0);
+    }
+}
+
+static void on_snapshot_grace_expired(uv_timer_t *t) {
+    size_t count = model_map_size(&ziti_dns.snapshot.reserved);
+    if (count == 0) return;
+
+    ZITI_LOG(INFO, "releasing %zd DNS mappings from snapshot that were not claimed", count);
+    while (release_reservation());
+    snapshot_changed();
+}
+
+int ziti_dns_load_snapshot(uv_loop_t *loop, const char *path) {
+    if (ziti_dns.snapshot.path != NULL) {
+        ZITI_LOG(WARN, "DNS snapshot is already loaded from %s", ziti_dns.snapshot.path);
+        return UV_EALREADY;
+    }
+
+    ziti_dns.snapshot.path = strdup(path);
+    if (!ziti_dns.snapshot.timers_init) {
+        uv_timer_init(loop, &ziti_dns.snapshot.save_timer);
+        uv_unref((uv_handle_t *) &ziti_dns.snapshot.save_timer);
+        uv_timer_init(loop, &ziti_dns.snapshot.grace_timer);
+        uv_unref((uv_handle_t *) &ziti_dns.snapshot.grace_timer);
+        ziti_dns.snapshot.timers_init = true;
+    }
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        ZITI_LOG(INFO, "DNS snapshot[%s] not found", path);
+        return 0;
+    }
+
+    // one line per address, hostnames with an IPv6 address have two
+    int count = 0;
+    char line[IP6ADDR_STRLEN_MAX + MAX_DNS_NAME + 8];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char ip[IP6ADDR_STRLEN_MAX];
+        char name[MAX_DNS_NAME];
+        struct in_addr in;
+        ip6_addr_t in6 = {0};
+        bool is_ip6 = false;
+        uint32_t off;
+        if (sscanf(line, "%45s %255s", ip, name) != 2) {
+            ZITI_LOG(WARN, "ignoring invalid DNS snapshot entry: %s", line);
+            continue;
+        }
+        if (uv_inet_pton(AF_INET6, ip, in6.addr) == 0) {
+            is_ip6 = true;
+        } else if (uv_inet_pton(AF_INET, ip, &in) != 0) {
+            ZITI_LOG(WARN, "ignoring invalid DNS snapshot entry: %s", line);
+            continue;
+        }
+
+        // skip entries that don't fit the current ip ranges, or conflict with an earlier entry
+        dns_reservation_t *r = model_map_get(&ziti_dns.snapshot.reserved, name);
+        bool restore = model_map_get(&ziti_dns.hostnames, name) == NULL;
+        if (is_ip6) {
+            restore = restore && !(r && r->has_ip6) && ipv6_offset(&in6, &off) &&
+                      ip_pool_claim(&ziti_dns.ip6.pool, off);
+        } else {
+            restore = restore && !(r && r->has_ip4) && ipv4_offset(in.s_addr, &off) &&
+                      ip_pool_claim(&ziti_dns.ip4.pool, off);
+        }
+        if (!restore) {
+            ZITI_LOG(DEBUG, "not restoring DNS mapping %s -> %s", name, ip);
+            continue;
+        }
+
+        if (r == NULL) {
+            r = calloc(1, sizeof(dns_reservation_t));
+            model_map_set(&ziti_dns.snapshot.reserved, name, r);
+            count++;
+        }
+        if (is_ip6) {
+            r->has_ip6 = true;
+            r->ip6 = in6;
+        } else {
+            r->has_ip4 = true;
+            r->ip4 = in.s_addr;
+        }
+    }
+    fclose(f);
+
+    if (count > 0) {
+        ZITI_LOG(INFO, "holding %d DNS mappings from snapshot[%s] for %ds", count, path, SNAPSHOT_GRACE_MILLIS / 1000);
+        uv_timer_start(&ziti_dns.snapshot.grace_timer, on_snapshot_grace_expired, SNAPSHOT_GRACE_MILLIS, 0);
+    }
+    return count;
+}
+
+void ziti_dns_close_snapshot() {
+    if (ziti_dns.snapshot.path == NULL) return;
+
+    uv_timer_stop(&ziti_dns.snapshot.save_timer);
+    uv_timer_stop(&ziti_dns.snapshot.grace_timer);
+    while (release_reservation());
+    ziti_dns.snapshot.dirty = false;
+    free(ziti_dns.snapshot.path);
+    ziti_dns.snapshot.path = NULL;
+}
+
 #define CHECK_UV(op) do{ int rc = (op); if (rc < 0) {\
 ZITI_LOG(ERROR, "failed [" #op "]: %d(%s)", rc, uv_strerror(rc)); \
 return rc;} \
@@ -333,46 +1011,181 @@ static bool check_name(const char *name, char clean_name[MAX_DNS_NAME], bool *is
     return success;
 }
 
-static dns_entry_t* new_ipv4_entry(const char *host) {
+static void build_answer_template(uint8_t *p, uint8_t type, const void *addr, uint8_t addr_len) {
+    *p++ = 0xc0; // name ref to question
+    *p++ = 0x0c;
+    *p++ = 0;
+    *p++ = type;
+    *p++ = 0;
+    *p++ = 1; // class IN
+    *p++ = (DNS_HOST_TTL >> 24) & 0xff;
+    *p++ = (DNS_HOST_TTL >> 16) & 0xff;
+    *p++ = (DNS_HOST_TTL >> 8) & 0xff;
+    *p++ = DNS_HOST_TTL & 0xff;
+    *p++ = 0;
+    *p++ = addr_len;
+    memcpy(p, addr, addr_len);
+}
+
+static dns_entry_t* new_dns_entry(const char *host) {
     dns_entry_t *entry = calloc(1, sizeof(dns_entry_t));
     strncpy(entry->name, host, sizeof(entry->name));
-    uint32_t next = next_ipv4();
+    uint32_t next;
+    dns_reservation_t *reserved = model_map_remove(&ziti_dns.snapshot.reserved, host);
+    if (reserved && reserved->has_ip4) {
+        next = reserved->ip4;
+        reserved->has_ip4 = false;
+    } else {
+        next = next_ipv4();
+    }
     if (next == INADDR_NONE) {
+        if (reserved) {
+            release_reserved_ips(reserved);
+        }
+        free(entry);
         return NULL;
     }
 
     ip_addr_set_ip4_u32(&entry->addr, next);
     ipaddr_ntoa_r(&entry->addr, entry->ip, sizeof(entry->ip));
-
+    build_answer_template(entry->a_rr, NS_T_A, &ip_2_ip4(&entry->addr)->addr, 4);
     model_map_set(&ziti_dns.hostnames, host, entry);
     model_map_setl(&ziti_dns.ip_addresses, ip_2_ip4(&entry->addr)->addr, entry);
-    ZITI_LOG(INFO, "registered DNS entry %s -> %s", host, entry->ip);
+
+    if (reserved && reserved->has_ip6) {
+        const ip6_addr_t *r6 = &reserved->ip6;
+        IP_ADDR6(&entry->addr6, r6->addr[0], r6->addr[1], r6->addr[2], r6->addr[3]);
+        entry->has_ip6 = true;
+    } else {
+        entry->has_ip6 = next_ipv6(&entry->addr6);
+    }
+    if (entry->has_ip6) {
+        const ip6_addr_t *ip6 = ip_2_ip6(&entry->addr6);
+        ipaddr_ntoa_r(&entry->addr6, entry->ip6, sizeof(entry->ip6));
+        build_answer_template(entry->aaaa_rr, NS_T_AAAA, ip6->addr, sizeof(ip6->addr));
+        model_map_set_key(&ziti_dns.ip6_addresses, ip6->addr, sizeof(ip6->addr), entry);
+    }
+    ZITI_LOG(INFO, "registered DNS entry %s -> %s%s%s%s", host, entry->ip,
+             entry->has_ip6 ? ", " : "", entry->has_ip6 ? entry->ip6 : "", reserved ? " (restored)" : "");
+    free(reserved);
+    snapshot_changed();
 
     return entry;
 }
 
 const char *ziti_dns_reverse_lookup_domain(const ip_addr_t *addr) {
-     dns_entry_t *entry = model_map_getl(&ziti_dns.ip_addresses, ip_2_ip4(addr)->addr);
+     dns_entry_t *entry = entry_by_addr(addr);
      if (entry && entry->domain) {
+         touch_entry(entry);
          return entry->domain->name;
      }
      return NULL;
 }
 
+const ziti_address *ziti_dns_match_domain_intercept(const ip_addr_t *addr, const void *intercept) {
+    dns_entry_t *entry = entry_by_addr(addr);
+    if (entry == NULL || entry->domain == NULL) {
+        return NULL;
+    }
+
+    touch_entry(entry);
+    // entry->domain is the most specific wildcard for the hostname, but the intercept may have a broader one
+    for (domain_trie_t *node = entry->domain->node; node != NULL; node = node->parent) {
+        if (node->domain) {
+            dns_domain_intercept_t *di = model_map_get_key(&node->domain->intercepts, &intercept, sizeof(intercept));
+            if (di) {
+                return &di->addr;
+            }
+        }
+    }
+    return NULL;
+}
+
+const ip_addr_t *ziti_dns_hostname_ip6(const ziti_address *addr) {
+    char clean[MAX_DNS_NAME];
+    bool is_domain;
+    if (addr->type != ziti_address_hostname ||
+        !check_name(addr->addr.hostname, clean, &is_domain) || is_domain) {
+        return NULL;
+    }
+
+    dns_entry_t *entry = model_map_get(&ziti_dns.hostnames, clean);
+    return entry && entry->has_ip6 ? &entry->addr6 : NULL;
+}
+
 const char *ziti_dns_reverse_lookup(const char *ip_addr) {
     ip_addr_t addr = {0};
     ipaddr_aton(ip_addr, &addr);
-    dns_entry_t *entry = model_map_getl(&ziti_dns.ip_addresses, ip_2_ip4(&addr)->addr);
+    dns_entry_t *entry = entry_by_addr(&addr);
+    if (entry) {
+        touch_entry(entry);
+    }
 
     return entry ? entry->name : NULL;
 }
 
+// walks `name` label by label, right to left. returns pointer to the start of the label before `end`
+static const char *prev_label(const char *name, const char *end) {
+    const char *p = end;
+    while (p > name && *(p - 1) != '.') p--;
+    return p;
+}
+
+static domain_trie_t *trie_child(domain_trie_t *node, const char *label, size_t label_len, bool create) {
+    char key[MAX_DNS_NAME];
+    snprintf(key, sizeof(key), "%.*s", (int)label_len, label);
+
+    domain_trie_t *child = model_map_get(&node->children, key);
+    if (child == NULL && create) {
+        child = calloc(1, sizeof(domain_trie_t));
+        child->parent = node;
+        child->label = strdup(key);
+        model_map_set(&node->children, key, child);
+    }
+    return child;
+}
+
+static void trie_add_domain(dns_domain_t *domain) {
+    const char *name = domain->name + 2; // skip '*.'
+    const char *end = name + strlen(name);
+    domain_trie_t *node = &ziti_dns.domain_trie;
+    while (true) {
+        const char *label = prev_label(name, end);
+        node = trie_child(node, label, end - label, true);
+        if (label == name) break;
+        end = label - 1;
+    }
+    node->domain = domain;
+    domain->node = node;
+}
+
+static void trie_remove_domain(dns_domain_t *domain) {
+    domain_trie_t *node = domain->node;
+    if (node == NULL) return;
+
+    node->domain = NULL;
+    domain->node = NULL;
+    while (node != &ziti_dns.domain_trie && node->domain == NULL && model_map_size(&node->children) == 0) {
+        domain_trie_t *parent = node->parent;
+        model_map_remove(&parent->children, node->label);
+        free(node->label);
+        free(node);
+        node = parent;
+    }
+}
+
+/** find the most specific active wildcard domain that covers `hostname` */
 static dns_domain_t* find_domain(const char *hostname) {
-    char *dot = strchr(hostname, '.');
-    dns_domain_t *domain = model_map_get(&ziti_dns.domains, hostname);
-    while (dot != NULL && domain == NULL) {
-        domain = model_map_get(&ziti_dns.domains, dot + 1);
-        dot = strchr(dot + 1, '.');
+    dns_domain_t *domain = NULL;
+    const char *end = hostname + strlen(hostname);
+    domain_trie_t *node = &ziti_dns.domain_trie;
+    while (true) {
+        const char *label = prev_label(hostname, end);
+        node = trie_child(node, label, end - label, false);
+        if (node == NULL) break;
+        if (node->domain) domain = node->domain;
+        if (label == hostname) break;
+        end = label - 1;
     }
     return domain;
 }
@@ -392,11 +1205,17 @@ static dns_entry_t *ziti_dns_lookup(const char *hostname) {
 
         if (domain && model_map_size(&domain->intercepts) > 0) {
             ZITI_LOG(DEBUG, "matching domain[%s] found for %s", domain->name, hostname);
-            entry = new_ipv4_entry(clean);
+            entry = new_dns_entry(clean);
             if (entry) {
                 entry->domain = domain;
+                LIST_INSERT_HEAD(&domain->entries, entry, _domain_link);
+                entry->in_lru = true;
+                entry->last_used = now_millis();
+                TAILQ_INSERT_TAIL(&ziti_dns.wildcard_lru, entry, _lru);
             }
         }
+    } else {
+        touch_entry(entry);
     }
 
     if (entry) {
@@ -411,38 +1230,74 @@ static dns_entry_t *ziti_dns_lookup(const char *hostname) {
 }
 
 
+static bool is_active_entry(const dns_entry_t *e) {
+    return model_map_size(&e->intercepts) > 0 || (e->domain != NULL && model_map_size(&e->domain->intercepts) > 0);
+}
+
+static void remove_inactive_entry(dns_entry_t *e) {
+    model_map_remove(&ziti_dns.hostnames, e->name);
+    ZITI_LOG(INFO, "DNS mapping %s -> %s is now inactive", e->name, e->ip);
+    free_dns_entry(e);
+    ZITI_LOG(DEBUG, "%zu active hostnames mapped to %zu IPs", model_map_size(&ziti_dns.hostnames), model_map_size(&ziti_dns.ip_addresses));
+}
+
+static void deactivate_domain(dns_domain_t *domain) {
+    model_map_remove(&ziti_dns.domains, domain->name + 2);
+    trie_remove_domain(domain);
+    ZITI_LOG(INFO, "wildcard domain[%s] is now inactive", domain->name);
+
+    // hostnames that were resolved via this domain go away, unless they are also intercepted explicitly
+    dns_entry_t *e = LIST_FIRST(&domain->entries);
+    while (e != NULL) {
+        dns_entry_t *next = LIST_NEXT(e, _domain_link);
+        if (model_map_size(&e->intercepts) == 0) {
+            remove_inactive_entry(e);
+        } else {
+            LIST_REMOVE(e, _domain_link);
+            e->domain = NULL;
+        }
+        e = next;
+    }
+}
+
 void ziti_dns_deregister_intercept(void *intercept) {
-    model_map_iter it = model_map_iterator(&ziti_dns.domains);
+    dns_intercept_refs_t *refs = model_map_remove_key(&ziti_dns.intercept_refs, &intercept, sizeof(intercept));
+    if (refs == NULL) {
+        return;
+    }
+
+    model_map_iter it = model_map_iterator(&refs->domains);
     while (it != NULL) {
         dns_domain_t *domain = model_map_it_value(it);
-        model_map_remove_key(&domain->intercepts, &intercept, sizeof(intercept));
+        free(model_map_remove_key(&domain->intercepts, &intercept, sizeof(intercept)));
+        if (model_map_size(&domain->intercepts) == 0) {
+            deactivate_domain(domain);
+        }
         it = model_map_it_next(it);
     }
 
-    it = model_map_iterator(&ziti_dns.hostnames);
+    it = model_map_iterator(&refs->entries);
     while (it != NULL) {
         dns_entry_t *e = model_map_it_value(it);
         model_map_remove_key(&e->intercepts, &intercept, sizeof(intercept));
-        if (model_map_size(&e->intercepts) == 0 && (e->domain == NULL || model_map_size(&e->domain->intercepts) == 0)) {
-            it = model_map_it_remove(it);
-            model_map_removel(&ziti_dns.ip_addresses, ip_2_ip4(&e->addr)->addr);
-            ZITI_LOG(DEBUG, "%zu active hostnames mapped to %zu IPs", model_map_size(&ziti_dns.hostnames), model_map_size(&ziti_dns.ip_addresses));
-            ZITI_LOG(INFO, "DNS mapping %s -> %s is now inactive", e->name, e->ip);
-        } else {
-            it = model_map_it_next(it);
+        if (!is_active_entry(e)) {
+            remove_inactive_entry(e);
         }
+        it = model_map_it_next(it);
     }
 
-    it = model_map_iterator(&ziti_dns.domains);
-    while (it != NULL) {
-        dns_domain_t *domain = model_map_it_value(it);
-        if (model_map_size(&domain->intercepts) == 0) {
-            it = model_map_it_remove(it);
-            ZITI_LOG(INFO, "wildcard domain[*%s] is now inactive", domain->name);
-        } else {
-            it = model_map_it_next(it);
-        }
+    model_map_clear(&refs->domains, NULL);
+    model_map_clear(&refs->entries, NULL);
+    free(refs);
+}
+
+static dns_intercept_refs_t *intercept_refs(void *intercept) {
+    dns_intercept_refs_t *refs = model_map_get_key(&ziti_dns.intercept_refs, &intercept, sizeof(intercept));
+    if (refs == NULL) {
+        refs = calloc(1, sizeof(dns_intercept_refs_t));
+        model_map_set_key(&ziti_dns.intercept_refs, &intercept, sizeof(intercept), refs);
     }
+    return refs;
 }
 
 const ip_addr_t *ziti_dns_register_hostname(const ziti_address *addr, void *intercept) {
@@ -466,16 +1321,25 @@ const ip_addr_t *ziti_dns_register_hostname(const ziti_address *addr, void *inte
             domain = calloc(1, sizeof(dns_domain_t));
             strncpy(domain->name, clean, sizeof(domain->name));
             model_map_set(&ziti_dns.domains, clean + 2, domain);
+            trie_add_domain(domain);
         }
-        model_map_set_key(&domain->intercepts, &intercept, sizeof(intercept), intercept);
+        dns_domain_intercept_t *di = model_map_get_key(&domain->intercepts, &intercept, sizeof(intercept));
+        if (di == NULL) {
+            di = calloc(1, sizeof(dns_domain_intercept_t));
+            di->intercept = intercept;
+            model_map_set_key(&domain->intercepts, &intercept, sizeof(intercept), di);
+        }
+        di->addr = *addr;
+        model_map_set_key(&intercept_refs(intercept)->domains, &domain, sizeof(domain), domain);
         return NULL;
     } else {
         dns_entry_t *entry = model_map_get(&ziti_dns.hostnames, clean);
         if (!entry) {
-            entry = new_ipv4_entry(clean);
+            entry = new_dns_entry(clean);
         }
         if (entry) {
             model_map_set_key(&entry->intercepts, &intercept, sizeof(intercept), intercept);
+            model_map_set_key(&intercept_refs(intercept)->entries, &entry, sizeof(entry), entry);
             return &entry->addr;
         } else {
             return NULL;
@@ -485,7 +1349,6 @@ const ip_addr_t *ziti_dns_register_hostname(const ziti_address *addr, void *inte
 
 static const char DNS_OPT[] = { 0x0, 0x0, 0x29, 0x10, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0 };
 
-#define DNS_HEADER_LEN 12
 #define DNS_ID(p) ((uint8_t)(p)[0] << 8 | (uint8_t)(p)[1])
 #define DNS_FLAGS(p) ((p)[2] << 8 | (p)[3])
 #define DNS_QRS(p) ((p)[4] << 8 | (p)[5])
@@ -582,6 +1445,17 @@ static void format_resp(struct dns_req *req) {
                     break;
                 }
 
+                case NS_T_AAAA: {
+                    if (resp_end - rp < (2 + sizeof(req->addr6))) {
+                        truncated = true;
+                        goto done;
+                    }
+                    SET_U16(rp, sizeof(req->addr6));
+                    memcpy(rp, &req->addr6, sizeof(req->addr6));
+                    rp += sizeof(req->addr6);
+                    break;
+                }
+
                 case NS_T_TXT: {
                     uint16_t txtlen = strlen(a->data);
                     uint16_t datalen = 1 + txtlen;
@@ -645,7 +1519,95 @@ static void format_resp(struct dns_req *req) {
     req->resp_len = rp - req->resp;
 }
 
-static void process_host_req(struct dns_req *req) {
+#define FAST_HOST_RESP_MAX (DNS_HEADER_LEN + MAX_DNS_NAME + 2 + 4 + DNS_AAAA_RR_LEN + sizeof(DNS_OPT))
+
+/**
+ * answers A and AAAA queries for ziti hostnames straight from the query packet, without allocating a dns_req.
+ * `resp` must hold FAST_HOST_RESP_MAX bytes. returns 0 if the query needs to go through regular processing.
+ */
+static size_t fast_host_answer(const uint8_t *q, size_t q_len, uint8_t *resp) {
+    if (q_len < DNS_HEADER_LEN) return 0;
+
+    uint16_t flags = DNS_FLAGS(q);
+    if (!IS_QUERY(flags) || (flags & 0x7800) != 0 || DNS_QRS(q) != 1) { // standard query with one question
+        return 0;
+    }
+
+    char name[MAX_DNS_NAME];
+    char *np = name;
+    size_t off = DNS_HEADER_LEN;
+    while (off < q_len && q[off] != 0) {
+        uint8_t label_len = q[off++];
+        if ((label_len & 0xc0) != 0 || off + label_len > q_len ||
+            (np - name) + label_len + 1 >= sizeof(name)) {
+            return 0;
+        }
+        if (np != name) *np++ = '.';
+        memcpy(np, q + off, label_len);
+        np += label_len;
+        off += label_len;
+    }
+    *np = '\0';
+    off++; // root label
+    if (off + 4 > q_len || np == name) return 0;
+
+    uint16_t qtype = (q[off] << 8) | q[off + 1];
+    uint16_t qclass = (q[off + 2] << 8) | q[off + 3];
+    off += 4;
+    if ((qtype != NS_T_A && qtype != NS_T_AAAA) || qclass != 1) {
+        return 0;
+    }
+
+    dns_entry_t *entry = ziti_dns_lookup(name);
+    if (entry == NULL) {
+        return 0;
+    }
+
+    memcpy(resp, q, off);
+    uint8_t *rp = resp + off;
+    DNS_SET_ANS(resp);
+    resp[3] &= 0xf0; // RCODE NOERROR
+    if (uv_is_active((const uv_handle_t *) &ziti_dns.upstream)) {
+        DNS_SET_RA(resp);
+    }
+    memset(resp + 6, 0, 6);
+    const char *answer = "no records";
+    if (qtype == NS_T_A) {
+        DNS_SET_ARS(resp, 1);
+        memcpy(rp, entry->a_rr, DNS_A_RR_LEN);
+        rp += DNS_A_RR_LEN;
+        answer = entry->ip;
+    } else if (entry->has_ip6) {
+        DNS_SET_ARS(resp, 1);
+        memcpy(rp, entry->aaaa_rr, DNS_AAAA_RR_LEN);
+        rp += DNS_AAAA_RR_LEN;
+        answer = entry->ip6;
+    }
+    DNS_SET_AARS(resp, 1);
+    memcpy(rp, DNS_OPT, sizeof(DNS_OPT));
+    rp += sizeof(DNS_OPT);
+
+    ZITI_LOG(TRACE, "answering query[%04x] type[%d] name[%s] with %s", DNS_ID(q), qtype, name, answer);
+    return rp - resp;
+}
+
+static bool fast_host_resp(ziti_dns_client_t *clt, const uint8_t *q, size_t q_len) {
+    uint8_t resp[FAST_HOST_RESP_MAX];
+    size_t resp_len = fast_host_answer(q, q_len, resp);
+    if (resp_len == 0) {
+        return false;
+    }
+
+    ziti_tunneler_write(clt->io_ctx->tnlr_io, resp, resp_len);
+    // close client if there are no other pending requests
+    if (model_map_size(&clt->active_reqs) == 0) {
+        on_dns_close(clt->io_ctx->ziti_io);
+    }
+    return true;
+}
+
+/** formats the answer for an A or AAAA query if the name is a ziti hostname */
+static bool host_answer(struct dns_req *req) {
     dns_entry_t *entry = ziti_dns_lookup(req->msg.question[0]->name);
     if (entry) {
         req->msg.status = DNS_NO_ERROR;
@@ -654,14 +1616,30 @@ static void process_host_req(struct dns_req *req) {
             req->addr.s_addr = entry->addr.u_addr.ip4.addr;
 
             dns_answer *a = calloc(1, sizeof(dns_answer));
-            a->ttl = 60;
+            a->ttl = DNS_HOST_TTL;
             a->type = NS_T_A;
             a->data = strdup(entry->ip);
             req->msg.answer = calloc(2, sizeof(dns_answer *));
             req->msg.answer[0] = a;
+        } else if (req->msg.question[0]->type == NS_T_AAAA && entry->has_ip6) {
+            memcpy(&req->addr6, ip_2_ip6(&entry->addr6)->addr, sizeof(req->addr6));
+
+            dns_answer *a = calloc(1, sizeof(dns_answer));
+            a->ttl = DNS_HOST_TTL;
+            a->type = NS_T_AAAA;
+            a->data = strdup(entry->ip6);
+            req->msg.answer = calloc(2, sizeof(dns_answer *));
+            req->msg.answer[0] = a;
         }
 
         format_resp(req);
+        return true;
+    }
+    return false;
+}
+
+static void process_host_req(struct dns_req *req) {
+    if (host_answer(req)) {
         complete_dns_req(req);
     } else {
         int rc = query_upstream(req);
@@ -677,6 +1655,9 @@ static void proxy_domain_close_cb(ziti_connection c) {
     dns_domain_t *domain = ziti_conn_data(c);
     if (domain) {
         domain->resolv_proxy = NULL;
+        domain->proxy_wire = false;
+        free(domain->proxy_rbuf);
+        domain->proxy_rbuf = NULL;
     }
 }
 
@@ -691,8 +1672,46 @@ static void on_proxy_connect(ziti_connection conn, int status) {
     }
 }
 
+static void on_proxy_wire_msg(void *ctx, const uint8_t *msg, size_t len) {
+    dns_domain_t *domain = ctx;
+    if (len == 0) {
+        ZITI_LOG(DEBUG, "proxy resolve connection for domain[%s] is using wire format", domain->name);
+        domain->proxy_wire = true;
+        return;
+    }
+
+    if (len < DNS_HEADER_LEN) {
+        ZITI_LOG(WARN, "proxy resolve: short DNS message (%zd bytes)", len);
+        return;
+    }
+
+    uint16_t id = DNS_ID(msg);
+    struct dns_req *req = model_map_get_key(&ziti_dns.requests, &id, sizeof(id));
+    if (req) {
+        if (len <= sizeof(req->resp)) {
+            memcpy(req->resp, msg, len);
+            req->resp_len = len;
+        } else {
+            req->msg.status = DNS_SERVFAIL;
+            format_resp(req);
+        }
+        complete_dns_req(req);
+    }
+}
+
 static ssize_t on_proxy_data(ziti_connection conn, const uint8_t* data, ssize_t status) {
-    if (status >= 0) {
+    dns_domain_t *domain = ziti_conn_data(conn);
+    // JSON responses (legacy peer, or requests sent before wire format was acknowledged) are never split
+    bool in_frame = domain->proxy_rbuf != NULL && domain->proxy_rbuf->len > 0;
+    if (status > 0 && (in_frame || data[0] != '{')) {
+        if (domain->proxy_rbuf == NULL) {
+            domain->proxy_rbuf = calloc(1, sizeof(dns_frame_buf_t));
+        }
+        if (dns_frame_read(domain->proxy_rbuf, data, status, on_proxy_wire_msg, domain) != 0) {
+            ZITI_LOG(ERROR, "invalid DNS message frame on proxy resolve connection for domain[%s]", domain->name);
+            ziti_close(conn, proxy_domain_close_cb);
+        }
+    } else if (status >= 0) {
         ZITI_LOG(DEBUG, "proxy resolve: %.*s", (int)status, data);
         dns_message msg = {0};
         int rc = parse_dns_message(&msg, (const char *) data, status);
@@ -718,13 +1737,13 @@ static ssize_t on_proxy_data(ziti_connection conn, const uint8_t* data, ssize_t
 
 struct proxy_dns_req_wr_s {
     struct dns_req *req;
-    char *json;
+    uint8_t *payload; // JSON or framed wire message
 };
 
 static void free_proxy_dns_wr(struct proxy_dns_req_wr_s *wr) {
-    if (wr->json) {
-        free(wr->json);
-        wr->json = NULL;
+    if (wr->payload) {
+        free(wr->payload);
+        wr->payload = NULL;
     }
     free(wr);
 }
@@ -748,24 +1767,31 @@ static void proxy_domain_req(struct dns_req *req, dns_domain_t *domain) {
     if (domain->resolv_proxy == NULL) {
         // initiate connection to hosting endpoint for this domain
         model_map_iter it = model_map_iterator(&domain->intercepts);
-        void *intercept = model_map_it_value(it);
-        domain->resolv_proxy = intercept_resolve_connect(intercept, domain, on_proxy_connect, on_proxy_data);
+        dns_domain_intercept_t *di = model_map_it_value(it);
+        domain->resolv_proxy = intercept_resolve_connect(di->intercept, domain, on_proxy_connect, on_proxy_data);
     }
     dns_question *q = req->msg.question[0];
     if (domain->resolv_proxy == NULL) {
         req->msg.status = DNS_SERVFAIL;
-    } else if (q->type == NS_T_MX || q->type == NS_T_SRV || q->type == NS_T_TXT) {
-        size_t jsonlen;
+    } else if (domain->proxy_wire || q->type == NS_T_MX || q->type == NS_T_SRV || q->type == NS_T_TXT) {
+        size_t payload_len;
         struct proxy_dns_req_wr_s *wr = calloc(1, sizeof(struct proxy_dns_req_wr_s));
         wr->req = req;
-        wr->json = dns_message_to_json(&req->msg, MODEL_JSON_COMPACT, &jsonlen);
-        if (wr->json) {
-            ZITI_LOG(DEBUG, "writing proxy resolve req[%04x]: %s", req->id, wr->json);
-
+        if (domain->proxy_wire) {
+            // any record type can be proxied in wire format
+            wr->payload = dns_frame_msg(req->req, req->req_len, &payload_len);
+            ZITI_LOG(DEBUG, "writing proxy resolve req[%04x]: %s[%d]", req->id, q->name, (int)q->type);
+        } else {
+            wr->payload = (uint8_t *) dns_message_to_json(&req->msg, MODEL_JSON_COMPACT, &payload_len);
+            if (wr->payload) {
+                ZITI_LOG(DEBUG, "writing proxy resolve req[%04x]: %s", req->id, (char *) wr->payload);
+            }
+        }
+        if (wr->payload) {
             // intercept_resolve_connect above can quick-fail if context does not have a valid API session
             // in that case resolve_proxy connection will be in Closed state and write will fail.
             // ziti_write will queue the message if the connection state is Connecting (as it will be the first time through)
-            int rc = ziti_write(domain->resolv_proxy, (uint8_t *) wr->json, jsonlen, on_proxy_write, wr);
+            int rc = ziti_write(domain->resolv_proxy, wr->payload, payload_len, on_proxy_write, wr);
             if (rc == ZITI_OK) {
                 // completion with client will happen in on_proxy_write if write fails, or on_proxy_data when response arrives
                 return;
@@ -784,11 +1810,40 @@ static void proxy_domain_req(struct dns_req *req, dns_domain_t *domain) {
     complete_dns_req(req);
 }
 
+size_t ziti_dns_host_answer(const uint8_t *q, size_t q_len, uint8_t *resp, size_t resp_len, bool fast) {
+    if (fast) {
+        uint8_t buf[FAST_HOST_RESP_MAX];
+        size_t len = fast_host_answer(q, q_len, buf);
+        if (len == 0 || len > resp_len) return 0;
+        memcpy(resp, buf, len);
+        return len;
+    }
+
+    struct dns_req *req = calloc(1, sizeof(struct dns_req));
+    size_t len = 0;
+    if (q_len >= DNS_HEADER_LEN && q_len <= sizeof(req->req) && parse_dns_req(&req->msg, q, q_len) == 0) {
+        memcpy(req->req, q, q_len);
+        req->req_len = q_len;
+        int type = req->msg.question[0]->type;
+        if ((type == NS_T_A || type == NS_T_AAAA) && host_answer(req) && req->resp_len <= resp_len) {
+            memcpy(resp, req->resp, req->resp_len);
+            len = req->resp_len;
+        }
+    }
+    free_dns_req(req);
+    return len;
+}
+
 ssize_t on_dns_req(const void *ziti_io_ctx, void *write_ctx, const void *q_packet, size_t q_len) {
     ziti_dns_client_t *clt = (ziti_dns_client_t *)ziti_io_ctx;
     const uint8_t *dns_packet = q_packet;
     size_t dns_packet_len = q_len;
 
+    if (fast_host_resp(clt, dns_packet, dns_packet_len)) {
+        ziti_tunneler_ack(write_ctx);
+        return (ssize_t)q_len;
+    }
+
     uint16_t req_id = DNS_ID(dns_packet);
     struct dns_req *req = model_map_get_key(&ziti_dns.requests, &req_id, sizeof(req_id));
     if (req != NULL) {
@@ -20,24 +20,41 @@
 #define _WIN32_WINNT  _WIN32_WINNT_WIN6
  // Windows Server 2008
 #include <ws2tcpip.h>
+#else
+#include <unistd.h>
 #endif
 
 
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <ziti/ziti_log.h>
 #include <memory.h>
 #include <ziti/ziti_tunnel_cbs.h>
 #include "ziti_hosting.h"
+#include "dial_pool.h"
+#include "mux.h"
+#include "compress.h"
 #include "tlsuv/tlsuv.h"
 
 #if _WIN32
 #ifndef strcasecmp
 #define strcasecmp(a,b) stricmp(a,b)
 #endif
+#define sock_close(s) closesocket(s)
+#else
+#define sock_close(s) close(s)
 #endif
 
 #define KEEPALIVE_DELAY 60
 
+// dynamic terminator cost
+#define COST_DEFAULT_INTERVAL_SECONDS 30
+
+IMPL_MODEL(host_backend_pool_cfg, HOST_BACKEND_POOL_MODEL)
+IMPL_MODEL(host_dynamic_cost_cfg, HOST_DYNAMIC_COST_MODEL)
+IMPL_MODEL(host_cfg_v1_ext, HOST_CFG_V1_EXT_MODEL)
+
 /********** hosting **********/
 static void on_bridge_close(uv_handle_t *handle);
 
@@ -50,28 +67,115 @@ struct hosted_io_ctx_s {
     const char *computed_dst_ip_or_hn;
     const char *computed_dst_port;
     char resolved_dst[80];
+    // requested source address for tcp. each connection attempt is bound to it
+    bool has_src_addr;
+    struct sockaddr_storage src_addr;
+    bool bridged;
+    // a resolve or connect callback still has `io`. if the client goes away meanwhile, the callback frees it
+    bool connecting;
+    bool released;
+    // the client was accepted before its flow was known, see dial_pool.h
+    bool deferred;
+    udp_bridge_t *udp_bridge;
+    // tcp flow on a multiplexed ziti connection, instead of `client`. see mux.h
+    mux_stream_t *stream;
+    size_t stream_pending; // bytes from the server that the stream hasn't sent yet
+    // tcp: the client asked for compression, so the flow is bridged here instead of by ziti_conn_bridge()
+    compress_encoder_t *encoder;
+    compress_decoder_t *decoder; // NULL if the client sends plain data
+    bool compress_hello_pending; // the client's first message tells whether it compresses as well
+    size_t client_pending; // bytes for the client that ziti hasn't sent yet
+    size_t server_pending; // bytes for the server that it hasn't taken yet
+    // streams and compressed flows
+    bool client_eof;
+    bool server_eof;
+    bool server_paused;
+    // backend that this connection counts against, for least-connections balancing
+    bool has_backend;
+    struct sockaddr_storage backend;
+    // connection setup milestones, uv_hrtime() nanos
+    struct {
+        uint64_t incoming;
+        uint64_t resolved;
+        uint64_t connected;
+        uint64_t accepted;
+    } timing;
     union {
         uv_tcp_t tcp;
         uv_udp_t udp;
     } server;
 };
 
+/** the ziti side of a hosted connection */
+typedef struct hosted_client_s {
+    ziti_connection conn; // for a stream, the multiplexed connection that carries it
+    const char *caller_id;
+    bool deferred;
+    mux_stream_t *stream;
+} hosted_client_t;
+
+/** a message for the ziti client, freed once it is written */
+struct client_write_s {
+    uint8_t *msg;
+    size_t len;
+};
+
 static void hosted_io_context_free(hosted_io_context io) {
     if (io) {
+        host_load_t *load = &io->service->load;
+        load->attempts++;
+        if (io->bridged) {
+            load->active--;
+        } else {
+            load->failures++;
+        }
+        if (io->has_backend && io->service->dial != NULL) {
+            host_dial_conn_closed(io->service->dial, (struct sockaddr *) &io->backend);
+        }
         if (io->app_data) {
             free_tunneler_app_data_ptr(io->app_data);
         }
+        if (io->encoder) {
+            uint64_t in, out;
+            compress_encoder_stats(io->encoder, &in, &out);
+            ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] compressed %" PRIu64 " bytes to %" PRIu64,
+                     io->service->service_name, io->client_identity, in, out);
+            compress_encoder_free(io->encoder);
+        }
+        compress_decoder_free(io->decoder);
         free(io);
     }
 }
 
+/** frees `io`, unless a resolve or connect callback still has it */
+static void hosted_io_context_release(hosted_io_context io) {
+    if (io->connecting) {
+        io->released = true;
+        return;
+    }
+    hosted_io_context_free(io);
+}
+
+/**
+ * called first by resolve and connect callbacks. returns false if the connection was closed while the callback was
+ * pending. `io` is freed then, if the close is complete.
+ */
+static bool hosted_connect_continue(hosted_io_context io) {
+    io->connecting = false;
+    if (io->released) {
+        hosted_io_context_free(io);
+        return false;
+    }
+    return !uv_is_closing((uv_handle_t *) &io->server);
+}
+
 static void ziti_conn_close_cb(ziti_connection zc) {
     struct hosted_io_ctx_s *io_ctx = ziti_conn_data(zc);
     if (io_ctx) {
         ZITI_LOG(TRACE, "hosted_service[%s] client[%s] ziti_conn[%p] io[%p] closed",
                  io_ctx->service->service_name, io_ctx->client_identity, zc, io_ctx);
-        hosted_io_context_free(io_ctx);
         ziti_conn_set_data(zc, NULL);
+        hosted_io_context_release(io_ctx);
     } else {
         ZITI_LOG(TRACE, "ziti_conn[%p] is closed", zc);
     }
@@ -91,6 +195,10 @@ static void free_hosted_service_ctx(struct hosted_service_ctx_s *hosted_ctx) {
     if (hosted_ctx == NULL) {
         return;
     }
+    struct ziti_instance_s *inst = ziti_app_ctx((ziti_context) hosted_ctx->ziti_ctx);
+    if (inst != NULL && model_map_get(&inst->hosts, hosted_ctx->service_name) == hosted_ctx) {
+        model_map_remove(&inst->hosts, hosted_ctx->service_name);
+    }
     safe_free(hosted_ctx->service_name);
     switch (hosted_ctx->cfg_type) {
         case HOST_CFG_V1:
@@ -124,6 +232,32 @@ static void free_hosted_service_ctx(struct hosted_service_ctx_s *hosted_ctx) {
     }
 
     STAILQ_CLEAR(&hosted_ctx->allowed_source_addresses, safe_free);
+    host_pool_close(hosted_ctx->pool);
+    hosted_ctx->pool = NULL;
+    if (hosted_ctx->cost_timer_active) {
+        uv_close((uv_handle_t *) &hosted_ctx->cost_timer, NULL);
+        hosted_ctx->cost_timer_active = false;
+    }
+    // callers close the listener that reported the failure, and clear it first
+    ziti_connection listeners[] = { hosted_ctx->listener, hosted_ctx->pending_listener };
+    for (int i = 0; i < sizeof(listeners) / sizeof(listeners[0]); i++) {
+        if (listeners[i] != NULL) {
+            ziti_conn_set_data(listeners[i], NULL);
+            ziti_close(listeners[i], NULL);
+        }
+    }
+    hosted_ctx->listener = NULL;
+    hosted_ctx->pending_listener = NULL;
+    for (int i = 0; i < hosted_ctx->num_backends; i++) {
+        free(hosted_ctx->backends[i].host);
+        free(hosted_ctx->backends[i].port);
+    }
+    safe_free(hosted_ctx->backends);
+    hosted_ctx->backends = NULL;
+    hosted_ctx->num_backends = 0;
+    free_host_cfg_v1_ext(&hosted_ctx->ext_cfg);
+    host_dial_ctx_release(hosted_ctx->dial);
+    hosted_ctx->dial = NULL;
 }
 
 static void hosted_server_close_cb(uv_handle_t *handle) {
@@ -132,6 +266,11 @@ static void hosted_server_close_cb(uv_handle_t *handle) {
         ziti_close(io_ctx->client, ziti_conn_close_cb);
         ZITI_LOG(TRACE, "hosted_service[%s] client[%s] server_conn[%p] closed",
                  io_ctx->service->service_name, io_ctx->client_identity, handle);
+    } else if (io_ctx->stream) {
+        mux_stream_close(io_ctx->stream, NULL);
+        ZITI_LOG(TRACE, "hosted_service[%s] client[%s] server_conn[%p] closed",
+                 io_ctx->service->service_name, io_ctx->client_identity, handle);
+        hosted_io_context_release(io_ctx);
     } else {
         ZITI_LOG(TRACE, "server_conn[%p] closed", handle);
         handle->data = NULL;
@@ -145,6 +284,10 @@ static void hosted_server_close(struct hosted_io_ctx_s *io_ctx) {
         return;
     }
 
+    if (io_ctx->udp_bridge) {
+        udp_bridge_close(io_ctx->udp_bridge);
+        io_ctx->udp_bridge = NULL;
+    }
     safe_close(&io_ctx->server, hosted_server_close_cb);
 }
 
@@ -171,16 +314,339 @@ void *local_addr(uv_handle_t *h, struct sockaddr *name, int *len) {
     return name;
 }
 
-/** called by ziti sdk when a client connection is established (or fails) */
-static void on_hosted_client_connect_complete(ziti_connection clt, int err) {
-    struct hosted_io_ctx_s *io_ctx = ziti_conn_data(clt);
+static double phase_ms(uint64_t from, uint64_t to) {
+    return (from == 0 || to < from) ? 0.0 : (double) (to - from) / 1e6;
+}
 
-    if (io_ctx == NULL) {
-        ZITI_LOG(WARN, "missing io_ctx");
-        ziti_close(clt, ziti_conn_close_cb);
+/** per-phase breakdown of how long it took from the incoming dial to a bridged connection */
+static void record_setup_latency(hosted_io_context io) {
+    double resolve = phase_ms(io->timing.incoming, io->timing.resolved);
+    double connect = phase_ms(io->timing.resolved, io->timing.connected);
+    double accept = phase_ms(io->timing.connected, io->timing.accepted);
+    double total = phase_ms(io->timing.incoming, io->timing.accepted);
+    host_setup_latency_t *latency = &io->service->setup_latency;
+    host_setup_latency_add(latency, resolve, connect, accept, total);
+    ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] server[%s] setup latency: resolve[%.3fms] connect[%.3fms] "
+                    "accept[%.3fms] total[%.3fms] (average[%.3fms] max[%.3fms] of %" PRIu64 ")",
+             io->service->service_name, io->client_identity, io->resolved_dst, resolve, connect, accept, total,
+             latency->total_millis, latency->max_total_millis, latency->count);
+}
+
+static void on_udp_bridge_written(ziti_connection clt, ssize_t status, void *ctx) {
+    struct client_write_s *w = ctx;
+    hosted_io_context io = ziti_conn_data(clt);
+    if (io != NULL && io->udp_bridge != NULL) {
+        udp_bridge_write_done(io->udp_bridge, w->len);
+    }
+    free(w->msg);
+    free(w);
+}
+
+static int udp_bridge_write(void *ctx, uint8_t *msg, size_t len) {
+    hosted_io_context io = ctx;
+    struct client_write_s *w = malloc(sizeof(struct client_write_s));
+    w->msg = msg;
+    w->len = len;
+    int rc = ziti_write(io->client, msg, len, on_udp_bridge_written, w);
+    if (rc != ZITI_OK) {
+        free(msg);
+        free(w);
+    }
+    return rc;
+}
+
+static void on_udp_bridge_error(void *ctx, int err) {
+    hosted_io_context io = ctx;
+    ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] server[%s] read failed: %s", io->service->service_name,
+             io->client_identity, io->resolved_dst, uv_strerror(err));
+    hosted_server_close(io);
+}
+
+/** datagrams from the ziti client. each message is one datagram */
+static ssize_t on_hosted_udp_data(ziti_connection clt, const uint8_t *data, ssize_t len) {
+    hosted_io_context io = ziti_conn_data(clt);
+    if (io == NULL) {
+        return len;
+    }
+    if (len < 0) {
+        ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] ziti connection closed: %s", io->service->service_name,
+                 io->client_identity, ziti_errorstr((int) len));
+        hosted_server_close(io);
+    } else if (io->udp_bridge != NULL) {
+        udp_bridge_send(io->udp_bridge, data, (size_t) len);
+    }
+    return len;
+}
+
+static int start_udp_bridge(hosted_io_context io) {
+    // intercepting tunnelers that understand framing ask for it, so datagrams can share ziti messages
+    bool framed = io->app_data != NULL && io->app_data->udp_framing != NULL &&
+                  strcmp(io->app_data->udp_framing, UDP_FRAMING_LEN16) == 0;
+    io->udp_bridge = udp_bridge_start(&io->server.udp, framed, udp_bridge_write, on_udp_bridge_error, io);
+    return io->udp_bridge != NULL ? 0 : UV_EINVAL;
+}
+
+typedef struct stream_server_write_s {
+    uv_write_t req;
+    size_t len;
+    char data[];
+} stream_server_write_t;
+
+// mux_stream_write and compress_encode copy, so one buffer serves every connection
+static char stream_read_buf[MUX_FRAME_MAX];
+
+static void stream_read_alloc(uv_handle_t *h, size_t suggested, uv_buf_t *buf) {
+    *buf = uv_buf_init(stream_read_buf, sizeof(stream_read_buf));
+}
+
+static void on_stream_server_read(uv_stream_t *server, ssize_t nread, const uv_buf_t *buf);
+
+static void on_stream_sent(void *stream_data, ssize_t status, void *ctx) {
+    hosted_io_context io = stream_data;
+    if (io == NULL || status < 0) {
         return;
     }
+    io->stream_pending -= (size_t) status;
+    // the client's window is open again
+    if (io->server_paused && io->stream_pending < MUX_WINDOW) {
+        io->server_paused = false;
+        uv_read_start((uv_stream_t *) &io->server.tcp, stream_read_alloc, on_stream_server_read);
+    }
+}
+
+/** data from the server, for the client's stream */
+static void on_stream_server_read(uv_stream_t *server, ssize_t nread, const uv_buf_t *buf) {
+    hosted_io_context io = server->data;
+    if (nread > 0) {
+        if (mux_stream_write(io->stream, (const uint8_t *) buf->base, (size_t) nread, on_stream_sent, NULL) != 0) {
+            hosted_server_close(io);
+            return;
+        }
+        io->stream_pending += (size_t) nread;
+        if (io->stream_pending >= MUX_WINDOW) {
+            io->server_paused = true;
+            uv_read_stop(server);
+        }
+    } else if (nread == UV_EOF) {
+        io->server_eof = true;
+        uv_read_stop(server);
+        mux_stream_close_write(io->stream);
+        if (io->client_eof) {
+            hosted_server_close(io);
+        }
+    } else if (nread < 0) {
+        ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] server[%s] read failed: %s", io->service->service_name,
+                 io->client_identity, io->resolved_dst, uv_strerror((int) nread));
+        hosted_server_close(io);
+    }
+}
+
+static void on_stream_server_written(uv_write_t *req, int status) {
+    stream_server_write_t *w = (stream_server_write_t *) req;
+    hosted_io_context io = req->handle->data;
+    if (status == 0) {
+        mux_stream_consumed(io->stream, w->len);
+    } else if (status != UV_ECANCELED) {
+        ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] server[%s] write failed: %s", io->service->service_name,
+                 io->client_identity, io->resolved_dst, uv_strerror(status));
+        hosted_server_close(io);
+    }
+    free(w);
+}
+
+static void on_stream_server_shutdown(uv_shutdown_t *req, int status) {
+    free(req);
+}
+
+/** data from the client's stream, for the server */
+static ssize_t on_hosted_stream_data(mux_stream_t *s, const uint8_t *data, ssize_t len) {
+    hosted_io_context io = mux_stream_data(s);
+    if (len > 0 && io->bridged) {
+        stream_server_write_t *w = malloc(sizeof(stream_server_write_t) + (size_t) len);
+        w->len = (size_t) len;
+        memcpy(w->data, data, (size_t) len);
+        uv_buf_t buf = uv_buf_init(w->data, (unsigned int) len);
+        if (uv_write(&w->req, (uv_stream_t *) &io->server.tcp, &buf, 1, on_stream_server_written) != 0) {
+            free(w);
+            hosted_server_close(io);
+            return -1;
+        }
+        return len;
+    }
+
+    if (len == UV_EOF && io->bridged) {
+        io->client_eof = true;
+        if (io->server_eof) {
+            hosted_server_close(io);
+        } else {
+            uv_shutdown_t *sr = calloc(1, sizeof(uv_shutdown_t));
+            if (uv_shutdown(sr, (uv_stream_t *) &io->server.tcp, on_stream_server_shutdown) != 0) {
+                free(sr);
+            }
+        }
+        return len;
+    }
+
+    // the client doesn't send anything before the stream is accepted
+    ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] stream closed: %s", io->service->service_name,
+             io->client_identity, len < 0 ? uv_strerror((int) len) : "unexpected data");
+    hosted_server_close(io);
+    return len < 0 ? len : -1;
+}
+
+static int start_stream_bridge(hosted_io_context io) {
+    int rc = mux_stream_accept(io->stream);
+    if (rc == 0) {
+        rc = uv_read_start((uv_stream_t *) &io->server.tcp, stream_read_alloc, on_stream_server_read);
+    }
+    return rc;
+}
+
+static void on_compressed_server_read(uv_stream_t *server, ssize_t nread, const uv_buf_t *buf);
+
+static void on_compressed_client_written(ziti_connection clt, ssize_t status, void *ctx) {
+    struct client_write_s *w = ctx;
+    hosted_io_context io = ziti_conn_data(clt);
+    if (io != NULL && status >= 0) {
+        io->client_pending -= w->len;
+        if (io->server_paused && io->client_pending < COMPRESS_MAX_PENDING) {
+            io->server_paused = false;
+            uv_read_start((uv_stream_t *) &io->server.tcp, stream_read_alloc, on_compressed_server_read);
+        }
+    }
+    free(w->msg);
+    free(w);
+}
+
+/** data from the server, compressed for the client */
+static void on_compressed_server_read(uv_stream_t *server, ssize_t nread, const uv_buf_t *buf) {
+    hosted_io_context io = server->data;
+    if (nread > 0) {
+        struct client_write_s *w = malloc(sizeof(struct client_write_s));
+        ssize_t len = compress_encode(io->encoder, (const uint8_t *) buf->base, (size_t) nread, &w->msg);
+        if (len < 0) {
+            free(w);
+            hosted_server_close(io);
+            return;
+        }
+        w->len = (size_t) len;
+        if (ziti_write(io->client, w->msg, w->len, on_compressed_client_written, w) != ZITI_OK) {
+            free(w->msg);
+            free(w);
+            hosted_server_close(io);
+            return;
+        }
+        io->client_pending += w->len;
+        if (io->client_pending >= COMPRESS_MAX_PENDING) {
+            io->server_paused = true;
+            uv_read_stop(server);
+        }
+    } else if (nread == UV_EOF) {
+        io->server_eof = true;
+        uv_read_stop(server);
+        ziti_close_write(io->client);
+        if (io->client_eof) {
+            hosted_server_close(io);
+        }
+    } else if (nread < 0) {
+        ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] server[%s] read failed: %s", io->service->service_name,
+                 io->client_identity, io->resolved_dst, uv_strerror((int) nread));
+        hosted_server_close(io);
+    }
+}
+
+static void on_compressed_server_written(uv_write_t *req, int status) {
+    stream_server_write_t *w = (stream_server_write_t *) req;
+    hosted_io_context io = req->handle->data;
+    io->server_pending -= w->len;
+    if (status != 0 && status != UV_ECANCELED) {
+        ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] server[%s] write failed: %s", io->service->service_name,
+                 io->client_identity, io->resolved_dst, uv_strerror(status));
+        hosted_server_close(io);
+    }
+    free(w);
+}
+
+static int write_to_server(void *ctx, const uint8_t *data, size_t len) {
+    hosted_io_context io = ctx;
+    stream_server_write_t *w = malloc(sizeof(stream_server_write_t) + len);
+    w->len = len;
+    memcpy(w->data, data, len);
+    uv_buf_t buf = uv_buf_init(w->data, (unsigned int) len);
+    int rc = uv_write(&w->req, (uv_stream_t *) &io->server.tcp, &buf, 1, on_compressed_server_written);
+    if (rc != 0) {
+        free(w);
+        return rc;
+    }
+    io->server_pending += len;
+    return 0;
+}
+
+/** data from a client that asked for compression, for the server */
+static ssize_t on_hosted_compressed_data(ziti_connection clt, const uint8_t *data, ssize_t len) {
+    hosted_io_context io = ziti_conn_data(clt);
+    if (io == NULL) {
+        return len;
+    }
+    if (len > 0) {
+        // the server is slow. ziti offers the data again later
+        if (io->server_pending >= COMPRESS_MAX_PENDING) {
+            return 0;
+        }
+        if (io->compress_hello_pending) {
+            io->compress_hello_pending = false;
+            if (len == COMPRESS_HELLO_LEN && memcmp(data, COMPRESS_HELLO, COMPRESS_HELLO_LEN) == 0) {
+                return len;
+            }
+            compress_decoder_free(io->decoder);
+            io->decoder = NULL;
+        }
+        ssize_t rc = io->decoder ? compress_decode(io->decoder, data, (size_t) len, write_to_server, io) :
+                     write_to_server(io, data, (size_t) len);
+        if (rc < 0) {
+            ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] server[%s] failed to forward client data: %s",
+                     io->service->service_name, io->client_identity, io->resolved_dst, uv_strerror((int) rc));
+            hosted_server_close(io);
+            return rc;
+        }
+        return len;
+    }
+
+    if (len == ZITI_EOF) {
+        io->client_eof = true;
+        if (io->server_eof) {
+            hosted_server_close(io);
+        } else {
+            uv_shutdown_t *sr = calloc(1, sizeof(uv_shutdown_t));
+            if (uv_shutdown(sr, (uv_stream_t *) &io->server.tcp, on_stream_server_shutdown) != 0) {
+                free(sr);
+            }
+        }
+        return len;
+    }
+
+    ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] ziti connection closed: %s", io->service->service_name,
+             io->client_identity, ziti_errorstr((int) len));
+    hosted_server_close(io);
+    return len;
+}
 
+static void on_compress_hello_written(ziti_connection clt, ssize_t status, void *ctx) {
+    if (status < 0) {
+        ZITI_LOG(DEBUG, "ziti_conn[%p] failed to write compression hello: %zd", clt, status);
+    }
+}
+
+static int start_compressed_bridge(hosted_io_context io) {
+    int rc = ziti_write(io->client, (uint8_t *) COMPRESS_HELLO, COMPRESS_HELLO_LEN, on_compress_hello_written, NULL);
+    if (rc != ZITI_OK) {
+        return UV_ECONNABORTED;
+    }
+    io->compress_hello_pending = true;
+    return uv_read_start((uv_stream_t *) &io->server.tcp, stream_read_alloc, on_compressed_server_read);
+}
+
+static void hosted_client_connected(hosted_io_context io_ctx, int err) {
     if (err == ZITI_OK) {
         int rc;
         uv_handle_t *server = (uv_handle_t *) &io_ctx->server.tcp;
@@ -193,19 +659,36 @@ static void on_hosted_client_connect_complete(ziti_connection clt, int err) {
             return;
         }
 
-        struct sockaddr_storage name_storage;
+        io_ctx->timing.accepted = uv_hrtime();
+
+        struct sockaddr_storage name_storage = {0};
         struct sockaddr *name = (struct sockaddr *) &name_storage;
         int len = sizeof(name_storage);
+        char laddr[INET6_ADDRSTRLEN + 8];
         local_addr(server, name, &len);
-        uv_getnameinfo_t req = {0};
-        uv_getnameinfo(io_ctx->service->loop, &req, NULL, name, NI_NUMERICHOST|NI_NUMERICSERV);
-        ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] local_addr[%s:%s] fd[%d] server[%s] connected %d", io_ctx->service->service_name,
-                 io_ctx->client_identity, req.host, req.service, fd, io_ctx->resolved_dst, len);
-        rc = ziti_conn_bridge(clt, server, on_bridge_close);
-        if (rc != 0) {
-            ZITI_LOG(ERROR, "failed to bridge client[%s] with hosted_service[%s] laddr[%s:%s] fd[%d]: %s",
+        host_dial_addr_str(name, laddr, sizeof(laddr));
+        ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] local_addr[%s] fd[%d] server[%s] connected %d", io_ctx->service->service_name,
+                 io_ctx->client_identity, laddr, fd, io_ctx->resolved_dst, len);
+        record_setup_latency(io_ctx);
+        if (server->type == UV_UDP) {
+            rc = start_udp_bridge(io_ctx);
+        } else if (io_ctx->stream) {
+            rc = start_stream_bridge(io_ctx);
+        } else if (io_ctx->encoder) {
+            rc = start_compressed_bridge(io_ctx);
+        } else {
+            rc = ziti_conn_bridge(io_ctx->client, server, on_bridge_close);
+        }
+        if (rc == 0) {
+            host_load_t *load = &io_ctx->service->load;
+            double connect_ms = phase_ms(io_ctx->timing.resolved, io_ctx->timing.connected);
+            load->connect_millis = load->connect_millis == 0 ? connect_ms : (3 * load->connect_millis + connect_ms) / 4;
+            load->active++;
+            io_ctx->bridged = true;
+        } else {
+            ZITI_LOG(ERROR, "failed to bridge client[%s] with hosted_service[%s] laddr[%s] fd[%d]: %s",
                      io_ctx->client_identity, io_ctx->service->service_name,
-                     req.host, req.service, fd, uv_strerror(rc));
+                     laddr, fd, uv_strerror(rc));
             hosted_server_close(io_ctx);
         }
     } else {
@@ -215,6 +698,33 @@ static void on_hosted_client_connect_complete(ziti_connection clt, int err) {
     }
 }
 
+/** called by ziti sdk when a client connection is established (or fails) */
+static void on_hosted_client_connect_complete(ziti_connection clt, int err) {
+    struct hosted_io_ctx_s *io_ctx = ziti_conn_data(clt);
+
+    if (io_ctx == NULL) {
+        ZITI_LOG(WARN, "missing io_ctx");
+        ziti_close(clt, ziti_conn_close_cb);
+        return;
+    }
+    hosted_client_connected(io_ctx, err);
+}
+
+static void on_deferred_ready_written(ziti_connection clt, ssize_t status, void *ctx) {
+    if (status < 0) {
+        ZITI_LOG(DEBUG, "ziti_conn[%p] failed to write ready message: %zd", clt, status);
+    }
+}
+
+/** a deferred client is already accepted. it is told that the server is connected instead */
+static void complete_deferred_connection(hosted_io_context io) {
+    static uint8_t ready[DIAL_POOL_PRELUDE_HDR];
+    if (ziti_write(io->client, ready, sizeof(ready), on_deferred_ready_written, NULL) != ZITI_OK) {
+        hosted_client_connected(io, ZITI_CONN_CLOSED);
+        return;
+    }
+    hosted_client_connected(io, ZITI_OK);
+}
 
 static void complete_hosted_tcp_connection(hosted_io_context io_ctx) {
     ZITI_LOG(DEBUG, "hosted_service[%s], client[%s]: connected to server %s", io_ctx->service->service_name,
@@ -231,38 +741,58 @@ static void complete_hosted_tcp_connection(hosted_io_context io_ctx) {
                  io_ctx->service->service_name, io_ctx->client_identity);
     }
 
-    ziti_accept(io_ctx->client, on_hosted_client_connect_complete, NULL);
+    if (io_ctx->deferred) {
+        complete_deferred_connection(io_ctx);
+    } else if (io_ctx->stream) {
+        hosted_client_connected(io_ctx, ZITI_OK);
+    } else {
+        ziti_accept(io_ctx->client, on_hosted_client_connect_complete,
+                    io_ctx->encoder ? on_hosted_compressed_data : NULL);
+    }
+}
+
+static void track_backend(hosted_io_context io, const struct sockaddr *addr) {
+    memcpy(&io->backend, addr, addr->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+    io->has_backend = true;
+    host_dial_conn_opened(io->service->dial, addr);
 }
 
 /**
- * called by libuv when a connection is established (or failed) with a TCP server
- *
- *  c is the uv_tcp_connect_t that was initialized in on_hosted_client_connect_complete
- *  c->handle is the uv_tcp_t (server stream) that was initialized in on_hosted_client_connect
+ * called when one of the connection attempts to a hosted TCP server succeeded, or all of them failed
  */
-static void on_hosted_tcp_server_connect_complete(uv_connect_t *c, int status) {
-    if (c == NULL || c->handle == NULL || c->handle->data == NULL) {
-        ZITI_LOG(ERROR, "null handle or io_ctx");
-        if (c) free(c);
+static void on_hosted_tcp_server_dial_complete(uv_os_sock_t sock, int status, const struct sockaddr *addr, void *ctx) {
+    hosted_io_context io = ctx;
+    if (!hosted_connect_continue(io)) {
+        if (status == 0) {
+            sock_close(sock);
+        }
         return;
     }
-    struct hosted_io_ctx_s *io_ctx = c->handle->data;
-    if (io_ctx->client == NULL) {
-        ZITI_LOG(ERROR, "client closed before server connection was established");
-        hosted_server_close(io_ctx);
-        free(c);
+
+    if (status != 0) {
+        ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: connect to %s:%s:%s failed: %s", io->service->service_name,
+                 io->client_identity, io->computed_dst_protocol, io->computed_dst_ip_or_hn, io->computed_dst_port,
+                 uv_strerror(status));
+        hosted_server_close(io);
         return;
     }
 
-    if (status < 0) {
-        ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: connect to %s failed: %s", io_ctx->service->service_name,
-                 io_ctx->client_identity, io_ctx->resolved_dst, uv_strerror(status));
-        hosted_server_close(io_ctx);
-        free(c);
+    io->timing.connected = uv_hrtime();
+    track_backend(io, addr);
+    char addr_str[INET6_ADDRSTRLEN + 8];
+    host_dial_addr_str(addr, addr_str, sizeof(addr_str));
+    snprintf(io->resolved_dst, sizeof(io->resolved_dst), "tcp:%s", addr_str);
+
+    int uv_err = uv_tcp_open(&io->server.tcp, sock);
+    if (uv_err != 0) {
+        ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: uv_tcp_open failed: %s", io->service->service_name,
+                 io->client_identity, uv_strerror(uv_err));
+        sock_close(sock);
+        hosted_server_close(io);
         return;
     }
-    complete_hosted_tcp_connection(io_ctx);
-    free(c);
+
+    complete_hosted_tcp_connection(io);
 }
 
 /**
@@ -270,6 +800,12 @@ static void on_hosted_tcp_server_connect_complete(uv_connect_t *c, int status) {
  */
 static void on_proxy_connect(uv_os_sock_t sock, int status, void *ctx) {
     hosted_io_context io = ctx;
+    if (!hosted_connect_continue(io)) {
+        if (status == 0) {
+            sock_close(sock);
+        }
+        return;
+    }
 
     if (status != 0) {
         ZITI_LOG(ERROR, "proxy connect failed: %s (e=%d)", uv_strerror(status), status);
@@ -277,6 +813,9 @@ static void on_proxy_connect(uv_os_sock_t sock, int status, void *ctx) {
         return;
     }
 
+    // the proxy resolves the destination, so its lookup is part of the connect phase
+    io->timing.resolved = io->timing.incoming;
+    io->timing.connected = uv_hrtime();
     int uv_err = uv_tcp_open(&io->server.tcp, sock);
     if (uv_err != 0) {
         ZITI_LOG(ERROR, "uv_tcp_open failed: %s (e=%d)", uv_strerror(uv_err), uv_err);
@@ -500,58 +1039,79 @@ static const char *compute_dst_port(const host_ctx_t *service, const tunneler_ap
     return port_from_config;
 }
 
-static int do_bind(hosted_io_context io, const char *addr, int socktype) {
-    // split out the ip and port if port was specified
-    char *src_ip = strdup(addr);
-    char *port = strchr(src_ip, ':');
-    if (port != NULL) {
-        *port = '\0';
-        port++;
+/** split "host", "host:port", "ip6" or "[ip6]:port". `port` points into `addr`, or is NULL if there is none */
+static int split_host_port(const char *addr, char *host, size_t host_sz, const char **port) {
+    const char *host_start = addr;
+    size_t host_len;
+    *port = NULL;
+
+    if (addr[0] == '[') {
+        const char *close = strchr(addr, ']');
+        if (close == NULL || (close[1] != '\0' && close[1] != ':')) return UV_EINVAL;
+        host_start = addr + 1;
+        host_len = close - host_start;
+        if (close[1] == ':') *port = close + 2;
+    } else {
+        const char *colon = strchr(addr, ':');
+        // more than one colon is a bare ipv6 address
+        if (colon != NULL && strchr(colon + 1, ':') == NULL) {
+            host_len = colon - addr;
+            *port = colon + 1;
+        } else {
+            host_len = strlen(addr);
+        }
     }
 
-    uv_getaddrinfo_t ai_req = {0};
-    struct addrinfo hints = {0};
-    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
-    hints.ai_protocol = get_protocol_id(io->computed_dst_protocol);
-    hints.ai_socktype = socktype;
+    if (*port != NULL && **port == '\0') *port = NULL;
+    if (host_len == 0 || host_len >= host_sz) return UV_EINVAL;
+    memcpy(host, host_start, host_len);
+    host[host_len] = '\0';
+    return 0;
+}
 
-    int uv_err = uv_getaddrinfo(io->service->loop, &ai_req, NULL, src_ip, port, &hints);
-    free(src_ip);
+/**
+ * parse a numeric source address.
+ * these never need the resolver, so there's no point blocking the loop on getaddrinfo.
+ */
+static int parse_source_addr(const char *addr, struct sockaddr_storage *ss) {
+    char host[INET6_ADDRSTRLEN + 2];
+    const char *port;
+    int rc = split_host_port(addr, host, sizeof(host), &port);
+    return rc != 0 ? rc : host_dial_parse_addr(host, port, ss);
+}
 
+static int do_bind(hosted_io_context io, const char *addr, int socktype) {
+    struct sockaddr_storage src = {0};
+    int uv_err = parse_source_addr(addr, &src);
     if (uv_err != 0) {
-        ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: getaddrinfo(%s) failed: %s",
+        ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: invalid source address '%s': %s",
                  io->service->service_name, io->client_identity, addr, uv_strerror(uv_err));
         return -1;
     }
 
-    if (ai_req.addrinfo->ai_next != NULL) {
-        ZITI_LOG(DEBUG, "hosted_service[%s], client[%s]: getaddrinfo(%s) returned multiple results; using first",
-                 io->service->service_name, io->client_identity, addr);
-    }
-
     ziti_address src_za;
-    ziti_address_from_sockaddr(&src_za, ai_req.addrinfo->ai_addr); // convert for easy validation
+    ziti_address_from_sockaddr(&src_za, (struct sockaddr *) &src); // convert for easy validation
     if (!address_match(&src_za, &io->service->allowed_source_addresses)) {
         ZITI_LOG(ERROR, "hosted_service[%s], client[%s] client requested source IP %s is not allowed",
                  io->service->service_name, io->client_identity, addr);
         return -1;
     }
 
-    switch (hints.ai_protocol) {
-        case IPPROTO_TCP:
-            uv_err = uv_tcp_bind(&io->server.tcp, ai_req.addrinfo->ai_addr, 0);
+    switch (socktype) {
+        case SOCK_STREAM:
+            // connection attempts use their own sockets
+            memcpy(&io->src_addr, &src, sizeof(io->src_addr));
+            io->has_src_addr = true;
             break;
-        case IPPROTO_UDP:
-            uv_err = uv_udp_bind(&io->server.udp, ai_req.addrinfo->ai_addr, 0);
+        case SOCK_DGRAM:
+            uv_err = uv_udp_bind(&io->server.udp, (struct sockaddr *) &src, 0);
             break;
         default:
-            ZITI_LOG(ERROR, "hosted_service[%s] client[%s] unsupported protocol %d when binding source address",
-                     io->service->service_name, io->client_identity, hints.ai_protocol);
+            ZITI_LOG(ERROR, "hosted_service[%s] client[%s] unsupported socket type %d when binding source address",
+                     io->service->service_name, io->client_identity, socktype);
             uv_err = UV_EINVAL;
     }
 
-    uv_freeaddrinfo(ai_req.addrinfo);
-
     if (uv_err != 0) {
         ZITI_LOG(ERROR, "hosted_service[%s] client[%s]: bind failed: %s", io->service->service_name,
                  io->client_identity, uv_strerror(uv_err));
@@ -561,17 +1121,19 @@ static int do_bind(hosted_io_context io, const char *addr, int socktype) {
     return 0;
 }
 
-static hosted_io_context hosted_io_context_new(struct hosted_service_ctx_s *service_ctx, ziti_connection client,
+static hosted_io_context hosted_io_context_new(struct hosted_service_ctx_s *service_ctx, const hosted_client_t *client,
         tunneler_app_data *app_data, const char *dst_protocol, const char *dst_ip_or_hn, const char *dst_port) {
     hosted_io_context io = calloc(1, sizeof(struct hosted_io_ctx_s));
     io->service = service_ctx;
+    io->timing.incoming = uv_hrtime();
 
-    // include underlay details in client identity if available
+    // include underlay details in client identity if available. hairpinned streams have no ziti connection
+    const char *source_identity = client->conn ? ziti_conn_source_identity(client->conn) : client->caller_id;
     if (app_data && app_data->src_protocol && app_data->src_ip && app_data->src_port) {
-        snprintf(io->client_identity, sizeof(io->client_identity), "%s] client_src_addr[%s:%s:%s", ziti_conn_source_identity(client),
+        snprintf(io->client_identity, sizeof(io->client_identity), "%s] client_src_addr[%s:%s:%s", source_identity,
                  app_data->src_protocol, app_data->src_ip, app_data->src_port);
     } else {
-        strncpy(io->client_identity, ziti_conn_source_identity(client), sizeof(io->client_identity));
+        strncpy(io->client_identity, source_identity, sizeof(io->client_identity));
     }
     io->computed_dst_protocol = dst_protocol;
     io->computed_dst_ip_or_hn = dst_ip_or_hn;
@@ -586,7 +1148,7 @@ static hosted_io_context hosted_io_context_new(struct hosted_service_ctx_s *serv
             io->server.tcp.data = io;
             break;
         case IPPROTO_UDP:
-            uv_err = uv_udp_init(service_ctx->loop, &io->server.udp);
+            uv_err = uv_udp_init_ex(service_ctx->loop, &io->server.udp, AF_UNSPEC | UV_UDP_RECVMMSG);
             socktype = SOCK_DGRAM;
             io->server.udp.data = io;
             break;
@@ -613,20 +1175,78 @@ static hosted_io_context hosted_io_context_new(struct hosted_service_ctx_s *serv
     }
 
     // success. now set references to ziti connection and app_data so cleanup happens in ziti_conn_close_cb
-    io->client = client;
+    if (client->stream) {
+        io->stream = client->stream;
+    } else {
+        io->client = client->conn;
+    }
+    io->deferred = client->deferred;
     io->app_data = app_data;
 
+    // pooled and multiplexed clients can't ask for compression, their app_data comes too late
+    if (socktype == SOCK_STREAM && !client->deferred && !client->stream && app_data && app_data->compression &&
+        strcmp(app_data->compression, COMPRESSION_DEFLATE) == 0) {
+        io->encoder = compress_encoder_new(COMPRESS_DEFAULT_LEVEL);
+        io->decoder = compress_decoder_new();
+    }
+
     return io;
 }
 
-static void on_hosted_client_connect_resolved(uv_getaddrinfo_t* req, int status, struct addrinfo* res);
+static void on_hosted_client_connect_resolved(void *ctx, int status, const struct sockaddr_storage *addrs, int count);
 
-/** called by ziti sdk when a ziti endpoint (client) initiates connection to a hosted service
- * - compute dial address (from appdata if forwarding, or from dial address in config)
- * - if forwarding, validate address is allowed
- * - validate src address if specified
- * - initiate async dns resolution of dial address (if computed address is hostname?)
- */
+/** addresses of all configured backends, collected for one connection */
+typedef struct backend_resolve_s {
+    hosted_io_context io;
+    int pending;
+    int status;
+    int count;
+    struct sockaddr_storage addrs[HOST_DIAL_MAX_ADDRS];
+} backend_resolve_t;
+
+static void on_backend_resolved(void *ctx, int status, const struct sockaddr_storage *addrs, int count) {
+    backend_resolve_t *br = ctx;
+    if (status != 0) {
+        br->status = status;
+    }
+    for (int i = 0; i < count && br->count < HOST_DIAL_MAX_ADDRS; i++) {
+        br->addrs[br->count++] = addrs[i];
+    }
+    if (--br->pending > 0) {
+        return;
+    }
+
+    // unreachable backends don't matter as long as one of them resolved
+    on_hosted_client_connect_resolved(br->io, br->count > 0 ? 0 : br->status, br->addrs, br->count);
+    free(br);
+}
+
+static void resolve_backends(hosted_io_context io, int socktype) {
+    struct hosted_service_ctx_s *service = io->service;
+    backend_resolve_t *br = calloc(1, sizeof(backend_resolve_t));
+    br->io = io;
+    br->pending = 1; // lookups can complete synchronously
+    br->status = UV_EAI_NONAME;
+
+    for (int i = 0; i < service->num_backends; i++) {
+        const host_backend_t *b = &service->backends[i];
+        br->pending++;
+        int rc = host_resolve(service->dial, b->host, b->port ? b->port : io->computed_dst_port, socktype,
+                              b->numeric, on_backend_resolved, br);
+        if (rc != 0) {
+            on_backend_resolved(br, rc, NULL, 0);
+        }
+    }
+    on_backend_resolved(br, 0, NULL, 0);
+}
+
+static void start_hosted_connection(struct hosted_service_ctx_s *service_ctx, const hosted_client_t *client,
+                                    tunneler_app_data *app_data);
+static void accept_deferred_conn(struct hosted_service_ctx_s *service_ctx, ziti_connection clt, const char *caller_id);
+static void accept_mux_conn(struct hosted_service_ctx_s *service_ctx, ziti_connection clt, const char *caller_id);
+static void reject_client(const hosted_client_t *client);
+
+/** called by ziti sdk when a ziti endpoint (client) initiates connection to a hosted service */
 static void on_hosted_client_connect(ziti_connection serv, ziti_connection clt, int status, const ziti_client_ctx *clt_ctx) {
     struct hosted_service_ctx_s *service_ctx = ziti_conn_data(serv);
 
@@ -640,6 +1260,9 @@ static void on_hosted_client_connect(ziti_connection serv, ziti_connection clt,
         ZITI_LOG(ERROR, "hosted_service[%s] incoming connection failed: %s", service_ctx->service_name, ziti_errorstr(status));
         ziti_close(clt, NULL);
         if (status == ZITI_SERVICE_UNAVAILABLE) {
+            if (serv == service_ctx->listener) service_ctx->listener = NULL;
+            if (serv == service_ctx->pending_listener) service_ctx->pending_listener = NULL;
+            ziti_conn_set_data(serv, NULL);
             ziti_close(serv, NULL);
             free_hosted_service_ctx(service_ctx);
         }
@@ -659,19 +1282,50 @@ static void on_hosted_client_connect(ziti_connection serv, ziti_connection clt,
     }
 
     if (app_data != NULL && app_data->conn_type == TunnelConnectionTypes.resolver) {
-        accept_resolver_conn(clt, &service_ctx->addr_u.allowed_hostnames);
+        accept_resolver_conn(clt, service_ctx->loop, &service_ctx->addr_u.allowed_hostnames, app_data->dns_format);
         free_tunneler_app_data_ptr(app_data);
         return;
     }
 
+    if (app_data != NULL && app_data->conn_type == TunnelConnectionTypes.deferred) {
+        free_tunneler_app_data_ptr(app_data);
+        accept_deferred_conn(service_ctx, clt, clt_ctx->caller_id);
+        return;
+    }
+
+    if (app_data != NULL && app_data->conn_type == TunnelConnectionTypes.multiplexed) {
+        free_tunneler_app_data_ptr(app_data);
+        accept_mux_conn(service_ctx, clt, clt_ctx->caller_id);
+        return;
+    }
+
+    hosted_client_t client = { .conn = clt, .caller_id = clt_ctx->caller_id };
+    start_hosted_connection(service_ctx, &client, app_data);
+}
+
+/**
+ * - compute dial address (from appdata if forwarding, or from dial address in config)
+ * - if forwarding, validate address is allowed
+ * - validate src address if specified
+ * - initiate async dns resolution of dial address (if computed address is hostname?)
+ */
+static void start_hosted_connection(struct hosted_service_ctx_s *service_ctx, const hosted_client_t *client,
+                                    tunneler_app_data *app_data) {
     char err[80];
     int protocol_number;
     const char *protocol = compute_dst_protocol(service_ctx, app_data, &protocol_number, err, sizeof(err));
     if (protocol == NULL) {
         ZITI_LOG(ERROR, "hosted_service[%s] client[%s] failed to compute destination protocol: %s",
-                 service_ctx->service_name, clt_ctx->caller_id, err);
+                 service_ctx->service_name, client->caller_id, err);
         free_tunneler_app_data_ptr(app_data);
-        ziti_close(clt, NULL);
+        reject_client(client);
+        return;
+    }
+    if (client->stream && protocol_number != IPPROTO_TCP) {
+        ZITI_LOG(ERROR, "hosted_service[%s] client[%s] multiplexed connections only carry tcp, not %s",
+                 service_ctx->service_name, client->caller_id, protocol);
+        free_tunneler_app_data_ptr(app_data);
+        reject_client(client);
         return;
     }
 
@@ -679,44 +1333,44 @@ static void on_hosted_client_connect(ziti_connection serv, ziti_connection clt,
     const char *ip_or_hn = compute_dst_ip_or_hn(service_ctx, app_data, &is_ip, err, sizeof(err));
     if (ip_or_hn == NULL) {
         ZITI_LOG(ERROR, "hosted_service[%s] client[%s] failed to compute destination address: %s",
-                 service_ctx->service_name, clt_ctx->caller_id, err);
+                 service_ctx->service_name, client->caller_id, err);
         free_tunneler_app_data_ptr(app_data);
-        ziti_close(clt, NULL);
+        reject_client(client);
         return;
     }
 
     const char *port = compute_dst_port(service_ctx, app_data, err, sizeof(err));
     if (port == NULL) {
         ZITI_LOG(ERROR, "hosted_service[%s] client[%s] failed to compute destination port: %s",
-                 service_ctx->service_name, clt_ctx->caller_id, err);
+                 service_ctx->service_name, client->caller_id, err);
         free_tunneler_app_data_ptr(app_data);
-        ziti_close(clt, NULL);
+        reject_client(client);
         return;
     }
 
-    hosted_io_context io = hosted_io_context_new(service_ctx, clt, app_data, protocol, ip_or_hn, port);
+    hosted_io_context io = hosted_io_context_new(service_ctx, client, app_data, protocol, ip_or_hn, port);
     if (io == NULL) {
         ZITI_LOG(ERROR, "hosted_service[%s] client[%s] failed to create io context", service_ctx->service_name,
-                 clt_ctx->caller_id);
+                 client->caller_id);
         free_tunneler_app_data_ptr(app_data);
-        ziti_close(clt, NULL);
+        reject_client(client);
         return;
     }
 
     ZITI_LOG(INFO, "hosted_service[%s] client[%s] dst_addr[%s:%s:%s]: incoming connection",
              service_ctx->service_name, io->client_identity, protocol, ip_or_hn, port);
 
-    struct addrinfo hints = {0};
-    hints.ai_protocol = protocol_number;
-    hints.ai_socktype = protocol_number == IPPROTO_UDP ? SOCK_DGRAM : SOCK_STREAM;
-    hints.ai_flags = AI_NUMERICSERV;
-    if (is_ip) hints.ai_flags |= AI_NUMERICHOST;
-    ziti_conn_set_data(clt, io);
+    if (client->stream) {
+        mux_stream_set_data(client->stream, on_hosted_stream_data, io);
+    } else {
+        ziti_conn_set_data(client->conn, io);
+    }
 
     if (service_ctx->proxy_connector) {
         if (protocol_number == IPPROTO_TCP) {
             ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] dst_addr[%s:%s:%s] connecting through proxy %s",
                      service_ctx->service_name, io->client_identity, protocol, ip_or_hn, port, service_ctx->proxy_addr);
+            io->connecting = true;
             service_ctx->proxy_connector->connect(service_ctx->loop, service_ctx->proxy_connector, ip_or_hn, port,
             on_proxy_connect, io);
         } else {
@@ -727,85 +1381,532 @@ static void on_hosted_client_connect(ziti_connection serv, ziti_connection clt,
         return;
     }
 
-    uv_getaddrinfo_t *ai_req = calloc(1, sizeof(uv_getaddrinfo_t));
-    ai_req->data = io;
-    int s = uv_getaddrinfo(service_ctx->loop, ai_req, on_hosted_client_connect_resolved, ip_or_hn, port, &hints);
+    // the pool only exists for fixed tcp destinations, but a requested source address needs its own socket
+    if (service_ctx->pool != NULL && !io->has_src_addr) {
+        uv_os_sock_t sock;
+        struct sockaddr_storage peer;
+        if (host_pool_take(service_ctx->pool, &sock, &peer) == 0) {
+            io->timing.resolved = uv_hrtime();
+            ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] using pooled connection",
+                     service_ctx->service_name, io->client_identity);
+            on_hosted_tcp_server_dial_complete(sock, 0, (struct sockaddr *) &peer, io);
+            return;
+        }
+        ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] no idle pooled connection",
+                 service_ctx->service_name, io->client_identity);
+    }
+
+    int socktype = protocol_number == IPPROTO_UDP ? SOCK_DGRAM : SOCK_STREAM;
+    // the client can go away before the server is connected: a stream can be reset, a deferred client closed
+    io->connecting = true;
+    if (service_ctx->num_backends > 0) {
+        resolve_backends(io, socktype);
+        return;
+    }
+    int s = host_resolve(service_ctx->dial, ip_or_hn, port, socktype, is_ip, on_hosted_client_connect_resolved, io);
     if (s != 0) {
+        io->connecting = false;
         ZITI_LOG(ERROR, "hosted_service[%s] client[%s]: getaddrinfo(%s:%s:%s) failed: %s",
                  service_ctx->service_name, io->client_identity, protocol, ip_or_hn, port, uv_strerror(s));
-        free(ai_req);
         hosted_server_close(io);
         return;
     }
 }
 
-static void on_hosted_client_connect_resolved(uv_getaddrinfo_t* ai_req, int status, struct addrinfo* res) {
-    hosted_io_context io = ai_req->data;
-    if (io == NULL) {
-        ZITI_LOG(ERROR, "null io");
-        if (status >= 0) uv_freeaddrinfo(res);
-        free(ai_req);
+/** a pooled client connection, waiting for the app_data of the flow that will use it */
+struct deferred_client_s {
+    struct hosted_service_ctx_s *service;
+    char caller_id[80];
+    size_t len;
+    uint8_t prelude[DIAL_POOL_PRELUDE_HDR + DIAL_POOL_PRELUDE_MAX];
+};
+
+// deferred clients that haven't sent their prelude yet
+static model_map deferred_clients;
+
+static void close_deferred_conn(ziti_connection clt) {
+    struct deferred_client_s *dc = model_map_remove_key(&deferred_clients, &clt, sizeof(clt));
+    free(dc);
+    ziti_close(clt, NULL);
+}
+
+static void on_deferred_prelude(ziti_connection clt, struct deferred_client_s *dc) {
+    size_t json_len = dc->len - DIAL_POOL_PRELUDE_HDR;
+    tunneler_app_data *app_data = NULL;
+    if (parse_tunneler_app_data_ptr(&app_data, (char *) dc->prelude + DIAL_POOL_PRELUDE_HDR, json_len) < 0 ||
+        app_data->conn_type == TunnelConnectionTypes.resolver || app_data->conn_type == TunnelConnectionTypes.deferred) {
+        ZITI_LOG(ERROR, "hosted_service[%s] client[%s]: invalid deferred app_data_json '%.*s'",
+                 dc->service->service_name, dc->caller_id, (int) json_len, dc->prelude + DIAL_POOL_PRELUDE_HDR);
+        free_tunneler_app_data_ptr(app_data);
+        close_deferred_conn(clt);
+        return;
+    }
+    ZITI_LOG(DEBUG, "hosted_service[%s] client[%s]: received deferred app_data_json='%.*s'",
+             dc->service->service_name, dc->caller_id, (int) json_len, dc->prelude + DIAL_POOL_PRELUDE_HDR);
+
+    model_map_remove_key(&deferred_clients, &clt, sizeof(clt));
+    hosted_client_t client = { .conn = clt, .caller_id = dc->caller_id, .deferred = true };
+    start_hosted_connection(dc->service, &client, app_data);
+    free(dc);
+}
+
+static ssize_t on_deferred_data(ziti_connection clt, const uint8_t *data, ssize_t len) {
+    struct deferred_client_s *dc = model_map_get_key(&deferred_clients, &clt, sizeof(clt));
+    if (dc == NULL) {
+        // the flow has started. tcp clients are bridged with the server once it is connected,
+        // until then this only sees the connection closing
+        return on_hosted_udp_data(clt, data, len);
+    }
+    if (len < 0) {
+        ZITI_LOG(DEBUG, "hosted_service[%s] client[%s]: idle deferred connection closed: %s",
+                 dc->service->service_name, dc->caller_id, ziti_errorstr((int) len));
+        close_deferred_conn(clt);
+        return len;
+    }
+
+    size_t left = (size_t) len;
+    if (dc->len < DIAL_POOL_PRELUDE_HDR) {
+        size_t n = left < DIAL_POOL_PRELUDE_HDR - dc->len ? left : DIAL_POOL_PRELUDE_HDR - dc->len;
+        memcpy(dc->prelude + dc->len, data, n);
+        dc->len += n;
+        data += n;
+        left -= n;
+    }
+    if (dc->len < DIAL_POOL_PRELUDE_HDR) {
+        return len;
+    }
+
+    size_t json_len = ((size_t) dc->prelude[0] << 8) | dc->prelude[1];
+    if (json_len > DIAL_POOL_PRELUDE_MAX) {
+        ZITI_LOG(ERROR, "hosted_service[%s] client[%s]: deferred app_data is too long (%zd bytes)",
+                 dc->service->service_name, dc->caller_id, json_len);
+        close_deferred_conn(clt);
+        return -1;
+    }
+    size_t want = DIAL_POOL_PRELUDE_HDR + json_len - dc->len;
+    if (left > want) {
+        // the client doesn't send anything else before it is told that the server is connected
+        ZITI_LOG(ERROR, "hosted_service[%s] client[%s]: unexpected data after deferred app_data",
+                 dc->service->service_name, dc->caller_id);
+        close_deferred_conn(clt);
+        return -1;
+    }
+    memcpy(dc->prelude + dc->len, data, left);
+    dc->len += left;
+    if (left == want) {
+        on_deferred_prelude(clt, dc);
+    }
+    return len;
+}
+
+static void on_deferred_accepted(ziti_connection clt, int err) {
+    if (err != ZITI_OK) {
+        ZITI_LOG(DEBUG, "ziti_conn[%p] failed to accept deferred connection: %s", clt, ziti_errorstr(err));
+        close_deferred_conn(clt);
+    }
+}
+
+/**
+ * pooled connections from intercepting tunnelers are accepted right away. the flow that uses the connection
+ * sends its app_data later, and the server is connected then.
+ */
+static void accept_deferred_conn(struct hosted_service_ctx_s *service_ctx, ziti_connection clt, const char *caller_id) {
+    struct deferred_client_s *dc = calloc(1, sizeof(struct deferred_client_s));
+    dc->service = service_ctx;
+    strncpy(dc->caller_id, caller_id ? caller_id : "", sizeof(dc->caller_id) - 1);
+    model_map_set_key(&deferred_clients, &clt, sizeof(clt), dc);
+
+    if (ziti_accept(clt, on_deferred_accepted, on_deferred_data) != ZITI_OK) {
+        ZITI_LOG(ERROR, "hosted_service[%s] client[%s]: ziti_accept failed", service_ctx->service_name, dc->caller_id);
+        close_deferred_conn(clt);
+        return;
+    }
+    ZITI_LOG(DEBUG, "hosted_service[%s] client[%s]: accepted deferred connection", service_ctx->service_name, dc->caller_id);
+}
+
+static void reject_client(const hosted_client_t *client) {
+    if (client->stream) {
+        mux_stream_close(client->stream, NULL);
+    } else {
+        ziti_close(client->conn, NULL);
+    }
+}
+
+/** a multiplexed connection from an intercepting tunneler. every stream on it is a hosted connection */
+typedef struct hosted_mux_conn_s {
+    struct hosted_service_ctx_s *service;
+    ziti_connection conn;
+    hairpin_t *hairpin; // instead of `conn`, for flows that this tunneler intercepts itself
+    char caller_id[80];
+    mux_t *mux;
+} hosted_mux_conn_t;
+
+typedef struct mux_msg_s {
+    mux_t *mux;
+    uint8_t *msg;
+    void *req;
+} mux_msg_t;
+
+static void on_mux_msg_written(ziti_connection conn, ssize_t status, void *ctx) {
+    mux_msg_t *m = ctx;
+    mux_written(m->mux, m->req, status < 0 ? (int) status : 0);
+    free(m->msg);
+    free(m);
+}
+
+static int mux_conn_write(void *ctx, uint8_t *msg, size_t len, void *req) {
+    hosted_mux_conn_t *mc = ctx;
+    if (mc->hairpin) {
+        return hairpin_write(mc->hairpin, HAIRPIN_HOST, msg, len, req);
+    }
+    mux_msg_t *m = malloc(sizeof(mux_msg_t));
+    m->mux = mc->mux;
+    m->msg = msg;
+    m->req = req;
+    int rc = ziti_write(mc->conn, msg, len, on_mux_msg_written, m);
+    if (rc != ZITI_OK) {
+        free(msg);
+        free(m);
+    }
+    return rc;
+}
+
+static void close_mux_conn(hosted_mux_conn_t *mc, int err) {
+    mux_close(mc->mux, err);
+    ziti_conn_set_data(mc->conn, NULL);
+    ziti_close(mc->conn, NULL);
+    free(mc);
+}
+
+static void on_mux_stream_open(mux_t *mux, mux_stream_t *s, const uint8_t *json, size_t len, void *ctx) {
+    hosted_mux_conn_t *mc = ctx;
+    tunneler_app_data *app_data = NULL;
+    if (parse_tunneler_app_data_ptr(&app_data, (char *) json, len) < 0 ||
+        app_data->conn_type == TunnelConnectionTypes.resolver || app_data->conn_type == TunnelConnectionTypes.deferred ||
+        app_data->conn_type == TunnelConnectionTypes.multiplexed) {
+        ZITI_LOG(ERROR, "hosted_service[%s] client[%s]: invalid stream app_data_json '%.*s'",
+                 mc->service->service_name, mc->caller_id, (int) len, json);
+        free_tunneler_app_data_ptr(app_data);
+        mux_stream_close(s, NULL);
         return;
     }
+    ZITI_LOG(DEBUG, "hosted_service[%s] client[%s]: received stream app_data_json='%.*s'",
+             mc->service->service_name, mc->caller_id, (int) len, json);
+
+    hosted_client_t client = { .conn = mc->conn, .caller_id = mc->caller_id, .stream = s };
+    start_hosted_connection(mc->service, &client, app_data);
+}
+
+static ssize_t on_mux_conn_data(ziti_connection conn, const uint8_t *data, ssize_t len) {
+    hosted_mux_conn_t *mc = ziti_conn_data(conn);
+    if (mc == NULL) {
+        return len;
+    }
+    if (len > 0) {
+        mux_on_data(mc->mux, data, (size_t) len);
+        return len;
+    }
+    // the intercepting side only closes the whole connection when it is done with it
+    ZITI_LOG(DEBUG, "hosted_service[%s] client[%s]: multiplexed connection closed: %s (%d streams)",
+             mc->service->service_name, mc->caller_id, ziti_errorstr((int) len), mux_stream_count(mc->mux));
+    close_mux_conn(mc, UV_ECONNRESET);
+    return len;
+}
+
+static void on_mux_conn_accepted(ziti_connection conn, int err) {
+    hosted_mux_conn_t *mc = ziti_conn_data(conn);
+    if (err != ZITI_OK && mc != NULL) {
+        ZITI_LOG(DEBUG, "ziti_conn[%p] failed to accept multiplexed connection: %s", conn, ziti_errorstr(err));
+        close_mux_conn(mc, UV_ECONNRESET);
+    }
+}
+
+static void accept_mux_conn(struct hosted_service_ctx_s *service_ctx, ziti_connection clt, const char *caller_id) {
+    hosted_mux_conn_t *mc = calloc(1, sizeof(hosted_mux_conn_t));
+    mc->service = service_ctx;
+    mc->conn = clt;
+    strncpy(mc->caller_id, caller_id ? caller_id : "", sizeof(mc->caller_id) - 1);
+    mc->mux = mux_new(service_ctx->loop, mux_conn_write, on_mux_stream_open, mc);
+    ziti_conn_set_data(clt, mc);
+
+    if (ziti_accept(clt, on_mux_conn_accepted, on_mux_conn_data) != ZITI_OK) {
+        ZITI_LOG(ERROR, "hosted_service[%s] client[%s]: ziti_accept failed", service_ctx->service_name, mc->caller_id);
+        close_mux_conn(mc, UV_ECONNRESET);
+        return;
+    }
+    ZITI_LOG(DEBUG, "hosted_service[%s] client[%s]: accepted multiplexed connection", service_ctx->service_name, mc->caller_id);
+}
+
+static void on_hairpin_closed(void *ctx) {
+    free(ctx);
+}
+
+void hosted_service_hairpin(host_ctx_t *host_ctx, hairpin_t *hp, const char *caller_id) {
+    struct hosted_service_ctx_s *service_ctx = host_ctx;
+    hosted_mux_conn_t *mc = calloc(1, sizeof(hosted_mux_conn_t));
+    mc->service = service_ctx;
+    mc->hairpin = hp;
+    strncpy(mc->caller_id, caller_id ? caller_id : "", sizeof(mc->caller_id) - 1);
+    mc->mux = mux_new(service_ctx->loop, mux_conn_write, on_mux_stream_open, mc);
+    hairpin_attach(hp, HAIRPIN_HOST, mc->mux, on_hairpin_closed, mc);
+    ZITI_LOG(DEBUG, "hosted_service[%s] client[%s]: accepted hairpin", service_ctx->service_name, mc->caller_id);
+}
+
+static void on_hosted_client_connect_resolved(void *ctx, int status, const struct sockaddr_storage *addrs, int count) {
+    hosted_io_context io = ctx;
+    if (!hosted_connect_continue(io)) {
+        return;
+    }
+    io->timing.resolved = uv_hrtime();
 
     if (status < 0) {
         ZITI_LOG(ERROR, "hosted_service[%s] client[%s] getaddrinfo(%s:%s:%s) failed: %s", io->service->service_name,
                  io->client_identity, io->computed_dst_protocol, io->computed_dst_ip_or_hn, io->computed_dst_port,
                  uv_strerror(status));
-        free(ai_req);
         ZITI_LOG(DEBUG, "closing c[%p] io[%p]", io->client, ziti_conn_data(io->client));
         hosted_server_close(io);
         return;
     }
 
-    if (res->ai_next != NULL) {
-        ZITI_LOG(DEBUG, "hosted_service[%s], client[%s]: getaddrinfo(%s:%s:%s) returned multiple results; using first",
-                 io->service->service_name, io->client_identity, io->computed_dst_protocol,
-                 io->computed_dst_ip_or_hn, io->computed_dst_port);
-    }
-
-    uv_getnameinfo_t ni_req = {0};
-    int uv_err = uv_getnameinfo(io->service->loop, &ni_req, NULL, res->ai_addr, NI_NUMERICHOST | NI_NUMERICSERV);
-    if (uv_err == 0) {
-        snprintf(io->resolved_dst, sizeof(io->resolved_dst), "%s:%s:%s",
-                 get_protocol_str(res->ai_protocol), ni_req.host, ni_req.service);
-    } else {
-        ZITI_LOG(WARN, "hosted_service[%s] client[%s] getnameinfo failed: %s", io->service->service_name,
-                 io->client_identity, uv_strerror(uv_err));
-        strncpy(io->resolved_dst, "<unknown>", sizeof(io->resolved_dst));
-    }
-
-    ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] initiating connection to %s",
-             io->service->service_name, io->client_identity, io->resolved_dst);
-
-    switch (res->ai_protocol) {
+    int uv_err;
+    switch (get_protocol_id(io->computed_dst_protocol)) {
         case IPPROTO_TCP:
-            {
-                uv_connect_t *c = malloc(sizeof(uv_connect_t));
-                uv_err = uv_tcp_connect(c, &io->server.tcp, res->ai_addr, on_hosted_tcp_server_connect_complete);
-                if (uv_err != 0) {
-                    ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: uv_tcp_connect failed: %s",
-                             io->service->service_name, io->client_identity, uv_strerror(uv_err));
-                    hosted_server_close(io);
-                    free(c);
-                }
+            ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] initiating connection to %s:%s:%s (%d addresses)",
+                     io->service->service_name, io->client_identity, io->computed_dst_protocol,
+                     io->computed_dst_ip_or_hn, io->computed_dst_port, count);
+            io->connecting = true;
+            uv_err = host_dial_connect(io->service->dial, addrs, count,
+                                       io->has_src_addr ? (struct sockaddr *) &io->src_addr : NULL,
+                                       on_hosted_tcp_server_dial_complete, io);
+            if (uv_err != 0) {
+                io->connecting = false;
+            }
+            if (uv_err == HOST_DIAL_ECIRCUIT) {
+                // fail fast instead of letting the client wait for connects that are known to fail
+                ZITI_LOG(WARN, "hosted_service[%s], client[%s]: rejecting connection to %s:%s:%s, circuit breaker "
+                               "is open for all %d addresses", io->service->service_name, io->client_identity,
+                         io->computed_dst_protocol, io->computed_dst_ip_or_hn, io->computed_dst_port, count);
+                hosted_server_close(io);
+            } else if (uv_err != 0) {
+                ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: connect failed: %s",
+                         io->service->service_name, io->client_identity, uv_strerror(uv_err));
+                hosted_server_close(io);
             }
             break;
-        case IPPROTO_UDP:
-            uv_err = uv_udp_connect(&io->server.udp, res->ai_addr);
+        case IPPROTO_UDP: {
+            // no way to tell if a udp server is alive, just avoid addresses that tcp clients found dead
+            const struct sockaddr *addr = (const struct sockaddr *) host_dial_pick(io->service->dial, addrs, count);
+            if (addr == NULL) {
+                ZITI_LOG(WARN, "hosted_service[%s], client[%s]: rejecting connection to %s:%s:%s, circuit breaker "
+                               "is open for all %d addresses", io->service->service_name, io->client_identity,
+                         io->computed_dst_protocol, io->computed_dst_ip_or_hn, io->computed_dst_port, count);
+                hosted_server_close(io);
+                break;
+            }
+            char addr_str[INET6_ADDRSTRLEN + 8];
+            host_dial_addr_str(addr, addr_str, sizeof(addr_str));
+            snprintf(io->resolved_dst, sizeof(io->resolved_dst), "udp:%s", addr_str);
+            ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] initiating connection to %s",
+                     io->service->service_name, io->client_identity, io->resolved_dst);
+
+            uv_err = uv_udp_connect(&io->server.udp, addr);
+            io->timing.connected = uv_hrtime();
+            if (uv_err == 0) {
+                track_backend(io, addr);
+            }
             if (uv_err != 0) {
                 ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: uv_udp_connect failed: %s",
                          io->service->service_name, io->client_identity, uv_strerror(uv_err));
                 hosted_server_close(io);
-            } else if (ziti_accept(io->client, on_hosted_client_connect_complete, NULL) != ZITI_OK) {
+            } else if (io->deferred) {
+                complete_deferred_connection(io);
+            } else if (ziti_accept(io->client, on_hosted_client_connect_complete, on_hosted_udp_data) != ZITI_OK) {
                 ZITI_LOG(ERROR, "ziti_accept failed");
                 hosted_server_close(io);
             }
             break;
+        }
+    }
+}
+
+// indexed by host_lb_policy_e
+static const char *lb_policy_names[] = { "ordered", "round-robin", "least-connections", "latency" };
+
+static void configure_backends(struct hosted_service_ctx_s *service) {
+    const host_cfg_v1_ext *cfg = &service->ext_cfg;
+    int count = 0;
+    for (; cfg->backends != NULL && cfg->backends[count] != NULL; count++);
+
+    if (count > 0) {
+        if (service->forward_address) {
+            ZITI_LOG(WARN, "hosted_service[%s] 'backends' can't be used with 'forwardAddress'. ignoring backends",
+                     service->service_name);
+            count = 0;
+        } else if (service->proxy_connector != NULL) {
+            ZITI_LOG(WARN, "hosted_service[%s] 'backends' can't be used with a proxy. ignoring backends",
+                     service->service_name);
+            count = 0;
+        } else if (count > HOST_DIAL_MAX_ADDRS) {
+            ZITI_LOG(WARN, "hosted_service[%s] only the first %d 'backends' are used", service->service_name,
+                     HOST_DIAL_MAX_ADDRS);
+            count = HOST_DIAL_MAX_ADDRS;
+        }
+    }
+
+    if (count > 0) {
+        service->backends = calloc(count, sizeof(host_backend_t));
+        for (int i = 0; i < count; i++) {
+            char host[256];
+            const char *port;
+            struct sockaddr_storage addr;
+            if (split_host_port(cfg->backends[i], host, sizeof(host), &port) != 0) {
+                ZITI_LOG(WARN, "hosted_service[%s] ignoring invalid backend '%s'", service->service_name,
+                         cfg->backends[i]);
+                continue;
+            }
+            host_backend_t *b = &service->backends[service->num_backends++];
+            b->host = strdup(host);
+            b->port = port ? strdup(port) : NULL;
+            b->numeric = host_dial_parse_addr(host, NULL, &addr) == 0;
+        }
     }
 
-    uv_freeaddrinfo(res);
-    free(ai_req);
+    host_lb_policy_e policy = service->num_backends > 0 ? HOST_LB_ROUND_ROBIN : HOST_LB_ORDERED;
+    const char *lb = cfg->load_balancing;
+    if (lb != NULL) {
+        int i = 0;
+        for (; i < sizeof(lb_policy_names) / sizeof(lb_policy_names[0]); i++) {
+            if (strcasecmp(lb, lb_policy_names[i]) == 0) break;
+        }
+        if (i < sizeof(lb_policy_names) / sizeof(lb_policy_names[0])) {
+            policy = (host_lb_policy_e) i;
+        } else {
+            ZITI_LOG(WARN, "hosted_service[%s] unknown 'loadBalancing' policy '%s'", service->service_name, lb);
+        }
+    }
+    host_dial_set_policy(service->dial, policy);
+
+    if (service->num_backends > 0 || policy != HOST_LB_ORDERED) {
+        ZITI_LOG(INFO, "hosted_service[%s] balancing connections over %d backends with policy '%s'",
+                 service->service_name, service->num_backends, lb_policy_names[policy]);
+    }
+}
+
+static void start_backend_pool(struct hosted_service_ctx_s *service) {
+    const host_backend_pool_cfg *cfg = service->ext_cfg.backend_pool;
+    if (cfg == NULL || cfg->size <= 0) {
+        return;
+    }
+
+    if (service->forward_protocol || service->forward_address || service->forward_port ||
+        strcasecmp(service->proto_u.protocol, "tcp") != 0 || service->proxy_connector != NULL ||
+        service->num_backends > 0) {
+        ZITI_LOG(WARN, "hosted_service[%s] 'backendPool' requires a single fixed tcp destination without a proxy. not pooling",
+                 service->service_name);
+        return;
+    }
+
+    int size = cfg->size > HOST_POOL_MAX_SIZE ? HOST_POOL_MAX_SIZE : (int) cfg->size;
+    uint64_t max_idle = cfg->max_idle_seconds > 0 ? cfg->max_idle_seconds : HOST_POOL_DEFAULT_MAX_IDLE_SECONDS;
+    char port[12];
+    snprintf(port, sizeof(port), "%d", service->port_u.port);
+    struct sockaddr_storage addr;
+    bool numeric = host_dial_parse_addr(service->addr_u.address, NULL, &addr) == 0;
+
+    ZITI_LOG(INFO, "hosted_service[%s] keeping %d idle connections to tcp:%s:%s", service->service_name, size,
+             service->addr_u.address, port);
+    service->pool = host_pool_new(service->dial, service->loop, service->addr_u.address, port, numeric, size,
+                                  max_idle * 1000);
+}
+
+static void hosted_listen_cb(ziti_connection serv, int status);
+
+static int start_listener(struct hosted_service_ctx_s *service, ziti_connection *conn) {
+    ziti_conn_init((ziti_context) service->ziti_ctx, conn, service);
+    return ziti_listen_with_options(*conn, service->service_name,
+                                    service->has_listen_opts ? &service->listen_opts : NULL,
+                                    hosted_listen_cb, on_hosted_client_connect);
+}
+
+static void on_cost_timer(uv_timer_t *t) {
+    struct hosted_service_ctx_s *service = t->data;
+    host_load_t *load = &service->load;
+
+    int cost = host_load_cost(load, service->base_cost, service->ext_cfg.dynamic_cost->max_cost);
+    if (load->attempts == 0) {
+        // no news is good news
+        load->connect_millis /= 2;
+    }
+    load->attempts = 0;
+    load->failures = 0;
+
+    int current = service->advertised_cost;
+    if (!host_cost_changed(current, cost) || service->listener == NULL || service->pending_listener != NULL) {
+        return;
+    }
+
+    ZITI_LOG(DEBUG, "hosted_service[%s] updating terminator cost %d -> %d (active[%d] connect[%.1fms])",
+             service->service_name, current, cost, load->active, load->connect_millis);
+    service->listen_opts.terminator_cost = cost;
+    int rc = start_listener(service, &service->pending_listener);
+    if (rc != ZITI_OK) {
+        ZITI_LOG(WARN, "hosted_service[%s] failed to update terminator cost: %s", service->service_name,
+                 ziti_errorstr(rc));
+        service->listen_opts.terminator_cost = current;
+        ziti_conn_set_data(service->pending_listener, NULL);
+        ziti_close(service->pending_listener, NULL);
+        service->pending_listener = NULL;
+    }
+}
+
+static void start_dynamic_cost(struct hosted_service_ctx_s *service) {
+    const host_dynamic_cost_cfg *cfg = service->ext_cfg.dynamic_cost;
+    if (cfg == NULL || !service->has_listen_opts) {
+        return;
+    }
+
+    uint64_t interval = (cfg->interval_seconds > 0 ? cfg->interval_seconds : COST_DEFAULT_INTERVAL_SECONDS) * 1000;
+    ZITI_LOG(INFO, "hosted_service[%s] updating terminator cost from observed load every %" PRIu64 "s",
+             service->service_name, interval / 1000);
+    uv_timer_init(service->loop, &service->cost_timer);
+    service->cost_timer.data = service;
+    uv_unref((uv_handle_t *) &service->cost_timer);
+    uv_timer_start(&service->cost_timer, on_cost_timer, interval, interval);
+    service->cost_timer_active = true;
+}
+
+void hosted_service_set_ext_config(host_ctx_t *host_ctx, const char *host_v1_json) {
+    if (host_ctx == NULL || host_v1_json == NULL || host_ctx->cfg_type != HOST_CFG_V1) {
+        return;
+    }
+
+    if (parse_host_cfg_v1_ext(&host_ctx->ext_cfg, host_v1_json, strlen(host_v1_json)) < 0) {
+        ZITI_LOG(WARN, "hosted_service[%s] failed to parse tunneler settings from host.v1 config",
+                 host_ctx->service_name);
+        return;
+    }
+
+    configure_backends(host_ctx);
+    start_backend_pool(host_ctx);
+    start_dynamic_cost(host_ctx);
+}
+
+ziti_connection hosted_service_replace_listener(host_ctx_t *host_ctx, ziti_connection pending, int status) {
+    host_ctx->pending_listener = NULL;
+    if (status != ZITI_OK) {
+        ZITI_LOG(WARN, "hosted_service[%s] failed to update terminator cost: %s", host_ctx->service_name,
+                 ziti_errorstr(status));
+        host_ctx->listen_opts.terminator_cost = host_ctx->advertised_cost;
+        return pending;
+    }
+
+    // make before break: the old terminator goes away once the new one is in place
+    ziti_connection old = host_ctx->listener;
+    host_ctx->listener = pending;
+    host_ctx->advertised_cost = host_ctx->listen_opts.terminator_cost;
+    ZITI_LOG(DEBUG, "hosted_service[%s] terminator cost is now %d", host_ctx->service_name,
+             host_ctx->advertised_cost);
+    return old;
 }
 
 /** called by ziti SDK when a hosted service listener is ready */
@@ -816,8 +1917,18 @@ static void hosted_listen_cb(ziti_connection serv, int status) {
         return;
     }
 
+    if (serv == host_ctx->pending_listener) {
+        ziti_connection done = hosted_service_replace_listener(host_ctx, serv, status);
+        if (done != NULL) {
+            ziti_conn_set_data(done, NULL);
+            ziti_close(done, NULL);
+        }
+        return;
+    }
+
     if (status != ZITI_OK) {
         ZITI_LOG(ERROR, "unable to host service %s: %s", host_ctx->service_name, ziti_errorstr(status));
+        if (serv == host_ctx->listener) host_ctx->listener = NULL;
         ziti_conn_set_data(serv, NULL);
         ziti_close(serv, NULL);
         free_hosted_service_ctx(host_ctx);
@@ -879,6 +1990,7 @@ host_ctx_t *ziti_sdk_c_host(void *ziti_ctx, uv_loop_t *loop, const char *service
     host_ctx->loop = loop;
     host_ctx->cfg_type = cfg_type;
     host_ctx->cfg = cfg;
+    host_ctx->dial = host_dial_ctx_new(loop);
 
     const char *display_proto = "?", *display_addr = "?";
     char display_port[12] = { '?', '\0' };
@@ -1040,21 +2152,27 @@ host_ctx_t *ziti_sdk_c_host(void *ziti_ctx, uv_loop_t *loop, const char *service
     }
 
     snprintf(host_ctx->display_address, sizeof(host_ctx->display_address), "%s:%s:%s", display_proto, display_addr, display_port);
-    ziti_connection serv;
-    ziti_conn_init(ziti_ctx, &serv, host_ctx);
-
-    char listen_identity[128];
     if (listen_opts_p != NULL) {
+        // kept for listening again with an updated cost
+        host_ctx->listen_opts = *listen_opts_p;
+        host_ctx->has_listen_opts = true;
         if (listen_opts_p->identity != NULL && listen_opts_p->identity[0] != '\0') {
             const ziti_identity *zid = ziti_get_identity(ziti_ctx);
-            strncpy(listen_identity, listen_opts_p->identity, sizeof(listen_identity));
-            if (string_replace(listen_identity, sizeof(listen_identity), "$tunneler_id.name", zid->name) != NULL) {
-                listen_opts_p->identity = listen_identity;
+            strncpy(host_ctx->listen_identity, listen_opts_p->identity, sizeof(host_ctx->listen_identity));
+            if (string_replace(host_ctx->listen_identity, sizeof(host_ctx->listen_identity), "$tunneler_id.name", zid->name) != NULL) {
+                host_ctx->listen_opts.identity = host_ctx->listen_identity;
             }
         }
+        host_ctx->base_cost = host_ctx->listen_opts.terminator_cost;
+        host_ctx->advertised_cost = host_ctx->base_cost;
     }
-    ziti_listen_with_options(serv, service_name, listen_opts_p, hosted_listen_cb, on_hosted_client_connect);
+    start_listener(host_ctx, &host_ctx->listener);
 
+    // for intercepts of the same identity that hairpin their flows
+    struct ziti_instance_s *inst = ziti_app_ctx(ziti_ctx);
+    if (inst != NULL) {
+        model_map_set(&inst->hosts, service_name, host_ctx);
+    }
     return host_ctx;
 }
 
@@ -1066,16 +2184,16 @@ static void on_uv_close(uv_handle_t *handle) {
 
 static void on_bridge_close(uv_handle_t *handle) {
     struct hosted_io_ctx_s *io_ctx = handle->data;
-    uv_getnameinfo_t req = {0};
+    char laddr[INET6_ADDRSTRLEN + 8] = "";
     if (io_ctx != NULL) {
-        struct sockaddr_storage name_storage;
+        struct sockaddr_storage name_storage = {0};
         struct sockaddr *name = (struct sockaddr *) &name_storage;
         int len = sizeof(name_storage);
         local_addr(handle, name, &len);
-        uv_getnameinfo(io_ctx->service->loop, &req, NULL, name, NI_NUMERICHOST | NI_NUMERICSERV);
+        host_dial_addr_str(name, laddr, sizeof(laddr));
     }
     uv_os_fd_t fd;
     uv_fileno(handle, &fd);
-    ZITI_LOG(DEBUG, "closing local_addr[%s:%s] fd[%d] ", req.host, req.service, fd);
+    ZITI_LOG(DEBUG, "closing local_addr[%s] fd[%d] ", laddr, fd);
     uv_close(handle, on_uv_close);
 }
@@ -20,8 +20,40 @@
 
 #ifndef ZITI_TUNNEL_SDK_C_ZITI_HOSTING_H
 #define ZITI_TUNNEL_SDK_C_ZITI_HOSTING_H
+#include <ziti/ziti.h>
 #include <ziti/ziti_tunnel.h>
 #include "tlsuv/http.h"
+#include "host_dial.h"
+#include "host_pool.h"
+#include "udp_bridge.h"
+#include "hairpin.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// host.v1 settings that are specific to this tunneler. they are read from the same config json, and ignored
+// by anything else that parses it.
+#define HOST_BACKEND_POOL_MODEL(XX, ...) \
+XX(size, model_number, none, size, __VA_ARGS__) \
+XX(max_idle_seconds, model_number, none, maxIdleSeconds, __VA_ARGS__)
+
+DECLARE_MODEL(host_backend_pool_cfg, HOST_BACKEND_POOL_MODEL)
+
+#define HOST_DYNAMIC_COST_MODEL(XX, ...) \
+XX(interval_seconds, model_number, none, intervalSeconds, __VA_ARGS__) \
+XX(max_cost, model_number, none, maxCost, __VA_ARGS__)
+
+DECLARE_MODEL(host_dynamic_cost_cfg, HOST_DYNAMIC_COST_MODEL)
+
+#define HOST_CFG_V1_EXT_MODEL(XX, ...) \
+XX(backend_pool, host_backend_pool_cfg, ptr, backendPool, __VA_ARGS__) \
+XX(backends, model_string, array, backends, __VA_ARGS__) \
+XX(load_balancing, model_string, none, loadBalancing, __VA_ARGS__) \
+XX(dynamic_cost, host_dynamic_cost_cfg, ptr, dynamicCost, __VA_ARGS__)
+
+DECLARE_MODEL(host_cfg_v1_ext, HOST_CFG_V1_EXT_MODEL)
+
 // allowed address is one of:
 // - ip subnet address
 // - DNS name or wildcard
@@ -33,6 +65,13 @@ struct allowed_hostname_s {
 
 typedef LIST_HEAD(allowed_addr_list, allowed_hostname_s) allowed_hostnames_t;
 
+// one of the destinations that connections to a hosted service are spread over
+typedef struct host_backend_s {
+    char *host;
+    char *port; // NULL: destination port of the service
+    bool numeric;
+} host_backend_t;
+
 struct hosted_service_ctx_s {
     char *       service_name;
     const void * ziti_ctx;
@@ -62,6 +101,23 @@ struct hosted_service_ctx_s {
     address_list_t    allowed_source_addresses;
     const char *proxy_addr;
     tlsuv_connector_t *proxy_connector;
+    host_dial_ctx_t *dial;
+    host_cfg_v1_ext ext_cfg;
+    host_pool_t *pool;
+    host_backend_t *backends;
+    int num_backends;
+
+    ziti_connection listener;
+    ziti_connection pending_listener; // replaces `listener` once it is bound
+    bool has_listen_opts;
+    ziti_listen_opts listen_opts;
+    char listen_identity[128];
+    int base_cost;
+    int advertised_cost;
+    host_load_t load;
+    host_setup_latency_t setup_latency;
+    bool cost_timer_active;
+    uv_timer_t cost_timer;
 };
 
 struct tunneled_service_s {
@@ -69,6 +125,26 @@ struct tunneled_service_s {
     host_ctx_t      *host;
 };
 
-void accept_resolver_conn(ziti_connection conn, allowed_hostnames_t *allowed);
+/** apply tunneler specific settings from the raw host.v1 json of a service that is being hosted */
+void hosted_service_set_ext_config(host_ctx_t *host_ctx, const char *host_v1_json);
+
+/**
+ * accepts the streams from the intercepting end of `hp` as connections to the service from `caller_id`, for a
+ * tunneler that intercepts a service it hosts itself. see hairpin.h
+ */
+void hosted_service_hairpin(host_ctx_t *host_ctx, hairpin_t *hp, const char *caller_id);
+
+void accept_resolver_conn(ziti_connection conn, uv_loop_t *loop, allowed_hostnames_t *allowed, const char *dns_format);
+
+/**
+ * the listener that was started to advertise a new terminator cost reported `status`.
+ * on success it replaces the current listener, and the replaced one is returned. otherwise the cost goes back
+ * to the advertised one, and `pending` is returned. the caller closes the returned listener.
+ */
+ziti_connection hosted_service_replace_listener(host_ctx_t *host_ctx, ziti_connection pending, int status);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif //ZITI_TUNNEL_SDK_C_ZITI_HOSTING_H
@@ -29,6 +29,11 @@
 #include <ziti/ziti_dns.h>
 #include "ziti/ziti_tunnel_cbs.h"
 #include "ziti_hosting.h"
+#include "dial_template.h"
+#include "write_coalescer.h"
+#include "dial_pool.h"
+#include "mux.h"
+#include "compress.h"
 #include "ziti_instance.h"
 #include "lwip/err.h"
 
@@ -40,7 +45,67 @@ typedef int (*cfg_cmp_fn)(const void *, const void*);
 IMPL_ENUM(TunnelConnectionType, TUNNELER_CONN_TYPE_ENUM)
 IMPL_MODEL(tunneler_app_data, TUNNELER_APP_DATA_MODEL)
 
+// intercept.v1 settings that are specific to this tunneler. they are read from the same config json, and ignored
+// by anything else that parses it.
+#define WRITE_COALESCING_MODEL(XX, ...) \
+XX(max_bytes, model_number, none, maxBytes, __VA_ARGS__) \
+XX(max_delay_micros, model_number, none, maxDelayMicros, __VA_ARGS__)
+
+DECLARE_MODEL(write_coalescing_cfg, WRITE_COALESCING_MODEL)
+IMPL_MODEL(write_coalescing_cfg, WRITE_COALESCING_MODEL)
+
+#define DIAL_POOL_MODEL(XX, ...) \
+XX(max_size, model_number, none, maxSize, __VA_ARGS__) \
+XX(ttl_seconds, model_number, none, ttlSeconds, __VA_ARGS__)
+
+DECLARE_MODEL(dial_pool_cfg, DIAL_POOL_MODEL)
+IMPL_MODEL(dial_pool_cfg, DIAL_POOL_MODEL)
+
+#define MULTIPLEX_MODEL(XX, ...) \
+XX(connections, model_number, none, connections, __VA_ARGS__)
+
+DECLARE_MODEL(multiplex_cfg, MULTIPLEX_MODEL)
+IMPL_MODEL(multiplex_cfg, MULTIPLEX_MODEL)
+
+#define COMPRESSION_MODEL(XX, ...) \
+XX(level, model_number, none, level, __VA_ARGS__)
+
+DECLARE_MODEL(compression_cfg, COMPRESSION_MODEL)
+IMPL_MODEL(compression_cfg, COMPRESSION_MODEL)
+
+#define INTERCEPT_CFG_V1_EXT_MODEL(XX, ...) \
+XX(write_coalescing, write_coalescing_cfg, ptr, writeCoalescing, __VA_ARGS__) \
+XX(dial_pool, dial_pool_cfg, ptr, dialPool, __VA_ARGS__) \
+XX(multiplex, multiplex_cfg, ptr, multiplex, __VA_ARGS__) \
+XX(compression, compression_cfg, ptr, compression, __VA_ARGS__) \
+XX(hairpin, model_bool, none, hairpin, __VA_ARGS__)
+
+DECLARE_MODEL(intercept_cfg_v1_ext, INTERCEPT_CFG_V1_EXT_MODEL)
+IMPL_MODEL(intercept_cfg_v1_ext, INTERCEPT_CFG_V1_EXT_MODEL)
+
+#define WRITE_COALESCE_MAX_BYTES (64 * 1024)
+#define WRITE_COALESCE_MAX_DELAY_US (1000 * 1000)
+#define MUX_MAX_CONNECTIONS 8
+// a service whose hosting side doesn't accept multiplexed connections is dialed per flow for this long
+#define MUX_RETRY_SECONDS 60
+// a flow that asked for compression is connected without it if the hosting side doesn't answer in time
+#define COMPRESS_HELLO_TIMEOUT_MILLIS 250
+// a service whose hosting side doesn't compress isn't asked again for this long
+#define COMPRESS_RETRY_SECONDS 60
+
+typedef struct intercept_mux_s intercept_mux_t;
+typedef struct compress_flow_s compress_flow_t;
+
 static void ziti_conn_close_cb(ziti_connection zc);
+static void free_io_ctx(struct io_ctx_s *io);
+static void detach_intercept_mux(intercept_mux_t *im);
+static void on_mux_stream_closed(mux_stream_t *s);
+static void on_mux_stream_written(void *stream_data, ssize_t status, void *ctx);
+static int wait_for_compress_hello(struct io_ctx_s *io);
+static void stop_compress_wait(compress_flow_t *cf);
+static bool on_compress_hello(struct io_ctx_s *io, const uint8_t *data, ssize_t len);
+static ssize_t decompress_to_client(struct io_ctx_s *io, const uint8_t *data, size_t len);
+static void compress_flow_free(compress_flow_t *cf);
 
 typedef struct cfgtype_desc_s {
     const char *name;
@@ -59,6 +124,31 @@ struct ziti_intercept_s {
         ziti_intercept_cfg_v1 intercept_v1;
         ziti_client_cfg_v1 client_v1;
     } cfg;
+    // intercept.v1 sourceIp and dialOptions.identity, compiled once instead of on every dial. text is NULL if not set
+    dial_template_t source_addr_tpl;
+    dial_template_t identity_tpl;
+    intercept_cfg_v1_ext ext_cfg;
+    dial_pool_t *dial_pool; // started by the first dial, if the service has `dialPool` settings
+    intercept_mux_t *mux; // started by the first dial, if the service has `multiplex` settings
+    intercept_mux_t *hairpin; // one stream carrier to the hosting side in this process, if the service has `hairpin` set
+    uint64_t compress_retry_at; // uv_now() until which flows don't ask for compression
+};
+
+/** a tcp flow that asked the hosting side for compression. see compress.h */
+struct compress_flow_s {
+    const ziti_intercept_t *zi; // NULL once the flow is closed
+    int level;
+    bool hello_pending; // nothing came from the hosting side yet
+    bool connected; // the flow was reported connected, and the client may have sent plain data
+    uv_timer_t *timer;
+    compress_encoder_t *encoder; // if the hosting side's hello came before the flow was connected
+    compress_decoder_t *decoder; // if the hosting side compresses
+    // data for the client that it didn't take yet. the last byte of the ziti data that it came from is held back,
+    // so ziti offers it again later
+    uint8_t *out;
+    size_t out_len;
+    size_t out_off;
+    bool held_back;
 };
 
 #define CFGTYPE_DESC(name, cfgtype, type) { (name), (cfgtype), \
@@ -84,6 +174,12 @@ static void free_ziti_intercept(ziti_intercept_t *zi) {
     if (zi->cfg_desc) {
         zi->cfg_desc->free(&zi->cfg);
     }
+    dial_template_free(&zi->source_addr_tpl);
+    dial_template_free(&zi->identity_tpl);
+    free_intercept_cfg_v1_ext(&zi->ext_cfg);
+    dial_pool_close(zi->dial_pool);
+    detach_intercept_mux(zi->mux);
+    detach_intercept_mux(zi->hairpin);
 
     free(zi);
 }
@@ -98,13 +194,29 @@ static void on_ziti_connect(ziti_connection conn, int status) {
         return;
     }
     if (status == ZITI_OK) {
-        ziti_tunneler_dial_completed(io, true);
+        ziti_io_context *ziti_io_ctx = io->ziti_io;
+        if (ziti_io_ctx->compress == NULL || wait_for_compress_hello(io) != 0) {
+            ziti_tunneler_dial_completed(io, true);
+        }
     } else {
         ZITI_LOG(ERROR, "ziti dial failed: %s", ziti_errorstr(status));
         ziti_close(conn, ziti_conn_close_cb);
     }
 }
 
+struct ziti_frames_ctx_s {
+    struct io_ctx_s *io;
+    bool failed;
+};
+
+static void on_ziti_datagram(void *ctx, const uint8_t *dgram, size_t len) {
+    struct ziti_frames_ctx_s *fc = ctx;
+    if (!fc->failed && ziti_tunneler_write(fc->io->tnlr_io, dgram, len) < 0) {
+        ZITI_LOG(ERROR, "failed to write to client");
+        fc->failed = true;
+    }
+}
+
 /** called by ziti SDK when ziti service has data for the client */
 static ssize_t on_ziti_data(ziti_connection conn, const uint8_t *data, ssize_t len) {
     struct io_ctx_s *io = ziti_conn_data(conn);
@@ -115,7 +227,43 @@ static ssize_t on_ziti_data(ziti_connection conn, const uint8_t *data, ssize_t l
         return UV_ECONNABORTED;
     }
     ziti_io_context *ziti_io_ctx = io->ziti_io;
-    if (len > 0) {
+    if (ziti_io_ctx->deferred_pending) {
+        // pooled connection. the flow is only connected once the hosting side has connected to the server
+        ziti_io_ctx->deferred_pending = false;
+        if (len == DIAL_POOL_PRELUDE_HDR && data[0] == 0 && data[1] == 0) {
+            ziti_tunneler_dial_completed(io, true);
+            return len;
+        }
+        ZITI_LOG(ERROR, "pooled ziti_conn[%p] failed to connect: %zd", conn, len);
+        ziti_close(conn, ziti_conn_close_cb);
+        return len < 0 ? len : -1;
+    }
+    if (ziti_io_ctx->compress != NULL && ziti_io_ctx->compress->hello_pending) {
+        if (on_compress_hello(io, data, len)) {
+            return len;
+        }
+    }
+    if (len > 0 && ziti_io_ctx->compress != NULL && ziti_io_ctx->compress->decoder != NULL) {
+        return decompress_to_client(io, data, (size_t) len);
+    }
+    if (len > 0 && ziti_io_ctx->udp_framing_pending) {
+        // the hosting side's first message is the framing hello if it frames what it sends. see udp_bridge.h
+        ziti_io_ctx->udp_framing_pending = false;
+        if (len == UDP_FRAMING_HELLO_LEN && memcmp(data, UDP_FRAMING_HELLO, UDP_FRAMING_HELLO_LEN) == 0) {
+            ZITI_LOG(DEBUG, "hosting side is using udp framing");
+            ziti_io_ctx->udp_frames = calloc(1, sizeof(udp_frame_reader_t));
+            return len;
+        }
+    }
+    if (len > 0 && ziti_io_ctx->udp_frames != NULL) {
+        struct ziti_frames_ctx_s fc = { .io = io };
+        udp_frame_read(ziti_io_ctx->udp_frames, data, len, on_ziti_datagram, &fc);
+        if (fc.failed) {
+            ziti_sdk_c_close(io->ziti_io);
+            return -1;
+        }
+        return len;
+    } else if (len > 0) {
         ssize_t accepted = ziti_tunneler_write(io->tnlr_io, data, len);
         if (accepted < 0) {
             ZITI_LOG(ERROR, "failed to write to client");
@@ -148,6 +296,15 @@ int ziti_sdk_c_close(void *io_ctx) {
     }
     ziti_io_context *ziti_io_ctx = io_ctx;
     ZITI_LOG(DEBUG, "closing ziti_conn tnlr_eof=%d, ziti_eof=%d", ziti_io_ctx->tnlr_eof, ziti_io_ctx->ziti_eof);
+    if (ziti_io_ctx->compress) {
+        // the intercept may be gone before the close completes
+        stop_compress_wait(ziti_io_ctx->compress);
+        ziti_io_ctx->compress->zi = NULL;
+    }
+    if (ziti_io_ctx->mux_stream) {
+        mux_stream_close(ziti_io_ctx->mux_stream, on_mux_stream_closed);
+        return 0;
+    }
     return ziti_close(ziti_io_ctx->ziti_conn, ziti_conn_close_cb);
 }
 
@@ -156,14 +313,26 @@ int ziti_sdk_c_close_write(void *io_ctx) {
     ziti_io_context *ziti_io_ctx = io_ctx;
     ZITI_LOG(DEBUG, "closing ziti_conn tnlr_eof=%d, ziti_eof=%d", ziti_io_ctx->tnlr_eof, ziti_io_ctx->ziti_eof);
     ziti_io_ctx->tnlr_eof = true;
+    // whatever the client sent before FIN goes out first
+    if (ziti_io_ctx->coalescer) {
+        write_coalescer_flush(ziti_io_ctx->coalescer);
+    }
     if (ziti_io_ctx->ziti_eof) { // both sides are now closed
         ZITI_LOG(DEBUG, "closing ziti_conn tnlr_eof=%d, ziti_eof=%d", ziti_io_ctx->tnlr_eof, ziti_io_ctx->ziti_eof);
-        ziti_close(ziti_io_ctx->ziti_conn, ziti_conn_close_cb);
+        if (ziti_io_ctx->mux_stream) {
+            mux_stream_close(ziti_io_ctx->mux_stream, on_mux_stream_closed);
+        } else {
+            ziti_close(ziti_io_ctx->ziti_conn, ziti_conn_close_cb);
+        }
         return 1;
     }
 
     ZITI_LOG(DEBUG, "closing ziti_conn tnlr_eof=%d, ziti_eof=%d", ziti_io_ctx->tnlr_eof, ziti_io_ctx->ziti_eof);
-    ziti_close_write(ziti_io_ctx->ziti_conn);
+    if (ziti_io_ctx->mux_stream) {
+        mux_stream_close_write(ziti_io_ctx->mux_stream);
+    } else {
+        ziti_close_write(ziti_io_ctx->ziti_conn);
+    }
     return 0;
 }
 
@@ -194,62 +363,70 @@ char *string_replace(char *source, size_t sourceSize, const char *substring, con
     return substring_source + strlen(with);
 }
 
-/** parse "proto:ip:port" */
-static void parse_socket_address(const char *address, char **proto, char **ip, char **port) {
-    if (proto != NULL) *proto = NULL;
-    if (ip != NULL) *ip = NULL;
-    if (port != NULL) *port = NULL;
-
-    if (address != NULL) {
-        const char *proto_sep = strchr(address, ':');
-        if (proto_sep != NULL) {
-            size_t proto_len = proto_sep - address + 1;
-            *proto = malloc(proto_len);
-            snprintf(*proto, proto_len, "%.*s", (int) (proto_sep - address), address);
-        }
-
-        const char *ip_start = proto_sep + 1;
-        const char *ip_sep = strrchr(address, ':');
-        if (ip_sep != NULL) {
-            size_t ip_len = ip_sep - ip_start + 1;
-            *ip = malloc(ip_len);
-            snprintf(*ip, ip_len, "%.*s", (int) (ip_sep - ip_start), ip_start);
-            *port = strdup(ip_sep + 1);
-        }
-    }
+typedef struct sock_fields_s {
+    char proto[8];
+    char ip[INET6_ADDRSTRLEN];
+    char port[8];
+} sock_fields_t;
+
+/** per-dial scratch space. app_data points into it, so nothing is allocated or freed */
+typedef struct dial_fields_s {
+    sock_fields_t dst;
+    sock_fields_t src;
+    char source_addr[64];
+    char identity[128];
+    dial_template_values_t values;
+    tunneler_app_data app_data;
+} dial_fields_t;
+
+static void sock_fields_init(sock_fields_t *f, const char *proto, const tunneler_endpoint_t *ep) {
+    snprintf(f->proto, sizeof(f->proto), "%s", proto);
+    ipaddr_ntoa_r(&ep->ip, f->ip, sizeof(f->ip));
+    snprintf(f->port, sizeof(f->port), "%u", ep->port);
 }
 
 /** initialize app_data and render json for a dial request. */
-static ssize_t get_app_data(char *buf, size_t bufsz, tunneler_io_context io, ziti_context ziti_ctx, const char *source_ip, tunneler_app_data *app_data) {
-    const char *intercepted = get_intercepted_address(io);
-    const char *client = get_client_address(io);
-
-    if (intercepted != NULL) {
-        parse_socket_address(intercepted, (char**)&app_data->dst_protocol, 
-                             (char**)&app_data->dst_ip, (char**)&app_data->dst_port);
-        if (app_data->dst_ip) {
-            const char *dst_hostname = ziti_dns_reverse_lookup(app_data->dst_ip);
-            if (dst_hostname) {
-                app_data->dst_hostname = strdup(dst_hostname);
-            }
+static ssize_t get_app_data(char *buf, size_t bufsz, tunneler_io_context io, const ziti_intercept_t *zi_ctx,
+                            dial_fields_t *f) {
+    tunneler_app_data *app_data = &f->app_data;
+    const char **v = f->values.v;
+
+    const char *proto = get_intercepted_protocol(io);
+    const tunneler_endpoint_t *dst = get_intercepted_endpoint(io);
+    const tunneler_endpoint_t *src = get_client_endpoint(io);
+    if (dst != NULL) {
+        sock_fields_init(&f->dst, proto, dst);
+        app_data->dst_protocol = f->dst.proto;
+        app_data->dst_ip = f->dst.ip;
+        app_data->dst_port = f->dst.port;
+        app_data->dst_hostname = (char *) ziti_dns_reverse_lookup(f->dst.ip);
+        if (strcmp(f->dst.proto, "udp") == 0) {
+            app_data->udp_framing = UDP_FRAMING_LEN16;
         }
     }
-    if (client != NULL) {
-        parse_socket_address(client, (char**)&app_data->src_protocol, 
-                             (char**)&app_data->src_ip, (char**)&app_data->src_port);
+    if (src != NULL) {
+        sock_fields_init(&f->src, proto, src);
+        app_data->src_protocol = f->src.proto;
+        app_data->src_ip = f->src.ip;
+        app_data->src_port = f->src.port;
     }
-    if (source_ip != NULL && *source_ip != 0) {
-        const ziti_identity *zid = ziti_get_identity(ziti_ctx);
-        size_t source_addr_maxlen = 64;
-        size_t source_addr_sz = source_addr_maxlen * sizeof(char);
-        char *srcAddr = calloc(source_addr_maxlen, sizeof(char));
-        strncpy(srcAddr, source_ip, source_addr_sz);
-        string_replace(srcAddr, source_addr_sz, "$tunneler_id.name", zid->name);
-        string_replace(srcAddr, source_addr_sz, "$dst_ip", app_data->dst_ip);
-        string_replace(srcAddr, source_addr_sz, "$dst_port", app_data->dst_port);
-        string_replace(srcAddr, source_addr_sz, "$src_ip", app_data->src_ip);
-        string_replace(srcAddr, source_addr_sz, "$src_port", app_data->src_port);
-        app_data->source_addr = srcAddr;
+
+    v[DIAL_VAR_DST_PROTOCOL] = app_data->dst_protocol;
+    v[DIAL_VAR_DST_IP] = app_data->dst_ip;
+    v[DIAL_VAR_DST_PORT] = app_data->dst_port;
+    v[DIAL_VAR_DST_HOSTNAME] = app_data->dst_hostname;
+    v[DIAL_VAR_SRC_IP] = app_data->src_ip;
+    v[DIAL_VAR_SRC_PORT] = app_data->src_port;
+
+    if (zi_ctx->source_addr_tpl.text != NULL) {
+        const ziti_identity *zid = ziti_get_identity(zi_ctx->ztx);
+        v[DIAL_VAR_TUNNELER_ID] = zid ? zid->name : NULL;
+        if (dial_template_render(&zi_ctx->source_addr_tpl, &f->values, f->source_addr, sizeof(f->source_addr)) < 0) {
+            ZITI_LOG(WARN, "service[%s] source address '%s' is too long", zi_ctx->service_name,
+                     zi_ctx->source_addr_tpl.text);
+        } else {
+            app_data->source_addr = f->source_addr;
+        }
     }
     ssize_t json_len = tunneler_app_data_to_json_r(app_data, MODEL_JSON_COMPACT, buf, bufsz);
     return json_len;
@@ -277,6 +454,747 @@ static void dial_opts_from_intercept_cfg_v1(ziti_dial_opts *opts, const ziti_int
     }
 }
 
+/** called by ziti SDK when data transfer initiated by ziti_write completes */
+static void on_ziti_write(ziti_connection ziti_conn, ssize_t len, void *ctx) {
+    struct io_ctx_s *io = ziti_conn_data(ziti_conn);
+    if (io != NULL) {
+        ziti_io_context *zio = io->ziti_io;
+
+        if (len < 0) {
+            ZITI_LOG(ERROR, "ziti_write(ziti_conn[%p]) failed: %s", ziti_conn, ziti_errorstr(len));
+            ziti_close(ziti_conn, ziti_conn_close_cb);
+        } else {
+            zio->pending_wbytes -= len;
+        }
+    }
+
+    // without calling this ctx is leaked
+    // in case of error this should N(negative)ACK,
+    // but connection is being closed anyway, so it is probably ok
+    ziti_tunneler_ack(ctx);
+}
+
+static void release_write_ctx(void *write_ctx) {
+    ziti_tunneler_ack(write_ctx);
+}
+
+/** called by ziti SDK when a batch of client writes was written */
+static void on_ziti_batch_write(ziti_connection ziti_conn, ssize_t len, void *ctx) {
+    write_batch_t *batch = ctx;
+    struct io_ctx_s *io = ziti_conn_data(ziti_conn);
+    if (io != NULL) {
+        ziti_io_context *zio = io->ziti_io;
+
+        if (len < 0) {
+            ZITI_LOG(ERROR, "ziti_write(ziti_conn[%p]) failed: %s", ziti_conn, ziti_errorstr(len));
+            ziti_close(ziti_conn, ziti_conn_close_cb);
+        } else {
+            zio->pending_wbytes -= batch->len;
+        }
+    }
+
+    for (int i = 0; i < batch->num_ctx; i++) {
+        release_write_ctx(batch->ctx[i]);
+    }
+    write_batch_free(batch);
+}
+
+static void write_batch(void *ctx, write_batch_t *batch) {
+    ziti_io_context *zio = ctx;
+    // the batch was already counted in pending_wbytes, one write at a time
+    int zs = ziti_write(zio->ziti_conn, batch->data, batch->len, on_ziti_batch_write, batch);
+    if (zs != ZITI_OK) {
+        // the connection is closing. the client's data is dropped, like writes that are in flight
+        ZITI_LOG(DEBUG, "ziti_write(ziti_conn[%p]) failed: %s", zio->ziti_conn, ziti_errorstr(zs));
+        zio->pending_wbytes -= batch->len;
+        for (int i = 0; i < batch->num_ctx; i++) {
+            release_write_ctx(batch->ctx[i]);
+        }
+        write_batch_free(batch);
+    }
+}
+
+static void start_write_coalescing(ziti_io_context *zio, tunneler_io_context tnlr_io, const ziti_intercept_t *zi_ctx) {
+    const write_coalescing_cfg *cfg = zi_ctx->ext_cfg.write_coalescing;
+    if (cfg == NULL || cfg->max_bytes <= 0) {
+        return;
+    }
+
+    size_t max_bytes = cfg->max_bytes > WRITE_COALESCE_MAX_BYTES ? WRITE_COALESCE_MAX_BYTES : (size_t) cfg->max_bytes;
+    uint32_t max_delay_us = 0;
+    if (cfg->max_delay_micros > 0) {
+        max_delay_us = cfg->max_delay_micros > WRITE_COALESCE_MAX_DELAY_US ?
+                       WRITE_COALESCE_MAX_DELAY_US : (uint32_t) cfg->max_delay_micros;
+    }
+    zio->coalescer = write_coalescer_new(get_tunneler_loop(tnlr_io), max_bytes, max_delay_us, write_batch, zio);
+}
+
+/** zlib level for a flow that asks for compression, or 0 */
+static int compression_level(const ziti_intercept_t *zi, struct io_ctx_s *io) {
+    if (zi->cfg_desc->cfgtype != INTERCEPT_CFG_V1) {
+        return 0;
+    }
+    const compression_cfg *cfg = zi->ext_cfg.compression;
+    if (cfg == NULL || cfg->level <= 0 || strcmp(get_intercepted_protocol(io->tnlr_io), "tcp") != 0 ||
+        uv_now(get_tunneler_loop(io->tnlr_io)) < zi->compress_retry_at) {
+        return 0;
+    }
+    return cfg->level > COMPRESS_MAX_LEVEL ? COMPRESS_MAX_LEVEL : (int) cfg->level;
+}
+
+static void compress_flow_free(compress_flow_t *cf) {
+    if (cf == NULL) return;
+    stop_compress_wait(cf);
+    if (cf->encoder) {
+        uint64_t in, out;
+        compress_encoder_stats(cf->encoder, &in, &out);
+        ZITI_LOG(DEBUG, "compressed %" PRIu64 " bytes to %" PRIu64, in, out);
+        compress_encoder_free(cf->encoder);
+    }
+    compress_decoder_free(cf->decoder);
+    free(cf->out);
+    free(cf);
+}
+
+/** the flow is connected, without compression if the hosting side hasn't said that it compresses */
+static void on_compress_hello_timeout(uv_timer_t *t) {
+    struct io_ctx_s *io = t->data;
+    ziti_io_context *ziti_io_ctx = io->ziti_io;
+    compress_flow_t *cf = ziti_io_ctx->compress;
+    stop_compress_wait(cf);
+    ZITI_LOG(DEBUG, "no compression hello after %dms, connecting without it", COMPRESS_HELLO_TIMEOUT_MILLIS);
+    if (cf->zi) {
+        ((ziti_intercept_t *) cf->zi)->compress_retry_at = uv_now(t->loop) + COMPRESS_RETRY_SECONDS * 1000;
+    }
+    cf->connected = true;
+    ziti_tunneler_dial_completed(io, true);
+}
+
+static int wait_for_compress_hello(struct io_ctx_s *io) {
+    ziti_io_context *ziti_io_ctx = io->ziti_io;
+    compress_flow_t *cf = ziti_io_ctx->compress;
+    cf->timer = calloc(1, sizeof(uv_timer_t));
+    uv_timer_init(get_tunneler_loop(io->tnlr_io), cf->timer);
+    cf->timer->data = io;
+    int rc = uv_timer_start(cf->timer, on_compress_hello_timeout, COMPRESS_HELLO_TIMEOUT_MILLIS, 0);
+    if (rc != 0) {
+        stop_compress_wait(cf);
+        cf->connected = true;
+    }
+    return rc;
+}
+
+static void stop_compress_wait(compress_flow_t *cf) {
+    if (cf->timer) {
+        uv_close((uv_handle_t *) cf->timer, (uv_close_cb) free);
+        cf->timer = NULL;
+    }
+}
+
+static void on_compress_hello_written(ziti_connection conn, ssize_t len, void *ctx) {
+    if (len < 0) {
+        // the connection failure is reported to on_ziti_data as well
+        ZITI_LOG(DEBUG, "failed to write compression hello to ziti_conn[%p]: %zd", conn, len);
+    }
+}
+
+/**
+ * the hosting side compresses what it sends if its first message is the hello. the client's data is compressed as
+ * well if the flow isn't connected yet, since nothing was sent plain then. returns true for the hello.
+ */
+static bool on_compress_hello(struct io_ctx_s *io, const uint8_t *data, ssize_t len) {
+    ziti_io_context *ziti_io_ctx = io->ziti_io;
+    compress_flow_t *cf = ziti_io_ctx->compress;
+    bool hello = len == COMPRESS_HELLO_LEN && memcmp(data, COMPRESS_HELLO, COMPRESS_HELLO_LEN) == 0;
+    cf->hello_pending = false;
+    stop_compress_wait(cf);
+    if (hello) {
+        cf->decoder = compress_decoder_new();
+    } else if (len > 0 && cf->zi) {
+        ZITI_LOG(DEBUG, "service[%s] hosting side doesn't compress", cf->zi->service_name);
+        ((ziti_intercept_t *) cf->zi)->compress_retry_at =
+                uv_now(get_tunneler_loop(io->tnlr_io)) + COMPRESS_RETRY_SECONDS * 1000;
+    }
+    if (cf->connected) {
+        return hello;
+    }
+    if (hello && ziti_write(ziti_io_ctx->ziti_conn, (uint8_t *) COMPRESS_HELLO, COMPRESS_HELLO_LEN,
+                            on_compress_hello_written, NULL) == ZITI_OK) {
+        cf->encoder = compress_encoder_new(cf->level);
+    }
+    cf->connected = true;
+    ziti_tunneler_dial_completed(io, true);
+    return hello;
+}
+
+/** returns non-zero if the client didn't take all of it */
+static int write_decompressed(void *ctx, const uint8_t *data, size_t len) {
+    struct io_ctx_s *io = ctx;
+    ziti_io_context *ziti_io_ctx = io->ziti_io;
+    compress_flow_t *cf = ziti_io_ctx->compress;
+    ssize_t n = ziti_tunneler_write(io->tnlr_io, data, len);
+    if (n < 0) {
+        return (int) n;
+    }
+    if ((size_t) n == len) {
+        return 0;
+    }
+    if (cf->out == NULL) {
+        cf->out = malloc(COMPRESS_BLOCK);
+    }
+    cf->out_len = len - (size_t) n;
+    cf->out_off = 0;
+    memcpy(cf->out, data + n, cf->out_len);
+    return 1;
+}
+
+static ssize_t decompress_to_client(struct io_ctx_s *io, const uint8_t *data, size_t len) {
+    ziti_io_context *ziti_io_ctx = io->ziti_io;
+    compress_flow_t *cf = ziti_io_ctx->compress;
+    size_t off = 0;
+    if (cf->held_back) {
+        ssize_t n = ziti_tunneler_write(io->tnlr_io, cf->out + cf->out_off, cf->out_len - cf->out_off);
+        if (n < 0) {
+            ZITI_LOG(ERROR, "failed to write to client");
+            ziti_sdk_c_close(io->ziti_io);
+            return -1;
+        }
+        cf->out_off += (size_t) n;
+        if (cf->out_off < cf->out_len) {
+            return 0;
+        }
+        // the byte that was held back belongs to data that was already decompressed
+        cf->held_back = false;
+        off = 1;
+    }
+
+    ssize_t n = compress_decode(cf->decoder, data + off, len - off, write_decompressed, io);
+    if (n < 0) {
+        ZITI_LOG(ERROR, "failed to decompress data from ziti: %s", uv_strerror((int) n));
+        ziti_sdk_c_close(io->ziti_io);
+        return -1;
+    }
+    off += (size_t) n;
+    if (cf->out_off < cf->out_len) {
+        // decoding stopped at the frame that the client didn't take all of
+        cf->held_back = true;
+        off--;
+    }
+    return (ssize_t) off;
+}
+
+typedef struct compressed_write_s {
+    uint8_t *msg;
+    size_t len; // from the client
+    void *write_ctx;
+} compressed_write_t;
+
+static void on_compressed_ziti_write(ziti_connection ziti_conn, ssize_t len, void *ctx) {
+    compressed_write_t *cw = ctx;
+    struct io_ctx_s *io = ziti_conn_data(ziti_conn);
+    if (io != NULL) {
+        ziti_io_context *zio = io->ziti_io;
+        if (len < 0) {
+            ZITI_LOG(ERROR, "ziti_write(ziti_conn[%p]) failed: %s", ziti_conn, ziti_errorstr(len));
+            ziti_close(ziti_conn, ziti_conn_close_cb);
+        } else {
+            zio->pending_wbytes -= cw->len;
+        }
+    }
+    ziti_tunneler_ack(cw->write_ctx);
+    free(cw->msg);
+    free(cw);
+}
+
+static ssize_t write_compressed(ziti_io_context *zio, void *write_ctx, const void *data, size_t len) {
+    compressed_write_t *cw = malloc(sizeof(compressed_write_t));
+    ssize_t n = compress_encode(zio->compress->encoder, data, len, &cw->msg);
+    if (n < 0) {
+        free(cw);
+        return n;
+    }
+    cw->len = len;
+    cw->write_ctx = write_ctx;
+    int zs = ziti_write(zio->ziti_conn, cw->msg, (size_t) n, on_compressed_ziti_write, cw);
+    if (zs != ZITI_OK) {
+        free(cw->msg);
+        free(cw);
+        return zs;
+    }
+    zio->pending_wbytes += len;
+    return ZITI_OK;
+}
+
+/** called from tunneler SDK when intercepted client sends data */
+ssize_t ziti_sdk_c_write(const void *ziti_io_ctx, void *write_ctx, const void *data, size_t len) {
+    struct ziti_io_ctx_s *_ziti_io_ctx = (struct ziti_io_ctx_s *)ziti_io_ctx;
+    if (_ziti_io_ctx->pending_wbytes + len < MAX_PENDING_BYTES) {
+        if (_ziti_io_ctx->mux_stream) {
+            int rc = mux_stream_write(_ziti_io_ctx->mux_stream, data, len, on_mux_stream_written, write_ctx);
+            if (rc == 0) {
+                _ziti_io_ctx->pending_wbytes += len;
+            }
+            return rc;
+        }
+        if (_ziti_io_ctx->compress && _ziti_io_ctx->compress->encoder) {
+            return write_compressed(_ziti_io_ctx, write_ctx, data, len);
+        }
+        if (_ziti_io_ctx->coalescer) {
+            // counted first, the batch may be written before write_coalescer_write returns
+            _ziti_io_ctx->pending_wbytes += len;
+            if (write_coalescer_write(_ziti_io_ctx->coalescer, data, len, write_ctx) != WRITE_COALESCE_BYPASS) {
+                return ZITI_OK;
+            }
+            _ziti_io_ctx->pending_wbytes -= len;
+        }
+        int zs = ziti_write(_ziti_io_ctx->ziti_conn, (void *) data, len, on_ziti_write, write_ctx);
+        if (zs == ZITI_OK) {
+            _ziti_io_ctx->pending_wbytes += len;
+        }
+        return zs;
+    }
+
+    ZITI_LOG(VERBOSE, "applying backpressure %" PRIu64 " pending bytes", _ziti_io_ctx->pending_wbytes);
+    return ERR_WOULDBLOCK;
+}
+
+// pooled connections that are not bound to a flow yet (dialing or idle), and the pool they belong to
+static model_map pooled_conns;
+
+#define DEFERRED_APP_DATA "{\"connType\":\"deferred\"}"
+
+static void close_pooled_conn(void *conn) {
+    ziti_connection zc = conn;
+    model_map_remove_key(&pooled_conns, &zc, sizeof(zc));
+    ziti_close(zc, NULL);
+}
+
+static void on_pooled_conn_connect(ziti_connection conn, int status) {
+    dial_pool_t *pool = model_map_get_key(&pooled_conns, &conn, sizeof(conn));
+    if (pool == NULL) {
+        ZITI_LOG(WARN, "unknown pooled ziti_conn[%p] status[%d]", conn, status);
+        ziti_close(conn, NULL);
+        return;
+    }
+    if (status == ZITI_OK) {
+        dial_pool_dialed(pool, conn, 0);
+    } else {
+        ZITI_LOG(DEBUG, "pooled ziti dial failed: %s", ziti_errorstr(status));
+        model_map_remove_key(&pooled_conns, &conn, sizeof(conn));
+        dial_pool_dialed(pool, NULL, status);
+        ziti_close(conn, NULL);
+    }
+}
+
+static ssize_t on_pooled_conn_data(ziti_connection conn, const uint8_t *data, ssize_t len) {
+    dial_pool_t *pool = model_map_get_key(&pooled_conns, &conn, sizeof(conn));
+    if (pool == NULL) {
+        // bound to a flow
+        return on_ziti_data(conn, data, len);
+    }
+    // the hosting side has nothing to say on an idle connection, other than closing it
+    ZITI_LOG(DEBUG, "idle pooled ziti_conn[%p] is closed: %zd", conn, len);
+    dial_pool_remove(pool, conn);
+    close_pooled_conn(conn);
+    return len;
+}
+
+static int dial_pooled_conn(dial_pool_t *pool, void *ctx) {
+    ziti_intercept_t *zi = ctx;
+    ziti_connection conn;
+    int rc = ziti_conn_init(zi->ztx, &conn, NULL);
+    if (rc != ZITI_OK) {
+        return rc;
+    }
+
+    // the pooled connection carries the service's static dial options. the flow's app_data follows in the prelude
+    ziti_dial_opts opts = {0};
+    dial_opts_from_intercept_cfg_v1(&opts, &zi->cfg.intercept_v1);
+    opts.stream = true;
+    opts.app_data = DEFERRED_APP_DATA;
+    opts.app_data_sz = strlen(DEFERRED_APP_DATA);
+
+    model_map_set_key(&pooled_conns, &conn, sizeof(conn), pool);
+    rc = ziti_dial_with_options(conn, zi->service_name, &opts, on_pooled_conn_connect, on_pooled_conn_data);
+    if (rc != ZITI_OK) {
+        model_map_remove_key(&pooled_conns, &conn, sizeof(conn));
+        ziti_close(conn, NULL);
+    }
+    return rc;
+}
+
+static void on_prelude_written(ziti_connection conn, ssize_t len, void *ctx) {
+    free(ctx);
+    if (len < 0) {
+        // the connection failure is reported to on_ziti_data as well
+        ZITI_LOG(DEBUG, "failed to write prelude to pooled ziti_conn[%p]: %zd", conn, len);
+    }
+}
+
+/**
+ * bind a pooled connection to the flow, if the service has a pool with a connection ready.
+ * the flow's app_data goes out as the connection's first message.
+ */
+static bool dial_from_pool(ziti_intercept_t *zi, struct io_ctx_s *io, const char *app_data, size_t app_data_len) {
+    const dial_pool_cfg *cfg = zi->ext_cfg.dial_pool;
+    // pooled connections are dialed before the flow's identity is known
+    if (cfg == NULL || cfg->max_size <= 0 || zi->identity_tpl.num_vars > 0 || app_data_len > DIAL_POOL_PRELUDE_MAX) {
+        return false;
+    }
+
+    if (zi->dial_pool == NULL) {
+        int max_size = cfg->max_size > DIAL_POOL_MAX_SIZE ? DIAL_POOL_MAX_SIZE : (int) cfg->max_size;
+        uint64_t ttl = cfg->ttl_seconds > 0 ? (uint64_t) cfg->ttl_seconds : DIAL_POOL_DEFAULT_TTL_SECONDS;
+        zi->dial_pool = dial_pool_new(get_tunneler_loop(io->tnlr_io), max_size, ttl * 1000,
+                                      dial_pooled_conn, close_pooled_conn, zi);
+        if (zi->dial_pool == NULL) {
+            return false;
+        }
+        ZITI_LOG(DEBUG, "service[%s] started dial pool max_size[%d] ttl[%" PRIu64 "s]", zi->service_name, max_size, ttl);
+    }
+
+    ziti_connection conn = dial_pool_take(zi->dial_pool);
+    if (conn == NULL) {
+        return false;
+    }
+    model_map_remove_key(&pooled_conns, &conn, sizeof(conn));
+
+    ziti_io_context *ziti_io_ctx = io->ziti_io;
+    ziti_io_ctx->ziti_conn = conn;
+    ziti_io_ctx->deferred_pending = true;
+    ziti_conn_set_data(conn, io);
+    ZITI_LOG(DEBUG, "service[%s] using pooled ziti_conn[%p]", zi->service_name, conn);
+
+    uint8_t *prelude = malloc(DIAL_POOL_PRELUDE_HDR + app_data_len);
+    prelude[0] = (uint8_t) (app_data_len >> 8);
+    prelude[1] = (uint8_t) app_data_len;
+    memcpy(prelude + DIAL_POOL_PRELUDE_HDR, app_data, app_data_len);
+    if (ziti_write(conn, prelude, DIAL_POOL_PRELUDE_HDR + app_data_len, on_prelude_written, prelude) != ZITI_OK) {
+        ZITI_LOG(ERROR, "failed to write prelude to pooled ziti_conn[%p]", conn);
+        free(prelude);
+        // the client is disconnected once the close completes
+        ziti_close(conn, ziti_conn_close_cb);
+    }
+    return true;
+}
+
+#define MULTIPLEXED_APP_DATA "{\"connType\":\"multiplexed\"}"
+
+/** a ziti connection, or a hairpin, that carries the service's tcp flows as mux streams */
+typedef struct mux_conn_s {
+    intercept_mux_t *owner; // NULL once the intercept is gone, or the connection is closed
+    int slot;
+    uv_loop_t *loop;
+    ziti_connection conn; // NULL once closed
+    hairpin_t *hairpin; // instead of `conn`, NULL once closed
+    const host_ctx_t *host; // hosting side of the hairpin
+    mux_t *mux; // NULL until connected
+    int streams; // opened and not released yet
+} mux_conn_t;
+
+struct intercept_mux_s {
+    int size;
+    mux_conn_t *conns[MUX_MAX_CONNECTIONS];
+    uint64_t retry_at; // uv_now() until which flows are dialed on their own
+};
+
+typedef struct mux_msg_s {
+    mux_t *mux;
+    uint8_t *msg;
+    void *req;
+} mux_msg_t;
+
+/** the connection stays around until the streams that are still open have released their flows */
+static void close_mux_conn(mux_conn_t *mc, int err) {
+    if (mc->owner) {
+        mc->owner->conns[mc->slot] = NULL;
+        mc->owner = NULL;
+    }
+    if (mc->conn) {
+        ziti_conn_set_data(mc->conn, NULL);
+        ziti_close(mc->conn, NULL);
+        mc->conn = NULL;
+    }
+    if (mc->hairpin) {
+        hairpin_t *hp = mc->hairpin;
+        mc->hairpin = NULL;
+        hairpin_close(hp, err);
+    }
+    if (mc->mux) {
+        mux_close(mc->mux, err);
+    }
+    if (mc->streams == 0) {
+        free(mc);
+    }
+}
+
+static void detach_intercept_mux(intercept_mux_t *im) {
+    if (im == NULL) return;
+    for (int i = 0; i < im->size; i++) {
+        mux_conn_t *mc = im->conns[i];
+        if (mc == NULL) continue;
+        mc->owner = NULL;
+        // otherwise closed after its last stream
+        if (mc->streams == 0) {
+            close_mux_conn(mc, UV_ECANCELED);
+        }
+    }
+    free(im);
+}
+
+static void on_mux_msg_written(ziti_connection conn, ssize_t len, void *ctx) {
+    mux_msg_t *m = ctx;
+    mux_written(m->mux, m->req, len < 0 ? (int) len : 0);
+    free(m->msg);
+    free(m);
+}
+
+static int mux_conn_write(void *ctx, uint8_t *msg, size_t len, void *req) {
+    mux_conn_t *mc = ctx;
+    if (mc->hairpin) {
+        return hairpin_write(mc->hairpin, HAIRPIN_INTERCEPT, msg, len, req);
+    }
+    mux_msg_t *m = malloc(sizeof(mux_msg_t));
+    m->mux = mc->mux;
+    m->msg = msg;
+    m->req = req;
+    int rc = ziti_write(mc->conn, msg, len, on_mux_msg_written, m);
+    if (rc != ZITI_OK) {
+        free(msg);
+        free(m);
+    }
+    return rc;
+}
+
+static void on_mux_conn_connect(ziti_connection conn, int status) {
+    mux_conn_t *mc = ziti_conn_data(conn);
+    if (mc == NULL) {
+        ziti_close(conn, NULL);
+        return;
+    }
+    if (status != ZITI_OK) {
+        if (mc->owner) {
+            mc->owner->retry_at = uv_now(mc->loop) + MUX_RETRY_SECONDS * 1000;
+        }
+        ZITI_LOG(INFO, "multiplexed ziti dial failed: %s. flows are dialed individually for %ds",
+                 ziti_errorstr(status), MUX_RETRY_SECONDS);
+        close_mux_conn(mc, status);
+        return;
+    }
+    if (mc->owner == NULL) {
+        close_mux_conn(mc, UV_ECANCELED);
+        return;
+    }
+    mc->mux = mux_new(mc->loop, mux_conn_write, NULL, mc);
+    ZITI_LOG(DEBUG, "multiplexed ziti_conn[%p] connected", conn);
+}
+
+static ssize_t on_mux_conn_data(ziti_connection conn, const uint8_t *data, ssize_t len) {
+    mux_conn_t *mc = ziti_conn_data(conn);
+    if (mc == NULL) {
+        ziti_close(conn, NULL);
+        return UV_ECONNABORTED;
+    }
+    if (len > 0) {
+        mux_on_data(mc->mux, data, len);
+        return len;
+    }
+    ZITI_LOG(DEBUG, "multiplexed ziti_conn[%p] is closed: %zd", conn, len);
+    close_mux_conn(mc, len == ZITI_EOF ? UV_ECONNRESET : (int) len);
+    return len;
+}
+
+static void start_mux_conn(ziti_intercept_t *zi, uv_loop_t *loop, int slot) {
+    mux_conn_t *mc = calloc(1, sizeof(mux_conn_t));
+    mc->owner = zi->mux;
+    mc->slot = slot;
+    mc->loop = loop;
+    if (ziti_conn_init(zi->ztx, &mc->conn, mc) != ZITI_OK) {
+        free(mc);
+        return;
+    }
+    zi->mux->conns[slot] = mc;
+
+    ziti_dial_opts opts = {0};
+    dial_opts_from_intercept_cfg_v1(&opts, &zi->cfg.intercept_v1);
+    opts.stream = true;
+    opts.app_data = MULTIPLEXED_APP_DATA;
+    opts.app_data_sz = strlen(MULTIPLEXED_APP_DATA);
+    if (ziti_dial_with_options(mc->conn, zi->service_name, &opts, on_mux_conn_connect, on_mux_conn_data) != ZITI_OK) {
+        ZITI_LOG(WARN, "service[%s] multiplexed ziti dial failed", zi->service_name);
+        zi->mux->retry_at = uv_now(loop) + MUX_RETRY_SECONDS * 1000;
+        close_mux_conn(mc, UV_ECANCELED);
+    }
+}
+
+static void on_mux_stream_closed(mux_stream_t *s) {
+    mux_conn_t *mc = mux_ctx(mux_stream_mux(s));
+    free_io_ctx(mux_stream_data(s));
+    mc->streams--;
+    if (mc->conn == NULL && mc->hairpin == NULL) {
+        if (mc->streams == 0) {
+            free(mc);
+        }
+    } else if (mc->owner == NULL && mc->streams == 0) {
+        // the intercept is gone
+        close_mux_conn(mc, UV_ECANCELED);
+    }
+}
+
+static void on_mux_stream_connect(mux_stream_t *s, int status) {
+    struct io_ctx_s *io = mux_stream_data(s);
+    if (status == 0) {
+        ziti_tunneler_dial_completed(io, true);
+    } else {
+        ZITI_LOG(ERROR, "multiplexed dial failed: %s", uv_strerror(status));
+        mux_stream_close(s, on_mux_stream_closed);
+    }
+}
+
+static ssize_t on_mux_stream_data(mux_stream_t *s, const uint8_t *data, ssize_t len) {
+    struct io_ctx_s *io = mux_stream_data(s);
+    ziti_io_context *ziti_io_ctx = io->ziti_io;
+    if (len > 0) {
+        ssize_t accepted = ziti_tunneler_write(io->tnlr_io, data, len);
+        if (accepted < 0) {
+            ZITI_LOG(ERROR, "failed to write to client");
+            mux_stream_close(s, on_mux_stream_closed);
+            return accepted;
+        }
+        mux_stream_consumed(s, accepted);
+        return accepted;
+    }
+    if (len == UV_EOF) {
+        ZITI_LOG(DEBUG, "mux stream sent EOF (ziti_eof=%d, tnlr_eof=%d)", ziti_io_ctx->ziti_eof, ziti_io_ctx->tnlr_eof);
+        ziti_io_ctx->ziti_eof = true;
+        if (ziti_io_ctx->tnlr_eof) {
+            mux_stream_close(s, on_mux_stream_closed);
+        } else {
+            ziti_tunneler_close_write(io->tnlr_io);
+        }
+        return len;
+    }
+    ZITI_LOG(DEBUG, "mux stream is closed due to [%zd](%s)", len, uv_strerror((int) len));
+    mux_stream_close(s, on_mux_stream_closed);
+    return len;
+}
+
+static void on_mux_stream_written(void *stream_data, ssize_t status, void *ctx) {
+    struct io_ctx_s *io = stream_data;
+    if (io != NULL && status > 0) {
+        ziti_io_context *ziti_io_ctx = io->ziti_io;
+        ziti_io_ctx->pending_wbytes -= status;
+    }
+    ziti_tunneler_ack(ctx);
+}
+
+static bool open_mux_stream(mux_conn_t *mc, struct io_ctx_s *io, const char *app_data, size_t app_data_len) {
+    mux_stream_t *s = mux_stream_open(mc->mux, (const uint8_t *) app_data, app_data_len,
+                                      on_mux_stream_connect, on_mux_stream_data, io);
+    if (s == NULL) {
+        return false;
+    }
+    mc->streams++;
+    ziti_io_context *ziti_io_ctx = io->ziti_io;
+    ziti_io_ctx->mux_stream = s;
+    return true;
+}
+
+/**
+ * open the flow as a stream on one of the service's multiplexed connections, the least busy one.
+ * connections are dialed as they are needed. flows are dialed on their own until one is connected.
+ */
+static bool dial_multiplexed(ziti_intercept_t *zi, struct io_ctx_s *io, const char *app_data, size_t app_data_len) {
+    const multiplex_cfg *cfg = zi->ext_cfg.multiplex;
+    // multiplexed connections are shared by flows, so they can't use a dial identity that depends on the flow
+    if (cfg == NULL || cfg->connections <= 0 || zi->identity_tpl.num_vars > 0 || app_data_len > MUX_FRAME_MAX) {
+        return false;
+    }
+
+    uv_loop_t *loop = get_tunneler_loop(io->tnlr_io);
+    if (zi->mux == NULL) {
+        zi->mux = calloc(1, sizeof(intercept_mux_t));
+        zi->mux->size = cfg->connections > MUX_MAX_CONNECTIONS ? MUX_MAX_CONNECTIONS : (int) cfg->connections;
+        ZITI_LOG(DEBUG, "service[%s] multiplexing flows over %d connections", zi->service_name, zi->mux->size);
+    }
+    intercept_mux_t *im = zi->mux;
+    if (uv_now(loop) < im->retry_at) {
+        return false;
+    }
+
+    mux_conn_t *best = NULL;
+    for (int i = 0; i < im->size; i++) {
+        mux_conn_t *mc = im->conns[i];
+        if (mc == NULL) {
+            start_mux_conn(zi, loop, i);
+        } else if (mc->mux != NULL && (best == NULL || mux_stream_count(mc->mux) < mux_stream_count(best->mux))) {
+            best = mc;
+        }
+    }
+    if (best == NULL || !open_mux_stream(best, io, app_data, app_data_len)) {
+        return false;
+    }
+    ZITI_LOG(DEBUG, "service[%s] flow is a stream on ziti_conn[%p]", zi->service_name, best->conn);
+    return true;
+}
+
+static mux_conn_t *start_hairpin(ziti_intercept_t *zi, uv_loop_t *loop, host_ctx_t *host, const char *caller_id) {
+    mux_conn_t *mc = calloc(1, sizeof(mux_conn_t));
+    mc->owner = zi->hairpin;
+    mc->loop = loop;
+    mc->host = host;
+    mc->hairpin = hairpin_new(loop);
+    mc->mux = mux_new(loop, mux_conn_write, NULL, mc);
+    hairpin_attach(mc->hairpin, HAIRPIN_INTERCEPT, mc->mux, NULL, NULL);
+    hosted_service_hairpin(host, mc->hairpin, caller_id);
+    zi->hairpin->conns[0] = mc;
+    ZITI_LOG(INFO, "service[%s] is hosted by this tunneler, flows are hairpinned", zi->service_name);
+    return mc;
+}
+
+/**
+ * open the flow as a stream to the hosting side of this tunneler, if it hosts the service. the flow doesn't leave
+ * the process then, and the hosting side still applies its own checks to the flow's app_data.
+ */
+static bool dial_hairpin(ziti_intercept_t *zi, struct io_ctx_s *io, const ziti_dial_opts *opts, const char *app_data,
+                         size_t app_data_len) {
+    if (!zi->ext_cfg.hairpin || app_data_len > MUX_FRAME_MAX) {
+        return false;
+    }
+    if (zi->hairpin == NULL) {
+        zi->hairpin = calloc(1, sizeof(intercept_mux_t));
+        zi->hairpin->size = 1;
+    }
+
+    struct ziti_instance_s *inst = ziti_app_ctx(zi->ztx);
+    host_ctx_t *host = inst != NULL ? model_map_get(&inst->hosts, zi->service_name) : NULL;
+    mux_conn_t *mc = zi->hairpin->conns[0];
+    if (mc != NULL && mc->host != host) {
+        // the service isn't hosted the same way anymore. flows that use the old hairpin keep it until they are done
+        zi->hairpin->conns[0] = NULL;
+        mc->owner = NULL;
+        if (mc->streams == 0) {
+            close_mux_conn(mc, UV_ECANCELED);
+        }
+        mc = NULL;
+    }
+
+    const ziti_identity *zid = ziti_get_identity(zi->ztx);
+    // flows for a particular terminator go through the fabric, unless it is this tunneler
+    if (host == NULL || zid == NULL || zi->identity_tpl.num_vars > 0 ||
+        (opts->identity != NULL && opts->identity[0] != '\0' && strcmp(opts->identity, zid->name) != 0)) {
+        return false;
+    }
+    if (mc == NULL) {
+        mc = start_hairpin(zi, get_tunneler_loop(io->tnlr_io), host, zid->name);
+    }
+    if (!open_mux_stream(mc, io, app_data, app_data_len)) {
+        return false;
+    }
+    ZITI_LOG(DEBUG, "service[%s] flow is hairpinned", zi->service_name);
+    return true;
+}
+
 /** called by tunneler SDK after a client connection is intercepted */
 void * ziti_sdk_c_dial(const void *intercept_ctx, struct io_ctx_s *io) {
     if (intercept_ctx == NULL) {
@@ -295,17 +1213,15 @@ void * ziti_sdk_c_dial(const void *intercept_ctx, struct io_ctx_s *io) {
     ziti_io_ctx->ziti_eof = false;
     ziti_io_ctx->tnlr_eof = false;
     ziti_io_ctx->pending_wbytes = 0;
-
-    ziti_context ziti_ctx = zi_ctx->ztx;
-    if (ziti_conn_init(ziti_ctx, &ziti_io_ctx->ziti_conn, io) != ZITI_OK) {
-        ZITI_LOG(ERROR, "ziti_conn_init failed");
-        free(ziti_io_ctx);
-        return NULL;
-    }
+    ziti_io_ctx->udp_framing_pending = false;
+    ziti_io_ctx->udp_frames = NULL;
+    ziti_io_ctx->coalescer = NULL;
+    ziti_io_ctx->deferred_pending = false;
+    ziti_io_ctx->mux_stream = NULL;
+    ziti_io_ctx->compress = NULL;
 
     ziti_dial_opts dial_opts = {0};
-    char app_data_json[256];
-    const char *source_ip = NULL;
+    char app_data_json[320];
 
     switch (zi_ctx->cfg_desc->cfgtype) {
         case CLIENT_CFG_V1:
@@ -313,47 +1229,79 @@ void * ziti_sdk_c_dial(const void *intercept_ctx, struct io_ctx_s *io) {
             break;
         case INTERCEPT_CFG_V1:
             dial_opts_from_intercept_cfg_v1(&dial_opts, &zi_ctx->cfg.intercept_v1);
-            source_ip = zi_ctx->cfg.intercept_v1.source_ip;
             break;
         default:
             break;
     }
     
-    tunneler_app_data app_data = {0};
-    ssize_t json_len = get_app_data(app_data_json, sizeof(app_data_json), io->tnlr_io, ziti_ctx, source_ip, &app_data);
+    dial_fields_t fields = {0};
+    int compress_level = compression_level(zi_ctx, io);
+    if (compress_level > 0) {
+        fields.app_data.compression = COMPRESSION_DEFLATE;
+    }
+    ssize_t json_len = get_app_data(app_data_json, sizeof(app_data_json), io->tnlr_io, zi_ctx, &fields);
     if (json_len < 0) {
         ZITI_LOG(ERROR, "service[%s] failed to encode app_data", zi_ctx->service_name);
         free(ziti_io_ctx);
         return NULL;
     }
 
-    dial_opts.stream = strcmp(app_data.dst_protocol, "tcp") == 0;
+    dial_opts.stream = strcmp(fields.dst.proto, "tcp") == 0;
+    ziti_io_ctx->udp_framing_pending = fields.app_data.udp_framing != NULL;
 
-    char resolved_dial_identity[128];
-    if (dial_opts.identity != NULL && dial_opts.identity[0] != '\0') {
-        strncpy(resolved_dial_identity, dial_opts.identity, sizeof(resolved_dial_identity));
-        if (app_data.dst_protocol != NULL) {
-            string_replace(resolved_dial_identity, sizeof(resolved_dial_identity), "$dst_protocol", app_data.dst_protocol);
-        }
-        if (app_data.dst_ip != NULL) {
-            string_replace(resolved_dial_identity, sizeof(resolved_dial_identity), "$dst_ip", app_data.dst_ip);
-        }
-        if (app_data.dst_port != NULL) {
-            string_replace(resolved_dial_identity, sizeof(resolved_dial_identity), "$dst_port", app_data.dst_port);
-        }
-        if (app_data.dst_hostname != NULL) {
-            string_replace(resolved_dial_identity, sizeof(resolved_dial_identity), "$dst_hostname", app_data.dst_hostname);
+    // streams are framed by the mux, so their writes are not coalesced
+    if (dial_opts.stream && zi_ctx->cfg_desc->cfgtype == INTERCEPT_CFG_V1 &&
+        dial_hairpin((ziti_intercept_t *) zi_ctx, io, &dial_opts, app_data_json, (size_t) json_len)) {
+        return ziti_io_ctx;
+    }
+    if (dial_opts.stream && zi_ctx->cfg_desc->cfgtype == INTERCEPT_CFG_V1 &&
+        dial_multiplexed((ziti_intercept_t *) zi_ctx, io, app_data_json, (size_t) json_len)) {
+        return ziti_io_ctx;
+    }
+
+    // flows that ask for compression write the client's data as it comes
+    if (dial_opts.stream && compress_level == 0) {
+        start_write_coalescing(ziti_io_ctx, io->tnlr_io, zi_ctx);
+    }
+
+    if (dial_opts.stream && zi_ctx->cfg_desc->cfgtype == INTERCEPT_CFG_V1 &&
+        dial_from_pool((ziti_intercept_t *) zi_ctx, io, app_data_json, (size_t) json_len)) {
+        return ziti_io_ctx;
+    }
+
+    if (ziti_conn_init(zi_ctx->ztx, &ziti_io_ctx->ziti_conn, io) != ZITI_OK) {
+        ZITI_LOG(ERROR, "ziti_conn_init failed");
+        write_coalescer_close(ziti_io_ctx->coalescer, NULL);
+        free(ziti_io_ctx);
+        return NULL;
+    }
+    if (compress_level > 0) {
+        compress_flow_t *cf = calloc(1, sizeof(compress_flow_t));
+        cf->zi = zi_ctx;
+        cf->level = compress_level;
+        cf->hello_pending = true;
+        ziti_io_ctx->compress = cf;
+    }
+
+    if (zi_ctx->identity_tpl.num_vars > 0) {
+        if (dial_template_render(&zi_ctx->identity_tpl, &fields.values, fields.identity, sizeof(fields.identity)) < 0) {
+            ZITI_LOG(WARN, "service[%s] dial identity '%s' is too long. dialing without one", zi_ctx->service_name,
+                     zi_ctx->identity_tpl.text);
+            // the unrendered template would name a terminator that doesn't exist
+            dial_opts.identity = NULL;
+        } else {
+            dial_opts.identity = fields.identity;
         }
-        dial_opts.identity = resolved_dial_identity;
     }
 
-    free_tunneler_app_data(&app_data);
     dial_opts.app_data_sz = (size_t) json_len;
     dial_opts.app_data = app_data_json;
 
     ZITI_LOG(DEBUG, "service[%s] app_data_json[%zd]='%.*s'", zi_ctx->service_name, dial_opts.app_data_sz, (int)dial_opts.app_data_sz, (char *) dial_opts.app_data);
     if (ziti_dial_with_options(ziti_io_ctx->ziti_conn, zi_ctx->service_name, &dial_opts, on_ziti_connect, on_ziti_data) != ZITI_OK) {
         ZITI_LOG(ERROR, "ziti_dial failed");
+        write_coalescer_close(ziti_io_ctx->coalescer, NULL);
+        free(ziti_io_ctx->compress);
         free(ziti_io_ctx);
         return NULL;
     }
@@ -361,39 +1309,18 @@ void * ziti_sdk_c_dial(const void *intercept_ctx, struct io_ctx_s *io) {
     return ziti_io_ctx;
 }
 
-/** called by ziti SDK when data transfer initiated by ziti_write completes */
-static void on_ziti_write(ziti_connection ziti_conn, ssize_t len, void *ctx) {
-    struct io_ctx_s *io = ziti_conn_data(ziti_conn);
-    if (io != NULL) {
-        ziti_io_context *zio = io->ziti_io;
-
-        if (len < 0) {
-            ZITI_LOG(ERROR, "ziti_write(ziti_conn[%p]) failed: %s", ziti_conn, ziti_errorstr(len));
-            ziti_close(ziti_conn, ziti_conn_close_cb);
-        } else {
-            zio->pending_wbytes -= len;
-        }
+static void compile_dial_templates(ziti_intercept_t *zi) {
+    const ziti_intercept_cfg_v1 *cfg = &zi->cfg.intercept_v1;
+    if (cfg->source_ip != NULL && cfg->source_ip[0] != '\0' &&
+        dial_template_compile(&zi->source_addr_tpl, cfg->source_ip, DIAL_SOURCE_ADDR_VARS) != 0) {
+        ZITI_LOG(WARN, "service[%s] ignoring invalid sourceIp '%s'", zi->service_name, cfg->source_ip);
     }
 
-    // without calling this ctx is leaked
-    // in case of error this should N(negative)ACK,
-    // but connection is being closed anyway, so it is probably ok
-    ziti_tunneler_ack(ctx);
-}
-
-/** called from tunneler SDK when intercepted client sends data */
-ssize_t ziti_sdk_c_write(const void *ziti_io_ctx, void *write_ctx, const void *data, size_t len) {
-    struct ziti_io_ctx_s *_ziti_io_ctx = (struct ziti_io_ctx_s *)ziti_io_ctx;
-    if (_ziti_io_ctx->pending_wbytes + len < MAX_PENDING_BYTES) {
-        int zs = ziti_write(_ziti_io_ctx->ziti_conn, (void *) data, len, on_ziti_write, write_ctx);
-        if (zs == ZITI_OK) {
-            _ziti_io_ctx->pending_wbytes += len;
-        }
-        return zs;
+    const tag *t = model_map_get(&cfg->dial_options, "identity");
+    if (t != NULL && t->type == tag_string && t->string_value != NULL && t->string_value[0] != '\0' &&
+        dial_template_compile(&zi->identity_tpl, t->string_value, DIAL_IDENTITY_VARS) != 0) {
+        ZITI_LOG(WARN, "service[%s] ignoring invalid dial identity '%s'", zi->service_name, t->string_value);
     }
-
-    ZITI_LOG(VERBOSE, "applying backpressure %" PRIu64 " pending bytes", _ziti_io_ctx->pending_wbytes);
-    return ERR_WOULDBLOCK;
 }
 
 ziti_intercept_t *new_ziti_intercept(ziti_context ztx, ziti_service *service, ziti_intercept_t *curr_i) {
@@ -407,8 +1334,13 @@ ziti_intercept_t *new_ziti_intercept(ziti_context ztx, ziti_service *service, zi
         const char *cfg_json = ziti_service_get_raw_config(service, cfgtype->name);
         if (cfg_json != 0 && cfgtype->parse(&zi_ctx->cfg, cfg_json, strlen(cfg_json)) > 0) {
             zi_ctx->cfg_desc = cfgtype;
+            if (cfgtype->cfgtype == INTERCEPT_CFG_V1 &&
+                parse_intercept_cfg_v1_ext(&zi_ctx->ext_cfg, cfg_json, strlen(cfg_json)) < 0) {
+                ZITI_LOG(WARN, "service[%s] failed to parse tunneler settings from %s config", service->name, cfgtype->name);
+            }
 
-            if (curr_i && cfgtype == curr_i->cfg_desc && cfgtype->compare(&zi_ctx->cfg, &curr_i->cfg) == 0) {
+            if (curr_i && cfgtype == curr_i->cfg_desc && cfgtype->compare(&zi_ctx->cfg, &curr_i->cfg) == 0 &&
+                cmp_intercept_cfg_v1_ext(&zi_ctx->ext_cfg, &curr_i->ext_cfg) == 0) {
                 ZITI_LOG(DEBUG, "configuration[%s] was not changed for service[%s]", cfgtype->name, service->name);
             } else {
                 ZITI_LOG(INFO, "%s intercept for service[%s] with %s = %s", curr_i ? "changing" : "creating", service->name, cfgtype->name, cfg_json);
@@ -423,6 +1355,9 @@ ziti_intercept_t *new_ziti_intercept(ziti_context ztx, ziti_service *service, zi
         free_ziti_intercept(zi_ctx);
         return NULL;
     }
+    if (zi_ctx->cfg_desc->cfgtype == INTERCEPT_CFG_V1) {
+        compile_dial_templates(zi_ctx);
+    }
     return zi_ctx;
 }
 
@@ -430,17 +1365,7 @@ ziti_intercept_t *new_ziti_intercept(ziti_context ztx, ziti_service *service, zi
 static const ziti_address *intercept_match_addr(ip_addr_t *addr, void *ctx) {
     ziti_intercept_t *zi_ctx = ctx;
     if (zi_ctx->cfg_desc->cfgtype == INTERCEPT_CFG_V1) {
-        ziti_intercept_cfg_v1 *cfg = &zi_ctx->cfg.intercept_v1;
-        const char *domain = ziti_dns_reverse_lookup_domain(addr);
-        if (domain) {
-            const ziti_address *zaddr;
-            MODEL_LIST_FOREACH(zaddr, cfg->addresses) {
-                if (zaddr->type != ziti_address_hostname) continue;
-                if (ziti_address_match_s(domain, zaddr) >= 0) {
-                    return zaddr;
-                }
-            }
-        }
+        return ziti_dns_match_domain_intercept(addr, zi_ctx);
     }
     return NULL;
 }
@@ -464,6 +1389,18 @@ static const ziti_address  *intercept_addr_from_cfg_addr(const ziti_address *cfg
     return intercept_addr_p;
 }
 
+/** hostnames are intercepted on their IPv6 address too, if DNS has an IPv6 range */
+static void add_intercept_address(intercept_ctx_t *i_ctx, const ziti_address *cfg_addr, ziti_intercept_t *zi) {
+    intercept_ctx_add_address(i_ctx, intercept_addr_from_cfg_addr(cfg_addr, zi));
+
+    const ip_addr_t *ip6 = ziti_dns_hostname_ip6(cfg_addr);
+    if (ip6) {
+        ziti_address za6;
+        ziti_address_from_ip_addr(&za6, ip6);
+        intercept_ctx_add_address(i_ctx, &za6);
+    }
+}
+
 intercept_ctx_t *new_intercept_ctx(tunneler_context tnlr_ctx, ziti_intercept_t *zi_ctx) {
     intercept_ctx_t *i_ctx = intercept_ctx_new(tnlr_ctx, zi_ctx->service_name, zi_ctx);
     intercept_ctx_set_match_addr(i_ctx, intercept_match_addr);
@@ -473,8 +1410,7 @@ intercept_ctx_t *new_intercept_ctx(tunneler_context tnlr_ctx, ziti_intercept_t *
         case CLIENT_CFG_V1:
             intercept_ctx_add_protocol(i_ctx, "udp");
             intercept_ctx_add_protocol(i_ctx, "tcp");
-            za = intercept_addr_from_cfg_addr(&zi_ctx->cfg.client_v1.hostname, zi_ctx);
-            intercept_ctx_add_address(i_ctx, za);
+            add_intercept_address(i_ctx, &zi_ctx->cfg.client_v1.hostname, zi_ctx);
             intercept_ctx_add_port_range(i_ctx, zi_ctx->cfg.client_v1.port, zi_ctx->cfg.client_v1.port);
             break;
         case INTERCEPT_CFG_V1:
@@ -486,8 +1422,7 @@ intercept_ctx_t *new_intercept_ctx(tunneler_context tnlr_ctx, ziti_intercept_t *
             }
             ziti_address *addr;
             MODEL_LIST_FOREACH(addr, config->addresses) {
-                za = intercept_addr_from_cfg_addr(addr, zi_ctx);
-                intercept_ctx_add_address(i_ctx, za);
+                add_intercept_address(i_ctx, addr, zi_ctx);
             }
             MODEL_LIST_FOREACH(addr, config->allowed_source_addresses) {
                 za = intercept_addr_from_cfg_addr(addr, zi_ctx);
@@ -563,6 +1498,8 @@ tunneled_service_t *ziti_sdk_c_on_service(ziti_context ziti_ctx, ziti_service *s
                 get_config_rc = ziti_service_get_config(service, cfgtype->name, config, cfgtype->parse);
                 if (get_config_rc == 0) {
                     current_tunneled_service.host = ziti_tunneler_host(tnlr_ctx, ziti_ctx, service->name, cfgtype->cfgtype, config);
+                    hosted_service_set_ext_config(current_tunneled_service.host,
+                                                  ziti_service_get_raw_config(service, cfgtype->name));
                     break;
                 }
                 cfgtype->free(config);
@@ -597,6 +1534,23 @@ void remove_intercepts(ziti_context ziti_ctx, void *tnlr_ctx) {
     }
 }
 
+/** releases a flow once its ziti side is closed */
+static void free_io_ctx(struct io_ctx_s *io) {
+    if (io->ziti_io) {
+        ziti_io_context *ziti_io_ctx = io->ziti_io;
+        if (ziti_io_ctx->udp_frames) {
+            udp_frame_reader_free(ziti_io_ctx->udp_frames);
+            free(ziti_io_ctx->udp_frames);
+        }
+        write_coalescer_close(ziti_io_ctx->coalescer, release_write_ctx);
+        compress_flow_free(ziti_io_ctx->compress);
+        free(io->ziti_io);
+        io->ziti_io = NULL;
+    }
+    ziti_tunneler_close(io->tnlr_io);
+    free(io);
+}
+
 /** called by ziti sdk after ziti_close completes */
 static void ziti_conn_close_cb(ziti_connection zc) {
     ZITI_LOG(TRACE, "ziti_conn[%p] is closed", zc);
@@ -605,17 +1559,12 @@ static void ziti_conn_close_cb(ziti_connection zc) {
         ZITI_LOG(WARN, "null io. underlay connection possibly leaked. ziti_conn[%p]", zc);
         return;
     }
-    if (io->ziti_io) {
-        free(io->ziti_io);
-        io->ziti_io = NULL;
-    }
-    ziti_tunneler_close(io->tnlr_io);
-    free(io);
+    free_io_ctx(io);
     ziti_conn_set_data(zc, NULL);
     ZITI_LOG(VERBOSE, "nulled data for ziti_conn[%p]", zc);
 }
 
-#define RESOLVE_APP_DATA "{\"connType\":\"resolver\"}"
+#define RESOLVE_APP_DATA "{\"connType\":\"resolver\",\"dns_format\":\"wire\"}"
 ziti_connection intercept_resolve_connect(ziti_intercept_t *intercept, void *ctx, ziti_conn_cb conn_cb, ziti_data_cb data_cb) {
     ziti_connection conn;
     ziti_conn_init(intercept->ztx, &conn, ctx);
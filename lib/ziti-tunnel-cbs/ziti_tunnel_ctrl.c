@@ -174,6 +174,18 @@ static void dump_to_file(dumper dump, void *dump_ctx, char* outputFile) {
     fclose(fp);
 }
 
+// lwip stats plus the DNS virtual ip pool
+static void get_ip_stats(tunnel_ip_stats *stats) {
+    ziti_tunnel_get_ip_stats(stats);
+
+    int n = 0;
+    while (stats->pools && stats->pools[n] != NULL) n++;
+    stats->pools = realloc(stats->pools, (n + 2) * sizeof(tunnel_ip_mem_pool *));
+    stats->pools[n] = calloc(1, sizeof(tunnel_ip_mem_pool));
+    ziti_dns_get_ip_pool_stats(stats->pools[n]);
+    stats->pools[n + 1] = NULL;
+}
+
 static void ip_dump(const tunnel_ip_stats *stats, dump_writer writer, void *writer_ctx) {
     int i;
 
@@ -395,7 +407,7 @@ static int process_cmd(const tunnel_command *cmd, command_cb cb, void *ctx) {
                 break;
             }
             tunnel_ip_stats stats = {0};
-            ziti_tunnel_get_ip_stats(&stats);
+            get_ip_stats(&stats);
             result.data = tunnel_ip_stats_to_json(&stats, MODEL_JSON_COMPACT, NULL);
             bool success = true;
             if (dump.dump_path != NULL) {
@@ -1500,7 +1512,7 @@ static void on_sigdump(uv_signal_t *sig, int signum) {
 
     CHECK(cleanup, fprintf(dumpfile, "IP Dump starting: %s\n", time_str));
     tunnel_ip_stats stats = {0};
-    ziti_tunnel_get_ip_stats(&stats);
+    get_ip_stats(&stats);
     ip_dump(&stats, (dump_writer) fprintf, dumpfile);
     free_tunnel_ip_stats(&stats);
 
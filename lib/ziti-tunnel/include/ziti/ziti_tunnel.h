@@ -55,8 +55,21 @@ extern const char *SOURCE_IP_KEY; // "source_ip"
 
 typedef struct tunneler_ctx_s *tunneler_context;
 typedef struct tunneler_io_ctx_s *tunneler_io_context;
+
+/** one end of an intercepted connection */
+typedef struct tunneler_endpoint_s {
+    ip_addr_t ip;
+    uint16_t port;
+} tunneler_endpoint_t;
+
+/** "tcp" or "udp" */
+const char *get_intercepted_protocol(const struct tunneler_io_ctx_s *tnlr_io);
+const tunneler_endpoint_t *get_intercepted_endpoint(const struct tunneler_io_ctx_s *tnlr_io);
+const tunneler_endpoint_t *get_client_endpoint(const struct tunneler_io_ctx_s *tnlr_io);
+/** "proto:ip:port". formatted on first use, prefer the endpoints for anything but logging */
 const char * get_intercepted_address(const struct tunneler_io_ctx_s * tnlr_io);
 const char * get_client_address(const struct tunneler_io_ctx_s * tnlr_io);
+uv_loop_t *get_tunneler_loop(const struct tunneler_io_ctx_s *tnlr_io);
 typedef struct hosted_io_ctx_s *hosted_io_context;
 typedef struct hosted_service_ctx_s host_ctx_t;
 typedef struct io_ctx_s io_ctx_t;
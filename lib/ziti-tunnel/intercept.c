@@ -256,6 +256,6 @@ void free_intercept(intercept_ctx_t *intercept) {
         free(a);
     }
 
-    free(intercept->service_name);
+    tnlr_str_release(intercept->service_name);
     free(intercept);
 }
\ No newline at end of file
@@ -114,4 +114,54 @@ TEST_CASE("address_conversion", "[address]") {
     ziti_address_print(za_str, sizeof(za_str), &za_from_ip6);
     fprintf(stderr, "%s converted to %s\n", ip6_str, za_str);
     REQUIRE(ziti_address_match(&za_from_ip6, &za_from_str) == 0);
-}
\ No newline at end of file
+}
+TEST_CASE("shared strings", "[address]") {
+    char name[] = "service";
+    const char *s = tnlr_str_new(name);
+    REQUIRE(s != name);
+    CHECK_THAT(s, Catch::Equals("service"));
+
+    // a reference is the same string, and keeps it after the first owner lets go
+    const char *ref = tnlr_str_ref(s);
+    CHECK(ref == s);
+    tnlr_str_release(s);
+    CHECK_THAT(ref, Catch::Equals("service"));
+    tnlr_str_release(ref);
+
+    CHECK(tnlr_str_ref(nullptr) == nullptr);
+    tnlr_str_release(nullptr);
+}
+
+TEST_CASE("endpoint addresses", "[address]") {
+    struct tunneler_io_ctx_s io = {};
+    io.proto = tun_udp;
+    IP_ADDR4(&io.client.ip, 100, 64, 0, 1);
+    io.client.port = 5353;
+    ipaddr_aton("fd00:7a69::2", &io.intercepted.ip);
+    io.intercepted.port = 53;
+    const struct tunneler_io_ctx_s *cio = &io;
+
+    CHECK(get_client_endpoint(cio) == &io.client);
+    CHECK(get_intercepted_endpoint(cio) == &io.intercepted);
+    CHECK_THAT(get_intercepted_protocol(cio), Catch::Equals("udp"));
+
+    // formatted on first use
+    CHECK(io.client_str[0] == '\0');
+    const char *client = get_client_address(cio);
+    CHECK_THAT(client, Catch::Equals("udp:100.64.0.1:5353"));
+    CHECK(client == io.client_str);
+    CHECK(get_client_address(cio) == client);
+    CHECK(io.intercepted_str[0] == '\0');
+    CHECK_THAT(get_intercepted_address(cio), Catch::Equals("udp:fd00:7a69::2:53"));
+
+    // the longest endpoint fits
+    struct tunneler_io_ctx_s io6 = {};
+    io6.proto = tun_tcp;
+    ipaddr_aton("ffff:ffff:ffff:ffff:ffff:ffff:ffff:fffe", &io6.client.ip);
+    io6.client.port = 65535;
+    CHECK_THAT(get_client_address(&io6), Catch::Equals("tcp:ffff:ffff:ffff:ffff:ffff:ffff:ffff:fffe:65535"));
+
+    CHECK(get_client_address(nullptr) == nullptr);
+    CHECK(get_intercepted_address(nullptr) == nullptr);
+    CHECK(get_client_endpoint(nullptr) == nullptr);
+}
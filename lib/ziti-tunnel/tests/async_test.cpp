@@ -0,0 +1,143 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "catch2/catch.hpp"
+#include "tunnel_async.h"
+
+#include <cstdio>
+#include <vector>
+
+#define PRODUCERS 4
+
+struct async_run {
+    explicit async_run(long per_producer) : calls_per_producer(per_producer) {}
+    tunnel_async_t q;
+    uv_timer_t keep_alive;
+    uv_sem_t start;
+    long calls_per_producer;
+    long calls = 0;
+    bool ordered = true;
+    std::vector<long> last_seq = std::vector<long>(PRODUCERS, -1);
+};
+
+struct producer {
+    async_run *run;
+    int id;
+    uv_thread_t thread;
+};
+
+static async_run *current;
+
+static void on_call(uv_loop_t *loop, void *arg) {
+    auto v = (uintptr_t) arg;
+    int id = (int) (v / current->calls_per_producer);
+    long seq = (long) (v % current->calls_per_producer);
+    if (current->last_seq[id] != seq - 1) {
+        current->ordered = false;
+    }
+    current->last_seq[id] = seq;
+    if (++current->calls == PRODUCERS * current->calls_per_producer) {
+        uv_close((uv_handle_t *) &current->q.async, nullptr);
+        uv_close((uv_handle_t *) &current->keep_alive, nullptr);
+    }
+}
+
+static void produce(void *arg) {
+    auto p = static_cast<producer *>(arg);
+    long n = p->run->calls_per_producer;
+    uv_sem_wait(&p->run->start);
+    for (long i = 0; i < n; i++) {
+        tunnel_async_send(&p->run->q, on_call, (void *) (uintptr_t) (p->id * n + i));
+    }
+}
+
+/** returns how long it took the loop to make every call */
+static uint64_t run_producers(async_run &run) {
+    uv_loop_t loop;
+    uv_loop_init(&loop);
+    current = &run;
+    REQUIRE(tunnel_async_init(&run.q, &loop) == 0);
+    // the handle doesn't keep the loop alive while it waits for producers, the test waits for every call
+    uv_timer_init(&loop, &run.keep_alive);
+    uv_timer_start(&run.keep_alive, [](uv_timer_t *) {}, 60000, 0);
+    uv_sem_init(&run.start, 0);
+
+    producer producers[PRODUCERS];
+    for (int i = 0; i < PRODUCERS; i++) {
+        producers[i] = { &run, i };
+        REQUIRE(uv_thread_create(&producers[i].thread, produce, &producers[i]) == 0);
+    }
+    uint64_t start = uv_hrtime();
+    for (int i = 0; i < PRODUCERS; i++) {
+        uv_sem_post(&run.start);
+    }
+    uv_run(&loop, UV_RUN_DEFAULT);
+    uint64_t elapsed = uv_hrtime() - start;
+    for (int i = 0; i < PRODUCERS; i++) {
+        uv_thread_join(&producers[i].thread);
+    }
+
+    uv_sem_destroy(&run.start);
+    CHECK(uv_loop_close(&loop) == 0);
+    return elapsed;
+}
+
+TEST_CASE("async calls from many threads", "[async]") {
+    async_run run(1000);
+    run_producers(run);
+    CHECK(run.calls == PRODUCERS * run.calls_per_producer);
+    CHECK(run.ordered);
+}
+
+static int chained_calls;
+
+static void chained_call(uv_loop_t *loop, void *arg) {
+    auto q = static_cast<tunnel_async_t *>(arg);
+    if (++chained_calls < 3) {
+        tunnel_async_send(q, chained_call, q);
+    }
+}
+
+TEST_CASE("async calls queued by a call keep the loop alive", "[async]") {
+    uv_loop_t loop;
+    uv_loop_init(&loop);
+    tunnel_async_t q;
+    REQUIRE(tunnel_async_init(&q, &loop) == 0);
+
+    // nothing else keeps the loop alive once the timer has fired
+    uv_timer_t t;
+    uv_timer_init(&loop, &t);
+    uv_timer_start(&t, [](uv_timer_t *) {}, 0, 0);
+    chained_calls = 0;
+    tunnel_async_send(&q, chained_call, &q);
+    uv_run(&loop, UV_RUN_DEFAULT);
+    CHECK(chained_calls == 3);
+
+    uv_close((uv_handle_t *) &t, nullptr);
+    uv_close((uv_handle_t *) &q.async, nullptr);
+    uv_run(&loop, UV_RUN_DEFAULT);
+    CHECK(uv_loop_close(&loop) == 0);
+}
+
+// not run by default. use `all_tests "[benchmark]"`
+TEST_CASE("async calls benchmark", "[.][benchmark][async]") {
+    async_run run(100000);
+    uint64_t elapsed = run_producers(run);
+    CHECK(run.calls == PRODUCERS * run.calls_per_producer);
+    CHECK(run.ordered);
+    printf("async: %d producers, %ld calls in %.1fms, %.0f calls/sec\n", PRODUCERS, run.calls, elapsed / 1e6,
+           run.calls / (elapsed / 1e9));
+}
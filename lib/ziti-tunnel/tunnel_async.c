@@ -0,0 +1,112 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "tunnel_async.h"
+
+struct tunnel_async_call_s {
+    tunnel_async_call_t *next;
+    tunnel_async_fn f;
+    void *arg;
+};
+
+// uv.h brings in windows.h on windows
+#if defined(_MSC_VER) && !defined(__clang__)
+static void push_call(tunnel_async_t *q, tunnel_async_call_t *call) {
+    void *head;
+    do {
+        head = q->head;
+        call->next = head;
+    } while (InterlockedCompareExchangePointer(&q->head, call, head) != head);
+}
+
+static tunnel_async_call_t *take_calls(tunnel_async_t *q) {
+    return InterlockedExchangePointer(&q->head, NULL);
+}
+
+static bool has_calls(tunnel_async_t *q) {
+    return InterlockedCompareExchangePointer(&q->head, NULL, NULL) != NULL;
+}
+#else
+static void push_call(tunnel_async_t *q, tunnel_async_call_t *call) {
+    void *head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    do {
+        call->next = head;
+    } while (!__atomic_compare_exchange_n(&q->head, &head, call, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static tunnel_async_call_t *take_calls(tunnel_async_t *q) {
+    return __atomic_exchange_n(&q->head, NULL, __ATOMIC_ACQUIRE);
+}
+
+static bool has_calls(tunnel_async_t *q) {
+    return __atomic_load_n(&q->head, __ATOMIC_RELAXED) != NULL;
+}
+#endif
+
+/** runs everything that was queued so far. calls that are queued meanwhile send the async again */
+static void run_calls(uv_async_t *async) {
+    tunnel_async_t *q = async->data;
+    tunnel_async_call_t *calls = take_calls(q);
+
+    // the stack has the most recent call first
+    tunnel_async_call_t *ordered = NULL;
+    while (calls != NULL) {
+        tunnel_async_call_t *next = calls->next;
+        calls->next = ordered;
+        ordered = calls;
+        calls = next;
+    }
+
+    while (ordered != NULL) {
+        tunnel_async_call_t *call = ordered;
+        ordered = call->next;
+        if (call->f != NULL) {
+            call->f(async->loop, call->arg);
+        }
+        free(call);
+    }
+
+    // ref counts can only change on the loop thread, so the handle is ref'd here while calls wait for the next
+    // wakeup (e.g. calls queued by the ones that just ran), and the loop doesn't exit before they run
+    if (has_calls(q)) {
+        uv_ref((uv_handle_t *) async);
+    } else {
+        uv_unref((uv_handle_t *) async);
+    }
+}
+
+int tunnel_async_init(tunnel_async_t *q, uv_loop_t *loop) {
+    q->head = NULL;
+    int rc = uv_async_init(loop, &q->async, run_calls);
+    if (rc == 0) {
+        q->async.data = q;
+        uv_unref((uv_handle_t *) &q->async);
+    }
+    return rc;
+}
+
+int tunnel_async_send(tunnel_async_t *q, tunnel_async_fn f, void *arg) {
+    tunnel_async_call_t *call = malloc(sizeof(tunnel_async_call_t));
+    if (call == NULL) {
+        return UV_ENOMEM;
+    }
+    call->f = f;
+    call->arg = arg;
+    push_call(q, call);
+    return uv_async_send(&q->async);
+}
@@ -0,0 +1,53 @@
+/*
+ Copyright NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_TUNNEL_ASYNC_H
+#define ZITI_TUNNELER_SDK_TUNNEL_ASYNC_H
+
+#include <uv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** same as ziti_tunnel_async_fn */
+typedef void (*tunnel_async_fn)(uv_loop_t *loop, void *arg);
+
+typedef struct tunnel_async_call_s tunnel_async_call_t;
+
+/**
+ * function calls that other threads queue for a loop. producers push onto a lock-free stack, and the loop takes the
+ * whole stack at once when the async handle fires, so one wakeup runs every call that was queued until then.
+ */
+typedef struct tunnel_async_s {
+    uv_async_t async;
+    void *head; // tunnel_async_call_t, most recent first
+} tunnel_async_t;
+
+/**
+ * call on the loop thread, or before the loop runs. the handle keeps the loop alive only while calls that were
+ * queued during a wakeup wait for the next one. calls queued after the loop exited run when it runs again.
+ */
+int tunnel_async_init(tunnel_async_t *q, uv_loop_t *loop);
+
+/** thread safe. `f` is called on the loop thread, in the order of the calls from each producer */
+int tunnel_async_send(tunnel_async_t *q, tunnel_async_fn f, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_TUNNEL_ASYNC_H
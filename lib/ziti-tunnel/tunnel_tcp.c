@@ -30,8 +30,8 @@
     tunneler_io_context tnlr_io = io ? io->tnlr_io : NULL; \
     const char *service_name = tnlr_io ? tnlr_io->service_name : ""; \
     TNL_LOG(level, op " src[%s] dst[%s] state[%d/%s] flags[%#0x] service[%s]", ##__VA_ARGS__, \
-            tnlr_io ? tnlr_io->client : "", \
-            tnlr_io ? tnlr_io->intercepted : "", \
+            tnlr_io ? get_client_address(tnlr_io) : "", \
+            tnlr_io ? get_intercepted_address(tnlr_io) : "", \
             pcb->state, tcp_state_str(pcb->state), pcb->flags, service_name); \
 } while (0)
 
@@ -142,7 +142,7 @@ static err_t on_tcp_client_data(void *io_ctx, struct tcp_pcb *pcb, struct pbuf *
     struct io_ctx_s *io = (struct io_ctx_s *)io_ctx;
 
     if (err == ERR_OK && p == NULL) {
-        TNL_LOG(DEBUG, "client sent FIN: client=%s, service=%s", io->tnlr_io->client, io->tnlr_io->service_name);
+        TNL_LOG(DEBUG, "client sent FIN: client=%s, service=%s", get_client_address(io->tnlr_io), io->tnlr_io->service_name);
         LOG_STATE(DEBUG, "FIN received", pcb);
         io->close_write_fn(io->ziti_io);
         return err;
@@ -157,11 +157,11 @@ static err_t on_tcp_client_data(void *io_ctx, struct tcp_pcb *pcb, struct pbuf *
     ssize_t s = io->write_fn(io->ziti_io, wr_ctx, p->payload, len);
     if (s == ERR_WOULDBLOCK) {
         // apply backpressure -- let LWIP keep the data and retry later
-        TNL_LOG(VERBOSE, "ziti_write indicated backpressure: service=%s, client=%s", io->tnlr_io->service_name, io->tnlr_io->client);
+        TNL_LOG(VERBOSE, "ziti_write indicated backpressure: service=%s, client=%s", io->tnlr_io->service_name, get_client_address(io->tnlr_io));
         free(wr_ctx);
         return ERR_WOULDBLOCK;
     } else if (s < 0) {
-        TNL_LOG(ERR, "ziti_write failed: service=%s, client=%s, ret=%ld", io->tnlr_io->service_name, io->tnlr_io->client, s);
+        TNL_LOG(ERR, "ziti_write failed: service=%s, client=%s, ret=%ld", io->tnlr_io->service_name, get_client_address(io->tnlr_io), s);
         // tell lwip to abort this connection immediately, and null the PCB to prevent ziti_close callback from (double) closing
         tcp_abort(io->tnlr_io->tcp);
         io->tnlr_io->tcp = NULL;
@@ -184,7 +184,7 @@ static void on_tcp_client_err(void *io_ctx, err_t err) {
     else {
         const char *client = "<unknown>";
         if (io->tnlr_io != NULL) {
-            client = io->tnlr_io->client;
+            client = get_client_address(io->tnlr_io);
             // null our pcb so tunneler_tcp_close doesn't try to close it.
             io->tnlr_io->tcp = NULL;
         }
@@ -278,7 +278,7 @@ void tunneler_tcp_dial_completed(struct io_ctx_s *io, bool ok) {
 
     struct tcp_pcb *pcb = io->tnlr_io->tcp;
     if (pcb == NULL) {
-        TNL_LOG(ERR, "tcp connection with %s is no longer viable", io->tnlr_io->client);
+        TNL_LOG(ERR, "tcp connection with %s is no longer viable", get_client_address(io->tnlr_io));
         // no need to close the ziti side here, since it was done in the tcp error callback.
         return;
     }
@@ -300,16 +300,18 @@ void tunneler_tcp_dial_completed(struct io_ctx_s *io, bool ok) {
     tcp_output(io->tnlr_io->tcp);
 }
 
-static tunneler_io_context new_tunneler_io_context(tunneler_context tnlr_ctx, const char *service_name, const char *src, const char *dst, struct tcp_pcb *pcb) {
+static tunneler_io_context new_tunneler_io_context(tunneler_context tnlr_ctx, const char *service_name, struct tcp_pcb *pcb) {
     struct tunneler_io_ctx_s *ctx = calloc(1, sizeof(struct tunneler_io_ctx_s));
     if (ctx == NULL) {
         TNL_LOG(ERR, "failed to allocate tunneler_io_ctx");
         return NULL;
     }
     ctx->tnlr_ctx = tnlr_ctx;
-    ctx->service_name = strdup(service_name);
-    snprintf(ctx->client, sizeof(ctx->client), "tcp:%s:%d", src, pcb->remote_port);
-    snprintf(ctx->intercepted, sizeof(ctx->intercepted), "tcp:%s:%d", dst, pcb->local_port);
+    ctx->service_name = tnlr_str_ref(service_name);
+    ip_addr_copy(ctx->client.ip, pcb->remote_ip);
+    ctx->client.port = pcb->remote_port;
+    ip_addr_copy(ctx->intercepted.ip, pcb->local_ip);
+    ctx->intercepted.port = pcb->local_port;
     ctx->proto = tun_tcp;
     ctx->tcp = pcb;
     return ctx;
@@ -352,10 +354,9 @@ u8_t recv_tcp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
     struct tcp_hdr *tcphdr = (struct tcp_hdr *)((char*)p->payload + iphdr_hlen);
     u16_t src_p = lwip_ntohs(tcphdr->src);
     u16_t dst_p = lwip_ntohs(tcphdr->dest);
+    // only formatted for log messages that are enabled
     char src_str[IPADDR_STRLEN_MAX];
     char dst_str[IPADDR_STRLEN_MAX];
-    ipaddr_ntoa_r(&src, src_str, sizeof(src_str));
-    ipaddr_ntoa_r(&dst, dst_str, sizeof(dst_str));
     u8_t flags = TCPH_FLAGS(tcphdr);
 
     if (tunnel_log_level >= TRACE) {
@@ -369,7 +370,9 @@ u8_t recv_tcp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
         if (flags & TCP_ECE) strcat(flags_str, "ECE,");
         if (flags & TCP_CWR) strcat(flags_str, "CWR,");
         if (strlen(flags_str) > 0) flags_str[strlen(flags_str) - 1] = '\0'; // remove trailing comma
-        TNL_LOG(TRACE, "received segment src[tcp:%s:%d] dst[tcp:%s:%d] flags[%s]", src_str, src_p, dst_str, dst_p, flags_str);
+        TNL_LOG(TRACE, "received segment src[tcp:%s:%d] dst[tcp:%s:%d] flags[%s]",
+                ipaddr_ntoa_r(&src, src_str, sizeof(src_str)), src_p,
+                ipaddr_ntoa_r(&dst, dst_str, sizeof(dst_str)), dst_p, flags_str);
     }
 
     if (!(flags & TCP_SYN)) {
@@ -380,7 +383,8 @@ u8_t recv_tcp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
     intercept_ctx_t *intercept_ctx = lookup_intercept_by_address(tnlr_ctx, "tcp", &src, &dst, dst_p);
     if (intercept_ctx == NULL) {
         /* dst address is not being intercepted. don't consume */
-        TNL_LOG(TRACE, "no intercepted addresses match tcp:%s:%d", dst_str, dst_p);
+        TNL_LOG(TRACE, "no intercepted addresses match tcp:%s:%d",
+                ipaddr_ntoa_r(&dst, dst_str, sizeof(dst_str)), dst_p);
         return 0;
     }
 
@@ -390,7 +394,8 @@ u8_t recv_tcp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
             tpcb->local_port == dst_p &&
             ip_addr_cmp(&tpcb->remote_ip, &src) &&
             ip_addr_cmp(&tpcb->local_ip, &dst)) {
-            TNL_LOG(VERBOSE, "received SYN on active connection: client=tcp:%s:%d, service=%s", src_str, src_p, intercept_ctx->service_name);
+            TNL_LOG(VERBOSE, "received SYN on active connection: client=tcp:%s:%d, service=%s",
+                    ipaddr_ntoa_r(&src, src_str, sizeof(src_str)), src_p, intercept_ctx->service_name);
             /* Move this PCB to the front of the list so that subsequent
                lookups will be faster (we exploit locality in TCP segment
                arrivals). */
@@ -422,7 +427,7 @@ u8_t recv_tcp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
         TNL_LOG(ERR, "failed to allocate io_context");
         goto done;
     }
-    io->tnlr_io = new_tunneler_io_context(tnlr_ctx, intercept_ctx->service_name, src_str, dst_str, npcb);
+    io->tnlr_io = new_tunneler_io_context(tnlr_ctx, intercept_ctx->service_name, npcb);
     if (io->tnlr_io == NULL) {
         TNL_LOG(ERR, "failed to allocate tunneler io context");
         goto done;
@@ -435,7 +440,8 @@ u8_t recv_tcp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
     tcp_err(npcb, on_tcp_client_err);
     tcp_arg(npcb, io);
 
-    TNL_LOG(DEBUG, "intercepted address[%s] client[%s] service[%s]", io->tnlr_io->intercepted, io->tnlr_io->client,
+    TNL_LOG(DEBUG, "intercepted address[%s] client[%s] service[%s]",
+            get_intercepted_address(io->tnlr_io), get_client_address(io->tnlr_io),
             intercept_ctx->service_name);
     void *ziti_io_ctx = zdial(intercept_ctx->app_intercept_ctx, io);
     if (ziti_io_ctx == NULL) {
@@ -27,7 +27,7 @@ static void udp_timeout_cb(uv_timer_t *t) {
     tunneler_io_context  tnlr_io = io->tnlr_io;
     if (tnlr_io) {
         TNL_LOG(TRACE, "initiating close idle_timeout[%d] src[%s] dst[%s] service[%s]", tnlr_io->idle_timeout,
-                tnlr_io->client, tnlr_io->intercepted, tnlr_io->service_name);
+                get_client_address(tnlr_io), get_intercepted_address(tnlr_io), tnlr_io->service_name);
     }
     io->close_fn(io->ziti_io);
 }
@@ -52,7 +52,7 @@ static void to_ziti(struct io_ctx_s *io, struct pbuf *p) {
 
     do {
         TNL_LOG(TRACE, "writing %d bytes to ziti src[%s] dst[%s] service[%s]", recv_data->len,
-                io->tnlr_io->client, io->tnlr_io->intercepted, io->tnlr_io->service_name);
+                get_client_address(io->tnlr_io), get_intercepted_address(io->tnlr_io), io->tnlr_io->service_name);
         struct write_ctx_s *wr_ctx = calloc(1, sizeof(struct write_ctx_s));
         wr_ctx->pbuf = recv_data;
         wr_ctx->udp = io->tnlr_io->udp;
@@ -68,17 +68,17 @@ static void to_ziti(struct io_ctx_s *io, struct pbuf *p) {
             free(wr_ctx);
             if (log_stalled_warns) {
                 TNL_LOG(WARN, "ziti_write stalled: dropping UDP packets until buffers are released service=%s, client=%s, ret=%ld",
-                        io->tnlr_io->service_name, io->tnlr_io->client, s);
+                        io->tnlr_io->service_name, get_client_address(io->tnlr_io), s);
             }
             break;
         } else if (s < 0) {
             tunneler_udp_ack(wr_ctx);
             free(wr_ctx);
-            TNL_LOG(ERR, "ziti_write failed: service=%s, client=%s, ret=%ld", io->tnlr_io->service_name, io->tnlr_io->client, s);
+            TNL_LOG(ERR, "ziti_write failed: service=%s, client=%s, ret=%ld", io->tnlr_io->service_name, get_client_address(io->tnlr_io), s);
             io->close_fn(io->ziti_io);
             break;
         } else if (s == 0 && !log_stalled_warns) {
-            TNL_LOG(INFO, "ziti_write un-stalled: service=%s client=%s", io->tnlr_io->service_name, io->tnlr_io->client);
+            TNL_LOG(INFO, "ziti_write un-stalled: service=%s client=%s", io->tnlr_io->service_name, get_client_address(io->tnlr_io));
             log_stalled_warns = true;
         }
     } while (recv_data != NULL);
@@ -110,7 +110,7 @@ int tunneler_udp_close(struct udp_pcb *pcb) {
     struct io_ctx_s *io_ctx = pcb->recv_arg;
     tunneler_io_context tnlr_io_ctx = io_ctx->tnlr_io;
     TNL_LOG(DEBUG, "closing src[%s] dst[%s] service[%s]",
-            tnlr_io_ctx->client, tnlr_io_ctx->intercepted, tnlr_io_ctx->service_name);
+            get_client_address(tnlr_io_ctx), get_intercepted_address(tnlr_io_ctx), tnlr_io_ctx->service_name);
     udp_remove(pcb);
     return 0;
 }
@@ -158,11 +158,11 @@ u8_t recv_udp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
     struct udp_hdr *udphdr = (struct udp_hdr *)((char*)p->payload + iphdr_hlen);
     u16_t src_p = lwip_ntohs(udphdr->src);
     u16_t dst_p = lwip_ntohs(udphdr->dest);
+    // only formatted for log messages that are enabled
     char src_str[IPADDR_STRLEN_MAX];
     char dst_str[IPADDR_STRLEN_MAX];
-    ipaddr_ntoa_r(&src, src_str, sizeof(src_str));
-    ipaddr_ntoa_r(&dst, dst_str, sizeof(dst_str));
-    TNL_LOG(TRACE, "received datagram src[%s:%d] dst[%s:%d]", src_str, src_p, dst_str, dst_p);
+    TNL_LOG(TRACE, "received datagram src[%s:%d] dst[%s:%d]",
+            ipaddr_ntoa_r(&src, src_str, sizeof(src_str)), src_p, ipaddr_ntoa_r(&dst, dst_str, sizeof(dst_str)), dst_p);
 
     /* first see if this datagram belongs to an active connection */
     for (struct udp_pcb *con_pcb = udp_pcbs, *prev = NULL; con_pcb != NULL; con_pcb = con_pcb->next) {
@@ -186,7 +186,8 @@ u8_t recv_udp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
     /* is the dest address being intercepted? */
     intercept_ctx_t * intercept_ctx = lookup_intercept_by_address(tnlr_ctx, "udp", &src, &dst, dst_p);
     if (intercept_ctx == NULL) {
-        TNL_LOG(TRACE, "no intercepted addresses match udp:%s:%d", dst_str, dst_p);
+        TNL_LOG(TRACE, "no intercepted addresses match udp:%s:%d",
+                ipaddr_ntoa_r(&dst, dst_str, sizeof(dst_str)), dst_p);
         return 0;
     }
 
@@ -203,7 +204,7 @@ u8_t recv_udp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
     npcb->local_port = dst_p;
     err_t err = udp_connect(npcb, &src, src_p);
     if (err != ERR_OK) {
-        TNL_LOG(ERR, "failed to udp_connect %s:%d: err: %d", src_str, src_p, err);
+        TNL_LOG(ERR, "failed to udp_connect %s:%d: err: %d", ipaddr_ntoa_r(&src, src_str, sizeof(src_str)), src_p, err);
         udp_remove(npcb);
         pbuf_free(p);
         return 1;
@@ -227,16 +228,19 @@ u8_t recv_udp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
     }
     io->tnlr_io->tnlr_ctx = tnlr_ctx;
     io->tnlr_io->proto = tun_udp;
-    io->tnlr_io->service_name = strdup(intercept_ctx->service_name);
-    snprintf(io->tnlr_io->client, sizeof(io->tnlr_io->client), "udp:%s:%d", src_str, src_p);
-    snprintf(io->tnlr_io->intercepted, sizeof(io->tnlr_io->intercepted), "udp:%s:%d", dst_str, dst_p);
+    io->tnlr_io->service_name = tnlr_str_ref(intercept_ctx->service_name);
+    ip_addr_copy(io->tnlr_io->client.ip, src);
+    io->tnlr_io->client.port = src_p;
+    ip_addr_copy(io->tnlr_io->intercepted.ip, dst);
+    io->tnlr_io->intercepted.port = dst_p;
     io->tnlr_io->udp = npcb;
     io->ziti_ctx = intercept_ctx->app_intercept_ctx;
     io->write_fn = intercept_ctx->write_fn ? intercept_ctx->write_fn : tnlr_ctx->opts.ziti_write;
     io->close_fn = intercept_ctx->close_fn ? intercept_ctx->close_fn : tnlr_ctx->opts.ziti_close;
     io->tnlr_io->idle_timeout = UDP_TIMEOUT;
 
-    TNL_LOG(DEBUG, "intercepted address[%s] client[%s] service[%s]", io->tnlr_io->intercepted, io->tnlr_io->client,
+    TNL_LOG(DEBUG, "intercepted address[%s] client[%s] service[%s]",
+            get_intercepted_address(io->tnlr_io), get_client_address(io->tnlr_io),
             intercept_ctx->service_name);
 
     udp_recv(npcb, on_udp_client_data, io);
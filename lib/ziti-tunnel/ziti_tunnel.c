@@ -34,6 +34,7 @@
 #include "tunnel_tcp.h"
 #include "tunnel_udp.h"
 
+#include <stddef.h>
 #include <string.h>
 
 const char *DST_PROTO_KEY = "dst_protocol";
@@ -50,10 +51,13 @@ static void run_packet_loop(uv_loop_t *loop, tunneler_context tnlr_ctx);
 STAILQ_HEAD(tlnr_ctx_list_s, tunneler_ctx_s) tnlr_ctx_list_head = STAILQ_HEAD_INITIALIZER(tnlr_ctx_list_head);
 
 // todo expose tunneler_context to modules that need `ziti_tunnel_async_send` (e.g. windows-scripts) so these can be removed
-static uv_once_t default_loop_sem_init_once = UV_ONCE_INIT;
-static uv_sem_t default_loop_sem;
-static void default_loop_sem_init(void) {
-    uv_sem_init(&default_loop_sem, 1);
+static uv_once_t default_loop_async_init_once = UV_ONCE_INIT;
+static tunnel_async_t default_loop_async;
+static void default_loop_async_init(void) {
+    int e = tunnel_async_init(&default_loop_async, uv_default_loop());
+    if (e != 0) {
+        TNL_LOG(ERR, "uv_async_init error: %s", uv_err_name(e));
+    }
 }
 
 static tunneler_context create_tunneler_ctx(tunneler_sdk_options *opts, uv_loop_t *loop) {
@@ -70,8 +74,13 @@ static tunneler_context create_tunneler_ctx(tunneler_sdk_options *opts, uv_loop_
         return NULL;
     }
     ctx->loop = loop;
-    uv_sem_init(&ctx->sem, 1);
-    uv_once(&default_loop_sem_init_once, default_loop_sem_init);
+    int e = tunnel_async_init(&ctx->async, loop);
+    if (e != 0) {
+        TNL_LOG(ERR, "uv_async_init error: %s", uv_err_name(e));
+        free(ctx);
+        return NULL;
+    }
+    uv_once(&default_loop_async_init_once, default_loop_async_init);
     memcpy(&ctx->opts, opts, sizeof(ctx->opts));
     return ctx;
 }
@@ -175,18 +184,49 @@ void ziti_tunneler_ack(struct write_ctx_s *write_ctx) {
     free(write_ctx);
 }
 
+const char *get_intercepted_protocol(const struct tunneler_io_ctx_s *tnlr_io) {
+    if (tnlr_io == NULL) {
+        return NULL;
+    }
+    return tnlr_io->proto == tun_tcp ? "tcp" : "udp";
+}
+
+const tunneler_endpoint_t *get_intercepted_endpoint(const struct tunneler_io_ctx_s *tnlr_io) {
+    return tnlr_io ? &tnlr_io->intercepted : NULL;
+}
+
+const tunneler_endpoint_t *get_client_endpoint(const struct tunneler_io_ctx_s *tnlr_io) {
+    return tnlr_io ? &tnlr_io->client : NULL;
+}
+
+static const char *format_endpoint(const struct tunneler_io_ctx_s *tnlr_io, const tunneler_endpoint_t *ep,
+                                   const char *str, size_t len) {
+    // the buffers are part of the context, which is only const to the callers
+    char *buf = (char *) str;
+    if (buf[0] == '\0') {
+        char ip[IPADDR_STRLEN_MAX];
+        snprintf(buf, len, "%s:%s:%d", get_intercepted_protocol(tnlr_io), ipaddr_ntoa_r(&ep->ip, ip, sizeof(ip)),
+                 ep->port);
+    }
+    return buf;
+}
+
 const char *get_intercepted_address(const struct tunneler_io_ctx_s * tnlr_io) {
     if (tnlr_io == NULL) {
         return NULL;
     }
-    return tnlr_io->intercepted;
+    return format_endpoint(tnlr_io, &tnlr_io->intercepted, tnlr_io->intercepted_str, sizeof(tnlr_io->intercepted_str));
 }
 
 const char *get_client_address(const struct tunneler_io_ctx_s * tnlr_io) {
     if (tnlr_io == NULL) {
         return NULL;
     }
-    return tnlr_io->client;
+    return format_endpoint(tnlr_io, &tnlr_io->client, tnlr_io->client_str, sizeof(tnlr_io->client_str));
+}
+
+uv_loop_t *get_tunneler_loop(const struct tunneler_io_ctx_s *tnlr_io) {
+    return tnlr_io ? tnlr_io->tnlr_ctx->loop : NULL;
 }
 
 void free_tunneler_io_context(tunneler_io_context *tnlr_io_ctx_p) {
@@ -196,12 +236,42 @@ void free_tunneler_io_context(tunneler_io_context *tnlr_io_ctx_p) {
 
     if (*tnlr_io_ctx_p != NULL) {
         tunneler_io_context io = *tnlr_io_ctx_p;
-        if (io->service_name != NULL) free((char*)io->service_name);
+        tnlr_str_release(io->service_name);
         free(io);
         *tnlr_io_ctx_p = NULL;
     }
 }
 
+struct tnlr_str_s {
+    unsigned int refs;
+    char s[];
+};
+
+#define tnlr_str_hdr(s) ((struct tnlr_str_s *) ((s) - offsetof(struct tnlr_str_s, s)))
+
+const char *tnlr_str_new(const char *s) {
+    size_t len = strlen(s);
+    struct tnlr_str_s *str = malloc(sizeof(struct tnlr_str_s) + len + 1);
+    str->refs = 1;
+    memcpy(str->s, s, len + 1);
+    return str->s;
+}
+
+const char *tnlr_str_ref(const char *s) {
+    if (s != NULL) {
+        tnlr_str_hdr(s)->refs++;
+    }
+    return s;
+}
+
+void tnlr_str_release(const char *s) {
+    if (s == NULL) return;
+    struct tnlr_str_s *str = tnlr_str_hdr(s);
+    if (--str->refs == 0) {
+        free(str);
+    }
+}
+
 void ziti_tunneler_set_idle_timeout(struct io_ctx_s *io_context, unsigned int timeout) {
     io_context->tnlr_io->idle_timeout = timeout;
 }
@@ -218,7 +288,7 @@ void ziti_tunneler_dial_completed(struct io_ctx_s *io, bool ok) {
         TNL_LOG(ERR, "null ziti_io or tnlr_io");
     }
     const char *status = ok ? "succeeded" : "failed";
-    TNL_LOG(DEBUG, "ziti dial %s: client[%s] service[%s]", status, io->tnlr_io->client, io->tnlr_io->service_name);
+    TNL_LOG(DEBUG, "ziti dial %s: client[%s] service[%s]", status, get_client_address(io->tnlr_io), io->tnlr_io->service_name);
 
     switch (io->tnlr_io->proto) {
         case tun_tcp:
@@ -240,7 +310,7 @@ host_ctx_t *ziti_tunneler_host(tunneler_context tnlr_ctx, const void *ziti_ctx,
 intercept_ctx_t* intercept_ctx_new(tunneler_context tnlr_ctx, const char *app_id, void *app_intercept_ctx) {
     intercept_ctx_t *ictx = calloc(1, sizeof(intercept_ctx_t));
     ictx->tnlr_ctx = tnlr_ctx;
-    ictx->service_name = strdup(app_id);
+    ictx->service_name = tnlr_str_new(app_id);
     ictx->app_intercept_ctx = app_intercept_ctx;
     STAILQ_INIT(&ictx->protocols);
     STAILQ_INIT(&ictx->addresses);
@@ -350,7 +420,7 @@ static void tunneler_kill_active(const void *zi_ctx) {
     l = tunneler_tcp_active(zi_ctx);
     while (!SLIST_EMPTY(l)) {
         struct io_ctx_list_entry_s *n = SLIST_FIRST(l);
-        TNL_LOG(DEBUG, "service_ctx[%p] client[%s] killing active connection", zi_ctx, n->io->tnlr_io->client);
+        TNL_LOG(DEBUG, "service_ctx[%p] client[%s] killing active connection", zi_ctx, get_client_address(n->io->tnlr_io));
         // close the ziti connection, which also closes the underlay
         zclose = n->io->close_fn;
         if (zclose) zclose(n->io->ziti_io);
@@ -363,7 +433,7 @@ static void tunneler_kill_active(const void *zi_ctx) {
     l = tunneler_udp_active(zi_ctx);
     while (!SLIST_EMPTY(l)) {
         struct io_ctx_list_entry_s *n = SLIST_FIRST(l);
-        TNL_LOG(DEBUG, "service[%p] client[%s] killing active connection", zi_ctx, n->io->tnlr_io->client);
+        TNL_LOG(DEBUG, "service[%p] client[%s] killing active connection", zi_ctx, get_client_address(n->io->tnlr_io));
         // close the ziti connection, which also closes the underlay
         zclose = n->io->close_fn;
         if (zclose) zclose(n->io->ziti_io);
@@ -443,7 +513,7 @@ int ziti_tunneler_close(tunneler_io_context tnlr_io_ctx) {
         return 0;
     }
     TNL_LOG(DEBUG, "closing connection: client[%s] service[%s]",
-            tnlr_io_ctx->client, tnlr_io_ctx->service_name);
+            get_client_address(tnlr_io_ctx), tnlr_io_ctx->service_name);
     switch (tnlr_io_ctx->proto) {
         case tun_tcp:
             tunneler_tcp_close(tnlr_io_ctx->tcp);
@@ -474,7 +544,7 @@ int ziti_tunneler_close_write(tunneler_io_context tnlr_io_ctx) {
         return 0;
     }
     TNL_LOG(DEBUG, "closing write connection: client[%s] service[%s]",
-            tnlr_io_ctx->client, tnlr_io_ctx->service_name);
+            get_client_address(tnlr_io_ctx), tnlr_io_ctx->service_name);
     switch (tnlr_io_ctx->proto) {
         case tun_tcp:
             tunneler_tcp_close_write(tnlr_io_ctx->tcp);
@@ -594,60 +664,20 @@ static void run_packet_loop(uv_loop_t *loop, tunneler_context tnlr_ctx) {
     uv_unref((uv_handle_t *) &tnlr_ctx->lwip_timer_req);
 }
 
-typedef struct ziti_tunnel_async_call_s {
-    ziti_tunnel_async_fn f;
-    void *               arg;
-} ziti_tunnel_async_call_t;
-
-static void async_close_cb(uv_handle_t *async) {
-    if (async->data != NULL) {
-        free(async->data);
-    }
-    free(async);
-}
-
-/** invoke a caller-supplied function with argument. this is called by libuv on the loop thread */
-static void ziti_tunnel_async_wrapper(uv_async_t *async) {
-    ziti_tunnel_async_call_t *call = async->data;
-    if (call != NULL && call->f != NULL) {
-        call->f(async->loop, call->arg);
-    }
-    uv_close((uv_handle_t *)async, async_close_cb);
-}
-
-/** sets up a function call on the specified loop */
+/** sets up a function call on the specified loop. see tunnel_async.h */
 void ziti_tunnel_async_send(tunneler_context tctx, ziti_tunnel_async_fn f, void *arg) {
-    uv_loop_t *loop = uv_default_loop();
+    tunnel_async_t *q = &default_loop_async;
     if (tctx != NULL) {
-        loop = tctx->loop;
-    }
-
-    ziti_tunnel_async_call_t *call = calloc(1, sizeof(ziti_tunnel_async_call_t));
-    call->f = f;
-    call->arg = arg;
-
-    uv_async_t *async = calloc(1, sizeof(uv_async_t));
-    async->data = call;
-
-    if (tctx != NULL) {
-        uv_sem_wait(&tctx->sem);
-    } else {
-        uv_sem_wait(&default_loop_sem);
-    }
-    int e = uv_async_init(loop, async, ziti_tunnel_async_wrapper);
-    if (tctx != NULL) {
-        uv_sem_post(&tctx->sem);
+        q = &tctx->async;
     } else {
-        uv_sem_post(&default_loop_sem);
+        // nothing may have created a tunneler context yet
+        uv_once(&default_loop_async_init_once, default_loop_async_init);
     }
+
+    int e = tunnel_async_send(q, f, arg);
     if (e != 0) {
-        TNL_LOG(ERR, "uv_async_init error: %s", uv_err_name(e));
-        free(call);
-        free(async);
-        return;
+        TNL_LOG(ERR, "uv_async_send error: %s", uv_err_name(e));
     }
-
-    uv_async_send(async);
 }
 
 #define _str(x) #x
@@ -21,6 +21,7 @@
 #include "lwip/netif.h"
 
 #include "ziti/ziti_model.h"
+#include "tunnel_async.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -97,7 +98,7 @@ extern tunnel_logger_f tunnel_logger;
 
 struct intercept_ctx_s {
     tunneler_context tnlr_ctx;
-    char *service_name;
+    const char *service_name;
     void *app_intercept_ctx;
 
     protocol_list_t protocols;
@@ -125,7 +126,7 @@ typedef struct tunneler_ctx_s {
     struct raw_pcb *tcp;
     struct raw_pcb *udp;
     uv_loop_t *loop;
-    uv_sem_t sem;
+    tunnel_async_t async; // ziti_tunnel_async_send() calls
     uv_poll_t netif_poll_req;
     uv_timer_t lwip_timer_req;
     LIST_HEAD(intercept_ctx_list_s, intercept_ctx_s) intercepts;
@@ -143,9 +144,12 @@ typedef enum {
 
 struct tunneler_io_ctx_s {
     tunneler_context tnlr_ctx;
-    char *service_name;
-    char client[64];
-    char intercepted[64];
+    const char *service_name; // shared with the intercept, see tnlr_str_new()
+    tunneler_endpoint_t client;
+    tunneler_endpoint_t intercepted;
+    // "proto:ip:port" of the endpoints, only formatted when something asks for them
+    char client_str[64];
+    char intercepted_str[64];
     tunneler_proto_type proto;
     union {
         struct tcp_pcb *tcp;
@@ -155,6 +159,14 @@ struct tunneler_io_ctx_s {
     uint32_t idle_timeout;
 };
 
+/**
+ * reference counted copy of `s`. connections hold a reference to their intercept's service name
+ * instead of copying it, and keep it after the intercept is gone.
+ */
+extern const char *tnlr_str_new(const char *s);
+extern const char *tnlr_str_ref(const char *s);
+extern void tnlr_str_release(const char *s);
+
 extern void check_tnlr_timer(tunneler_context tnlr_ctx);
 extern void free_tunneler_io_context(tunneler_io_context *tnlr_io_ctx_p);
 
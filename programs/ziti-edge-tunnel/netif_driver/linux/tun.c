@@ -397,6 +397,10 @@ static int tun_exclude_rt(netif_handle dev, uv_loop_t *l, const char *addr) {
     return run_command("ip route replace %s %s", addr, route);
 }
 
+int tun_add_ipv6_range(netif_handle tun, const char *cidr6) {
+    return run_command("ip -6 addr add %s dev %s", cidr6, tun->name);
+}
+
 static void cleanup_sock(const int *fd) {
     if (fd && *fd != -1) {
         close(*fd);
@@ -30,4 +30,7 @@ struct netif_handle_s {
 
 extern netif_driver tun_open(struct uv_loop_s *loop, uint32_t tun_ip, uint32_t dns_ip, const char *cidr, char *error, size_t error_len);
 
+/** assign IPv6 address to the tun, `cidr6` is the address and prefix length of the DNS IPv6 range */
+extern int tun_add_ipv6_range(netif_handle tun, const char *cidr6);
+
 #endif //ZITI_TUNNELER_SDK_TUN_H
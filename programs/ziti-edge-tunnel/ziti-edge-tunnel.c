@@ -126,6 +126,7 @@ bool uses_config_dir = false;
 static long refresh_metrics = 5000;
 static long metrics_latency = 5000;
 static char *configured_cidr = NULL;
+static char *configured_cidr6 = NULL;
 static char *configured_log_level = NULL;
 static char *configured_proxy = NULL;
 static char *ipc_discriminator = NULL;
@@ -839,7 +840,7 @@ static char* normalize_host(char* hostname) {
     return hostname_new;
 }
 
-static int run_tunnel(uv_loop_t *ziti_loop, uint32_t tun_ip, uint32_t dns_ip, const char *ip_range, const char *dns_upstream) {
+static int run_tunnel(uv_loop_t *ziti_loop, uint32_t tun_ip, uint32_t dns_ip, const char *ip_range, const char *ip6_range, const char *dns_upstream) {
     netif_driver tun;
     char tun_error[64];
 
@@ -893,7 +894,26 @@ static int run_tunnel(uv_loop_t *ziti_loop, uint32_t tun_ip, uint32_t dns_ip, co
     tunneler = initialize_tunneler(tun, ziti_loop);
 
     ip_addr_t dns_ip4 = IPADDR4_INIT(dns_ip);
-    ziti_dns_setup(tunneler, ipaddr_ntoa(&dns_ip4), ip_range);
+    if (ziti_dns_setup(tunneler, ipaddr_ntoa(&dns_ip4), ip_range) != 0) {
+        ZITI_LOG(ERROR, "failed to set up DNS with range %s", ip_range);
+        return 1;
+    }
+    if (ip6_range) {
+#if __linux__
+        if (ziti_dns_setup_ipv6(ip6_range) != 0) {
+            ZITI_LOG(ERROR, "failed to set up DNS with IPv6 range %s", ip6_range);
+            return 1;
+        }
+        tun_add_ipv6_range(tun->handle, ziti_dns_ipv6_cidr());
+#else
+        ZITI_LOG(WARN, "IPv6 DNS range is not supported on this platform, ignoring %s", ip6_range);
+#endif
+    }
+    if (config_dir != NULL) {
+        char dns_snapshot[PATH_MAX];
+        snprintf(dns_snapshot, sizeof(dns_snapshot), "%s%c%s", config_dir, PATH_SEP, "dns-snapshot.txt");
+        ziti_dns_load_snapshot(ziti_loop, dns_snapshot);
+    }
     if (dns_upstream) {
         tunnel_upstream_dns upstream = {
                 .host = dns_upstream
@@ -1157,6 +1177,7 @@ static struct option run_options[] = {
         { "verbose", required_argument, NULL, 'v'},
         { "refresh", required_argument, NULL, 'r'},
         { "dns-ip-range", required_argument, NULL, 'd'},
+        { "dns-ip6-range", required_argument, NULL, '6'},
         { "dns-upstream", required_argument, NULL, 'u'},
         { "proxy", required_argument, NULL, 'x' },
 #if __linux__
@@ -1234,7 +1255,7 @@ static int run_opts(int argc, char *argv[]) {
 #else
 #define DIVERTER_SHORT_OPTS ""
 #endif
-    while ((c = getopt_long(argc, argv, "i:I:v:r:d:u:x:"DIVERTER_SHORT_OPTS,
+    while ((c = getopt_long(argc, argv, "i:I:v:r:d:6:u:x:"DIVERTER_SHORT_OPTS,
                             run_options, &option_index)) != -1) {
         switch (c) {
 #if __linux__
@@ -1276,6 +1297,9 @@ static int run_opts(int argc, char *argv[]) {
             case 'd': // ip range
                 configured_cidr = optarg;
                 break;
+            case '6': // ipv6 range
+                configured_cidr6 = optarg;
+                break;
             case 'u':
                 dns_upstream = optarg;
                 break;
@@ -1540,7 +1564,7 @@ static void run(int argc, char *argv[]) {
     if (is_host_only()) {
         rc = run_tunnel_host_mode(global_loop_ref);
     } else {
-        rc = run_tunnel(global_loop_ref, tun_ip, dns_ip, configured_cidr, dns_upstream);
+        rc = run_tunnel(global_loop_ref, tun_ip, dns_ip, configured_cidr, configured_cidr6, dns_upstream);
     }
     exit(rc);
 }
@@ -2555,7 +2579,7 @@ static CommandLine enroll_cmd = make_command(
 #endif
 
 static CommandLine run_cmd = make_command("run", "run Ziti tunnel (required superuser access)",
-                                          "-i <id.file> [-r N] [-v N] [-d|--dns-ip-range N.N.N.N/N] " DIVERTER_OPTS_SUMMARY "[-u|--dns-upstream N.N.N.N]\n",
+                                          "-i <id.file> [-r N] [-v N] [-d|--dns-ip-range N.N.N.N/N] [-6|--dns-ip6-range X:X::X/N] " DIVERTER_OPTS_SUMMARY "[-u|--dns-upstream N.N.N.N]\n",
                                           "\t-i|--identity <identity>\trun with provided identity file (required)\n"
                                           "\t-I|--identity-dir <dir>\tload identities from provided directory\n"
                                           "\t-x|--proxy type://[username[:password]@]hostname_or_ip:port\tproxy to use when"
@@ -2564,6 +2588,8 @@ static CommandLine run_cmd = make_command("run", "run Ziti tunnel (required supe
                                           "\t-r|--refresh N\tset service polling interval in seconds (default 10)\n"
                                           "\t-d|--dns-ip-range <ip range>\tspecify CIDR block in which service DNS names"
                                           " are assigned in N.N.N.N/n format (default " DEFAULT_DNS_CIDR ")\n"
+                                          "\t-6|--dns-ip6-range <ip range>\tspecify IPv6 (ULA) block in which service DNS names"
+                                          " are also assigned in X:X::X/n format, e.g. fd00:7a69::1/64 (default none, linux only)\n"
                                           DIVERTER_OPTS_DETAIL
                                           "\t-u|--dns-upstream <ip addr>\tresolver listening on 53/udp for DNS queries that do not match a Ziti service\n",
                                           run_opts, run);